@@ -0,0 +1,731 @@
+// blake3.c
+#define _POSIX_C_SOURCE 200809L
+#include "blake3.h"
+#include "hash_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLAKE3_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/*
+ * BLAKE3 following the reference implementation's structure.
+ *
+ * A backend is a hash_many kernel: hash n equal-length inputs of whole
+ * blocks (whole chunks or parent nodes) to n chaining values. The streaming
+ * hasher keeps a stack of subtree chaining values, one per set bit of the
+ * chunk count; whole subtrees of the input are compressed "wide" (all their
+ * chunks through hash_many, then their parents, level by level), and the
+ * two halves of a large subtree are hashed on two threads. Chunk counters
+ * are absolute, so any split of the work produces the same tree.
+ */
+
+#define CHUNK_START 1
+#define CHUNK_END 2
+#define PARENT 4
+#define ROOT 8
+
+#define MAX_DEGREE 8 // widest hash_many, sizes the scratch CV arrays
+
+static const uint32_t IV[8] = {
+    0x6A09E667ul, 0xBB67AE85ul, 0x3C6EF372ul, 0xA54FF53Aul,
+    0x510E527Ful, 0x9B05688Cul, 0x1F83D9ABul, 0x5BE0CD19ul
+};
+
+static const uint8_t MSG_SCHEDULE[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+typedef void (*blake3_hash_many_fn)(const uint8_t *const *inputs, size_t n, size_t blocks,
+                                    const uint32_t key[8], uint64_t counter, int increment,
+                                    uint8_t flags, uint8_t flags_start, uint8_t flags_end,
+                                    uint8_t *out);
+
+typedef struct {
+    const char *name;
+    blake3_hash_many_fn hash_many;
+    size_t degree; // inputs per kernel call
+    int (*available)(void);
+} Blake3Backend;
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void store32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void store_cv(uint8_t out[32], const uint32_t cv[8]) {
+    for (int i = 0; i < 8; ++i) store32(out + 4 * i, cv[i]);
+}
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// ---------------------------------------------------------------------------
+// Portable compression
+
+static inline void g(uint32_t *s, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    s[a] = s[a] + s[b] + x;
+    s[d] = rotr(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = rotr(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + y;
+    s[d] = rotr(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = rotr(s[b] ^ s[c], 7);
+}
+
+static void compress_pre(uint32_t s[16], const uint32_t cv[8], const uint8_t block[64],
+                         uint8_t block_len, uint64_t counter, uint8_t flags) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) m[i] = load32(block + 4 * i);
+    for (int i = 0; i < 8; ++i) s[i] = cv[i];
+    s[8] = IV[0];
+    s[9] = IV[1];
+    s[10] = IV[2];
+    s[11] = IV[3];
+    s[12] = (uint32_t)counter;
+    s[13] = (uint32_t)(counter >> 32);
+    s[14] = block_len;
+    s[15] = flags;
+    for (int r = 0; r < 7; ++r) {
+        const uint8_t *sc = MSG_SCHEDULE[r];
+        g(s, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+        g(s, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+        g(s, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+        g(s, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+        g(s, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+        g(s, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+        g(s, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+        g(s, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+    }
+}
+
+static void compress_in_place(uint32_t cv[8], const uint8_t block[64], uint8_t block_len,
+                              uint64_t counter, uint8_t flags) {
+    uint32_t s[16];
+    compress_pre(s, cv, block, block_len, counter, flags);
+    for (int i = 0; i < 8; ++i) cv[i] = s[i] ^ s[i + 8];
+}
+
+static void hash_one_generic(const uint8_t *input, size_t blocks, const uint32_t key[8],
+                             uint64_t counter, uint8_t flags, uint8_t flags_start,
+                             uint8_t flags_end, uint8_t out[32]) {
+    uint32_t cv[8];
+    memcpy(cv, key, sizeof(cv));
+    uint8_t block_flags = flags | flags_start;
+    while (blocks > 0) {
+        if (blocks == 1) block_flags |= flags_end;
+        compress_in_place(cv, input, BLAKE3_BLOCK_LEN, counter, block_flags);
+        input += BLAKE3_BLOCK_LEN;
+        blocks -= 1;
+        block_flags = flags;
+    }
+    store_cv(out, cv);
+}
+
+static void hash_many_generic(const uint8_t *const *inputs, size_t n, size_t blocks,
+                              const uint32_t key[8], uint64_t counter, int increment,
+                              uint8_t flags, uint8_t flags_start, uint8_t flags_end,
+                              uint8_t *out) {
+    for (size_t i = 0; i < n; ++i) {
+        hash_one_generic(inputs[i], blocks, key, counter, flags, flags_start, flags_end, out);
+        if (increment) counter += 1;
+        out += BLAKE3_OUT_LEN;
+    }
+}
+
+static int available_always(void) { return 1; }
+
+#ifdef BLAKE3_X86
+
+static int cpu_os_saves_ymm(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!(ecx & (1u << 27))) return 0; // OSXSAVE
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    (void)xcr0_hi;
+    return (xcr0_lo & 0x6) == 0x6;
+}
+
+static int available_avx2(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!cpu_os_saves_ymm()) return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx & (1u << 5)) != 0;
+}
+
+/*
+ * AVX2 kernel: eight inputs at once, one per 32-bit lane. Message words are
+ * transposed so that vector i holds word i of every input; the round
+ * function is then the scalar one applied to whole vectors, with the 16- and
+ * 8-bit rotations done as byte shuffles.
+ */
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i add(__m256i a, __m256i b) { return _mm256_add_epi32(a, b); }
+AVX2_TARGET static inline __m256i xorv(__m256i a, __m256i b) { return _mm256_xor_si256(a, b); }
+AVX2_TARGET static inline __m256i set1(uint32_t x) { return _mm256_set1_epi32((int32_t)x); }
+
+AVX2_TARGET static inline __m256i rot16(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                  13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+
+AVX2_TARGET static inline __m256i rot12(__m256i x) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20));
+}
+
+AVX2_TARGET static inline __m256i rot8(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                                  12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+}
+
+AVX2_TARGET static inline __m256i rot7(__m256i x) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25));
+}
+
+AVX2_TARGET static inline void gv(__m256i *v, int a, int b, int c, int d, __m256i x, __m256i y) {
+    v[a] = add(add(v[a], v[b]), x);
+    v[d] = rot16(xorv(v[d], v[a]));
+    v[c] = add(v[c], v[d]);
+    v[b] = rot12(xorv(v[b], v[c]));
+    v[a] = add(add(v[a], v[b]), y);
+    v[d] = rot8(xorv(v[d], v[a]));
+    v[c] = add(v[c], v[d]);
+    v[b] = rot7(xorv(v[b], v[c]));
+}
+
+AVX2_TARGET static inline void round_avx2(__m256i v[16], const __m256i m[16], int r) {
+    const uint8_t *sc = MSG_SCHEDULE[r];
+    gv(v, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+    gv(v, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+    gv(v, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+    gv(v, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+    gv(v, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+    gv(v, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+    gv(v, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+    gv(v, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+}
+
+// 8x8 transpose of 32-bit words: vecs[i] word j <-> vecs[j] word i
+AVX2_TARGET static inline void transpose8(__m256i vecs[8]) {
+    __m256i ab_0145 = _mm256_unpacklo_epi32(vecs[0], vecs[1]);
+    __m256i ab_2367 = _mm256_unpackhi_epi32(vecs[0], vecs[1]);
+    __m256i cd_0145 = _mm256_unpacklo_epi32(vecs[2], vecs[3]);
+    __m256i cd_2367 = _mm256_unpackhi_epi32(vecs[2], vecs[3]);
+    __m256i ef_0145 = _mm256_unpacklo_epi32(vecs[4], vecs[5]);
+    __m256i ef_2367 = _mm256_unpackhi_epi32(vecs[4], vecs[5]);
+    __m256i gh_0145 = _mm256_unpacklo_epi32(vecs[6], vecs[7]);
+    __m256i gh_2367 = _mm256_unpackhi_epi32(vecs[6], vecs[7]);
+
+    __m256i abcd_04 = _mm256_unpacklo_epi64(ab_0145, cd_0145);
+    __m256i abcd_15 = _mm256_unpackhi_epi64(ab_0145, cd_0145);
+    __m256i abcd_26 = _mm256_unpacklo_epi64(ab_2367, cd_2367);
+    __m256i abcd_37 = _mm256_unpackhi_epi64(ab_2367, cd_2367);
+    __m256i efgh_04 = _mm256_unpacklo_epi64(ef_0145, gh_0145);
+    __m256i efgh_15 = _mm256_unpackhi_epi64(ef_0145, gh_0145);
+    __m256i efgh_26 = _mm256_unpacklo_epi64(ef_2367, gh_2367);
+    __m256i efgh_37 = _mm256_unpackhi_epi64(ef_2367, gh_2367);
+
+    vecs[0] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x20);
+    vecs[1] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x20);
+    vecs[2] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x20);
+    vecs[3] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x20);
+    vecs[4] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x31);
+    vecs[5] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x31);
+    vecs[6] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x31);
+    vecs[7] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x31);
+}
+
+AVX2_TARGET static void hash8_avx2(const uint8_t *const *inputs, size_t blocks, const uint32_t key[8],
+                                   uint64_t counter, int increment, uint8_t flags,
+                                   uint8_t flags_start, uint8_t flags_end, uint8_t *out) {
+    __m256i h[8];
+    for (int i = 0; i < 8; ++i) h[i] = set1(key[i]);
+    // per-lane counters, carrying into the high word
+    __m256i step = increment ? _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0) : _mm256_setzero_si256();
+    __m256i lo = add(set1((uint32_t)counter), step);
+    __m256i sign = set1(0x80000000u);
+    __m256i carry = _mm256_cmpgt_epi32(xorv(step, sign), xorv(lo, sign));
+    __m256i hi = _mm256_sub_epi32(set1((uint32_t)(counter >> 32)), carry);
+
+    uint8_t block_flags = flags | flags_start;
+    for (size_t b = 0; b < blocks; ++b) {
+        if (b + 1 == blocks) block_flags |= flags_end;
+        __m256i m[16];
+        for (int i = 0; i < 8; ++i) {
+            const uint8_t *p = inputs[i] + b * BLAKE3_BLOCK_LEN;
+            m[i] = _mm256_loadu_si256((const __m256i *)p);
+            m[i + 8] = _mm256_loadu_si256((const __m256i *)(p + 32));
+        }
+        transpose8(m);
+        transpose8(m + 8);
+        __m256i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            set1(IV[0]), set1(IV[1]), set1(IV[2]), set1(IV[3]),
+            lo, hi, set1(BLAKE3_BLOCK_LEN), set1(block_flags),
+        };
+        for (int r = 0; r < 7; ++r) round_avx2(v, m, r);
+        for (int i = 0; i < 8; ++i) h[i] = xorv(v[i], v[i + 8]);
+        block_flags = flags;
+    }
+    transpose8(h);
+    for (int i = 0; i < 8; ++i) _mm256_storeu_si256((__m256i *)(out + i * BLAKE3_OUT_LEN), h[i]);
+}
+
+static void hash_many_avx2(const uint8_t *const *inputs, size_t n, size_t blocks,
+                           const uint32_t key[8], uint64_t counter, int increment,
+                           uint8_t flags, uint8_t flags_start, uint8_t flags_end,
+                           uint8_t *out) {
+    while (n >= 8) {
+        hash8_avx2(inputs, blocks, key, counter, increment, flags, flags_start, flags_end, out);
+        if (increment) counter += 8;
+        inputs += 8;
+        n -= 8;
+        out += 8 * BLAKE3_OUT_LEN;
+    }
+    hash_many_generic(inputs, n, blocks, key, counter, increment, flags, flags_start, flags_end, out);
+}
+
+#endif // BLAKE3_X86
+
+// Ordered fastest first; the first available backend that passes the self-test wins
+static const Blake3Backend backends[] = {
+#ifdef BLAKE3_X86
+    { "avx2", hash_many_avx2, 8, available_avx2 },
+#endif
+    { "generic", hash_many_generic, 1, available_always },
+};
+#define N_BACKENDS ((int)(sizeof(backends) / sizeof(backends[0])))
+
+static const Blake3Backend *active_backend = NULL;
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+
+static int self_test_with(const Blake3Backend *b);
+
+static void select_backend(void) {
+    const char *forced = getenv("REPROVM_BLAKE3_BACKEND");
+    for (int i = 0; i < N_BACKENDS; ++i) {
+        const Blake3Backend *b = &backends[i];
+        if (forced && *forced && strcmp(forced, b->name) != 0) continue;
+        if (!b->available() || self_test_with(b) != 0) continue;
+        active_backend = b;
+        return;
+    }
+    active_backend = &backends[N_BACKENDS - 1];
+}
+
+static const Blake3Backend *get_backend(void) {
+    pthread_once(&backend_once, select_backend);
+    return active_backend;
+}
+
+const char *blake3_backend_name(void) {
+    return get_backend()->name;
+}
+
+int blake3_set_backend(const char *name) {
+    if (!name) return -1;
+    get_backend();
+    for (int i = 0; i < N_BACKENDS; ++i) {
+        if (strcmp(backends[i].name, name) == 0) {
+            if (!backends[i].available()) return -1;
+            active_backend = &backends[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Chunk state
+
+static void chunk_init(Blake3ChunkState *c, uint64_t counter) {
+    memcpy(c->cv, IV, sizeof(c->cv));
+    c->chunk_counter = counter;
+    memset(c->buf, 0, sizeof(c->buf));
+    c->buf_len = 0;
+    c->blocks_compressed = 0;
+}
+
+static size_t chunk_len(const Blake3ChunkState *c) {
+    return (size_t)BLAKE3_BLOCK_LEN * c->blocks_compressed + c->buf_len;
+}
+
+static uint8_t chunk_start_flag(const Blake3ChunkState *c) {
+    return c->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+static void chunk_update(Blake3ChunkState *c, const uint8_t *input, size_t len) {
+    if (c->buf_len > 0) {
+        size_t take = BLAKE3_BLOCK_LEN - c->buf_len;
+        if (take > len) take = len;
+        memcpy(c->buf + c->buf_len, input, take);
+        c->buf_len += (uint8_t)take;
+        input += take;
+        len -= take;
+        if (len > 0) {
+            compress_in_place(c->cv, c->buf, BLAKE3_BLOCK_LEN, c->chunk_counter, chunk_start_flag(c));
+            c->blocks_compressed += 1;
+            c->buf_len = 0;
+            memset(c->buf, 0, sizeof(c->buf));
+        }
+    }
+    // keep the last block buffered: it may be the chunk's final one
+    while (len > BLAKE3_BLOCK_LEN) {
+        compress_in_place(c->cv, input, BLAKE3_BLOCK_LEN, c->chunk_counter, chunk_start_flag(c));
+        c->blocks_compressed += 1;
+        input += BLAKE3_BLOCK_LEN;
+        len -= BLAKE3_BLOCK_LEN;
+    }
+    memcpy(c->buf + c->buf_len, input, len);
+    c->buf_len += (uint8_t)len;
+}
+
+// A node whose compression is deferred until we know whether it is the root
+typedef struct {
+    uint32_t cv[8];
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t block_len;
+    uint64_t counter;
+    uint8_t flags;
+} Output;
+
+static Output chunk_output(const Blake3ChunkState *c) {
+    Output o;
+    memcpy(o.cv, c->cv, sizeof(o.cv));
+    memcpy(o.block, c->buf, sizeof(o.block));
+    o.block_len = c->buf_len;
+    o.counter = c->chunk_counter;
+    o.flags = chunk_start_flag(c) | CHUNK_END;
+    return o;
+}
+
+static Output parent_output(const uint8_t block[BLAKE3_BLOCK_LEN]) {
+    Output o;
+    memcpy(o.cv, IV, sizeof(o.cv));
+    memcpy(o.block, block, sizeof(o.block));
+    o.block_len = BLAKE3_BLOCK_LEN;
+    o.counter = 0;
+    o.flags = PARENT;
+    return o;
+}
+
+static void output_cv(const Output *o, uint8_t out[32]) {
+    uint32_t cv[8];
+    memcpy(cv, o->cv, sizeof(cv));
+    compress_in_place(cv, o->block, o->block_len, o->counter, o->flags);
+    store_cv(out, cv);
+}
+
+static void output_root(const Output *o, uint8_t out[32]) {
+    uint32_t s[16];
+    compress_pre(s, o->cv, o->block, o->block_len, 0, o->flags | ROOT);
+    for (int i = 0; i < 8; ++i) store32(out + 4 * i, s[i] ^ s[i + 8]);
+}
+
+// ---------------------------------------------------------------------------
+// Wide subtree compression
+
+// Largest power of two <= x (x > 0)
+static uint64_t round_down_pow2(uint64_t x) {
+    return 1ULL << (63 - __builtin_clzll(x | 1));
+}
+
+// The left subtree gets the largest power-of-two number of chunks that still
+// leaves at least one byte for the right
+static size_t left_len(size_t len) {
+    size_t full_chunks = (len - 1) / BLAKE3_CHUNK_LEN;
+    return (size_t)round_down_pow2(full_chunks) * BLAKE3_CHUNK_LEN;
+}
+
+// Hash each chunk of input to a CV; returns the number written
+static size_t compress_chunks(const Blake3Backend *be, const uint8_t *input, size_t len,
+                              uint64_t counter, uint8_t *out) {
+    const uint8_t *ptrs[MAX_DEGREE];
+    size_t n = 0;
+    while (len - n * BLAKE3_CHUNK_LEN >= BLAKE3_CHUNK_LEN) {
+        ptrs[n] = input + n * BLAKE3_CHUNK_LEN;
+        n += 1;
+    }
+    be->hash_many(ptrs, n, BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, IV, counter, 1, 0, CHUNK_START,
+                  CHUNK_END, out);
+    size_t rest = len - n * BLAKE3_CHUNK_LEN;
+    if (rest > 0) {
+        Blake3ChunkState c;
+        chunk_init(&c, counter + n);
+        chunk_update(&c, input + n * BLAKE3_CHUNK_LEN, rest);
+        Output o = chunk_output(&c);
+        output_cv(&o, out + n * BLAKE3_OUT_LEN);
+        return n + 1;
+    }
+    return n;
+}
+
+// Hash pairs of CVs to parent CVs; an odd one out is copied through
+static size_t compress_parents(const Blake3Backend *be, const uint8_t *cvs, size_t n, uint8_t *out) {
+    const uint8_t *ptrs[MAX_DEGREE];
+    size_t pairs = 0;
+    while (n - 2 * pairs >= 2) {
+        ptrs[pairs] = cvs + 2 * pairs * BLAKE3_OUT_LEN;
+        pairs += 1;
+    }
+    be->hash_many(ptrs, pairs, 1, IV, 0, 0, PARENT, 0, 0, out);
+    if (n > 2 * pairs) {
+        memcpy(out + pairs * BLAKE3_OUT_LEN, cvs + 2 * pairs * BLAKE3_OUT_LEN, BLAKE3_OUT_LEN);
+        return pairs + 1;
+    }
+    return pairs;
+}
+
+typedef struct {
+    const Blake3Backend *be;
+    const uint8_t *input;
+    size_t len;
+    uint64_t counter;
+    uint8_t *out;
+    size_t n;
+} SubtreeJob;
+
+static size_t compress_subtree_wide(const Blake3Backend *be, const uint8_t *input, size_t len,
+                                    uint64_t counter, uint8_t *out);
+
+static void run_subtree(void *ctx, int i) {
+    SubtreeJob *j = &((SubtreeJob *)ctx)[i];
+    j->n = compress_subtree_wide(j->be, j->input, j->len, j->counter, j->out);
+}
+
+/*
+ * Hash a subtree to at most be->degree CVs (2 if the degree is 1), so the
+ * caller can keep hashing them wide. input starts on a chunk boundary and
+ * counter is the index of its first chunk.
+ */
+static size_t compress_subtree_wide(const Blake3Backend *be, const uint8_t *input, size_t len,
+                                    uint64_t counter, uint8_t *out) {
+    if (len <= be->degree * BLAKE3_CHUNK_LEN) return compress_chunks(be, input, len, counter, out);
+
+    size_t left = left_len(len);
+    size_t right = len - left;
+    uint8_t cvs[2 * MAX_DEGREE * BLAKE3_OUT_LEN];
+    // the left half returns up to degree CVs; with degree 1 it must return
+    // two for the tree to shrink, unless it is a single chunk
+    size_t degree = be->degree;
+    if (degree == 1 && left > BLAKE3_CHUNK_LEN) degree = 2;
+    uint8_t *right_cvs = cvs + degree * BLAKE3_OUT_LEN;
+
+    size_t n_left, n_right;
+    if (right >= BLAKE3_PARALLEL_MIN && hash_pool_size() > 0) {
+        SubtreeJob jobs[2] = {
+            { be, input, left, counter, cvs, 0 },
+            { be, input + left, right, counter + left / BLAKE3_CHUNK_LEN, right_cvs, 0 },
+        };
+        hash_pool_run(2, run_subtree, jobs);
+        n_left = jobs[0].n;
+        n_right = jobs[1].n;
+    } else {
+        n_left = compress_subtree_wide(be, input, left, counter, cvs);
+        n_right = compress_subtree_wide(be, input + left, right, counter + left / BLAKE3_CHUNK_LEN,
+                                        right_cvs);
+    }
+    // a single chunk on the left means one CV each side: return both
+    if (n_left == 1) {
+        memcpy(out, cvs, 2 * BLAKE3_OUT_LEN);
+        return 2;
+    }
+    return compress_parents(be, cvs, n_left + n_right, out);
+}
+
+// Reduce a subtree all the way to one parent node (input > one chunk)
+static void compress_subtree_to_parent(const Blake3Backend *be, const uint8_t *input, size_t len,
+                                       uint64_t counter, uint8_t out[2 * BLAKE3_OUT_LEN]) {
+    uint8_t cvs[MAX_DEGREE * BLAKE3_OUT_LEN];
+    size_t n = compress_subtree_wide(be, input, len, counter, cvs);
+    uint8_t tmp[MAX_DEGREE / 2 * BLAKE3_OUT_LEN];
+    while (n > 2) {
+        n = compress_parents(be, cvs, n, tmp);
+        memcpy(cvs, tmp, n * BLAKE3_OUT_LEN);
+    }
+    memcpy(out, cvs, 2 * BLAKE3_OUT_LEN);
+}
+
+// ---------------------------------------------------------------------------
+// Hasher
+
+void blake3_init(BLAKE3_CTX *ctx) {
+    chunk_init(&ctx->chunk, 0);
+    ctx->cv_stack_len = 0;
+}
+
+// Merge completed subtrees: the stack holds one CV per set bit of total_len
+// chunks, so pop while it is longer than that. Called lazily, before a push,
+// so the last CV stays on the stack in case it turns out to be the root.
+static void merge_cv_stack(BLAKE3_CTX *ctx, uint64_t total_len) {
+    size_t post = (size_t)__builtin_popcountll(total_len);
+    while (ctx->cv_stack_len > post) {
+        uint8_t *parent = &ctx->cv_stack[(ctx->cv_stack_len - 2) * BLAKE3_OUT_LEN];
+        Output o = parent_output(parent);
+        output_cv(&o, parent);
+        ctx->cv_stack_len -= 1;
+    }
+}
+
+static void push_cv(BLAKE3_CTX *ctx, const uint8_t cv[32], uint64_t counter) {
+    merge_cv_stack(ctx, counter);
+    memcpy(&ctx->cv_stack[ctx->cv_stack_len * BLAKE3_OUT_LEN], cv, BLAKE3_OUT_LEN);
+    ctx->cv_stack_len += 1;
+}
+
+static void update_with(const Blake3Backend *be, BLAKE3_CTX *ctx, const uint8_t *input, size_t len) {
+    if (len == 0) return;
+
+    // Finish a partial chunk first
+    if (chunk_len(&ctx->chunk) > 0) {
+        size_t take = BLAKE3_CHUNK_LEN - chunk_len(&ctx->chunk);
+        if (take > len) take = len;
+        chunk_update(&ctx->chunk, input, take);
+        input += take;
+        len -= take;
+        if (len == 0) return; // may still be the root: keep it
+        Output o = chunk_output(&ctx->chunk);
+        uint8_t cv[32];
+        output_cv(&o, cv);
+        push_cv(ctx, cv, ctx->chunk.chunk_counter);
+        chunk_init(&ctx->chunk, ctx->chunk.chunk_counter + 1);
+    }
+
+    // Whole subtrees, aligned to the chunk counter, while more input follows
+    while (len > BLAKE3_CHUNK_LEN) {
+        uint64_t subtree = round_down_pow2(len);
+        uint64_t counter = ctx->chunk.chunk_counter;
+        while (((subtree - 1) & (counter * BLAKE3_CHUNK_LEN)) != 0) subtree /= 2;
+        uint64_t chunks = subtree / BLAKE3_CHUNK_LEN;
+        if (subtree <= BLAKE3_CHUNK_LEN) {
+            Blake3ChunkState c;
+            chunk_init(&c, counter);
+            chunk_update(&c, input, (size_t)subtree);
+            Output o = chunk_output(&c);
+            uint8_t cv[32];
+            output_cv(&o, cv);
+            push_cv(ctx, cv, counter);
+        } else {
+            uint8_t pair[2 * BLAKE3_OUT_LEN];
+            compress_subtree_to_parent(be, input, (size_t)subtree, counter, pair);
+            push_cv(ctx, pair, counter);
+            push_cv(ctx, pair + BLAKE3_OUT_LEN, counter + chunks / 2);
+        }
+        ctx->chunk.chunk_counter += chunks;
+        input += subtree;
+        len -= (size_t)subtree;
+    }
+
+    // At most one chunk left: buffer it, it may be the root
+    if (len > 0) {
+        chunk_update(&ctx->chunk, input, len);
+        merge_cv_stack(ctx, ctx->chunk.chunk_counter);
+    }
+}
+
+void blake3_update(BLAKE3_CTX *ctx, const uint8_t *data, size_t len) {
+    update_with(get_backend(), ctx, data, len);
+}
+
+void blake3_final(const BLAKE3_CTX *ctx, uint8_t out[BLAKE3_OUT_LEN]) {
+    // A lone chunk is the root
+    if (ctx->cv_stack_len == 0) {
+        Output o = chunk_output(&ctx->chunk);
+        output_root(&o, out);
+        return;
+    }
+    // Otherwise fold the stack from the top, starting from the partial chunk
+    // if there is one or else from the two topmost CVs
+    Output o;
+    size_t remaining;
+    if (chunk_len(&ctx->chunk) > 0) {
+        remaining = ctx->cv_stack_len;
+        o = chunk_output(&ctx->chunk);
+    } else {
+        remaining = ctx->cv_stack_len - 2;
+        o = parent_output(&ctx->cv_stack[remaining * BLAKE3_OUT_LEN]);
+    }
+    while (remaining > 0) {
+        remaining -= 1;
+        uint8_t block[BLAKE3_BLOCK_LEN];
+        memcpy(block, &ctx->cv_stack[remaining * BLAKE3_OUT_LEN], BLAKE3_OUT_LEN);
+        output_cv(&o, block + BLAKE3_OUT_LEN);
+        o = parent_output(block);
+    }
+    output_root(&o, out);
+}
+
+void blake3_digest(const uint8_t *data, size_t len, uint8_t out[BLAKE3_OUT_LEN]) {
+    BLAKE3_CTX ctx;
+    blake3_init(&ctx);
+    blake3_update(&ctx, data, len);
+    blake3_final(&ctx, out);
+}
+
+// ---------------------------------------------------------------------------
+// Self-test
+
+static int unhex_cmp(const uint8_t *bin, const char *hex) {
+    for (int i = 0; i < BLAKE3_OUT_LEN; ++i) {
+        unsigned v;
+        char tmp[3] = { hex[2 * i], hex[2 * i + 1], 0 };
+        v = (unsigned)strtoul(tmp, NULL, 16);
+        if (bin[i] != v) return -1;
+    }
+    return 0;
+}
+
+static void digest_with(const Blake3Backend *be, const uint8_t *data, size_t len, size_t piece,
+                        uint8_t out[BLAKE3_OUT_LEN]) {
+    BLAKE3_CTX ctx;
+    blake3_init(&ctx);
+    if (piece == 0) piece = len ? len : 1;
+    for (size_t off = 0; off < len; off += piece) update_with(be, &ctx, data + off, len - off < piece ? len - off : piece);
+    blake3_final(&ctx, out);
+}
+
+// Official test vectors: input byte i is i % 251
+static int self_test_with(const Blake3Backend *be) {
+    static const struct { size_t len; const char *hex; } vectors[] = {
+        { 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+        { 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+        { 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+        { 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+        { 8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+        { 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+    };
+    static uint8_t buf[31744];
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)(i % 251);
+    uint8_t out[BLAKE3_OUT_LEN];
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+        digest_with(be, buf, vectors[i].len, 0, out);
+        if (unhex_cmp(out, vectors[i].hex) != 0) return -1;
+        digest_with(be, buf, vectors[i].len, 777, out);
+        if (unhex_cmp(out, vectors[i].hex) != 0) return -1;
+    }
+    return 0;
+}
+
+int blake3_self_test(void) {
+    return self_test_with(get_backend());
+}
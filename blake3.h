@@ -0,0 +1,55 @@
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * BLAKE3 (unkeyed hash, 32-byte output). Input is split into 1 KiB chunks
+ * that form a binary tree, so independent chunks are compressed several at a
+ * time in SIMD lanes, and large updates are split into subtrees hashed on the
+ * hash pool (hash_pool.h). The result does not depend on how the input is
+ * split across updates, nor on the backend or thread count.
+ */
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+
+// Contiguous input of at least this many bytes per half is hashed by two
+// threads at once
+#define BLAKE3_PARALLEL_MIN (512 * 1024)
+
+typedef struct {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t buf[BLAKE3_BLOCK_LEN];
+    uint8_t buf_len;
+    uint8_t blocks_compressed;
+} Blake3ChunkState;
+
+// Streaming BLAKE3 context
+typedef struct {
+    Blake3ChunkState chunk;
+    uint8_t cv_stack_len;
+    uint8_t cv_stack[(BLAKE3_MAX_DEPTH + 1) * BLAKE3_OUT_LEN];
+} BLAKE3_CTX;
+
+void blake3_init(BLAKE3_CTX *ctx);
+void blake3_update(BLAKE3_CTX *ctx, const uint8_t *data, size_t len);
+void blake3_final(const BLAKE3_CTX *ctx, uint8_t out[BLAKE3_OUT_LEN]);
+
+// One-shot helper
+void blake3_digest(const uint8_t *data, size_t len, uint8_t out[BLAKE3_OUT_LEN]);
+
+// Backend selection ("avx2", "generic"), as for sha256.h: the fastest
+// backend that passes the self-test is chosen on first use, and
+// REPROVM_BLAKE3_BACKEND=<name> overrides it.
+const char *blake3_backend_name(void);
+int blake3_set_backend(const char *name); // returns -1 if unknown or unsupported
+
+// Run the known-answer vectors against the active backend. Returns 0 on success.
+int blake3_self_test(void);
+
+#endif // BLAKE3_H
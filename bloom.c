@@ -0,0 +1,249 @@
+// bloom.c
+#define _GNU_SOURCE
+#include "bloom.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOOM_MAGIC "RVMBLOOM"
+#define BLOOM_VERSION 1
+#define BLOOM_HEADER_SIZE 64
+#define BLOOM_K 11 // optimal for BLOOM_BITS_PER_OBJECT
+
+#define FLAG_VALID 1ULL      // fully built
+#define FLAG_SUPERSEDED 2ULL // replaced by a newer filter at the same path
+
+typedef struct Mapping {
+    unsigned char *base;
+    size_t len;
+    uint64_t bits;
+    uint32_t k;
+    struct Mapping *retired; // older mappings, kept until bloom_close
+} Mapping;
+
+static char filter_path[1100];
+static Mapping *current = NULL; // read without the lock; replaced under it
+static pthread_mutex_t remap_mu = PTHREAD_MUTEX_INITIALIZER;
+static int rebuild_lock_fd = -1;
+
+static uint64_t *hdr_flags(const Mapping *m) { return (uint64_t *)(m->base + 24); }
+static uint64_t *hdr_added(const Mapping *m) { return (uint64_t *)(m->base + 32); }
+
+static uint64_t load_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+static Mapping *map_filter(const char *path, int *missing) {
+    *missing = 0;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        *missing = errno == ENOENT;
+        return NULL;
+    }
+    struct stat st;
+    Mapping *m = NULL;
+    unsigned char hdr[BLOOM_HEADER_SIZE];
+    if (fstat(fd, &st) == 0 && st.st_size > BLOOM_HEADER_SIZE &&
+        pread(fd, hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && memcmp(hdr, BLOOM_MAGIC, 8) == 0 &&
+        (hdr[8] | hdr[9] << 8) == BLOOM_VERSION) {
+        uint64_t bits = load_le64(hdr + 16);
+        uint32_t k = hdr[12] | hdr[13] << 8;
+        int pow2 = bits >= 64 && (bits & (bits - 1)) == 0;
+        if (pow2 && k > 0 && k <= 32 && (uint64_t)st.st_size == BLOOM_HEADER_SIZE + bits / 8 &&
+            (m = calloc(1, sizeof(Mapping)))) {
+            m->len = (size_t)st.st_size;
+            m->bits = bits;
+            m->k = k;
+            m->base = mmap(NULL, m->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (m->base == MAP_FAILED) {
+                free(m);
+                m = NULL;
+            }
+        }
+    }
+    close(fd);
+    return m;
+}
+
+// Make m current, keeping the one it replaces mapped: other threads may
+// still be probing it. Called with remap_mu held.
+static void install(Mapping *m) {
+    m->retired = current;
+    __atomic_store_n(&current, m, __ATOMIC_RELEASE);
+}
+
+int bloom_open(const char *path) {
+    bloom_close();
+    snprintf(filter_path, sizeof(filter_path), "%s", path);
+    int missing;
+    Mapping *m = map_filter(path, &missing);
+    if (!m) return missing ? 0 : -1;
+    pthread_mutex_lock(&remap_mu);
+    install(m);
+    pthread_mutex_unlock(&remap_mu);
+    return 1;
+}
+
+void bloom_close(void) {
+    pthread_mutex_lock(&remap_mu);
+    Mapping *m = current;
+    current = NULL;
+    while (m) {
+        Mapping *next = m->retired;
+        munmap(m->base, m->len);
+        free(m);
+        m = next;
+    }
+    pthread_mutex_unlock(&remap_mu);
+    if (rebuild_lock_fd >= 0) close(rebuild_lock_fd);
+    rebuild_lock_fd = -1;
+}
+
+// Move from a superseded filter to whatever is at the path now
+static Mapping *follow(Mapping *seen) {
+    pthread_mutex_lock(&remap_mu);
+    if (current == seen) {
+        int missing;
+        Mapping *m = map_filter(filter_path, &missing);
+        if (m) install(m);
+    }
+    Mapping *now = current;
+    pthread_mutex_unlock(&remap_mu);
+    return now;
+}
+
+static uint64_t probe(const uint8_t digest[32], uint32_t i, uint64_t bits) {
+    uint64_t h1 = load_le64(digest + 8), h2 = load_le64(digest + 16) | 1;
+    return (h1 + i * h2) & (bits - 1);
+}
+
+int bloom_check(const uint8_t digest[32]) {
+    Mapping *m = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (!m) return BLOOM_UNKNOWN;
+    uint64_t flags = __atomic_load_n(hdr_flags(m), __ATOMIC_ACQUIRE);
+    if (flags & FLAG_SUPERSEDED) {
+        Mapping *next = follow(m);
+        if (next == m) return BLOOM_UNKNOWN;
+        m = next;
+        flags = __atomic_load_n(hdr_flags(m), __ATOMIC_ACQUIRE);
+    }
+    if ((flags & (FLAG_VALID | FLAG_SUPERSEDED)) != FLAG_VALID) return BLOOM_UNKNOWN;
+    const unsigned char *bitmap = m->base + BLOOM_HEADER_SIZE;
+    for (uint32_t i = 0; i < m->k; ++i) {
+        uint64_t p = probe(digest, i, m->bits);
+        if (!(__atomic_load_n(&bitmap[p >> 3], __ATOMIC_RELAXED) & (1u << (p & 7)))) return BLOOM_ABSENT;
+    }
+    return BLOOM_MAYBE;
+}
+
+void bloom_add(const uint8_t digest[32]) {
+    Mapping *m = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    while (m) {
+        unsigned char *bitmap = m->base + BLOOM_HEADER_SIZE;
+        for (uint32_t i = 0; i < m->k; ++i) {
+            uint64_t p = probe(digest, i, m->bits);
+            __atomic_fetch_or(&bitmap[p >> 3], (unsigned char)(1u << (p & 7)), __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_add(hdr_added(m), 1, __ATOMIC_SEQ_CST);
+        // A rebuild marks this filter superseded before it scans; if it has
+        // not yet, the scan will see the object, otherwise add it there too
+        if (!(__atomic_load_n(hdr_flags(m), __ATOMIC_SEQ_CST) & FLAG_SUPERSEDED)) return;
+        Mapping *next = follow(m);
+        if (next == m) return;
+        m = next;
+    }
+}
+
+int bloom_rebuild_begin(uint64_t expected) {
+    char path[1200];
+    snprintf(path, sizeof(path), "%s.lock", filter_path);
+    int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0) return -1;
+    while (flock(lock, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            close(lock);
+            return -1;
+        }
+    }
+    uint64_t bits = BLOOM_MIN_BITS;
+    while (bits < expected * BLOOM_BITS_PER_OBJECT) bits <<= 1;
+    snprintf(path, sizeof(path), "%s.%ld.tmp", filter_path, (long)getpid());
+    unsigned char hdr[BLOOM_HEADER_SIZE] = { 0 };
+    memcpy(hdr, BLOOM_MAGIC, 8);
+    hdr[8] = BLOOM_VERSION;
+    hdr[12] = BLOOM_K;
+    for (int i = 0; i < 8; ++i) hdr[16 + i] = (unsigned char)(bits >> (8 * i));
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int ok = fd >= 0 && ftruncate(fd, (off_t)(BLOOM_HEADER_SIZE + bits / 8)) == 0 &&
+             pwrite(fd, hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr);
+    if (fd >= 0) close(fd);
+    int missing;
+    Mapping *fresh = ok ? map_filter(path, &missing) : NULL;
+    Mapping *old = fresh ? map_filter(filter_path, &missing) : NULL;
+    if (!fresh || rename(path, filter_path) != 0) {
+        unlink(path);
+        if (fresh) munmap(fresh->base, fresh->len);
+        if (old) munmap(old->base, old->len);
+        free(fresh);
+        free(old);
+        close(lock);
+        return -1;
+    }
+    pthread_mutex_lock(&remap_mu);
+    install(fresh);
+    pthread_mutex_unlock(&remap_mu);
+    // Writers still on the old filter switch over from here on
+    if (old) {
+        __atomic_fetch_or(hdr_flags(old), FLAG_SUPERSEDED, __ATOMIC_SEQ_CST);
+        munmap(old->base, old->len);
+        free(old);
+    }
+    rebuild_lock_fd = lock;
+    return 0;
+}
+
+int bloom_rebuild_finish(void) {
+    if (rebuild_lock_fd < 0) return -1;
+    Mapping *m = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (m) __atomic_fetch_or(hdr_flags(m), FLAG_VALID, __ATOMIC_SEQ_CST);
+    close(rebuild_lock_fd);
+    rebuild_lock_fd = -1;
+    return m ? 0 : -1;
+}
+
+int bloom_needs_rebuild(void) {
+    BloomInfo info;
+    bloom_get_info(&info);
+    if (info.bits == 0) return 1;
+    if (info.added > 2 * (info.bits / BLOOM_BITS_PER_OBJECT)) return 1;
+    if (info.valid) return 0;
+    // not valid: rebuilding unless nobody holds the rebuild lock
+    char path[1200];
+    snprintf(path, sizeof(path), "%s.lock", filter_path);
+    int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0) return 0;
+    int idle = flock(lock, LOCK_EX | LOCK_NB) == 0;
+    close(lock);
+    return idle;
+}
+
+void bloom_get_info(BloomInfo *out) {
+    memset(out, 0, sizeof(*out));
+    Mapping *m = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (!m) return;
+    uint64_t flags = __atomic_load_n(hdr_flags(m), __ATOMIC_ACQUIRE);
+    out->bits = m->bits;
+    out->added = __atomic_load_n(hdr_added(m), __ATOMIC_RELAXED);
+    out->valid = (flags & (FLAG_VALID | FLAG_SUPERSEDED)) == FLAG_VALID;
+    out->estimated_fp_rate = pow(1.0 - exp(-(double)m->k * (double)out->added / (double)m->bits), m->k);
+}
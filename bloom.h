@@ -0,0 +1,60 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdint.h>
+
+/*
+ * Persistent Bloom filter of every object digest in the store, so probes for
+ * missing objects are answered from memory instead of a stat. The filter is a
+ * file mapped shared by every process using the store: a 64-byte header
+ * { "RVMBLOOM"; uint32 version; uint32 k; uint64 bits; uint64 flags;
+ * uint64 added; } (little-endian) followed by the bit array. Digests are
+ * uniformly distributed (SHA-256 or BLAKE3), so the k probe positions are
+ * taken straight from the digest by double hashing.
+ *
+ * Writers add an object after publishing it. A rebuild publishes a fresh,
+ * not yet valid filter, marks the one it replaces as superseded and only
+ * then scans the store; a writer that finds its filter superseded after
+ * adding moves to the new one and adds again, so no object published during
+ * the scan is missed. Deleted objects stay in the filter until the next
+ * rebuild (they cost false positives, never wrong answers).
+ */
+
+#define BLOOM_BITS_PER_OBJECT 16 // ~0.05% false positives at the design load
+#define BLOOM_MIN_BITS (1ULL << 23) // 1 MB
+
+// bloom_check results
+#define BLOOM_ABSENT 0  // definitely not in the store
+#define BLOOM_MAYBE 1   // possibly in the store
+#define BLOOM_UNKNOWN -1 // no usable filter: ask the filesystem
+
+typedef struct {
+    uint64_t bits;           // size of the filter (0 = none)
+    uint64_t added;          // objects added since it was built
+    int valid;
+    double estimated_fp_rate; // from the fill: (1 - e^(-k*added/bits))^k
+} BloomInfo;
+
+// Map the filter at path. Returns 1 if one exists, 0 if not (probes then
+// return BLOOM_UNKNOWN until a rebuild), -1 if it is unreadable.
+int bloom_open(const char *path);
+void bloom_close(void);
+
+int bloom_check(const uint8_t digest[32]);
+
+// Record a published object
+void bloom_add(const uint8_t digest[32]);
+
+// Replace the filter with an empty one sized for expected objects; the
+// caller then adds every object in the store and calls bloom_rebuild_finish.
+// Rebuilds are serialized across processes between begin and finish.
+int bloom_rebuild_begin(uint64_t expected);
+int bloom_rebuild_finish(void);
+
+void bloom_get_info(BloomInfo *out);
+
+// 1 if the filter should be rebuilt: there is none, a rebuild died before
+// finishing, or it holds more than twice the objects it was sized for
+int bloom_needs_rebuild(void);
+
+#endif // BLOOM_H
@@ -0,0 +1,470 @@
+// bundle.c
+#define _GNU_SOURCE
+#include "bundle.h"
+#include "cas.h"
+#include "durability.h"
+#include "hash_pool.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BUNDLE_MAGIC "RVMBNDL1"
+#define INDEX_MAGIC "RVMBIDX1"
+#define BUNDLE_VERSION 1
+#define HEADER_SIZE 32
+#define ENTRY_SIZE 48
+#define INDEX_ENTRY_SIZE 56
+#define TRAILER_SIZE 24
+#define META_EXT ".meta"
+#define IO_CHUNK (1 << 20)         // bytes per read or write of a large object
+#define BATCH_BYTES (32u << 20)    // object bytes an import holds at once
+#define BATCH_MAX 1024             // objects written in parallel at once
+#define STREAM_MIN (BATCH_BYTES / 4) // larger objects stream, never whole in memory
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+static void header(unsigned char h[HEADER_SIZE]) {
+    memset(h, 0, HEADER_SIZE);
+    memcpy(h, BUNDLE_MAGIC, 8);
+    put_le32(h + 8, BUNDLE_VERSION);
+    strncpy((char *)h + 16, digest_algorithm_name(digest_algorithm()), 15);
+}
+
+/* ---- export ---- */
+
+typedef struct {
+    FILE *f;
+    uint64_t off;
+    BundleEntry *index;
+    size_t n, cap;
+    // objects already in the bundle
+    Digest *slots;
+    unsigned char *used;
+    size_t set_cap, set_n;
+    unsigned char *buf;
+    BundleStats *st;
+} Writer;
+
+static int seen_has(const Writer *w, const Digest *d) {
+    if (w->set_cap == 0) return 0;
+    for (size_t i = (size_t)digest_hash(d) & (w->set_cap - 1); w->used[i]; i = (i + 1) & (w->set_cap - 1))
+        if (digest_eq(&w->slots[i], d)) return 1;
+    return 0;
+}
+
+// Add d (not yet there) to the written set; -1 out of memory
+static int seen_add(Writer *w, const Digest *d) {
+    if ((w->set_n + 1) * 4 >= w->set_cap * 3) {
+        size_t cap = w->set_cap ? w->set_cap * 2 : 1024;
+        Digest *slots = malloc(cap * sizeof(Digest));
+        unsigned char *used = calloc(cap, 1);
+        if (!slots || !used) {
+            free(slots);
+            free(used);
+            return -1;
+        }
+        for (size_t i = 0; i < w->set_cap; ++i) {
+            if (!w->used[i]) continue;
+            size_t j = (size_t)digest_hash(&w->slots[i]) & (cap - 1);
+            while (used[j]) j = (j + 1) & (cap - 1);
+            slots[j] = w->slots[i];
+            used[j] = 1;
+        }
+        free(w->slots);
+        free(w->used);
+        w->slots = slots;
+        w->used = used;
+        w->set_cap = cap;
+    }
+    size_t i = (size_t)digest_hash(d) & (w->set_cap - 1);
+    while (w->used[i]) i = (i + 1) & (w->set_cap - 1);
+    w->slots[i] = *d;
+    w->used[i] = 1;
+    w->set_n++;
+    return 0;
+}
+
+static int put(Writer *w, const void *p, size_t len) {
+    if (len > 0 && fwrite(p, 1, len, w->f) != len) return -1;
+    w->off += len;
+    return 0;
+}
+
+// An entry's header, indexed unless it ends the list
+static int put_entry(Writer *w, const Digest *d, uint64_t len, BundleKind kind) {
+    unsigned char h[ENTRY_SIZE] = { 0 };
+    memcpy(h, d->b, DIGEST_SIZE);
+    put_le64(h + 32, len);
+    put_le32(h + 40, (uint32_t)kind);
+    if (put(w, h, sizeof(h)) != 0) return -1;
+    if (kind == BUNDLE_END) return 0;
+    if (w->n == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 1024;
+        BundleEntry *grown = realloc(w->index, cap * sizeof(BundleEntry));
+        if (!grown) return -1;
+        w->index = grown;
+        w->cap = cap;
+    }
+    w->index[w->n++] = (BundleEntry){ *d, w->off, len, kind };
+    return 0;
+}
+
+// d after everything it names, each object once, streamed from the store.
+// Returns -1 if d or something it names is missing, -2 if writing failed.
+// An object is only marked written once it is, so a missing one fails
+// every record that reaches it.
+static int put_object(Writer *w, const Digest *d) {
+    if (seen_has(w, d)) return 0;
+    Digest *refs = NULL;
+    size_t n = 0;
+    if (cas_object_refs(d, &refs, &n) < 0) {
+        w->st->missing++;
+        return -1;
+    }
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < n; ++i) rc = put_object(w, &refs[i]);
+    free(refs);
+    if (rc != 0) return rc;
+    int fd;
+    off_t off;
+    uint64_t len;
+    if (cas_open_object(d, &fd, &off, &len) != 0) {
+        w->st->missing++;
+        return -1;
+    }
+    if (put_entry(w, d, len, BUNDLE_OBJECT) != 0) rc = -2;
+    for (uint64_t done = 0; rc == 0 && done < len;) {
+        size_t want = len - done < IO_CHUNK ? (size_t)(len - done) : IO_CHUNK;
+        ssize_t got = pread(fd, w->buf, want, off + (off_t)done);
+        if (got <= 0 || put(w, w->buf, (size_t)got) != 0) rc = -2;
+        else done += (uint64_t)got;
+    }
+    close(fd);
+    if (rc == 0 && seen_add(w, d) != 0) rc = -2;
+    if (rc == 0) {
+        w->st->objects++;
+        w->st->bytes += len;
+    }
+    return rc;
+}
+
+// The objects a record names ("output <path> <hash>", "tree <dir> <hash>")
+static int put_record_objects(Writer *w, char *text) {
+    int rc = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(text, "\n", &save); line && rc != -2; line = strtok_r(NULL, "\n", &save)) {
+        if (strncmp(line, "output ", 7) != 0 && strncmp(line, "tree ", 5) != 0) continue;
+        char *hash = strrchr(line, ' ');
+        Digest d;
+        if (!hash || digest_from_hex(hash + 1, &d) != 0) continue;
+        int r = put_object(w, &d);
+        if (r != 0) rc = r;
+    }
+    return rc;
+}
+
+int bundle_export(const char *path, const Digest tasks[], size_t n, BundleStats *stats) {
+    BundleStats local;
+    BundleStats *st = stats ? stats : &local;
+    memset(st, 0, sizeof(*st));
+    char tmp[1200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+    Writer w = { 0 };
+    w.st = st;
+    w.f = fopen(tmp, "wb");
+    w.buf = malloc(IO_CHUNK);
+    // records go after every object, so they are kept until then
+    char **texts = calloc(n ? n : 1, sizeof(char *));
+    size_t *lens = calloc(n ? n : 1, sizeof(size_t));
+    int rc = w.f && w.buf && texts && lens ? 0 : -1;
+    unsigned char h[HEADER_SIZE];
+    header(h);
+    if (rc == 0) rc = put(&w, h, sizeof(h));
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        char file[1200], hex[DIGEST_HEX_SIZE];
+        snprintf(file, sizeof(file), "%s/%s%s", cas_get_cache_root(), digest_to_hex(&tasks[i], hex), META_EXT);
+        char *text = read_entire_file(file, &lens[i]);
+        if (!text) continue;
+        char *scratch = strdup(text);
+        int r = scratch ? put_record_objects(&w, scratch) : -2;
+        free(scratch);
+        if (r == -2) rc = -1;
+        // a record whose outputs are gone would only be a broken hit
+        if (r == 0) texts[i] = text;
+        else free(text);
+    }
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        if (!texts[i]) continue;
+        if (put_entry(&w, &tasks[i], lens[i], BUNDLE_RECORD) != 0 || put(&w, texts[i], lens[i]) != 0) rc = -1;
+        st->records++;
+    }
+    Digest zero = { { 0 } };
+    if (rc == 0) rc = put_entry(&w, &zero, 0, BUNDLE_END);
+    uint64_t index_off = w.off;
+    for (size_t i = 0; rc == 0 && i < w.n; ++i) {
+        unsigned char e[INDEX_ENTRY_SIZE] = { 0 };
+        memcpy(e, w.index[i].d.b, DIGEST_SIZE);
+        put_le64(e + 32, w.index[i].offset);
+        put_le64(e + 40, w.index[i].length);
+        put_le32(e + 48, (uint32_t)w.index[i].kind);
+        rc = put(&w, e, sizeof(e));
+    }
+    unsigned char t[TRAILER_SIZE];
+    put_le64(t, index_off);
+    put_le64(t + 8, (uint64_t)w.n);
+    memcpy(t + 16, INDEX_MAGIC, 8);
+    if (rc == 0) rc = put(&w, t, sizeof(t));
+    if (w.f && (fflush(w.f) != 0 || fsync(fileno(w.f)) != 0)) rc = -1;
+    if (w.f && fclose(w.f) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) unlink(tmp);
+    for (size_t i = 0; texts && i < n; ++i) free(texts[i]);
+    free(texts);
+    free(lens);
+    free(w.index);
+    free(w.slots);
+    free(w.used);
+    free(w.buf);
+    return rc;
+}
+
+/* ---- import ---- */
+
+// An object read into memory, waiting for its batch
+typedef struct {
+    Digest d;
+    unsigned char *data;
+    size_t len;
+    int refs; // names other objects: written after the rest, in order
+    int rc;
+} Pending;
+
+typedef struct {
+    Pending *items;
+    size_t n;
+    uint64_t bytes;
+    int failed; // an object did not verify: no record after it is kept
+    BundleStats *st;
+} Batch;
+
+static int read_exact(FILE *in, void *p, size_t len) {
+    return fread(p, 1, len, in) == len ? 0 : -1;
+}
+
+// Pass over len bytes: a seek when the input allows it, else reads
+static int skip(FILE *in, uint64_t len, unsigned char *buf) {
+    if (len <= (uint64_t)INT64_MAX && fseeko(in, (off_t)len, SEEK_CUR) == 0) return 0;
+    while (len > 0) {
+        size_t want = len < IO_CHUNK ? (size_t)len : IO_CHUNK;
+        if (read_exact(in, buf, want) != 0) return -1;
+        len -= want;
+    }
+    return 0;
+}
+
+static void write_leaf(void *ctx, int i) {
+    Pending *p = &((Pending *)ctx)[i];
+    Digest *refs = NULL;
+    size_t n = 0;
+    p->refs = cas_parse_object_refs(p->data, p->len, &refs, &n) > 0 && n > 0;
+    free(refs);
+    if (!p->refs) p->rc = cas_write_object(&p->d, p->data, p->len);
+}
+
+static void tally(Batch *b, const Digest *d, uint64_t len, int rc) {
+    if (rc == 0) {
+        b->st->objects++;
+        b->st->bytes += len;
+        return;
+    }
+    char hex[DIGEST_HEX_SIZE];
+    fprintf(stderr, "Cannot store object %s from the bundle\n", digest_to_hex(d, hex));
+    b->failed = 1;
+}
+
+// Store the batch: objects that name nothing in parallel on the hash pool,
+// then chunk lists and trees in bundle order, as what they name is in by then
+static void flush(Batch *b) {
+    if (b->n == 0) return;
+    hash_pool_run((int)b->n, write_leaf, b->items);
+    for (size_t i = 0; i < b->n; ++i) {
+        Pending *p = &b->items[i];
+        if (p->refs) p->rc = cas_write_object(&p->d, p->data, p->len);
+        tally(b, &p->d, p->len, p->rc);
+        free(p->data);
+    }
+    b->n = 0;
+    b->bytes = 0;
+}
+
+// An object too large to hold, stored as it is read
+static int stream_object(FILE *in, const Digest *d, uint64_t len, unsigned char *buf) {
+    CasObjectWriter *w = cas_object_writer_new(d);
+    int rc = w ? 0 : -1;
+    for (uint64_t left = len; left > 0;) {
+        size_t want = left < IO_CHUNK ? (size_t)left : IO_CHUNK;
+        if (read_exact(in, buf, want) != 0) {
+            cas_object_writer_abort(w);
+            return -2;
+        }
+        if (rc == 0) rc = cas_object_writer_write(w, buf, want);
+        left -= want;
+    }
+    if (rc != 0) {
+        cas_object_writer_abort(w);
+        return -1;
+    }
+    return cas_object_writer_commit(w) == 0 ? 0 : -1;
+}
+
+int bundle_import(const char *path, BundleStats *stats) {
+    BundleStats local;
+    BundleStats *st = stats ? stats : &local;
+    memset(st, 0, sizeof(*st));
+    int from_stdin = strcmp(path, "-") == 0;
+    FILE *in = from_stdin ? stdin : fopen(path, "rb");
+    if (!in) return -1;
+    // one large sequential read
+    setvbuf(in, NULL, _IOFBF, IO_CHUNK);
+    unsigned char *buf = malloc(IO_CHUNK);
+    Batch b = { calloc(BATCH_MAX, sizeof(Pending)), 0, 0, 0, st };
+    unsigned char h[HEADER_SIZE], want[HEADER_SIZE];
+    header(want);
+    int rc = buf && b.items ? 0 : -1;
+    if (rc == 0 && (read_exact(in, h, sizeof(h)) != 0 || memcmp(h, want, 8) != 0 ||
+                    get_le32(h + 8) != BUNDLE_VERSION)) {
+        fprintf(stderr, "Not a cache bundle, or one from a newer version\n");
+        rc = -1;
+    }
+    if (rc == 0 && memcmp(h + 16, want + 16, 16) != 0) {
+        fprintf(stderr, "The bundle holds %.15s objects; this store uses %s\n", (const char *)h + 16,
+                digest_algorithm_name(digest_algorithm()));
+        rc = -1;
+    }
+    while (rc == 0) {
+        unsigned char e[ENTRY_SIZE];
+        if (read_exact(in, e, sizeof(e)) != 0) {
+            rc = -1;
+            break;
+        }
+        Digest d;
+        memcpy(d.b, e, DIGEST_SIZE);
+        uint64_t len = get_le64(e + 32);
+        uint32_t kind = get_le32(e + 40);
+        if (kind == BUNDLE_END) break;
+        if (kind == BUNDLE_RECORD) {
+            // the objects before it are stored first
+            flush(&b);
+            char *text = len < (1u << 30) ? malloc((size_t)len + 1) : NULL;
+            if (!text || read_exact(in, text, (size_t)len) != 0) {
+                free(text);
+                rc = -1;
+                break;
+            }
+            char name[DIGEST_HEX_SIZE + sizeof(META_EXT)], hex[DIGEST_HEX_SIZE];
+            snprintf(name, sizeof(name), "%s%s", digest_to_hex(&d, hex), META_EXT);
+            // the record must name the task it is filed under
+            char first[16 + DIGEST_HEX_SIZE];
+            int n = snprintf(first, sizeof(first), "task_hash: %s\n", hex);
+            if (len < (uint64_t)n || memcmp(text, first, (size_t)n) != 0) {
+                fprintf(stderr, "Warning: skipping the bundled record for %s, which is for another task\n", hex);
+            } else if (!b.failed) {
+                if (cas_write_cache_file(name, text, (size_t)len) != 0) rc = -1;
+                else st->records++;
+            }
+            free(text);
+            continue;
+        }
+        // kinds from a newer version, and objects already here, are passed over
+        if (kind != BUNDLE_OBJECT || cas_blob_exists(&d)) {
+            if (kind == BUNDLE_OBJECT) st->objects_present++;
+            if (skip(in, len, buf) != 0) rc = -1;
+            continue;
+        }
+        if (len >= STREAM_MIN) {
+            flush(&b);
+            int r = stream_object(in, &d, len, buf);
+            if (r == -2) rc = -1;
+            else tally(&b, &d, len, r);
+            continue;
+        }
+        if (b.n == BATCH_MAX || b.bytes + len > BATCH_BYTES) flush(&b);
+        Pending *p = &b.items[b.n];
+        *p = (Pending){ d, malloc(len ? (size_t)len : 1), (size_t)len, 0, -1 };
+        if (!p->data || read_exact(in, p->data, (size_t)len) != 0) {
+            free(p->data);
+            rc = -1;
+            break;
+        }
+        b.n++;
+        b.bytes += len;
+    }
+    flush(&b);
+    if (rc != 0) fprintf(stderr, "The bundle is truncated or damaged\n");
+    if (b.failed) rc = -1;
+    if (durability_commit() != 0) rc = -1;
+    if (!from_stdin) fclose(in);
+    free(b.items);
+    free(buf);
+    return rc;
+}
+
+int bundle_read_index(const char *path, BundleEntry **entries, size_t *n) {
+    *entries = NULL;
+    *n = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    unsigned char t[TRAILER_SIZE];
+    int rc = fstat(fd, &st) == 0 && st.st_size >= HEADER_SIZE + ENTRY_SIZE + TRAILER_SIZE &&
+                     pread(fd, t, sizeof(t), st.st_size - TRAILER_SIZE) == (ssize_t)sizeof(t) &&
+                     memcmp(t + 16, INDEX_MAGIC, 8) == 0
+                 ? 0
+                 : -1;
+    uint64_t off = rc == 0 ? get_le64(t) : 0, count = rc == 0 ? get_le64(t + 8) : 0;
+    if (rc == 0 && (off > (uint64_t)st.st_size || count != ((uint64_t)st.st_size - TRAILER_SIZE - off) / INDEX_ENTRY_SIZE))
+        rc = -1;
+    unsigned char *raw = rc == 0 ? malloc(count * INDEX_ENTRY_SIZE + 1) : NULL;
+    BundleEntry *out = raw ? malloc(count * sizeof(BundleEntry) + 1) : NULL;
+    if (!out || pread(fd, raw, count * INDEX_ENTRY_SIZE, (off_t)off) != (ssize_t)(count * INDEX_ENTRY_SIZE))
+        rc = -1;
+    for (uint64_t i = 0; rc == 0 && i < count; ++i) {
+        const unsigned char *e = raw + i * INDEX_ENTRY_SIZE;
+        memcpy(out[i].d.b, e, DIGEST_SIZE);
+        out[i].offset = get_le64(e + 32);
+        out[i].length = get_le64(e + 40);
+        out[i].kind = (BundleKind)get_le32(e + 48);
+    }
+    free(raw);
+    close(fd);
+    if (rc != 0) {
+        free(out);
+        return -1;
+    }
+    *entries = out;
+    *n = (size_t)count;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "digest.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Cache bundles: task records and every object they reach in one file, so
+ * a cache moves between machines (a CI cache, say) as one sequential read
+ * instead of a copy of two directory trees of small files.
+ *
+ * Format (little-endian):
+ *   header  "RVMBNDL1" | uint32 version | uint32 reserved | char digest[16]
+ *           (the digest algorithm's name, NUL padded)
+ *   entries uint8 digest[32] | uint64 length | uint32 kind | uint32 reserved,
+ *           then length bytes; an entry of kind BUNDLE_END closes the list
+ *   index   count x { uint8 digest[32]; uint64 offset; uint64 length;
+ *                     uint32 kind; uint32 reserved }   (offset of the bytes)
+ *   trailer uint64 index offset | uint64 count | "RVMBIDX1"
+ * An object entry is the object's stored form (a chunk list stays a chunk
+ * list) and comes after everything it names; records come after all
+ * objects. A reader can stream the entries front to back, or seek to the
+ * trailer and find any entry through the index.
+ */
+
+typedef enum { BUNDLE_END = 0, BUNDLE_OBJECT = 1, BUNDLE_RECORD = 2 } BundleKind;
+
+typedef struct {
+    Digest d; // the object, or the task hash of a record
+    uint64_t offset;
+    uint64_t length;
+    BundleKind kind;
+} BundleEntry;
+
+typedef struct {
+    uint64_t records;
+    uint64_t objects;
+    uint64_t bytes;           // object bytes written or stored
+    uint64_t objects_present; // import: already in the store, skipped
+    uint64_t missing;         // export: named by a record but not in the store
+} BundleStats;
+
+// Write the records of tasks[0..n) (task hashes; ones without a record
+// are passed over) and every object they reach to path, replacing it. A
+// record that names a missing object is left out and counted in
+// stats->missing. Returns 0, or -1 if the bundle could not be written.
+int bundle_export(const char *path, const Digest tasks[], size_t n, BundleStats *stats);
+
+// Read a bundle front to back ("-" is stdin) into the store and the record
+// cache. Objects already present are skipped unread; the others are
+// checked against their digest and written in parallel on the hash pool,
+// each batch before the records that need it. Returns 0, or -1 if the
+// bundle is damaged, for another digest algorithm, or an object does not
+// verify.
+int bundle_import(const char *path, BundleStats *stats);
+
+// The index of a bundle, read from its end (caller frees *entries)
+int bundle_read_index(const char *path, BundleEntry **entries, size_t *n);
+
+#endif // BUNDLE_H
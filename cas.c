@@ -1,7 +1,16 @@
 // cas.c
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include "cas.h"
 #include "util.h"
+#include "stat_index.h"
+#include "pack.h"
+#include "chunker.h"
+#include "compression.h"
+#include "hash_pool.h"
+#include "hash_io.h"
+#include "io_batch.h"
+#include "bloom.h"
+#include "durability.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,239 +19,2431 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+
+/* global root */
+static char objects_root[1024] = {0};
+static char cache_root[1024] = {0};
+static char tmp_root[1100] = {0};
+static char pack_root[1100] = {0};
+static char quarantine_root[1100] = {0};
+static int cache_fd = -1; // cache_root, for publishing records into
+// objects/<xx> directories, opened once; object I/O is relative to these
+static int shard_fds[256];
+static int shards_open = 0;
+static CasStats cas_stats; // updated with relaxed atomics
+
+const char *cas_get_objects_root() { return objects_root; }
+const char *cas_get_quarantine_root() { return quarantine_root; }
+
+static void close_shards(void) {
+    for (int i = 0; shards_open && i < 256; ++i) close(shard_fds[i]);
+    shards_open = 0;
+}
+
+// Create all 256 shard directories up front and keep them open, so object
+// lookups never mkdir and resolve only the final path component.
+static int open_shards(void) {
+    close_shards();
+    int root = open(objects_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0) return -1;
+    int rc = 0;
+    int b;
+    for (b = 0; b < 256; ++b) {
+        char name[3];
+        snprintf(name, sizeof(name), "%02x", b);
+        shard_fds[b] = openat(root, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (shard_fds[b] < 0 && errno == ENOENT) {
+            if (mkdirat(root, name, 0755) != 0 && errno != EEXIST) break;
+            shard_fds[b] = openat(root, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (shard_fds[b] < 0) break;
+    }
+    if (b < 256) {
+        while (b-- > 0) close(shard_fds[b]);
+        rc = -1;
+    } else {
+        shards_open = 1;
+    }
+    close(root);
+    return rc;
+}
+const char *cas_get_cache_root() { return cache_root; }
+
+// objects/ALGORITHM names the digest its objects are filed under. Only the
+// SHA-256 store can predate the marker, so a missing one is simply written.
+static int check_algorithm_marker(void) {
+    char path[1100], have[32] = { 0 };
+    const char *want = digest_algorithm_name(digest_algorithm());
+    snprintf(path, sizeof(path), "%s/ALGORITHM", objects_root);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        int ok = fgets(have, sizeof(have), f) != NULL;
+        fclose(f);
+        have[strcspn(have, "\n")] = '\0';
+        if (ok && strcmp(have, want) == 0) return 0;
+        fprintf(stderr, "Error: %s holds %s objects, not %s\n", objects_root, ok ? have : "unknown", want);
+        return -1;
+    }
+    f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "%s\n", want);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+int cas_init(const char *base_dir) {
+    if (!base_dir) return -1;
+    // SHA-256 keeps the original layout. Another algorithm gets objects,
+    // filter, records and stat index of its own under .reprovm/cas/<name>,
+    // so stores of both can live in the same tree.
+    DigestAlgorithm algo = digest_algorithm();
+    char store_root[1000], index_path[1100];
+    snprintf(store_root, sizeof(store_root), "%s/.reprovm/cas", base_dir);
+    snprintf(cache_root, sizeof(cache_root), "%s/.reprovm/cache", base_dir);
+    snprintf(index_path, sizeof(index_path), "%s/.reprovm/index", base_dir);
+    if (algo != DIGEST_SHA256) {
+        snprintf(store_root, sizeof(store_root), "%s/.reprovm/cas/%s", base_dir, digest_algorithm_name(algo));
+        snprintf(cache_root, sizeof(cache_root), "%s/cache", store_root);
+        snprintf(index_path, sizeof(index_path), "%s/index", store_root);
+    }
+    snprintf(objects_root, sizeof(objects_root), "%s/objects", store_root);
+    if (ensure_dir_recursive(objects_root) != 0) return -1;
+    if (ensure_dir_recursive(cache_root) != 0) return -1;
+    if (cache_fd >= 0) close(cache_fd);
+    if ((cache_fd = open(cache_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return -1;
+    if (check_algorithm_marker() != 0) return -1;
+    if (open_shards() != 0) return -1;
+    snprintf(tmp_root, sizeof(tmp_root), "%s/tmp", objects_root);
+    if (ensure_dir_recursive(tmp_root) != 0) return -1;
+    snprintf(quarantine_root, sizeof(quarantine_root), "%s/quarantine", objects_root);
+    snprintf(pack_root, sizeof(pack_root), "%s/pack", objects_root);
+    if (ensure_dir_recursive(pack_root) != 0) return -1;
+    pack_open_dir(pack_root);
+    // The object filter is built on first use, and rebuilt once it holds
+    // twice the objects it was sized for (like a hash table growing)
+    char filter_path[1100];
+    snprintf(filter_path, sizeof(filter_path), "%s/bloom", store_root);
+    bloom_open(filter_path);
+    if (bloom_needs_rebuild()) cas_rebuild_filter(NULL);
+    stat_index_open(index_path);
+    return 0;
+}
+
+void cas_shutdown(void) {
+    durability_commit();
+    hash_pool_shutdown();
+    io_batch_shutdown();
+    stat_index_close();
+    bloom_close();
+    pack_close_all();
+    close_shards();
+    if (cache_fd >= 0) close(cache_fd);
+    cache_fd = -1;
+}
+
+// Loose object location: shard_fds[d->b[0]] / name
+typedef struct {
+    int dirfd;
+    char name[DIGEST_HEX_SIZE - 2];
+} ObjectLoc;
+
+static void object_loc(const Digest *d, ObjectLoc *loc) {
+    char hash[DIGEST_HEX_SIZE];
+    digest_to_hex(d, hash);
+    loc->dirfd = shard_fds[d->b[0]];
+    memcpy(loc->name, hash + 2, sizeof(loc->name));
+}
+
+static int loose_exists(const ObjectLoc *loc) {
+    struct stat st;
+    return fstatat(loc->dirfd, loc->name, &st, 0) == 0;
+}
+
+// Written by this process but still waiting for a batched commit to link it
+static int pending_exists(const ObjectLoc *loc) {
+    int fd = durable_pending_open(loc->dirfd, loc->name);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+
+static int make_object_path(const Digest *d, char *out, size_t sz) {
+    char hash[DIGEST_HEX_SIZE];
+    digest_to_hex(d, hash);
+    // use two-level: first two chars as dir, remainder as file name
+    snprintf(out, sz, "%s/%c%c/%s", objects_root, hash[0], hash[1], hash + 2);
+    return 0;
+}
+
+int cas_get_object_path(const Digest *d, char *out_path, size_t sz) {
+    return make_object_path(d, out_path, sz);
+}
+
+// Look d up in the packs, rescanning for packs written since we last looked.
+// Callers use this only after the loose object turned out to be missing.
+static int find_packed_fresh(const Digest *d, PackRef *ref) {
+    return pack_reload() && pack_find(d->b, ref);
+}
+
+// Filter verdict on d, counted; BLOOM_ABSENT needs no filesystem access
+static int filter_check(const Digest *d) {
+    int f = bloom_check(d->b);
+    if (f == BLOOM_ABSENT) __atomic_fetch_add(&cas_stats.filter_negatives, 1, __ATOMIC_RELAXED);
+    return f;
+}
+
+static void count_false_positive(int filter, int found) {
+    if (filter == BLOOM_MAYBE && !found) __atomic_fetch_add(&cas_stats.filter_false_positives, 1, __ATOMIC_RELAXED);
+}
+
+int cas_blob_exists(const Digest *d) {
+    int f = filter_check(d);
+    if (f == BLOOM_ABSENT) return 0;
+    ObjectLoc loc;
+    object_loc(d, &loc);
+    // packed: one stat of the pack dir, since another process's gc may have
+    // deleted the pack; loose: one fstatat
+    if (pack_find(d->b, NULL)) {
+        pack_reload();
+        if (pack_find(d->b, NULL)) return 1;
+    }
+    if (loose_exists(&loc) || pending_exists(&loc)) return 1;
+    int found = find_packed_fresh(d, NULL);
+    count_false_positive(f, found);
+    return found;
+}
+
+// The filter and packs answer from memory; the loose probes go out as one batch
+int cas_blobs_exist_batch(const Digest d[], int n, int out[]) {
+    if (n <= 0) return 0;
+    ObjectLoc *locs = malloc(sizeof(*locs) * n);
+    IoOp *ops = malloc(sizeof(*ops) * n);
+    struct stat *sts = malloc(sizeof(*sts) * n);
+    int *idx = malloc(sizeof(*idx) * n);
+    int *verdict = malloc(sizeof(*verdict) * n);
+    if (!locs || !ops || !sts || !idx || !verdict) {
+        free(locs);
+        free(ops);
+        free(sts);
+        free(idx);
+        free(verdict);
+        return -1;
+    }
+    int m = 0;
+    pack_reload(); // drop packs another process deleted before trusting them
+    for (int i = 0; i < n; ++i) {
+        int f = filter_check(&d[i]);
+        out[i] = f != BLOOM_ABSENT && pack_find(d[i].b, NULL);
+        if (f == BLOOM_ABSENT || out[i]) continue;
+        object_loc(&d[i], &locs[m]);
+        io_op_stat(&ops[m], locs[m].dirfd, locs[m].name, 0, &sts[m]);
+        verdict[m] = f;
+        idx[m++] = i;
+    }
+    io_batch_run(ops, m);
+    for (int k = 0; k < m; ++k) {
+        out[idx[k]] = ops[k].res == 0 || pending_exists(&locs[k]) || find_packed_fresh(&d[idx[k]], NULL);
+        count_false_positive(verdict[k], out[idx[k]]);
+    }
+    free(locs);
+    free(ops);
+    free(sts);
+    free(idx);
+    free(verdict);
+    return 0;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
 
 /*
- * Minimal SHA-256 implementation (public domain / simplified)
- * Based on the pseudocode from FIPS PUB 180-4.
- * SHA256_CTX is now defined in cas.h
+ * Stored object format. Most objects are stored as their raw content, so
+ * they can be reflinked or hardlinked straight out of the store. Objects
+ * that need another representation start with a 16-byte frame header:
+ *   "\x89RVMOBJ\n" | uint8 type | 7 reserved bytes
+ * FRAME_RAW:    the content follows (raw content that itself begins with
+ *               the magic is stored this way, so detection is unambiguous)
+ * FRAME_CHUNKS: uint64 total_size | uint32 count | count x { digest[32]; uint32 length }
+ *               the content is the concatenation of the listed chunk objects
+ * FRAME_COMPRESSED: header byte 9 is the codec (CompressionAlgorithm), then
+ *               uint64 original_size | block stream (see compression.h)
+ * FRAME_TREE:   uint32 count | count x { uint32 mode; digest[32]; uint16 name_len; name }
+ *               one directory, entries in strictly increasing name order
+ * Integers are little-endian: objects may be shared with remote caches.
+ * An object's name is always the digest of its content, not of its frame.
+ * A tree is the exception that proves the rule: it has no other content, so
+ * its name is the digest of all its stored bytes, header included.
  */
+#define FRAME_MAGIC "\x89RVMOBJ\n"
+#define FRAME_MAGIC_LEN 8
+#define FRAME_HEADER_SIZE 16
+#define FRAME_RAW 0
+#define FRAME_CHUNKS 1
+#define FRAME_COMPRESSED 2
+#define FRAME_TREE 3
+#define COMPRESSED_PREFIX (FRAME_HEADER_SIZE + 8)
+#define CHUNKS_FIXED_SIZE 12
+#define CHUNK_ENTRY_SIZE 36
+#define TREE_ENTRY_FIXED 38
 
-const uint32_t k[64] = {
-    0x428a2f98ul,0x71374491ul,0xb5c0fbcful,0xe9b5dba5ul,0x3956c25bul,0x59f111f1ul,0x923f82a4ul,0xab1c5ed5ul,
-    0xd807aa98ul,0x12835b01ul,0x243185beul,0x550c7dc3ul,0x72be5d74ul,0x80deb1feul,0x9bdc06a7ul,0xc19bf174ul,
-    0xe49b69c1ul,0xefbe4786ul,0x0fc19dc6ul,0x240ca1ccul,0x2de92c6ful,0x4a7484aaul,0x5cb0a9dcul,0x76f988daul,
-    0x983e5152ul,0xa831c66dul,0xb00327c8ul,0xbf597fc7ul,0xc6e00bf3ul,0xd5a79147ul,0x06ca6351ul,0x14292967ul,
-    0x27b70a85ul,0x2e1b2138ul,0x4d2c6dfcul,0x53380d13ul,0x650a7354ul,0x766a0abbul,0x81c2c92eul,0x92722c85ul,
-    0xa2bfe8a1ul,0xa81a664bul,0xc24b8b70ul,0xc76c51a3ul,0xd192e819ul,0xd6990624ul,0xf40e3585ul,0x106aa070ul,
-    0x19a4c116ul,0x1e376c08ul,0x2748774cul,0x34b0bcb5ul,0x391c0cb3ul,0x4ed8aa4aul,0x5b9cca4ful,0x682e6ff3ul,
-    0x748f82eeul,0x78a5636ful,0x84c87814ul,0x8cc70208ul,0x90befffaul,0xa4506cebul,0xbef9a3f7ul,0xc67178f2ul
-};
+static uint64_t chunk_threshold = 0;
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+static void frame_header(unsigned char hdr[FRAME_HEADER_SIZE], int type) {
+    memset(hdr, 0, FRAME_HEADER_SIZE);
+    memcpy(hdr, FRAME_MAGIC, FRAME_MAGIC_LEN);
+    hdr[FRAME_MAGIC_LEN] = (unsigned char)type;
+}
+
+static int starts_with_magic(const unsigned char *data, size_t len) {
+    return len >= FRAME_MAGIC_LEN && memcmp(data, FRAME_MAGIC, FRAME_MAGIC_LEN) == 0;
+}
+
+// Validate a FRAME_CHUNKS object held in memory
+static int parse_chunk_list(const unsigned char *obj, size_t len, uint64_t *total, uint32_t *count) {
+    if (len < FRAME_HEADER_SIZE + CHUNKS_FIXED_SIZE || !starts_with_magic(obj, len) ||
+        obj[FRAME_MAGIC_LEN] != FRAME_CHUNKS)
+        return -1;
+    *total = get_le64(obj + FRAME_HEADER_SIZE);
+    *count = get_le32(obj + FRAME_HEADER_SIZE + 8);
+    if (len != FRAME_HEADER_SIZE + CHUNKS_FIXED_SIZE + (size_t)*count * CHUNK_ENTRY_SIZE) return -1;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < *count; ++i)
+        sum += get_le32(obj + FRAME_HEADER_SIZE + CHUNKS_FIXED_SIZE + (size_t)i * CHUNK_ENTRY_SIZE + 32);
+    return sum == *total ? 0 : -1;
+}
+
+static void chunk_entry(const unsigned char *obj, uint32_t i, Digest *d, uint32_t *len) {
+    const unsigned char *e = obj + FRAME_HEADER_SIZE + CHUNKS_FIXED_SIZE + (size_t)i * CHUNK_ENTRY_SIZE;
+    memcpy(d->b, e, DIGEST_SIZE);
+    *len = get_le32(e + 32);
+}
+
+// A tree entry name is one path component
+static int tree_name_ok(const unsigned char *name, size_t len) {
+    if (len == 0 || (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.')) return 0;
+    return memchr(name, '/', len) == NULL && memchr(name, '\0', len) == NULL;
+}
+
+static int tree_mode_ok(uint32_t mode) {
+    return mode == CAS_TREE_FILE || mode == CAS_TREE_EXEC || mode == CAS_TREE_DIR || mode == CAS_TREE_SYMLINK;
+}
+
+// Decode the entry at *off of a tree already checked by parse_tree; name
+// points into obj and is not terminated
+static void tree_entry(const unsigned char *obj, size_t *off, uint32_t *mode, Digest *d,
+                       const unsigned char **name, size_t *name_len) {
+    const unsigned char *e = obj + *off;
+    *mode = get_le32(e);
+    memcpy(d->b, e + 4, DIGEST_SIZE);
+    *name_len = (size_t)e[36] | (size_t)e[37] << 8;
+    *name = e + TREE_ENTRY_FIXED;
+    *off += TREE_ENTRY_FIXED + *name_len;
+}
+
+// Validate a FRAME_TREE object held in memory
+static int parse_tree(const unsigned char *obj, size_t len, uint32_t *count) {
+    if (len < FRAME_HEADER_SIZE + 4 || !starts_with_magic(obj, len) || obj[FRAME_MAGIC_LEN] != FRAME_TREE)
+        return -1;
+    *count = get_le32(obj + FRAME_HEADER_SIZE);
+    size_t off = FRAME_HEADER_SIZE + 4, prev_len = 0;
+    const unsigned char *prev = NULL;
+    for (uint32_t i = 0; i < *count; ++i) {
+        if (len - off < TREE_ENTRY_FIXED) return -1;
+        size_t name_len = (size_t)obj[off + 36] | (size_t)obj[off + 37] << 8;
+        if (len - off - TREE_ENTRY_FIXED < name_len) return -1;
+        uint32_t mode;
+        Digest d;
+        const unsigned char *name;
+        tree_entry(obj, &off, &mode, &d, &name, &name_len);
+        if (!tree_mode_ok(mode) || !tree_name_ok(name, name_len)) return -1;
+        if (prev) {
+            size_t m = prev_len < name_len ? prev_len : name_len;
+            int c = memcmp(prev, name, m);
+            if (c > 0 || (c == 0 && prev_len >= name_len)) return -1;
+        }
+        prev = name;
+        prev_len = name_len;
+    }
+    return off == len ? 0 : -1;
+}
+
+// Objects are compressed only when LZ4 is enabled (g_compression_config),
+// they are not tiny, and a sample does not look incompressible.
+#define COMPRESS_MIN_SIZE 512
+#define COMPRESS_SAMPLE (64 * 1024)
+#define COMPRESS_SKIP_RATIO 0.95
+
+// Content that begins with the frame magic stays FRAME_RAW, where a tree
+// stored as a file is still found by cas_tree_entries.
+static int should_compress(const unsigned char *data, size_t len) {
+    if (!g_compression_config.enabled || g_compression_config.algorithm != COMPRESS_LZ4 ||
+        len < COMPRESS_MIN_SIZE || starts_with_magic(data, len))
+        return 0;
+    return compression_estimate_ratio(data, len < COMPRESS_SAMPLE ? len : COMPRESS_SAMPLE) < COMPRESS_SKIP_RATIO;
+}
+
+static void compressed_header(unsigned char hdr[COMPRESSED_PREFIX], uint64_t size) {
+    frame_header(hdr, FRAME_COMPRESSED);
+    hdr[FRAME_MAGIC_LEN + 1] = COMPRESS_LZ4;
+    put_le64(hdr + FRAME_HEADER_SIZE, size);
+}
+
+static void count_compressed(uint64_t in, uint64_t out) {
+    __atomic_fetch_add(&cas_stats.compressed_objects, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cas_stats.compress_in_bytes, in, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cas_stats.compress_out_bytes, out, __ATOMIC_RELAXED);
+}
+
+// Unnamed new object inside the object store (same filesystem, so it can be
+// linked into its shard). Objects are read-only so restored outputs can
+// hardlink to them.
+static int open_temp_object(DurableFile *f) {
+    return durable_create(tmp_root, f);
+}
+
+// Link a finished temp object into place under its digest, as durably as the
+// durability mode asks, or drop it if another writer got there first.
+// DURABLE_ORDERED keeps an object that refers to others (a chunk list) from
+// becoming durable before them.
+static int publish_temp_object(DurableFile *f, const Digest *d, int flags, int *created) {
+    if (cas_blob_exists(d)) {
+        durable_abort(f);
+        return 0;
+    }
+    ObjectLoc loc;
+    object_loc(d, &loc);
+    if (durable_publish(f, loc.dirfd, loc.name, flags) != 0) return -1;
+    bloom_add(d->b);
+    if (created) *created = 1;
+    return 0;
+}
+
+// Write exactly these stored bytes (optional prefix + data) as object d
+static int write_object(const Digest *d, const unsigned char *prefix, size_t plen,
+                        const unsigned char *data, size_t len, int flags, int *created) {
+    if (cas_blob_exists(d)) return 0;
+    DurableFile f;
+    if (open_temp_object(&f) != 0) return -1;
+    if ((plen && write_all(f.fd, prefix, plen) != 0) || write_all(f.fd, data, len) != 0) {
+        durable_abort(&f);
+        return -1;
+    }
+    return publish_temp_object(&f, d, flags, created);
+}
+
+// Compressed stored form of data in a fresh buffer (*out_len bytes), or
+// NULL if compressing saves too little
+static unsigned char *compress_object(const unsigned char *data, size_t len, size_t *out_len) {
+    size_t blocks = (len + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE;
+    unsigned char *buf = malloc(COMPRESSED_PREFIX + len + blocks * COMPRESSION_BLOCK_HEADER);
+    if (!buf) return NULL;
+    size_t out = COMPRESSED_PREFIX;
+    for (size_t off = 0; off < len; off += COMPRESSION_BLOCK_SIZE) {
+        size_t n = len - off < COMPRESSION_BLOCK_SIZE ? len - off : COMPRESSION_BLOCK_SIZE;
+        out += compression_encode_block(data + off, n, buf + out);
+    }
+    if (out >= len - len / 16) {
+        free(buf);
+        return NULL;
+    }
+    compressed_header(buf, len);
+    *out_len = out;
+    return buf;
+}
+
+// Store data compressed. Returns 1 without writing if that saves too little.
+static int store_compressed(const Digest *d, const unsigned char *data, size_t len, int *created) {
+    size_t out;
+    unsigned char *buf = compress_object(data, len, &out);
+    if (!buf) return 1;
+    int made = 0;
+    int rc = write_object(d, NULL, 0, buf, out, 0, &made);
+    if (made) {
+        count_compressed(len, out);
+        if (created) *created = 1;
+    }
+    free(buf);
+    return rc;
+}
+
+// Write in-memory content whose digest is already known
+static int store_memory_as(const Digest *d, const unsigned char *data, size_t len, int *created) {
+    if (cas_blob_exists(d)) return 0;
+    if (should_compress(data, len)) {
+        int rc = store_compressed(d, data, len, created);
+        if (rc != 1) return rc;
+    }
+    if (!starts_with_magic(data, len)) return write_object(d, NULL, 0, data, len, 0, created);
+    unsigned char hdr[FRAME_HEADER_SIZE];
+    frame_header(hdr, FRAME_RAW);
+    return write_object(d, hdr, sizeof(hdr), data, len, 0, created);
+}
+
+// One object of a store_many batch on its way through the phases
+typedef struct {
+    int slot;               // index in the caller's arrays
+    ObjectLoc loc;
+    unsigned char hdr[FRAME_HEADER_SIZE];
+    size_t hdr_len;
+    const unsigned char *body;
+    size_t body_len;
+    unsigned char *packed;  // compressed form, owned
+    char tmp[1200];
+    int fd;
+    int ok;
+} PendingObject;
 
-static uint32_t rotr(uint32_t x, uint32_t n) {
-    return (x >> n) | (x << (32 - n));
-}
-
-void sha256_transform(SHA256_CTX *ctx, const uint8_t data[]) {
-    uint32_t m[64];
-    for (int i = 0; i < 16; ++i)
-        m[i] = (data[i*4] << 24) | (data[i*4+1] << 16) | (data[i*4+2] << 8) | (data[i*4+3]);
-    for (int i = 16; i < 64; ++i) {
-        uint32_t s0 = rotr(m[i-15], 7) ^ rotr(m[i-15], 18) ^ (m[i-15] >> 3);
-        uint32_t s1 = rotr(m[i-2], 17) ^ rotr(m[i-2], 19) ^ (m[i-2] >> 10);
-        m[i] = m[i-16] + s0 + m[i-7] + s1;
-    }
-    uint32_t a = ctx->state[0];
-    uint32_t b = ctx->state[1];
-    uint32_t c = ctx->state[2];
-    uint32_t d = ctx->state[3];
-    uint32_t e = ctx->state[4];
-    uint32_t f = ctx->state[5];
-    uint32_t g = ctx->state[6];
-    uint32_t h = ctx->state[7];
-    for (int i = 0; i < 64; ++i) {
-        uint32_t S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
-        uint32_t ch = (e & f) ^ ((~e) & g);
-        uint32_t temp1 = h + S1 + ch + k[i] + m[i];
-        uint32_t S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
-        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
-        uint32_t temp2 = S0 + maj;
-
-        h = g;
-        g = f;
-        f = e;
-        e = d + temp1;
-        d = c;
-        c = b;
-        b = a;
-        a = temp1 + temp2;
-    }
-    ctx->state[0] += a;
-    ctx->state[1] += b;
-    ctx->state[2] += c;
-    ctx->state[3] += d;
-    ctx->state[4] += e;
-    ctx->state[5] += f;
-    ctx->state[6] += g;
-    ctx->state[7] += h;
-}
-
-void sha256_init(SHA256_CTX *ctx) {
-    ctx->datalen = 0;
-    ctx->bitlen = 0;
-    ctx->state[0] = 0x6a09e667ul;
-    ctx->state[1] = 0xbb67ae85ul;
-    ctx->state[2] = 0x3c6ef372ul;
-    ctx->state[3] = 0xa54ff53aul;
-    ctx->state[4] = 0x510e527ful;
-    ctx->state[5] = 0x9b05688cul;
-    ctx->state[6] = 0x1f83d9abul;
-    ctx->state[7] = 0x5be0cd19ul;
-}
-
-void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len) {
-    for (size_t i = 0; i < len; ++i) {
-        ctx->data[ctx->datalen++] = data[i];
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
-        }
-    }
-}
-
-void sha256_final(SHA256_CTX *ctx, uint8_t hash[]) {
-    size_t i = ctx->datalen;
-
-    // Pad whatever data is left in the buffer.
-    if (ctx->datalen < 56) {
-        ctx->data[i++] = 0x80;
-        while (i < 56) ctx->data[i++] = 0x00;
+static unsigned temp_seq = 0;
+
+// Write the objects that are missing, with each step (open temp file,
+// write, close, rename into its shard) submitted for all of them at once.
+// Temp names are unique per process, so O_EXCL replaces mkstemp. Objects
+// that trip over anything are redone through store_memory_as.
+static void store_many_batched(const Digest d[], const unsigned char *const data[], const size_t lens[],
+                               int n, int failed[]) {
+    int *present = malloc(sizeof(int) * n);
+    PendingObject *p = calloc(n, sizeof(PendingObject));
+    IoOp *ops = malloc(sizeof(IoOp) * 2 * n);
+    int *owner = malloc(sizeof(int) * 2 * n);
+    if (!present || !p || !ops || !owner || cas_blobs_exist_batch(d, n, present) != 0) {
+        for (int i = 0; i < n; ++i) failed[i] = store_memory_as(&d[i], data[i], lens[i], NULL) != 0;
+        free(present);
+        free(p);
+        free(ops);
+        free(owner);
+        return;
+    }
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        failed[i] = 0;
+        if (present[i]) continue;
+        PendingObject *o = &p[m++];
+        o->slot = i;
+        object_loc(&d[i], &o->loc);
+        o->body = data[i];
+        o->body_len = lens[i];
+        if (should_compress(data[i], lens[i]) && (o->packed = compress_object(data[i], lens[i], &o->body_len))) {
+            o->body = o->packed;
+        } else if (starts_with_magic(data[i], lens[i])) {
+            frame_header(o->hdr, FRAME_RAW);
+            o->hdr_len = FRAME_HEADER_SIZE;
+        }
+        snprintf(o->tmp, sizeof(o->tmp), "%s/obj-%ld-%u", tmp_root, (long)getpid(),
+                 __atomic_fetch_add(&temp_seq, 1, __ATOMIC_RELAXED));
+        io_op_open(&ops[m - 1], AT_FDCWD, o->tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+    }
+    io_batch_run(ops, m);
+    int c = 0;
+    for (int k = 0; k < m; ++k) {
+        p[k].fd = ops[k].res;
+        p[k].ok = p[k].fd >= 0;
+    }
+    for (int k = 0; k < m; ++k) {
+        if (!p[k].ok) continue;
+        if (p[k].hdr_len) {
+            owner[c] = k;
+            io_op_write(&ops[c++], p[k].fd, p[k].hdr, p[k].hdr_len, 0);
+        }
+        owner[c] = k;
+        io_op_write(&ops[c++], p[k].fd, p[k].body, p[k].body_len, p[k].hdr_len);
+    }
+    io_batch_run(ops, c);
+    for (int j = 0; j < c; ++j)
+        if (ops[j].res != (int)ops[j].len) p[owner[j]].ok = 0;
+    c = 0;
+    for (int k = 0; k < m; ++k) {
+        if (p[k].fd < 0) continue;
+        owner[c] = k;
+        io_op_close(&ops[c++], p[k].fd);
+    }
+    io_batch_run(ops, c);
+    for (int j = 0; j < c; ++j)
+        if (ops[j].res != 0) p[owner[j]].ok = 0;
+    c = 0;
+    for (int k = 0; k < m; ++k) {
+        if (!p[k].ok) continue;
+        owner[c] = k;
+        io_op_rename(&ops[c++], AT_FDCWD, p[k].tmp, p[k].loc.dirfd, p[k].loc.name);
+    }
+    io_batch_run(ops, c);
+    for (int j = 0; j < c; ++j)
+        if (ops[j].res != 0) p[owner[j]].ok = 0;
+    for (int k = 0; k < m; ++k) {
+        PendingObject *o = &p[k];
+        if (o->ok) bloom_add(d[o->slot].b);
+        if (o->ok && o->packed) count_compressed(lens[o->slot], o->body_len);
+        if (!o->ok) {
+            if (o->fd >= 0) unlink(o->tmp);
+            failed[o->slot] = store_memory_as(&d[o->slot], data[o->slot], lens[o->slot], NULL) != 0;
+        }
+        free(o->packed);
+    }
+    free(present);
+    free(p);
+    free(ops);
+    free(owner);
+}
+
+// Store many in-memory objects whose digests are known; failed[i] is set
+// for those that could not be written. The io_uring batch renames named
+// temps into place, so it serves only stores that need no durability.
+static void store_many(const Digest d[], const unsigned char *const data[], const size_t lens[],
+                       int n, int failed[]) {
+    if (io_batch_backend() == IO_BATCH_URING && durability_mode() == DURABILITY_NONE) {
+        store_many_batched(d, data, lens, n, failed);
+        return;
+    }
+    for (int i = 0; i < n; ++i) failed[i] = store_memory_as(&d[i], data[i], lens[i], NULL) != 0;
+}
+
+int cas_store_blob_from_memory(const unsigned char *data, size_t len, Digest *out) {
+    digest_buffer(data, len, out);
+    return store_memory_as(out, data, len, NULL);
+}
+
+// Files up to this size are hashed in multi-buffer lanes
+#define BATCH_SMALL_MAX (64 * 1024)
+// Bytes of small-file content held in memory at once
+#define BATCH_ARENA_SIZE (4 * 1024 * 1024)
+// Streaming chunk for hashing and ingestion
+#define STREAM_CHUNK (256 * 1024)
+#if STREAM_CHUNK > COMPRESSION_BLOCK_SIZE || HASH_IO_PIECE > STREAM_CHUNK
+#error "streamed pieces are compressed one block each"
+#endif
+
+static int read_fd_fully(int fd, unsigned char *buf, size_t cap, size_t *out_len) {
+    size_t got = 0;
+    while (got < cap) {
+        ssize_t r = read(fd, buf + got, cap - got);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) break;
+        got += (size_t)r;
+    }
+    *out_len = got;
+    return 0;
+}
+
+// State of one stream_fd pass, fed piece by piece by hash_io_scan
+typedef struct {
+    DigestCtx ctx;
+    int hash;             // 0 when the digest is already known
+    int out;              // temp object being written, or -1 to only hash
+    int first;
+    unsigned char *cbuf;  // set while compressing, one block per piece
+    uint64_t total;
+    uint64_t written;
+} StreamState;
+
+static int stream_piece(const unsigned char *data, size_t len, void *arg) {
+    StreamState *st = arg;
+    if (st->hash) digest_update(&st->ctx, data, len);
+    st->total += len;
+    if (st->out < 0) return 0;
+    if (st->first) {
+        // the decision is made on the first piece; the size is filled in at the end
+        unsigned char hdr[COMPRESSED_PREFIX];
+        size_t hdr_len = 0;
+        st->first = 0;
+        if (should_compress(data, len) &&
+            (st->cbuf = malloc(COMPRESSION_BLOCK_HEADER + STREAM_CHUNK)) != NULL) {
+            compressed_header(hdr, 0);
+            hdr_len = COMPRESSED_PREFIX;
+        } else if (starts_with_magic(data, len)) {
+            frame_header(hdr, FRAME_RAW);
+            hdr_len = FRAME_HEADER_SIZE;
+        }
+        if (hdr_len && write_all(st->out, hdr, hdr_len) != 0) return -1;
+    }
+    if (!st->cbuf) return write_all(st->out, data, len);
+    size_t n = compression_encode_block(data, len, st->cbuf);
+    st->written += n;
+    return write_all(st->out, st->cbuf, n);
+}
+
+// Hash fd to EOF through hash_io, which picks pread, read or mmap by size.
+// If tmp is given, the bytes also go to a new temp object in the same pass,
+// so ingesting a file reads it exactly once. With hash unset, *digest is
+// already known and the pass only copies.
+static int stream_fd(int fd, Digest *digest, int hash, DurableFile *tmp) {
+    StreamState st;
+    st.hash = hash;
+    if (hash) digest_init(&st.ctx);
+    st.out = -1;
+    st.first = 1;
+    st.cbuf = NULL;
+    st.total = 0;
+    st.written = COMPRESSED_PREFIX;
+    if (tmp) {
+        if (open_temp_object(tmp) != 0) return -1;
+        st.out = tmp->fd;
+    }
+    int rc = hash_io_scan(fd, HASH_IO_AUTO, stream_piece, &st);
+    if (rc == 0 && st.cbuf) {
+        unsigned char hdr[COMPRESSED_PREFIX];
+        compressed_header(hdr, st.total);
+        if (pwrite(st.out, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) rc = -1;
+        else count_compressed(st.total, st.written);
+    }
+    free(st.cbuf);
+    if (hash) digest_final(&st.ctx, digest);
+    if (tmp && rc != 0) durable_abort(tmp);
+    return rc;
+}
+
+// Split fd into content-defined chunks, store each as its own object and
+// store the file itself as a chunk list. Still a single read of the file.
+static int ingest_chunked(int fd, Digest *digest) {
+    size_t cap = CHUNK_MAX_SIZE + 4 * STREAM_CHUNK;
+    unsigned char *buf = malloc(cap);
+    size_t man_cap = FRAME_HEADER_SIZE + CHUNKS_FIXED_SIZE + 64 * CHUNK_ENTRY_SIZE;
+    unsigned char *man = malloc(man_cap);
+    if (!buf || !man) {
+        free(buf);
+        free(man);
+        return -1;
+    }
+    DigestCtx ctx;
+    digest_init(&ctx);
+    size_t start = 0, end = 0, man_len = FRAME_HEADER_SIZE + CHUNKS_FIXED_SIZE;
+    uint64_t total = 0, stored = 0;
+    uint32_t count = 0;
+    int eof = 0, rc = 0;
+    for (;;) {
+        if (!eof && end - start < CHUNK_MAX_SIZE) {
+            memmove(buf, buf + start, end - start);
+            end -= start;
+            start = 0;
+            while (!eof && end < cap) {
+                ssize_t r = read(fd, buf + end, cap - end);
+                if (r < 0 && errno == EINTR) continue;
+                if (r < 0) {
+                    rc = -1;
+                    break;
+                }
+                if (r == 0) eof = 1;
+                end += (size_t)r;
+            }
+            if (rc != 0) break;
+        }
+        if (start == end) break;
+        size_t cut = chunker_next_cut(buf + start, end - start);
+        Digest cd;
+        int created = 0;
+        digest_buffer(buf + start, cut, &cd);
+        digest_update(&ctx, buf + start, cut);
+        if (store_memory_as(&cd, buf + start, cut, &created) != 0) {
+            rc = -1;
+            break;
+        }
+        if (created) stored += cut;
+        if (man_len + CHUNK_ENTRY_SIZE > man_cap) {
+            unsigned char *grown = realloc(man, man_cap * 2);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            man = grown;
+            man_cap *= 2;
+        }
+        memcpy(man + man_len, cd.b, DIGEST_SIZE);
+        put_le32(man + man_len + 32, (uint32_t)cut);
+        man_len += CHUNK_ENTRY_SIZE;
+        count++;
+        total += cut;
+        start += cut;
+    }
+    digest_final(&ctx, digest);
+    if (rc == 0) {
+        frame_header(man, FRAME_CHUNKS);
+        put_le64(man + FRAME_HEADER_SIZE, total);
+        put_le32(man + FRAME_HEADER_SIZE + 8, count);
+        rc = write_object(digest, NULL, 0, man, man_len, DURABLE_ORDERED, NULL);
+    }
+    if (rc == 0) {
+        __atomic_fetch_add(&cas_stats.chunked_files, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cas_stats.chunk_logical_bytes, total, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cas_stats.chunk_stored_bytes, stored, __ATOMIC_RELAXED);
+    }
+    free(buf);
+    free(man);
+    return rc;
+}
+
+static int digest_piece(const unsigned char *data, size_t len, void *ctx) {
+    digest_update(ctx, data, len);
+    return 0;
+}
+
+// BLAKE3 splits a large file across the hash pool when it sees the whole
+// mapping at once, rather than the pieces a copying pass works in
+static int hash_whole_first(const struct stat *st) {
+    return digest_algorithm() == DIGEST_BLAKE3 && S_ISREG(st->st_mode) &&
+           st->st_size >= HASH_IO_MMAP_MIN && hash_pool_size() > 0;
+}
+
+// Hash (and with store, ingest) an open file in one pass. Large regular
+// files are chunked when a chunking threshold is set. A file hashed whole
+// first is copied in a second pass, and only if its object is new.
+static int ingest_fd(int fd, const struct stat *st, int store, Digest *digest) {
+    if (store && chunk_threshold && S_ISREG(st->st_mode) && (uint64_t)st->st_size >= chunk_threshold)
+        return ingest_chunked(fd, digest);
+    DurableFile tmp;
+    if (hash_whole_first(st)) {
+        DigestCtx ctx;
+        digest_init(&ctx);
+        if (hash_io_scan_mapped(fd, HASH_IO_AUTO, digest_piece, &ctx) != 0) return -1;
+        digest_final(&ctx, digest);
+        if (!store || cas_blob_exists(digest)) return 0;
+        if (stream_fd(fd, digest, 0, &tmp) != 0) return -1;
+        return publish_temp_object(&tmp, digest, 0, NULL);
+    }
+    if (stream_fd(fd, digest, 1, store ? &tmp : NULL) != 0) return -1;
+    if (store && publish_temp_object(&tmp, digest, 0, NULL) != 0) return -1;
+    return 0;
+}
+
+void cas_set_chunk_threshold(uint64_t bytes) {
+    chunk_threshold = bytes;
+}
+
+// Index hit: digest known without reading. When storing, the object must
+// still be present (it may have been collected since).
+static int lookup_unchanged(const char *path, struct stat *st, int store, Digest *out) {
+    if (stat(path, st) != 0 || !stat_index_lookup(path, st, out->b)) return 0;
+    return !store || cas_blob_exists(out);
+}
+
+int cas_store_blob_from_file(const char *path, Digest *out) {
+    struct stat st;
+    if (lookup_unchanged(path, &st, 1, out)) return 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    int64_t stamp = stat_index_now_ns();
+    int rc = fstat(fd, &st) == 0 ? ingest_fd(fd, &st, 1, out) : -1;
+    close(fd);
+    if (rc == 0 && S_ISREG(st.st_mode)) stat_index_update(path, &st, out->b, stamp);
+    return rc;
+}
+
+typedef struct {
+    const char *const *paths;
+    Digest *out;
+    int store;
+    unsigned char *arena;
+    size_t cap;
+    size_t used;
+    const uint8_t **data;
+    size_t *lens;
+    int *slots;
+    int pending;
+    struct stat *sts;
+    int64_t *stamps;
+} FileBatch;
+
+// Hash the pending small files sitting in the arena, store them if asked and
+// record them in the index
+static void flush_small_batch(FileBatch *b) {
+    if (b->pending == 0) return;
+    Digest *digests = malloc(sizeof(Digest) * b->pending);
+    int *failed = calloc(b->pending, sizeof(int));
+    if (digests && failed) {
+        digest_buffers(b->data, b->lens, b->pending, digests);
+        if (b->store) store_many(digests, b->data, b->lens, b->pending, failed);
+        for (int i = 0; i < b->pending; ++i) {
+            int slot = b->slots[i];
+            if (failed[i]) continue;
+            stat_index_update(b->paths[slot], &b->sts[slot], digests[i].b, b->stamps[slot]);
+            b->out[slot] = digests[i];
+        }
+    }
+    free(digests);
+    free(failed);
+    b->used = 0;
+    b->pending = 0;
+}
+
+static void queue_small(FileBatch *b, int i, const unsigned char *data, size_t len) {
+    b->data[b->pending] = data;
+    b->lens[b->pending] = len;
+    b->slots[b->pending] = i;
+    b->pending++;
+}
+
+// Read or ingest paths[i], whose index entry did not match
+static void process_path(FileBatch *b, int i) {
+    memset(&b->out[i], 0, sizeof(Digest));
+    int fd = open(b->paths[i], O_RDONLY);
+    if (fd < 0) return;
+    b->stamps[i] = stat_index_now_ns();
+    if (fstat(fd, &b->sts[i]) != 0) {
+        close(fd);
+        return;
+    }
+    if (S_ISREG(b->sts[i].st_mode) && b->sts[i].st_size <= BATCH_SMALL_MAX) {
+        if (b->used + BATCH_SMALL_MAX + 1 > b->cap) flush_small_batch(b);
+        // one byte past the size tells a file that changed since fstat
+        size_t len = 0;
+        if (read_fd_fully(fd, b->arena + b->used, BATCH_SMALL_MAX + 1, &len) != 0) {
+            close(fd);
+            return;
+        }
+        if (len == (size_t)b->sts[i].st_size) {
+            queue_small(b, i, b->arena + b->used, len);
+            b->used += len;
+            close(fd);
+            return;
+        }
+        if (lseek(fd, 0, SEEK_SET) != 0 || fstat(fd, &b->sts[i]) != 0) {
+            close(fd);
+            return;
+        }
+    }
+    Digest digest;
+    if (ingest_fd(fd, &b->sts[i], b->store, &digest) == 0) {
+        b->out[i] = digest;
+        if (S_ISREG(b->sts[i].st_mode)) stat_index_update(b->paths[i], &b->sts[i], digest.b, b->stamps[i]);
+    }
+    close(fd);
+}
+
+// Read small files wv[0..c) into the arena: opens, fstats, reads and closes
+// each go out as one batch. A read of size + 1 bytes tells a file that grew
+// from one that did not; files that changed go through process_path.
+static void read_small_wave(FileBatch *b, const int *wv, int c, IoOp *ops, int *fds, int *idx) {
+    for (int k = 0; k < c; ++k) io_op_open(&ops[k], AT_FDCWD, b->paths[wv[k]], O_RDONLY | O_CLOEXEC, 0);
+    io_batch_run(ops, c);
+    int m = 0;
+    for (int k = 0; k < c; ++k) {
+        fds[k] = ops[k].res;
+        if (fds[k] >= 0) {
+            idx[m] = k;
+            io_op_stat(&ops[m++], fds[k], "", AT_EMPTY_PATH, &b->sts[wv[k]]);
+        }
+    }
+    io_batch_run(ops, m);
+    int r = 0;
+    for (int j = 0; j < m; ++j) {
+        int k = idx[j];
+        const struct stat *st = &b->sts[wv[k]];
+        if (ops[j].res != 0 || !S_ISREG(st->st_mode) || st->st_size > BATCH_SMALL_MAX ||
+            b->used + (size_t)st->st_size + 1 > b->cap) // grew since the wave was sized
+            continue;
+        idx[r] = k;
+        io_op_read(&ops[r++], fds[k], b->arena + b->used, (size_t)st->st_size + 1, 0);
+        b->used += (size_t)st->st_size + 1;
+    }
+    io_batch_run(ops, r);
+    int *read_ok = calloc(c, sizeof(int));
+    for (int j = 0; j < r; ++j) {
+        int k = idx[j];
+        if (read_ok && ops[j].res == (int)b->sts[wv[k]].st_size) {
+            queue_small(b, wv[k], ops[j].buf, (size_t)ops[j].res);
+            read_ok[k] = 1;
+        }
+    }
+    m = 0;
+    for (int k = 0; k < c; ++k)
+        if (fds[k] >= 0) io_op_close(&ops[m++], fds[k]);
+    io_batch_run(ops, m);
+    for (int k = 0; k < c; ++k)
+        if (!read_ok || !read_ok[k]) process_path(b, wv[k]);
+    free(read_ok);
+}
+
+// The io_uring flavour of a slice: one batch stats every path for the index,
+// the store check for index hits is one batch of probes, and small misses
+// are read in arena-sized waves. Everything else goes through process_path.
+static void process_slice_batched(FileBatch *b, int n) {
+    IoOp *ops = malloc(sizeof(IoOp) * n);
+    int *list = malloc(sizeof(int) * n);
+    int *small = malloc(sizeof(int) * n);
+    int *fds = malloc(sizeof(int) * n);
+    Digest *hits = malloc(sizeof(Digest) * n);
+    int *present = malloc(sizeof(int) * n);
+    if (!ops || !list || !small || !fds || !hits || !present) {
+        for (int i = 0; i < n; ++i)
+            if (!lookup_unchanged(b->paths[i], &b->sts[i], b->store, &b->out[i])) process_path(b, i);
+        goto out;
+    }
+    int64_t stamp = stat_index_now_ns();
+    for (int i = 0; i < n; ++i) io_op_stat(&ops[i], AT_FDCWD, b->paths[i], 0, &b->sts[i]);
+    io_batch_run(ops, n);
+    int n_hits = 0, n_small = 0;
+    for (int i = 0; i < n; ++i) {
+        if (ops[i].res == 0 && stat_index_lookup(b->paths[i], &b->sts[i], b->out[i].b)) {
+            hits[n_hits] = b->out[i];
+            list[n_hits++] = i;
+        } else {
+            memset(&b->out[i], 0, sizeof(Digest));
+        }
+    }
+    // index hits still need their object when storing
+    if (b->store && n_hits > 0) {
+        if (cas_blobs_exist_batch(hits, n_hits, present) != 0) memset(present, 0, sizeof(int) * n_hits);
+        for (int k = 0; k < n_hits; ++k)
+            if (!present[k]) memset(&b->out[list[k]], 0, sizeof(Digest));
+    }
+    for (int i = 0; i < n; ++i) {
+        if (!digest_is_zero(&b->out[i])) continue;
+        b->stamps[i] = stamp;
+        if (ops[i].res == 0 && S_ISREG(b->sts[i].st_mode) && b->sts[i].st_size <= BATCH_SMALL_MAX)
+            small[n_small++] = i;
+        else
+            process_path(b, i);
+    }
+    for (int start = 0; start < n_small;) {
+        size_t need = 0;
+        int c = 0;
+        while (start + c < n_small && b->used + need + (size_t)b->sts[small[start + c]].st_size + 1 <= b->cap) {
+            need += (size_t)b->sts[small[start + c]].st_size + 1;
+            c++;
+        }
+        if (c == 0) {
+            flush_small_batch(b);
+            continue;
+        }
+        read_small_wave(b, small + start, c, ops, fds, list);
+        start += c;
+    }
+out:
+    free(ops);
+    free(list);
+    free(small);
+    free(fds);
+    free(hits);
+    free(present);
+}
+
+// One thread's share of a batch: small files go through the multi-buffer path
+static int process_slice(const char *const paths[], int n, Digest out[], int store) {
+    if (n <= 0) return 0;
+    memset(out, 0, sizeof(Digest) * n);
+    FileBatch b = { paths, out, store, NULL, 0, 0, NULL, NULL, NULL, 0, NULL, NULL };
+    // n small files never need more than n * (BATCH_SMALL_MAX + 1) bytes
+    b.cap = (size_t)n * (BATCH_SMALL_MAX + 1) < BATCH_ARENA_SIZE ? (size_t)n * (BATCH_SMALL_MAX + 1)
+                                                                  : BATCH_ARENA_SIZE;
+    b.arena = malloc(b.cap);
+    b.data = malloc(sizeof(*b.data) * n);
+    b.lens = malloc(sizeof(*b.lens) * n);
+    b.slots = malloc(sizeof(*b.slots) * n);
+    b.sts = malloc(sizeof(*b.sts) * n);
+    b.stamps = malloc(sizeof(*b.stamps) * n);
+    int failed = 0;
+    if (!b.arena || !b.data || !b.lens || !b.slots || !b.sts || !b.stamps) failed = 1;
+    if (!failed && io_batch_backend() == IO_BATCH_URING) {
+        process_slice_batched(&b, n);
     } else {
-        ctx->data[i++] = 0x80;
-        while (i < 64) ctx->data[i++] = 0x00;
-        sha256_transform(ctx, ctx->data);
-        memset(ctx->data, 0, 56);
+        for (int i = 0; i < n && !failed; ++i)
+            if (!lookup_unchanged(paths[i], &b.sts[i], store, &out[i])) process_path(&b, i);
     }
+    if (!failed) flush_small_batch(&b);
+    for (int i = 0; i < n; ++i) if (digest_is_zero(&out[i])) failed = 1;
+    free(b.arena);
+    free(b.data);
+    free(b.lens);
+    free(b.slots);
+    free(b.sts);
+    free(b.stamps);
+    return failed ? -1 : 0;
+}
+
+// Slices handed to the hash pool: enough for every thread to get about two,
+// but big enough to keep the SIMD lanes of the small-file path busy.
+#define BATCH_SLICE_MAX 64
 
-    // Append to the padding the total message's length in bits and transform.
-    ctx->bitlen += ctx->datalen * 8;
-    ctx->data[63] = ctx->bitlen;
-    ctx->data[62] = ctx->bitlen >> 8;
-    ctx->data[61] = ctx->bitlen >> 16;
-    ctx->data[60] = ctx->bitlen >> 24;
-    ctx->data[59] = ctx->bitlen >> 32;
-    ctx->data[58] = ctx->bitlen >> 40;
-    ctx->data[57] = ctx->bitlen >> 48;
-    ctx->data[56] = ctx->bitlen >> 56;
-    sha256_transform(ctx, ctx->data);
+typedef struct {
+    const char *const *paths;
+    Digest *out;
+    int n;
+    int per;
+    int store;
+    int failed;
+} SliceJob;
+
+static void run_slice(void *arg, int k) {
+    SliceJob *job = arg;
+    int lo = k * job->per;
+    int cnt = job->n - lo < job->per ? job->n - lo : job->per;
+    if (process_slice(job->paths + lo, cnt, job->out + lo, job->store) != 0)
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+}
+
+// Every out[i] is written by exactly one slice, so the result does not
+// depend on how the pool schedules them.
+static int process_files_batch(const char *const paths[], int n, Digest out[], int store) {
+    int threads = hash_pool_size() + 1;
+    if (n <= 1 || threads <= 1) return process_slice(paths, n, out, store);
+    int per = (n + 2 * threads - 1) / (2 * threads);
+    if (per > BATCH_SLICE_MAX) per = BATCH_SLICE_MAX;
+    SliceJob job = { paths, out, n, per, store, 0 };
+    hash_pool_run((n + per - 1) / per, run_slice, &job);
+    return job.failed ? -1 : 0;
+}
 
-    // Since this implementation uses little endian byte ordering and SHA uses big endian,
-    // reverse all the bytes when copying the final state.
-    for (int j = 0; j < 4; ++j) {
-        for (int i = 0; i < 8; ++i) {
-            hash[j + i*4] = (ctx->state[i] >> (24 - j * 8)) & 0x000000ff;
+int cas_hash_files_batch(const char *const paths[], int n, Digest out[]) {
+    return process_files_batch(paths, n, out, 0);
+}
+
+int cas_store_files_batch(const char *const paths[], int n, Digest out[]) {
+    return process_files_batch(paths, n, out, 1);
+}
+
+/* ---- materialization ---- */
+
+static const char *const strategy_names[CAS_MAT_COUNT] = { "reflink", "hardlink", "copy_range", "copy" };
+static CasMaterialize preferred_strategy = CAS_MAT_REFLINK;
+static CasFetchFn fetch_handler = NULL;
+
+int cas_set_materialize_strategy(const char *name) {
+    for (int i = 0; i < CAS_MAT_COUNT; ++i) {
+        if (strcmp(name, strategy_names[i]) == 0) {
+            preferred_strategy = (CasMaterialize)i;
+            return 0;
         }
     }
+    return -1;
 }
 
-/* global root */
-static char objects_root[1024] = {0};
-static char cache_root[1024] = {0};
+void cas_set_fetch_handler(CasFetchFn fetch) {
+    __atomic_store_n(&fetch_handler, fetch, __ATOMIC_RELEASE);
+}
 
-const char *cas_get_objects_root() { return objects_root; }
-const char *cas_get_cache_root() { return cache_root; }
+int cas_fetch_missing(const Digest d[], int n) {
+    int *have = malloc(sizeof(int) * (n > 0 ? n : 1));
+    Digest *missing = malloc(sizeof(Digest) * (n > 0 ? n : 1));
+    int rc = have && missing && cas_blobs_exist_batch(d, n, have) == 0 ? 0 : -1;
+    size_t m = 0;
+    for (int i = 0; rc == 0 && i < n; ++i)
+        if (!have[i]) missing[m++] = d[i];
+    CasFetchFn fetch = __atomic_load_n(&fetch_handler, __ATOMIC_ACQUIRE);
+    if (rc == 0 && m > 0) rc = fetch ? fetch(missing, m) : -1;
+    free(have);
+    free(missing);
+    return rc;
+}
 
-int cas_init(const char *base_dir) {
-    if (!base_dir) return -1;
-    snprintf(objects_root, sizeof(objects_root), "%s/.reprovm/cas/objects", base_dir);
-    snprintf(cache_root, sizeof(cache_root), "%s/.reprovm/cache", base_dir);
-    if (ensure_dir_recursive(objects_root) != 0) return -1;
-    if (ensure_dir_recursive(cache_root) != 0) return -1;
+const char *cas_materialize_strategy_name(CasMaterialize s) {
+    return (s >= 0 && s < CAS_MAT_COUNT) ? strategy_names[s] : "unknown";
+}
+
+void cas_get_stats(CasStats *out) {
+    for (int i = 0; i < CAS_MAT_COUNT; ++i)
+        out->materialized[i] = __atomic_load_n(&cas_stats.materialized[i], __ATOMIC_RELAXED);
+    out->reassembled = __atomic_load_n(&cas_stats.reassembled, __ATOMIC_RELAXED);
+    out->chunked_files = __atomic_load_n(&cas_stats.chunked_files, __ATOMIC_RELAXED);
+    out->chunk_logical_bytes = __atomic_load_n(&cas_stats.chunk_logical_bytes, __ATOMIC_RELAXED);
+    out->chunk_stored_bytes = __atomic_load_n(&cas_stats.chunk_stored_bytes, __ATOMIC_RELAXED);
+    out->decompressed = __atomic_load_n(&cas_stats.decompressed, __ATOMIC_RELAXED);
+    out->compressed_objects = __atomic_load_n(&cas_stats.compressed_objects, __ATOMIC_RELAXED);
+    out->compress_in_bytes = __atomic_load_n(&cas_stats.compress_in_bytes, __ATOMIC_RELAXED);
+    out->compress_out_bytes = __atomic_load_n(&cas_stats.compress_out_bytes, __ATOMIC_RELAXED);
+    out->filter_negatives = __atomic_load_n(&cas_stats.filter_negatives, __ATOMIC_RELAXED);
+    out->filter_false_positives = __atomic_load_n(&cas_stats.filter_false_positives, __ATOMIC_RELAXED);
+}
+
+double cas_dedup_ratio(const CasStats *st) {
+    if (st->chunk_stored_bytes == 0) return st->chunk_logical_bytes ? 0.0 : 1.0;
+    return (double)st->chunk_logical_bytes / (double)st->chunk_stored_bytes;
+}
+
+double cas_filter_fp_rate(const CasStats *st) {
+    uint64_t absent = st->filter_negatives + st->filter_false_positives;
+    return absent ? (double)st->filter_false_positives / (double)absent : 0.0;
+}
+
+void cas_print_stats(FILE *out) {
+    CasStats st;
+    cas_get_stats(&st);
+    uint64_t total = 0;
+    for (int i = 0; i < CAS_MAT_COUNT; ++i) total += st.materialized[i];
+    total += st.reassembled + st.decompressed;
+    if (total > 0) {
+        fprintf(out, "Restored %llu outputs:", (unsigned long long)total);
+        for (int i = 0; i < CAS_MAT_COUNT; ++i)
+            fprintf(out, " %s=%llu", strategy_names[i], (unsigned long long)st.materialized[i]);
+        if (st.reassembled) fprintf(out, " reassembled=%llu", (unsigned long long)st.reassembled);
+        if (st.decompressed) fprintf(out, " decompressed=%llu", (unsigned long long)st.decompressed);
+        fputc('\n', out);
+    }
+    if (st.compressed_objects > 0) {
+        fprintf(out, "Compressed %llu objects: %llu -> %llu bytes (%.1f%%)\n",
+                (unsigned long long)st.compressed_objects, (unsigned long long)st.compress_in_bytes,
+                (unsigned long long)st.compress_out_bytes,
+                100.0 * (double)st.compress_out_bytes / (double)st.compress_in_bytes);
+    }
+    if (st.chunked_files > 0) {
+        if (st.chunk_stored_bytes > 0)
+            fprintf(out, "Chunked %llu files: %llu bytes, %llu new (dedup ratio %.2f)\n",
+                    (unsigned long long)st.chunked_files, (unsigned long long)st.chunk_logical_bytes,
+                    (unsigned long long)st.chunk_stored_bytes, cas_dedup_ratio(&st));
+        else
+            fprintf(out, "Chunked %llu files: %llu bytes, all chunks already stored\n",
+                    (unsigned long long)st.chunked_files, (unsigned long long)st.chunk_logical_bytes);
+    }
+    if (st.filter_negatives + st.filter_false_positives > 0) {
+        fprintf(out, "Object filter: %llu missing objects answered from memory, %llu false positives (%.3f%%)\n",
+                (unsigned long long)st.filter_negatives, (unsigned long long)st.filter_false_positives,
+                100.0 * cas_filter_fp_rate(&st));
+    }
+}
+
+// Hardlink to the object, renamed over dest so an existing file is replaced atomically
+static int materialize_link(const ObjectLoc *loc, const struct stat *obj_st, const char *dest) {
+    // a writable object could be modified through the output
+    if (obj_st->st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) return -1;
+    char tmp[2048];
+    snprintf(tmp, sizeof(tmp), "%s.reprovm-link.%ld", dest, (long)getpid());
+    unlink(tmp);
+    if (linkat(loc->dirfd, loc->name, AT_FDCWD, tmp, 0) != 0) return -1;
+    if (rename(tmp, dest) != 0) {
+        unlink(tmp);
+        return -1;
+    }
     return 0;
 }
 
-static int make_object_path(const char *hash, char *out, size_t sz) {
-    if (strlen(hash) < 3) return -1;
-    // use two-level: first two chars as dir
-    char dir[1024];
-    snprintf(dir, sizeof(dir), "%s/%c%c", objects_root, hash[0], hash[1]);
-    if (ensure_dir_recursive(dir) != 0) return -1;
-    // object file name is remainder
-    snprintf(out, sz, "%s/%s", dir, hash + 2);
+// Copy size bytes of src starting at off into dst (at its start)
+static int copy_range_fd(int src, off_t off, int dst, off_t size) {
+    off_t end = off + size;
+    while (off < end) {
+        ssize_t n = copy_file_range(src, &off, dst, NULL, (size_t)(end - off), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+    }
+    // older kernels or cross-filesystem: sendfile continues from the same offsets
+    while (off < end) {
+        ssize_t n = sendfile(dst, src, &off, (size_t)(end - off));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+    }
     return 0;
 }
 
-int cas_get_object_path(const char *hash, char *out_path, size_t sz) {
-    return make_object_path(hash, out_path, sz);
+static int copy_userspace_fd(int src, off_t off, int dst, off_t size) {
+    unsigned char *buf = malloc(STREAM_CHUNK);
+    if (!buf) return -1;
+    int rc = 0;
+    off_t end = off + size;
+    while (off < end) {
+        size_t want = end - off < STREAM_CHUNK ? (size_t)(end - off) : STREAM_CHUNK;
+        ssize_t r = pread(src, buf, want, off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0 || write_all(dst, buf, (size_t)r) != 0) {
+            rc = -1;
+            break;
+        }
+        off += r;
+    }
+    free(buf);
+    return rc;
+}
+
+// Copy size bytes at off in src into the empty, writable dst with a
+// data-copying strategy. Reflink needs the whole file (off 0, size = st_size).
+static int materialize_into(CasMaterialize s, int src, off_t off, off_t size, int dst) {
+    if (s == CAS_MAT_REFLINK) return ioctl(dst, FICLONE, src);
+    if (s == CAS_MAT_COPY_RANGE) return copy_range_fd(src, off, dst, size);
+    return copy_userspace_fd(src, off, dst, size);
 }
 
-int cas_blob_exists(const char *hash) {
-    char path[2048];
-    if (make_object_path(hash, path, sizeof(path)) != 0) return 0;
-    return file_exists(path);
+// Data-copying strategies for size bytes at off in src; dest is created
+// fresh and writable
+static int materialize_fd(CasMaterialize s, int src, off_t off, off_t size, const char *dest) {
+    int dst = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0) return -1;
+    int rc = materialize_into(s, src, off, size, dst);
+    if (close(dst) != 0) rc = -1;
+    if (rc != 0) unlink(dest);
+    return rc;
 }
 
-char *cas_store_blob_from_memory(const unsigned char *data, size_t len) {
-    SHA256_CTX ctx;
-    uint8_t hash_raw[32];
-    sha256_init(&ctx);
-    sha256_update(&ctx, data, len);
-    sha256_final(&ctx, hash_raw);
-    char *hex = hex_encode(hash_raw, 32);
-    if (!hex) return NULL;
-    char obj_path[2048];
-    if (make_object_path(hex, obj_path, sizeof(obj_path)) != 0) {
-        free(hex);
+// The stored bytes of one object: a whole loose file or a slice of a pack
+typedef struct {
+    int fd;
+    int loose;      // fd is ours to close
+    off_t off;
+    off_t len;
+    int frame;      // -1 for plain raw content, else the FRAME_* type
+    ObjectLoc loc;  // valid when loose
+    struct stat st; // valid when loose
+} StoredObject;
+
+static int open_stored(const Digest *d, StoredObject *o) {
+    PackRef ref;
+    int packed = pack_find(d->b, &ref);
+    o->loose = 0;
+    if (!packed) {
+        object_loc(d, &o->loc);
+        o->fd = openat(o->loc.dirfd, o->loc.name, O_RDONLY | O_CLOEXEC);
+        if (o->fd < 0) o->fd = durable_pending_open(o->loc.dirfd, o->loc.name);
+        if (o->fd >= 0) {
+            if (fstat(o->fd, &o->st) != 0) {
+                close(o->fd);
+                return -1;
+            }
+            o->loose = 1;
+            o->off = 0;
+            o->len = o->st.st_size;
+        } else if (!find_packed_fresh(d, &ref)) { // a concurrent repack may have just moved it
+            return -1;
+        }
+    }
+    if (!o->loose) {
+        o->fd = ref.fd;
+        o->off = (off_t)ref.offset;
+        o->len = (off_t)ref.length;
+    }
+    unsigned char hdr[FRAME_HEADER_SIZE];
+    o->frame = -1;
+    if (o->len >= FRAME_HEADER_SIZE &&
+        pread(o->fd, hdr, sizeof(hdr), o->off) == (ssize_t)sizeof(hdr) && starts_with_magic(hdr, sizeof(hdr)))
+        o->frame = hdr[FRAME_MAGIC_LEN];
+    return 0;
+}
+
+static void close_stored(StoredObject *o) {
+    if (o->loose) close(o->fd);
+}
+
+static int pread_full(int fd, unsigned char *buf, size_t len, off_t off) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, buf + done, len - done, off + (off_t)done);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+// Read the stored bytes of o into a fresh buffer
+static unsigned char *read_stored(const StoredObject *o) {
+    unsigned char *buf = malloc(o->len ? (size_t)o->len : 1);
+    if (buf && pread_full(o->fd, buf, (size_t)o->len, o->off) != 0) {
+        free(buf);
         return NULL;
     }
-    if (!file_exists(obj_path)) {
-        // write it (atomic)
-        char tmp[4096];
-        snprintf(tmp, sizeof(tmp), "%s.tmp", obj_path);
-        FILE *f = fopen(tmp, "wb");
-        if (!f) {
-            free(hex);
-            return NULL;
-        }
-        if (fwrite(data, 1, len, f) != len) {
-            fclose(f);
-            unlink(tmp);
-            free(hex);
-            return NULL;
+    return buf;
+}
+
+// Decode a FRAME_COMPRESSED object block by block, handing each block to
+// fn; *size gets the content length
+static int decode_compressed(const StoredObject *o, hash_io_fn fn, void *ctx, uint64_t *size) {
+    unsigned char hdr[COMPRESSED_PREFIX];
+    if (o->len < COMPRESSED_PREFIX || pread_full(o->fd, hdr, sizeof(hdr), o->off) != 0 ||
+        hdr[FRAME_MAGIC_LEN + 1] != COMPRESS_LZ4)
+        return -1;
+    unsigned char *in = malloc(COMPRESSION_BLOCK_SIZE), *out = malloc(COMPRESSION_BLOCK_SIZE);
+    off_t pos = o->off + COMPRESSED_PREFIX, end = o->off + o->len;
+    uint64_t got = 0;
+    int rc = in && out ? 0 : -1;
+    while (rc == 0 && pos < end) {
+        unsigned char bh[COMPRESSION_BLOCK_HEADER];
+        size_t raw, stored;
+        if (end - pos < COMPRESSION_BLOCK_HEADER || pread_full(o->fd, bh, sizeof(bh), pos) != 0 ||
+            compression_block_header(bh, &raw, &stored) != 0 ||
+            (off_t)stored > end - pos - COMPRESSION_BLOCK_HEADER ||
+            pread_full(o->fd, in, stored, pos + COMPRESSION_BLOCK_HEADER) != 0 ||
+            compression_decode_block(in, stored, out, raw) != 0 || fn(out, raw, ctx) != 0) {
+            rc = -1;
+            break;
         }
-        fclose(f);
-        if (rename(tmp, obj_path) != 0) {
-            unlink(tmp);
-            free(hex);
-            return NULL;
-        }
-    }
-    return hex;
-}
-
-char *cas_store_blob_from_file(const char *path) {
-    FILE *f = fopen(path, "rb");
-    if (!f) return NULL;
-    SHA256_CTX ctx;
-    uint8_t hash_raw[32];
-    sha256_init(&ctx);
-    char buf[8192];
-    size_t r;
-    while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
-        sha256_update(&ctx, (unsigned char*)buf, r);
-    }
-    fclose(f);
-    sha256_final(&ctx, hash_raw);
-    char *hex = hex_encode(hash_raw, 32);
-    if (!hex) return NULL;
-    char obj_path[2048];
-    if (make_object_path(hex, obj_path, sizeof(obj_path)) != 0) {
-        free(hex);
+        pos += COMPRESSION_BLOCK_HEADER + (off_t)stored;
+        got += raw;
+    }
+    free(in);
+    free(out);
+    if (rc == 0 && got != get_le64(hdr + FRAME_HEADER_SIZE)) rc = -1;
+    *size = got;
+    return rc;
+}
+
+static int write_piece(const unsigned char *data, size_t len, void *ctx) {
+    return write_all(*(int *)ctx, data, len);
+}
+
+static int decompress_to_fd(const StoredObject *o, int dst, uint64_t *size) {
+    return decode_compressed(o, write_piece, &dst, size);
+}
+
+// In-memory counterpart of decompress_to_fd, for verification
+static unsigned char *decompress_buffer(const unsigned char *obj, size_t len, size_t *out_len) {
+    if (len < COMPRESSED_PREFIX || obj[FRAME_MAGIC_LEN + 1] != COMPRESS_LZ4) return NULL;
+    uint64_t size = get_le64(obj + FRAME_HEADER_SIZE);
+    if (size / 256 > len) return NULL; // beyond what LZ4 can expand to
+    unsigned char *buf = malloc(size ? (size_t)size : 1);
+    size_t pos = COMPRESSED_PREFIX, got = 0;
+    while (buf && pos < len) {
+        size_t raw, stored;
+        if (len - pos < COMPRESSION_BLOCK_HEADER || compression_block_header(obj + pos, &raw, &stored) != 0 ||
+            len - pos - COMPRESSION_BLOCK_HEADER < stored || size - got < raw ||
+            compression_decode_block(obj + pos + COMPRESSION_BLOCK_HEADER, stored, buf + got, raw) != 0)
+            break;
+        pos += COMPRESSION_BLOCK_HEADER + stored;
+        got += raw;
+    }
+    if (!buf || pos != len || got != size) {
+        free(buf);
         return NULL;
     }
-    if (!file_exists(obj_path)) {
-        // copy over
-        if (copy_file(path, obj_path) != 0) {
-            free(hex);
-            return NULL;
+    *out_len = got;
+    return buf;
+}
+
+static int restore_compressed(const StoredObject *o, const char *dest) {
+    int dst = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0) return -1;
+    uint64_t size;
+    int rc = decompress_to_fd(o, dst, &size);
+    if (close(dst) != 0) rc = -1;
+    if (rc != 0) unlink(dest);
+    else __atomic_fetch_add(&cas_stats.decompressed, 1, __ATOMIC_RELAXED);
+    return rc;
+}
+
+// Only the copying strategies apply to a byte range inside a larger file
+static int restore_range(int fd, off_t off, off_t len, const char *dest) {
+    int rc = -1;
+    int first = preferred_strategy > CAS_MAT_COPY_RANGE ? preferred_strategy : CAS_MAT_COPY_RANGE;
+    for (int s = first; s < CAS_MAT_COUNT && rc != 0; ++s) {
+        rc = materialize_fd((CasMaterialize)s, fd, off, len, dest);
+        if (rc == 0) __atomic_fetch_add(&cas_stats.materialized[s], 1, __ATOMIC_RELAXED);
+    }
+    return rc;
+}
+
+// Append one chunk object to dst
+static int append_chunk(const Digest *d, uint32_t len, int dst) {
+    StoredObject c;
+    if (open_stored(d, &c) != 0) return -1;
+    off_t off = c.off, size = c.len;
+    if (c.frame == FRAME_RAW) {
+        off += FRAME_HEADER_SIZE;
+        size -= FRAME_HEADER_SIZE;
+    }
+    int rc = -1;
+    if (c.frame == FRAME_COMPRESSED) {
+        uint64_t got;
+        rc = decompress_to_fd(&c, dst, &got) == 0 && got == len ? 0 : -1;
+    } else if ((c.frame == -1 || c.frame == FRAME_RAW) && size == (off_t)len) {
+        off_t start = lseek(dst, 0, SEEK_CUR);
+        rc = copy_range_fd(c.fd, off, dst, size);
+        if (rc != 0 && start >= 0 && lseek(dst, start, SEEK_SET) == start && ftruncate(dst, start) == 0)
+            rc = copy_userspace_fd(c.fd, off, dst, size);
+    }
+    close_stored(&c);
+    return rc;
+}
+
+static int restore_chunked(const StoredObject *o, const char *dest) {
+    unsigned char *list = read_stored(o);
+    uint64_t total;
+    uint32_t count;
+    if (!list || parse_chunk_list(list, (size_t)o->len, &total, &count) != 0) {
+        free(list);
+        return -1;
+    }
+    int dst = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int rc = dst >= 0 ? 0 : -1;
+    for (uint32_t i = 0; rc == 0 && i < count; ++i) {
+        Digest cd;
+        uint32_t len;
+        chunk_entry(list, i, &cd, &len);
+        rc = append_chunk(&cd, len, dst);
+    }
+    if (dst >= 0 && close(dst) != 0) rc = -1;
+    if (rc != 0) unlink(dest);
+    else __atomic_fetch_add(&cas_stats.reassembled, 1, __ATOMIC_RELAXED);
+    free(list);
+    return rc;
+}
+
+int cas_restore_blob_to_file(const Digest *d, const char *dest) {
+    StoredObject o;
+    if (open_stored(d, &o) != 0) {
+        // a miss goes to the next tier, if there is one
+        CasFetchFn fetch = __atomic_load_n(&fetch_handler, __ATOMIC_ACQUIRE);
+        if (!fetch || fetch(d, 1) != 0 || open_stored(d, &o) != 0) return -1;
+    }
+    // never write through an existing dest: it may itself be a link to an object
+    unlink(dest);
+    int rc = -1;
+    if (o.frame == FRAME_CHUNKS) {
+        rc = restore_chunked(&o, dest);
+    } else if (o.frame == FRAME_COMPRESSED) {
+        rc = restore_compressed(&o, dest);
+    } else if (o.frame == FRAME_RAW) {
+        rc = restore_range(o.fd, o.off + FRAME_HEADER_SIZE, o.len - FRAME_HEADER_SIZE, dest);
+    } else if (o.frame == FRAME_TREE) {
+        rc = restore_range(o.fd, o.off, o.len, dest); // the listing itself
+    } else if (o.frame != -1) {
+        rc = -1; // written by a newer version
+    } else if (!o.loose) {
+        rc = restore_range(o.fd, o.off, o.len, dest);
+    } else {
+        for (int s = preferred_strategy; s < CAS_MAT_COUNT && rc != 0; ++s) {
+            if (s == CAS_MAT_HARDLINK) rc = materialize_link(&o.loc, &o.st, dest);
+            else rc = materialize_fd((CasMaterialize)s, o.fd, 0, o.len, dest);
+            if (rc == 0) __atomic_fetch_add(&cas_stats.materialized[s], 1, __ATOMIC_RELAXED);
         }
     }
-    return hex;
+    close_stored(&o);
+    return rc;
 }
 
-int cas_restore_blob_to_file(const char *hash, const char *dest) {
-    char obj_path[2048];
-    if (make_object_path(hash, obj_path, sizeof(obj_path)) != 0) return -1;
-    if (!file_exists(obj_path)) return -1;
-    return copy_file(obj_path, dest);
+// One output of a batched restore
+typedef struct {
+    int slot;
+    ObjectLoc loc;
+    int src;
+    int dst;
+    struct stat st;
+    unsigned char hdr[FRAME_HEADER_SIZE];
+    int state; // RESTORE_*
+} PendingRestore;
+
+enum { RESTORE_PENDING, RESTORE_DONE, RESTORE_SINGLE };
+
+// Each strategy is one round over the outputs it has not served yet: hardlinks
+// are a batch of links, the copying strategies a batch of opens, the copy
+// itself per file (FICLONE and copy_file_range have no io_uring form), and a
+// batch of closes. Outputs a strategy fails on move to the next one.
+static void restore_rounds(PendingRestore *r, int m, const char *const dests[], IoOp *ops, int *owner) {
+    for (int s = preferred_strategy; s < CAS_MAT_COUNT; ++s) {
+        int c = 0;
+        for (int k = 0; k < m; ++k) {
+            if (r[k].state != RESTORE_PENDING) continue;
+            // a writable object could be modified through the output
+            if (s == CAS_MAT_HARDLINK && (r[k].st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))) continue;
+            owner[c] = k;
+            if (s == CAS_MAT_HARDLINK)
+                io_op_link(&ops[c++], r[k].loc.dirfd, r[k].loc.name, AT_FDCWD, dests[r[k].slot], 0);
+            else
+                io_op_open(&ops[c++], AT_FDCWD, dests[r[k].slot], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+        if (c == 0) continue;
+        io_batch_run(ops, c);
+        if (s == CAS_MAT_HARDLINK) {
+            for (int j = 0; j < c; ++j) {
+                if (ops[j].res != 0) continue;
+                r[owner[j]].state = RESTORE_DONE;
+                __atomic_fetch_add(&cas_stats.materialized[s], 1, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+        int opened = 0;
+        for (int j = 0; j < c; ++j) {
+            PendingRestore *o = &r[owner[j]];
+            o->dst = ops[j].res;
+            if (o->dst < 0) continue;
+            if (materialize_into((CasMaterialize)s, o->src, 0, o->st.st_size, o->dst) == 0) o->state = RESTORE_DONE;
+            owner[opened] = owner[j];
+            io_op_close(&ops[opened++], o->dst);
+        }
+        io_batch_run(ops, opened);
+        int failed = 0;
+        for (int j = 0; j < opened; ++j) {
+            PendingRestore *o = &r[owner[j]];
+            if (ops[j].res != 0) o->state = RESTORE_PENDING;
+            if (o->state == RESTORE_DONE) {
+                __atomic_fetch_add(&cas_stats.materialized[s], 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            io_op_unlink(&ops[failed++], AT_FDCWD, dests[o->slot], 0);
+        }
+        io_batch_run(ops, failed);
+    }
+}
+
+int cas_restore_blobs_batch(const Digest d[], const char *const dests[], int n) {
+    int rc = 0;
+    // objects missing here are fetched together, not one miss at a time;
+    // any that cannot be fail below
+    if (__atomic_load_n(&fetch_handler, __ATOMIC_ACQUIRE)) cas_fetch_missing(d, n);
+    PendingRestore *r = io_batch_backend() == IO_BATCH_URING ? calloc(n > 0 ? n : 1, sizeof(PendingRestore)) : NULL;
+    IoOp *ops = r ? malloc(sizeof(IoOp) * 3 * n) : NULL;
+    int *owner = r ? malloc(sizeof(int) * 3 * n) : NULL;
+    if (!r || !ops || !owner) {
+        for (int i = 0; i < n; ++i)
+            if (cas_restore_blob_to_file(&d[i], dests[i]) != 0) rc = -1;
+        free(r);
+        free(ops);
+        free(owner);
+        return rc;
+    }
+    // Plain loose objects are batched; packed and framed ones, and any the
+    // batch could not open, take the single-object path
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        if (pack_find(d[i].b, NULL)) {
+            if (cas_restore_blob_to_file(&d[i], dests[i]) != 0) rc = -1;
+            continue;
+        }
+        r[m].slot = i;
+        object_loc(&d[i], &r[m].loc);
+        io_op_open(&ops[m], r[m].loc.dirfd, r[m].loc.name, O_RDONLY | O_CLOEXEC, 0);
+        m++;
+    }
+    io_batch_run(ops, m);
+    int c = 0;
+    for (int k = 0; k < m; ++k) {
+        r[k].src = ops[k].res;
+        r[k].dst = -1;
+        r[k].state = r[k].src >= 0 ? RESTORE_PENDING : RESTORE_SINGLE;
+    }
+    for (int k = 0; k < m; ++k) {
+        if (r[k].src < 0) continue;
+        owner[c] = k;
+        io_op_read(&ops[c++], r[k].src, r[k].hdr, FRAME_HEADER_SIZE, 0);
+        owner[c] = k;
+        io_op_stat(&ops[c++], r[k].src, "", AT_EMPTY_PATH, &r[k].st);
+        // never write through an existing dest: it may itself be a link to an object
+        owner[c] = k;
+        io_op_unlink(&ops[c++], AT_FDCWD, dests[r[k].slot], 0);
+    }
+    io_batch_run(ops, c);
+    for (int j = 0; j < c; ++j) {
+        PendingRestore *o = &r[owner[j]];
+        if (ops[j].kind == IO_OP_READ && ops[j].res >= FRAME_HEADER_SIZE &&
+            starts_with_magic(o->hdr, FRAME_HEADER_SIZE))
+            o->state = RESTORE_SINGLE;
+        if ((ops[j].kind == IO_OP_READ && ops[j].res < 0) || (ops[j].kind == IO_OP_STAT && ops[j].res != 0))
+            o->state = RESTORE_SINGLE;
+    }
+    restore_rounds(r, m, dests, ops, owner);
+    c = 0;
+    for (int k = 0; k < m; ++k)
+        if (r[k].src >= 0) io_op_close(&ops[c++], r[k].src);
+    io_batch_run(ops, c);
+    for (int k = 0; k < m; ++k) {
+        if (r[k].state == RESTORE_SINGLE)
+            r[k].state = cas_restore_blob_to_file(&d[r[k].slot], dests[r[k].slot]) == 0 ? RESTORE_DONE
+                                                                                         : RESTORE_PENDING;
+        if (r[k].state != RESTORE_DONE) rc = -1;
+    }
+    free(r);
+    free(ops);
+    free(owner);
+    return rc;
+}
+
+/* ---- verification ---- */
+
+#define VERIFY_PIECE (4 * 1024 * 1024)
+
+typedef struct {
+    DigestCtx ctx;
+    uint64_t bytes; // read from the store
+} VerifyState;
+
+static int verify_piece(const unsigned char *data, size_t len, void *arg) {
+    digest_update(&((VerifyState *)arg)->ctx, data, len);
+    return 0;
+}
+
+// Hash the content of an object that is not a chunk list into v; *size
+// gets the content length
+static int read_content(const StoredObject *o, VerifyState *v, uint64_t *size) {
+    *size = 0;
+    if (o->frame == FRAME_COMPRESSED) {
+        v->bytes += (uint64_t)o->len;
+        return decode_compressed(o, verify_piece, v, size);
+    }
+    if (o->frame != -1 && o->frame != FRAME_RAW && o->frame != FRAME_TREE) return -1;
+    off_t off = o->frame == FRAME_RAW ? o->off + FRAME_HEADER_SIZE : o->off, end = o->off + o->len;
+    unsigned char *buf = malloc(VERIFY_PIECE);
+    int rc = buf ? 0 : -1;
+    while (rc == 0 && off < end) {
+        size_t n = end - off < VERIFY_PIECE ? (size_t)(end - off) : VERIFY_PIECE;
+        rc = pread_full(o->fd, buf, n, off);
+        if (rc == 0) digest_update(&v->ctx, buf, n);
+        off += (off_t)n;
+        *size += n;
+        v->bytes += n;
+    }
+    free(buf);
+    return rc;
+}
+
+// Hash the chunks a chunk list names into v, in order. Each chunk must be
+// present and as long as the list says, and the lengths must add up.
+static int hash_chunks(const unsigned char *list, size_t list_len, VerifyState *v) {
+    uint64_t total = 0, sum = 0;
+    uint32_t count = 0;
+    int rc = parse_chunk_list(list, list_len, &total, &count) == 0 ? 0 : -1;
+    for (uint32_t i = 0; rc == 0 && i < count; ++i) {
+        Digest cd;
+        uint32_t len;
+        uint64_t size;
+        StoredObject c;
+        chunk_entry(list, i, &cd, &len);
+        if (open_stored(&cd, &c) != 0) {
+            rc = -1;
+            break;
+        }
+        rc = read_content(&c, v, &size) == 0 && size == len ? 0 : -1;
+        close_stored(&c);
+        sum += len;
+    }
+    return rc == 0 && sum == total ? 0 : -1;
+}
+
+// A chunk list is intact if its chunks reassemble into the named content
+static int read_chunks(const StoredObject *o, VerifyState *v) {
+    unsigned char *list = read_stored(o);
+    v->bytes += (uint64_t)o->len;
+    int rc = list ? hash_chunks(list, (size_t)o->len, v) : -1;
+    free(list);
+    return rc;
+}
+
+// Check stored bytes against the digest they are filed under. A chunk list
+// is checked by hashing the chunks it names; a tree by its own bytes, its
+// structure and the presence of its children.
+static int verify_stored(const Digest *d, const unsigned char *obj, size_t len) {
+    Digest got;
+    if (starts_with_magic(obj, len)) {
+        if (len < FRAME_HEADER_SIZE) return -1;
+        if (obj[FRAME_MAGIC_LEN] == FRAME_TREE) {
+            uint32_t count;
+            size_t off = FRAME_HEADER_SIZE + 4;
+            digest_buffer(obj, len, &got);
+            if (!digest_eq(&got, d) || parse_tree(obj, len, &count) != 0) return -1;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t mode;
+                Digest cd;
+                const unsigned char *name;
+                size_t name_len;
+                tree_entry(obj, &off, &mode, &cd, &name, &name_len);
+                if (!cas_blob_exists(&cd)) return -1;
+            }
+            return 0;
+        }
+        if (obj[FRAME_MAGIC_LEN] == FRAME_RAW) {
+            digest_buffer(obj + FRAME_HEADER_SIZE, len - FRAME_HEADER_SIZE, &got);
+            return digest_eq(&got, d) ? 0 : -1;
+        }
+        if (obj[FRAME_MAGIC_LEN] == FRAME_COMPRESSED) {
+            size_t raw_len;
+            unsigned char *raw = decompress_buffer(obj, len, &raw_len);
+            if (!raw) return -1;
+            digest_buffer(raw, raw_len, &got);
+            free(raw);
+            return digest_eq(&got, d) ? 0 : -1;
+        }
+        // the list is only as good as the content it reassembles
+        VerifyState v;
+        digest_init(&v.ctx);
+        v.bytes = 0;
+        if (hash_chunks(obj, len, &v) != 0) return -1;
+        digest_final(&v.ctx, &got);
+        return digest_eq(&got, d) ? 0 : -1;
+    }
+    digest_buffer(obj, len, &got);
+    return digest_eq(&got, d) ? 0 : -1;
+}
+
+int cas_read_object(const Digest *d, unsigned char **data, size_t *len) {
+    StoredObject o;
+    if (open_stored(d, &o) != 0) return -1;
+    *data = read_stored(&o);
+    *len = (size_t)o.len;
+    close_stored(&o);
+    return *data ? 0 : -1;
+}
+
+int cas_open_object(const Digest *d, int *fd, off_t *off, uint64_t *len) {
+    StoredObject o;
+    if (open_stored(d, &o) != 0) return -1;
+    // a packed object's fd belongs to the pack table
+    *fd = o.loose ? o.fd : fcntl(o.fd, F_DUPFD_CLOEXEC, 0);
+    *off = o.off;
+    *len = (uint64_t)o.len;
+    return *fd >= 0 ? 0 : -1;
+}
+
+int cas_read_blob(const Digest *d, unsigned char **data, size_t *len) {
+    unsigned char *obj;
+    size_t obj_len;
+    *data = NULL;
+    if (cas_read_object(d, &obj, &obj_len) != 0) return -1;
+    int frame = starts_with_magic(obj, obj_len) && obj_len >= FRAME_HEADER_SIZE ? obj[FRAME_MAGIC_LEN] : -1;
+    if (frame == -1 || frame == FRAME_TREE) {
+        *data = obj;
+        *len = obj_len;
+        return 0;
+    }
+    if (frame == FRAME_RAW) {
+        *len = obj_len - FRAME_HEADER_SIZE;
+        memmove(obj, obj + FRAME_HEADER_SIZE, *len);
+        *data = obj;
+    } else if (frame == FRAME_COMPRESSED) {
+        *data = decompress_buffer(obj, obj_len, len);
+        free(obj);
+    } else {
+        free(obj); // a chunk list: too large to want in memory
+    }
+    return *data ? 0 : -1;
+}
+
+int cas_write_object(const Digest *d, const unsigned char *data, size_t len) {
+    if (verify_stored(d, data, len) != 0) return -1;
+    // a chunk list or tree must not become durable before what it names
+    int refs = starts_with_magic(data, len) && len > FRAME_MAGIC_LEN &&
+               (data[FRAME_MAGIC_LEN] == FRAME_CHUNKS || data[FRAME_MAGIC_LEN] == FRAME_TREE);
+    return write_object(d, NULL, 0, data, len, refs ? DURABLE_ORDERED : 0, NULL);
+}
+
+int cas_write_cache_file(const char *name, const void *data, size_t len) {
+    DurableFile f;
+    if (cache_fd < 0 || durable_create(cache_root, &f) != 0) return -1;
+    fchmod(f.fd, 0644);
+    if (write_all(f.fd, data, len) != 0) {
+        durable_abort(&f);
+        return -1;
+    }
+    return durable_publish(&f, cache_fd, name, DURABLE_REPLACE | DURABLE_ORDERED);
+}
+
+int cas_parse_chunk_list(const unsigned char *obj, size_t len, Digest **chunks, size_t *n) {
+    *chunks = NULL;
+    *n = 0;
+    if (len < FRAME_HEADER_SIZE || !starts_with_magic(obj, len) || obj[FRAME_MAGIC_LEN] != FRAME_CHUNKS)
+        return 0;
+    uint64_t total;
+    uint32_t count;
+    if (parse_chunk_list(obj, len, &total, &count) != 0 ||
+        (*chunks = malloc(sizeof(Digest) * (count ? count : 1))) == NULL)
+        return -1;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t clen;
+        chunk_entry(obj, i, &(*chunks)[i], &clen);
+    }
+    *n = count;
+    return 1;
+}
+
+int cas_chunk_list(const Digest *d, Digest **chunks, size_t *n) {
+    *chunks = NULL;
+    *n = 0;
+    StoredObject o;
+    if (open_stored(d, &o) != 0) return -1;
+    int frame = o.frame;
+    unsigned char *list = frame == FRAME_CHUNKS ? read_stored(&o) : NULL;
+    size_t len = (size_t)o.len;
+    close_stored(&o);
+    if (frame != FRAME_CHUNKS) return 0;
+    int rc = list ? cas_parse_chunk_list(list, len, chunks, n) : -1;
+    free(list);
+    return rc;
+}
+
+/* ---- trees ---- */
+
+static int cmp_entry_ptr(const void *a, const void *b) {
+    return strcmp((*(const CasTreeEntry *const *)a)->name, (*(const CasTreeEntry *const *)b)->name);
+}
+
+int cas_put_tree(const CasTreeEntry entries[], size_t n, int store, Digest *out) {
+    const CasTreeEntry **sorted = malloc(sizeof(*sorted) * (n ? n : 1));
+    if (!sorted || n > UINT32_MAX) {
+        free(sorted);
+        return -1;
+    }
+    size_t len = FRAME_HEADER_SIZE + 4;
+    for (size_t i = 0; i < n; ++i) {
+        sorted[i] = &entries[i];
+        len += TREE_ENTRY_FIXED + strlen(entries[i].name);
+    }
+    qsort(sorted, n, sizeof(*sorted), cmp_entry_ptr);
+    unsigned char *buf = malloc(len);
+    int rc = buf ? 0 : -1;
+    size_t off = FRAME_HEADER_SIZE + 4;
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        const CasTreeEntry *e = sorted[i];
+        size_t name_len = strlen(e->name);
+        if (name_len > UINT16_MAX || !tree_mode_ok(e->mode) || !tree_name_ok((const unsigned char *)e->name, name_len) ||
+            (i > 0 && strcmp(sorted[i - 1]->name, e->name) == 0)) {
+            rc = -1;
+            break;
+        }
+        put_le32(buf + off, e->mode);
+        memcpy(buf + off + 4, e->d.b, DIGEST_SIZE);
+        buf[off + 36] = (unsigned char)name_len;
+        buf[off + 37] = (unsigned char)(name_len >> 8);
+        memcpy(buf + off + TREE_ENTRY_FIXED, e->name, name_len);
+        off += TREE_ENTRY_FIXED + name_len;
+    }
+    if (rc == 0) {
+        frame_header(buf, FRAME_TREE);
+        put_le32(buf + FRAME_HEADER_SIZE, (uint32_t)n);
+        digest_buffer(buf, len, out);
+        // trees are small and already dense: never compressed
+        if (store) rc = write_object(out, NULL, 0, buf, len, DURABLE_ORDERED, NULL);
+    }
+    free(buf);
+    free(sorted);
+    return rc;
+}
+
+// Whether o is a tree, and where its listing starts. A file whose content
+// happens to be a tree listing was stored as FRAME_RAW, and is the same tree.
+static int tree_start(const StoredObject *o, size_t *start) {
+    unsigned char inner[FRAME_HEADER_SIZE];
+    *start = 0;
+    if (o->frame == FRAME_TREE) return 1;
+    if (o->frame != FRAME_RAW || o->len < 2 * FRAME_HEADER_SIZE ||
+        pread_full(o->fd, inner, sizeof(inner), o->off + FRAME_HEADER_SIZE) != 0 ||
+        !starts_with_magic(inner, sizeof(inner)) || inner[FRAME_MAGIC_LEN] != FRAME_TREE)
+        return 0;
+    *start = FRAME_HEADER_SIZE;
+    return 1;
+}
+
+int cas_tree_entries(const Digest *d, CasTreeEntry **entries, size_t *n) {
+    *entries = NULL;
+    *n = 0;
+    StoredObject o;
+    if (open_stored(d, &o) != 0) return -1;
+    size_t start;
+    int is_tree = tree_start(&o, &start);
+    unsigned char *buf = is_tree ? read_stored(&o) : NULL;
+    size_t len = (size_t)o.len - start;
+    close_stored(&o);
+    if (!is_tree) return 0;
+    uint32_t count;
+    const unsigned char *obj = buf ? buf + start : NULL;
+    if (!obj || parse_tree(obj, len, &count) != 0 || (*entries = calloc(count ? count : 1, sizeof(CasTreeEntry))) == NULL) {
+        free(buf);
+        return -1;
+    }
+    size_t off = FRAME_HEADER_SIZE + 4;
+    for (uint32_t i = 0; i < count; ++i) {
+        CasTreeEntry *e = &(*entries)[i];
+        const unsigned char *name;
+        size_t name_len;
+        tree_entry(obj, &off, &e->mode, &e->d, &name, &name_len);
+        if ((e->name = malloc(name_len + 1)) == NULL) {
+            cas_free_tree_entries(*entries, i);
+            *entries = NULL;
+            free(buf);
+            return -1;
+        }
+        memcpy(e->name, name, name_len);
+        e->name[name_len] = '\0';
+    }
+    *n = count;
+    free(buf);
+    return 1;
+}
+
+void cas_free_tree_entries(CasTreeEntry *entries, size_t n) {
+    for (size_t i = 0; entries && i < n; ++i) free(entries[i].name);
+    free(entries);
+}
+
+int cas_is_tree(const Digest *d) {
+    StoredObject o;
+    if (open_stored(d, &o) != 0) return -1;
+    size_t start;
+    int is_tree = tree_start(&o, &start);
+    close_stored(&o);
+    return is_tree;
+}
+
+int cas_parse_object_refs(const unsigned char *obj, size_t len, Digest **refs, size_t *n) {
+    *refs = NULL;
+    *n = 0;
+    if (starts_with_magic(obj, len) && len >= 2 * FRAME_HEADER_SIZE && obj[FRAME_MAGIC_LEN] == FRAME_RAW &&
+        starts_with_magic(obj + FRAME_HEADER_SIZE, len - FRAME_HEADER_SIZE) &&
+        obj[FRAME_HEADER_SIZE + FRAME_MAGIC_LEN] == FRAME_TREE) {
+        obj += FRAME_HEADER_SIZE;
+        len -= FRAME_HEADER_SIZE;
+    }
+    if (len < FRAME_HEADER_SIZE || !starts_with_magic(obj, len) || obj[FRAME_MAGIC_LEN] != FRAME_TREE)
+        return cas_parse_chunk_list(obj, len, refs, n);
+    uint32_t count;
+    if (parse_tree(obj, len, &count) != 0 || (*refs = malloc(sizeof(Digest) * (count ? count : 1))) == NULL)
+        return -1;
+    size_t off = FRAME_HEADER_SIZE + 4;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t mode;
+        const unsigned char *name;
+        size_t name_len;
+        tree_entry(obj, &off, &mode, &(*refs)[i], &name, &name_len);
+    }
+    *n = count;
+    return 1;
+}
+
+int cas_object_refs(const Digest *d, Digest **refs, size_t *n) {
+    *refs = NULL;
+    *n = 0;
+    StoredObject o;
+    if (open_stored(d, &o) != 0) return -1;
+    size_t start;
+    int has_refs = o.frame == FRAME_CHUNKS || tree_start(&o, &start);
+    unsigned char *buf = has_refs ? read_stored(&o) : NULL;
+    size_t len = (size_t)o.len;
+    close_stored(&o);
+    if (!has_refs) return 0;
+    int rc = buf ? cas_parse_object_refs(buf, len, refs, n) : -1;
+    free(buf);
+    return rc;
+}
+
+int cas_verify_object(const Digest *d, uint64_t *bytes) {
+    StoredObject o;
+    if (bytes) *bytes = 0;
+    if (open_stored(d, &o) != 0) return -1;
+    VerifyState v;
+    digest_init(&v.ctx);
+    v.bytes = 0;
+    uint64_t size;
+    int rc = o.frame == FRAME_CHUNKS ? read_chunks(&o, &v) : read_content(&o, &v, &size);
+    close_stored(&o);
+    Digest got;
+    digest_final(&v.ctx, &got);
+    if (bytes) *bytes = v.bytes;
+    return rc == 0 && digest_eq(&got, d) ? 0 : 1;
+}
+
+/* ---- streamed object writes ---- */
+
+#define WRITER_MEMORY_MAX (64 * 1024) // objects up to this size are written whole
+
+struct CasObjectWriter {
+    Digest d;
+    unsigned char *mem; // the bytes so far, until they move to the temp object
+    size_t mem_len, mem_cap;
+    int spilled;
+    DurableFile f;
+    DigestCtx ctx;      // content hash of a plain spilled object
+    unsigned char head[2 * FRAME_HEADER_SIZE];
+    size_t head_len;
+    uint64_t len;
+};
+
+// Whether stored bytes starting with head name other objects: a chunk
+// list, or a tree (which may sit inside FRAME_RAW). 1 while too short to tell.
+static int head_has_refs(const unsigned char *head, size_t len) {
+    if (len < FRAME_HEADER_SIZE) return 1;
+    if (!starts_with_magic(head, len)) return 0;
+    if (head[FRAME_MAGIC_LEN] == FRAME_CHUNKS || head[FRAME_MAGIC_LEN] == FRAME_TREE) return 1;
+    if (head[FRAME_MAGIC_LEN] != FRAME_RAW) return 0;
+    if (len < 2 * FRAME_HEADER_SIZE) return 1;
+    return starts_with_magic(head + FRAME_HEADER_SIZE, len - FRAME_HEADER_SIZE) &&
+           head[FRAME_HEADER_SIZE + FRAME_MAGIC_LEN] == FRAME_TREE;
+}
+
+CasObjectWriter *cas_object_writer_new(const Digest *d) {
+    CasObjectWriter *w = calloc(1, sizeof(*w));
+    if (w) w->d = *d;
+    return w;
+}
+
+// Move the buffered bytes to a temp object and stream from here on
+static int writer_spill(CasObjectWriter *w) {
+    if (open_temp_object(&w->f) != 0) return -1;
+    if (write_all(w->f.fd, w->mem, w->mem_len) != 0) {
+        durable_abort(&w->f);
+        return -1;
+    }
+    w->spilled = 1;
+    digest_init(&w->ctx);
+    if (!starts_with_magic(w->head, w->head_len)) digest_update(&w->ctx, w->mem, w->mem_len);
+    free(w->mem);
+    w->mem = NULL;
+    w->mem_len = w->mem_cap = 0;
+    return 0;
+}
+
+int cas_object_writer_write(CasObjectWriter *w, const unsigned char *data, size_t len) {
+    if (w->head_len < sizeof(w->head)) {
+        size_t take = sizeof(w->head) - w->head_len < len ? sizeof(w->head) - w->head_len : len;
+        memcpy(w->head + w->head_len, data, take);
+        w->head_len += take;
+    }
+    w->len += len;
+    if (w->spilled) {
+        if (!starts_with_magic(w->head, w->head_len)) digest_update(&w->ctx, data, len);
+        return write_all(w->f.fd, data, len);
+    }
+    if (w->mem_len + len > w->mem_cap) {
+        size_t cap = w->mem_cap ? w->mem_cap : 4096;
+        while (cap < w->mem_len + len) cap *= 2;
+        unsigned char *p = realloc(w->mem, cap);
+        if (!p) return -1;
+        w->mem = p;
+        w->mem_cap = cap;
+    }
+    memcpy(w->mem + w->mem_len, data, len);
+    w->mem_len += len;
+    // a chunk list or tree stays in memory: it can only be checked once
+    // what it names is stored
+    if (w->mem_len > WRITER_MEMORY_MAX && !head_has_refs(w->head, w->head_len)) return writer_spill(w);
+    return 0;
+}
+
+int cas_object_writer_refs(CasObjectWriter *w, Digest **refs, size_t *n) {
+    *refs = NULL;
+    *n = 0;
+    if (w->spilled) return 0;
+    return cas_parse_object_refs(w->mem ? w->mem : (const unsigned char *)"", w->mem_len, refs, n);
+}
+
+int cas_object_writer_commit(CasObjectWriter *w) {
+    int rc;
+    if (!w->spilled) {
+        rc = cas_write_object(&w->d, w->mem ? w->mem : (const unsigned char *)"", w->mem_len);
+    } else {
+        // a spilled object is plain content, FRAME_RAW or FRAME_COMPRESSED
+        Digest got;
+        if (!starts_with_magic(w->head, w->head_len)) {
+            digest_final(&w->ctx, &got);
+            rc = 0;
+        } else {
+            StoredObject o = { .fd = w->f.fd, .loose = 0, .off = 0, .len = (off_t)w->len,
+                               .frame = w->head[FRAME_MAGIC_LEN] };
+            VerifyState v;
+            uint64_t size;
+            digest_init(&v.ctx);
+            v.bytes = 0;
+            rc = read_content(&o, &v, &size);
+            digest_final(&v.ctx, &got);
+        }
+        if (rc == 0 && digest_eq(&got, &w->d)) {
+            rc = publish_temp_object(&w->f, &w->d, 0, NULL);
+        } else {
+            durable_abort(&w->f);
+            rc = -1;
+        }
+    }
+    free(w->mem);
+    free(w);
+    return rc;
+}
+
+void cas_object_writer_abort(CasObjectWriter *w) {
+    if (!w) return;
+    if (w->spilled) durable_abort(&w->f);
+    free(w->mem);
+    free(w);
+}
+
+typedef struct {
+    Digest *d;
+    size_t n;
+} DigestSet;
+
+static int not_quarantined(const uint8_t digest[32], void *arg) {
+    const DigestSet *s = arg;
+    Digest key;
+    memcpy(key.b, digest, DIGEST_SIZE);
+    return bsearch(&key, s->d, s->n, sizeof(Digest), digest_qsort_cmp) == NULL;
+}
+
+// Keep whatever can still be read of a packed copy, so the quarantine
+// lists every object it took
+static int save_packed_copy(const Digest *d, const char *path) {
+    unsigned char *data = NULL;
+    size_t len = 0;
+    if (access(path, F_OK) == 0) return 0;
+    if (cas_read_object(d, &data, &len) != 0) len = 0;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+    int rc = fd >= 0 && write_all(fd, data, len) == 0 ? 0 : -1;
+    if (fd >= 0 && close(fd) != 0) rc = -1;
+    free(data);
+    return rc;
+}
+
+int cas_quarantine_objects(const Digest d[], size_t n) {
+    if (n == 0) return 0;
+    if (ensure_dir_recursive(quarantine_root) != 0) return -1;
+    DigestSet packed = { malloc(sizeof(Digest) * n), 0 };
+    if (!packed.d) return -1;
+    int rc = 0;
+    for (size_t i = 0; i < n; ++i) {
+        char hex[DIGEST_HEX_SIZE], path[1200];
+        ObjectLoc loc;
+        snprintf(path, sizeof(path), "%s/%s", quarantine_root, digest_to_hex(&d[i], hex));
+        object_loc(&d[i], &loc);
+        if (renameat(loc.dirfd, loc.name, AT_FDCWD, path) != 0 && errno != ENOENT) rc = -1;
+        if (!pack_find(d[i].b, NULL)) continue;
+        if (save_packed_copy(&d[i], path) != 0) rc = -1;
+        packed.d[packed.n++] = d[i];
+    }
+    if (packed.n > 0) {
+        qsort(packed.d, packed.n, sizeof(Digest), digest_qsort_cmp);
+        if (pack_prune(not_quarantined, &packed, NULL) != 0) rc = -1;
+    }
+    free(packed.d);
+    return rc;
+}
+
+typedef struct {
+    int (*fn)(const Digest *d, void *ctx);
+    void *ctx;
+    int stopped;
+} ForEachCtx;
+
+static int for_each_packed(const uint8_t digest[32], void *arg) {
+    ForEachCtx *c = arg;
+    Digest d;
+    memcpy(d.b, digest, DIGEST_SIZE);
+    return (c->stopped = c->fn(&d, c->ctx));
+}
+
+static int count_object(const Digest *d, void *ctx) {
+    (void)d;
+    (*(uint64_t *)ctx)++;
+    return 0;
+}
+
+static int add_to_filter(const Digest *d, void *ctx) {
+    (void)ctx;
+    bloom_add(d->b);
+    return 0;
+}
+
+int cas_rebuild_filter(uint64_t *objects) {
+    uint64_t n = 0;
+    if (cas_for_each_object(count_object, &n) != 0 || bloom_rebuild_begin(n) != 0) return -1;
+    // objects published from here on are added by their writers
+    int rc = cas_for_each_object(add_to_filter, NULL);
+    if (bloom_rebuild_finish() != 0) rc = -1;
+    if (objects) *objects = n;
+    return rc;
+}
+
+// Loose objects of shard b
+static void for_each_loose(int b, ForEachCtx *c) {
+    int dfd = openat(shard_fds[b], ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = dfd >= 0 ? fdopendir(dfd) : NULL;
+    if (!dir) {
+        if (dfd >= 0) close(dfd);
+        return;
+    }
+    struct dirent *de;
+    while (!c->stopped && (de = readdir(dir)) != NULL) {
+        char hex[DIGEST_HEX_SIZE];
+        Digest d;
+        if (strlen(de->d_name) != 62) continue;
+        snprintf(hex, 3, "%02x", b);
+        memcpy(hex + 2, de->d_name, 63);
+        if (digest_from_hex(hex, &d) != 0) continue;
+        c->stopped = c->fn(&d, c->ctx);
+    }
+    closedir(dir);
+}
+
+int cas_for_each_object_in_shard(int shard, int (*fn)(const Digest *d, void *ctx), void *ctx) {
+    if (shard < 0 || shard > 255) return -1;
+    ForEachCtx c = { fn, ctx, 0 };
+    for_each_loose(shard, &c);
+    if (!c.stopped) {
+        pack_reload();
+        if (pack_for_each_prefix((uint8_t)shard, for_each_packed, &c) != 0) return -1;
+    }
+    return 0;
+}
+
+int cas_for_each_object(int (*fn)(const Digest *d, void *ctx), void *ctx) {
+    ForEachCtx c = { fn, ctx, 0 };
+    for (int b = 0; b < 256 && !c.stopped; ++b) for_each_loose(b, &c);
+    if (!c.stopped) {
+        pack_reload();
+        if (pack_for_each(for_each_packed, &c) != 0) return -1;
+    }
+    return 0;
+}
+
+int cas_detach_output(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_nlink < 2 ||
+        (st.st_mode & S_IWUSR))
+        return 0;
+    int src = open(path, O_RDONLY);
+    if (src < 0) return -1;
+    char tmp[2048];
+    snprintf(tmp, sizeof(tmp), "%s.reprovm-detach.%ld", path, (long)getpid());
+    int rc = materialize_fd(CAS_MAT_COPY_RANGE, src, 0, st.st_size, tmp);
+    if (rc != 0) rc = materialize_fd(CAS_MAT_COPY, src, 0, st.st_size, tmp);
+    close(src);
+    if (rc == 0 && rename(tmp, path) != 0) {
+        unlink(tmp);
+        rc = -1;
+    }
+    return rc;
+}
+
+/* ---- repack ---- */
+
+// Move the loose objects of one shard into w. Objects that fail verification
+// are left alone; ones already packed are just dropped.
+static int repack_shard(int b, PackWriter **w, CasRepackStats *stats,
+                        char ***done, size_t *n_done, size_t *cap_done) {
+    char shard[1100];
+    snprintf(shard, sizeof(shard), "%s/%02x", objects_root, b);
+    int dfd = openat(shard_fds[b], ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *d = dfd >= 0 ? fdopendir(dfd) : NULL;
+    if (!d) {
+        if (dfd >= 0) close(dfd);
+        return 0;
+    }
+    unsigned char *buf = malloc(PACK_MAX_OBJECT);
+    if (!buf) {
+        closedir(d);
+        return -1;
+    }
+    char prefix[4];
+    snprintf(prefix, sizeof(prefix), "%02x", b);
+    int rc = 0;
+    struct dirent *de;
+    while (rc == 0 && (de = readdir(d)) != NULL) {
+        if (strlen(de->d_name) != 62) continue;
+        char hex[DIGEST_HEX_SIZE], path[2048];
+        memcpy(hex, prefix, 2);
+        memcpy(hex + 2, de->d_name, 63);
+        snprintf(path, sizeof(path), "%s/%s", shard, de->d_name);
+        Digest want;
+        if (digest_from_hex(hex, &want) != 0) continue;
+        struct stat st;
+        if (fstatat(shard_fds[b], de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (pack_find(want.b, NULL)) {
+            if (unlinkat(shard_fds[b], de->d_name, 0) == 0) stats->duplicates_removed++;
+            continue;
+        }
+        if (st.st_size > PACK_MAX_OBJECT) {
+            stats->loose_kept++;
+            continue;
+        }
+        int fd = openat(shard_fds[b], de->d_name, O_RDONLY | O_CLOEXEC);
+        size_t len = 0;
+        int readable = fd >= 0 && read_fd_fully(fd, buf, PACK_MAX_OBJECT, &len) == 0;
+        if (fd >= 0) close(fd);
+        if (!readable) continue;
+        if (verify_stored(&want, buf, len) != 0) {
+            fprintf(stderr, "Warning: %s does not match its name, not packing it\n", path);
+            stats->corrupt_skipped++;
+            continue;
+        }
+        if (*w && pack_writer_size(*w) + len > PACK_MAX_BYTES) {
+            if (pack_writer_commit(*w) != 0) rc = -1;
+            else stats->packs_written++;
+            *w = NULL;
+            // loose copies of a committed pack can go now
+            for (size_t i = 0; i < *n_done; ++i) {
+                if (rc == 0) unlink((*done)[i]);
+                free((*done)[i]);
+            }
+            *n_done = 0;
+            if (rc != 0) break;
+        }
+        if (!*w && (*w = pack_writer_begin(pack_root)) == NULL) {
+            rc = -1;
+            break;
+        }
+        if (pack_writer_add(*w, want.b, buf, len) != 0) {
+            rc = -1;
+            break;
+        }
+        if (*n_done == *cap_done) {
+            size_t new_cap = *cap_done ? *cap_done * 2 : 1024;
+            char **grown = realloc(*done, sizeof(char *) * new_cap);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            *done = grown;
+            *cap_done = new_cap;
+        }
+        (*done)[(*n_done)++] = strdup_safe(path);
+        stats->objects_packed++;
+        stats->bytes_packed += len;
+    }
+    free(buf);
+    closedir(d);
+    return rc;
+}
+
+int cas_repack(CasRepackStats *stats) {
+    CasRepackStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    pack_reload();
+    PackWriter *w = NULL;
+    char **done = NULL;
+    size_t n_done = 0, cap_done = 0;
+    int rc = 0;
+    for (int b = 0; b < 256 && rc == 0; ++b)
+        rc = repack_shard(b, &w, stats, &done, &n_done, &cap_done);
+    if (w) {
+        if (rc != 0) pack_writer_abort(w);
+        else if (pack_writer_commit(w) == 0) stats->packs_written++;
+        else rc = -1;
+    }
+    // loose objects are removed only once the pack holding them is visible
+    for (size_t i = 0; i < n_done; ++i) {
+        if (rc == 0) unlink(done[i]);
+        free(done[i]);
+    }
+    free(done);
+    return rc;
+}
+
+int cas_store(const char *path, char out_hex[65]) {
+    Digest d;
+    if (cas_store_blob_from_file(path, &d) != 0) return -1;
+    digest_to_hex(&d, out_hex);
+    return 0;
+}
+
+int cas_fetch(const char *hash, const char *dest) {
+    Digest d;
+    if (digest_from_hex(hash, &d) != 0) return -1;
+    return cas_restore_blob_to_file(&d, dest);
+}
+
+int cas_hash_of_file(const char *path, char out_hex[65]) {
+    Digest d;
+    if (cas_hash_files_batch(&path, 1, &d) != 0) return -1;
+    digest_to_hex(&d, out_hex);
+    return 0;
 }
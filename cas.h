@@ -2,27 +2,239 @@
 #define CAS_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "digest.h"
+
+// Ways to put an object at an output path, in fallback order
+typedef enum {
+    CAS_MAT_REFLINK,    // FICLONE: shares extents, copy-on-write
+    CAS_MAT_HARDLINK,   // link to the read-only object
+    CAS_MAT_COPY_RANGE, // copy_file_range, then sendfile (in-kernel copy)
+    CAS_MAT_COPY,       // read/write in userspace
+    CAS_MAT_COUNT
+} CasMaterialize;
+
+// Counters for this process
+typedef struct {
+    uint64_t materialized[CAS_MAT_COUNT]; // restores served by each strategy
+    uint64_t reassembled;                 // restores rebuilt from chunks
+    uint64_t chunked_files;               // files stored as chunk lists
+    uint64_t chunk_logical_bytes;         // bytes in those files
+    uint64_t chunk_stored_bytes;          // bytes of chunks that were new to the store
+    uint64_t decompressed;                // restores decoded from compressed objects
+    uint64_t compressed_objects;          // objects written compressed
+    uint64_t compress_in_bytes;           // their content size
+    uint64_t compress_out_bytes;          // their stored size
+    uint64_t filter_negatives;            // existence probes answered "absent" by the object filter
+    uint64_t filter_false_positives;      // probes it passed on that found nothing
+} CasStats;
 
 // Initialize the CAS and cache directories under base_dir (e.g., ".reprovm")
 int cas_init(const char *base_dir);
 
-// Store a blob from memory; returns newly allocated hash string (hex), or NULL on error.
-// The blob is written into CAS if not already present.
-char *cas_store_blob_from_memory(const unsigned char *data, size_t len);
+// Flush persistent CAS state (queued objects, stat index) before exit
+void cas_shutdown(void);
+
+// Store a blob from memory; fills out with its digest. Returns 0 on success.
+// The blob is written into CAS if not already present. When LZ4 is enabled
+// in g_compression_config, objects that look compressible are stored
+// compressed; restore decompresses them transparently.
+int cas_store_blob_from_memory(const unsigned char *data, size_t len, Digest *out);
+
+// Store a blob from an existing file; fills out with its digest. Returns 0 on success.
+// The file is read once: hashed while it is copied into a temp object, which
+// is then linked into place by digest (see durability.h for when that
+// reaches the disk). Files whose stat fingerprint matches
+// the index are not re-read.
+int cas_store_blob_from_file(const char *path, Digest *out);
+
+// Hash many files without storing them. Small files are read whole and hashed
+// several at a time in parallel SIMD lanes; large files are streamed.
+// out[i] receives the digest, or stays all-zero if paths[i] could not be
+// read. Returns 0 if every file was hashed, -1 otherwise.
+int cas_hash_files_batch(const char *const paths[], int n, Digest out[]);
 
-// Store a blob from an existing file; returns hash string (caller must free)
-char *cas_store_blob_from_file(const char *path);
+// Same as cas_hash_files_batch, but also stores every file in the CAS in the
+// same pass, so callers get both the digest and the object from one read.
+// With the io_uring backend, stats, small-file reads and object writes of a
+// batch are submitted together rather than one syscall at a time.
+int cas_store_files_batch(const char *const paths[], int n, Digest out[]);
+
+// Files of at least this many bytes are stored as content-defined chunks
+// (see chunker.h) plus a chunk list named by the whole file's digest, so
+// edited large files share most of their storage. 0 (the default) disables it.
+void cas_set_chunk_threshold(uint64_t bytes);
 
 // Check if a blob exists already
-int cas_blob_exists(const char *hash);
+int cas_blob_exists(const Digest *d);
+
+// cas_blob_exists for n digests at once: out[i] is 1 if d[i] is present.
+// With the io_uring backend (io_batch.h) all probes are in flight together.
+// Returns 0, or -1 if out of memory.
+int cas_blobs_exist_batch(const Digest d[], int n, int out[]);
+
+// Restore blob to a destination file (replaces it). The preferred
+// materialization strategy is tried first, then each later one in turn.
+int cas_restore_blob_to_file(const Digest *d, const char *dest);
+
+// Restore d[i] to dests[i] for every i, with the same fallbacks. With the
+// io_uring backend the opens, links and closes of all outputs go out as
+// batches. dests must be distinct. Returns 0 if every output was restored,
+// -1 otherwise.
+int cas_restore_blobs_batch(const Digest d[], const char *const dests[], int n);
+
+// A second tier behind the local store: when set, a restore that finds an
+// object missing calls fetch(d, n) to bring it (and what it names) into
+// the store before giving up, e.g. remote_cas.h does once configured.
+// NULL, the default, keeps reads local. fetch returns 0 once every
+// object is stored.
+typedef int (*CasFetchFn)(const Digest d[], size_t n);
+void cas_set_fetch_handler(CasFetchFn fetch);
+
+// Bring the ones of d[0..n) missing here in through the fetch handler,
+// all together. Returns 0 if every object is present afterwards.
+int cas_fetch_missing(const Digest d[], int n);
+
+// Pick the first strategy tried on restore by name ("reflink", "hardlink",
+// "copy_range", "copy"). Returns -1 if the name is unknown.
+int cas_set_materialize_strategy(const char *name);
+const char *cas_materialize_strategy_name(CasMaterialize s);
+
+// Replace a hardlinked, read-only output with a private writable copy so a
+// task can rewrite it without touching the CAS object. No-op for other files.
+int cas_detach_output(const char *path);
+
+// Move loose objects of at most PACK_MAX_OBJECT bytes into packfiles
+// (see pack.h). Lookups and restores check packs and loose objects alike,
+// so this is safe to run at any time.
+typedef struct {
+    uint64_t objects_packed;
+    uint64_t bytes_packed;
+    uint64_t packs_written;
+    uint64_t duplicates_removed; // loose copies of already-packed objects
+    uint64_t loose_kept;         // too large to pack
+    uint64_t corrupt_skipped;    // content does not match the name
+} CasRepackStats;
+
+int cas_repack(CasRepackStats *stats);
+
+// Stored form of an object, for moving objects between stores: the bytes
+// are exactly what sits in the object store (a chunk list stays a chunk
+// list). cas_write_object checks them against d before writing; a chunk
+// list or tree is only accepted once everything it names is present.
+int cas_read_object(const Digest *d, unsigned char **data, size_t *len); // caller frees *data
+int cas_write_object(const Digest *d, const unsigned char *data, size_t len);
+
+// The stored form of d for streaming: *len bytes of *fd (caller closes)
+// from *off. Returns 0, or -1 if d is missing.
+int cas_open_object(const Digest *d, int *fd, off_t *off, uint64_t *len);
+
+// cas_write_object for stored bytes that arrive in pieces. A large object
+// goes to a temp object as it arrives, never whole in memory; small ones,
+// chunk lists and trees are held until commit. cas_object_writer_refs
+// tells what a chunk list or tree names (as cas_parse_object_refs), so a
+// caller can store those first. Commit checks the bytes against d, stores
+// them and frees w; abort drops them.
+typedef struct CasObjectWriter CasObjectWriter;
+CasObjectWriter *cas_object_writer_new(const Digest *d);
+int cas_object_writer_write(CasObjectWriter *w, const unsigned char *data, size_t len);
+int cas_object_writer_refs(CasObjectWriter *w, Digest **refs, size_t *n);
+int cas_object_writer_commit(CasObjectWriter *w);
+void cas_object_writer_abort(CasObjectWriter *w);
+
+// Content of a small object in a fresh buffer (caller frees *data), whatever
+// its stored form; chunk lists are not read this way. Returns 0 on success.
+int cas_read_blob(const Digest *d, unsigned char **data, size_t *len);
+
+// Create or replace name in the cache root with data, atomically (a reader
+// sees the old file or the new one, whole). It is as durable as the
+// durability mode asks, and never durable before objects stored ahead of it
+// (durability.h), so a record cannot survive a crash that lost its outputs.
+int cas_write_cache_file(const char *name, const void *data, size_t len);
+
+// If stored bytes from cas_read_object are a chunk list, set *chunks
+// (caller frees) and *n and return 1. Returns 0 for any other object, -1 for
+// a damaged chunk list. cas_chunk_list does the same for a local object.
+int cas_parse_chunk_list(const unsigned char *obj, size_t len, Digest **chunks, size_t *n);
+int cas_chunk_list(const Digest *d, Digest **chunks, size_t *n);
+
+// Directory listings (Merkle trees). A tree is an object listing its
+// children by name, mode and digest; a child is a file's content, a
+// symlink's target, or another tree. Its digest covers the whole listing,
+// so two directories with equal digests are equal all the way down.
+#define CAS_TREE_FILE 0100644u
+#define CAS_TREE_EXEC 0100755u
+#define CAS_TREE_DIR 0040000u
+#define CAS_TREE_SYMLINK 0120000u
+
+typedef struct {
+    uint32_t mode; // CAS_TREE_*
+    Digest d;
+    char *name;    // one path component
+} CasTreeEntry;
+
+// Digest of the tree with these entries (any order; names must be distinct
+// path components), into out; with store set the tree is also written, after
+// the children, which must already be in the store. Returns 0 on success.
+int cas_put_tree(const CasTreeEntry entries[], size_t n, int store, Digest *out);
+
+// If d is a tree, set *entries (sorted by name; free with
+// cas_free_tree_entries) and *n and return 1. Returns 0 for any other
+// object, -1 if d is missing or damaged.
+int cas_tree_entries(const Digest *d, CasTreeEntry **entries, size_t *n);
+void cas_free_tree_entries(CasTreeEntry *entries, size_t n);
+
+// 1 if d is a tree, 0 if another object, -1 if missing
+int cas_is_tree(const Digest *d);
+
+// The objects an object needs: the chunks of a chunk list or the children
+// of a tree. Same results as cas_parse_chunk_list / cas_chunk_list, which
+// see only chunk lists.
+int cas_parse_object_refs(const unsigned char *obj, size_t len, Digest **refs, size_t *n);
+int cas_object_refs(const Digest *d, Digest **refs, size_t *n);
+
+// Rebuild the object filter (bloom.h) from a scan of the store, sized for
+// the objects found. Returns 0 on success; *objects gets the count.
+int cas_rebuild_filter(uint64_t *objects);
+
+// Observed false-positive rate of the object filter: false positives over
+// all probes for absent objects that it saw (0 before any)
+double cas_filter_fp_rate(const CasStats *st);
+
+// Call fn for every object, loose and packed, until it returns nonzero.
+// An object may be reported twice while a repack runs. Returns 0 on success.
+int cas_for_each_object(int (*fn)(const Digest *d, void *ctx), void *ctx);
+
+// cas_for_each_object for the objects whose digest starts with byte shard
+int cas_for_each_object_in_shard(int shard, int (*fn)(const Digest *d, void *ctx), void *ctx);
+
+// Rehash the stored object d and compare it with its name; a chunk list
+// must reassemble from its chunks. Returns 0 if intact, 1 if corrupt or
+// unreadable, -1 if d is not in the store. *bytes (optional) gets the
+// bytes read.
+int cas_verify_object(const Digest *d, uint64_t *bytes);
+
+// Move objects out of the store into the quarantine directory, named by
+// digest (packed copies are cut out of their packs). Records that need
+// them are left alone; see gc_quarantine. Returns 0 on success.
+int cas_quarantine_objects(const Digest d[], size_t n);
+
+void cas_get_stats(CasStats *out);
+double cas_dedup_ratio(const CasStats *st); // chunk bytes ingested per byte newly stored
+void cas_print_stats(FILE *out); // one summary line per non-zero counter group
 
-// Restore blob to a destination file (overwrites)
-int cas_restore_blob_to_file(const char *hash, const char *dest);
+// Hex conveniences for callers at the text boundary: digests are written into a 65-byte buffer.
+int cas_store(const char *path, char out_hex[65]);
+int cas_fetch(const char *hash, const char *dest);
+int cas_hash_of_file(const char *path, char out_hex[65]); // hash only, does not store
 
 // Get path to the object (internal use)
-int cas_get_object_path(const char *hash, char *out_path, size_t sz);
+int cas_get_object_path(const Digest *d, char *out_path, size_t sz);
 
 // Base paths (you can read these if needed)
 const char *cas_get_objects_root();
+const char *cas_get_quarantine_root();
 const char *cas_get_cache_root();
 #endif
@@ -0,0 +1,41 @@
+// chunker.c
+#include "chunker.h"
+#include <pthread.h>
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// splitmix64 from a fixed seed: reproducible everywhere, no table to ship
+static void init_gear(void) {
+    uint64_t x = 0x5265707256564d31ULL; // "ReprVVM1"
+    for (int i = 0; i < 256; ++i) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+// The high bits of the gear hash mix the most bytes. Below the average size
+// a stricter mask (2 bits more than log2(avg)) makes cuts rarer, above it a
+// looser one (2 bits fewer) makes them likelier, pulling sizes to the average.
+#define MASK_S (((1ULL << 16) - 1) << 48)
+#define MASK_L (((1ULL << 12) - 1) << 52)
+
+size_t chunker_next_cut(const uint8_t *data, size_t len) {
+    pthread_once(&gear_once, init_gear);
+    if (len <= CHUNK_MIN_SIZE) return len;
+    size_t end = len < CHUNK_MAX_SIZE ? len : CHUNK_MAX_SIZE;
+    size_t normal = end < CHUNK_AVG_SIZE ? end : CHUNK_AVG_SIZE;
+    uint64_t fp = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_S)) return i + 1;
+    }
+    for (; i < end; ++i) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_L)) return i + 1;
+    }
+    return end;
+}
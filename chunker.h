@@ -0,0 +1,22 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FastCDC content-defined chunking (gear rolling hash with normalized
+ * chunking). Cut points depend only on nearby content, so an edit moves at
+ * most the chunk boundaries around it and the remaining chunks deduplicate.
+ * The gear table is fixed, so every machine cuts the same data identically.
+ */
+
+#define CHUNK_MIN_SIZE (4 * 1024)
+#define CHUNK_AVG_SIZE (16 * 1024)
+#define CHUNK_MAX_SIZE (64 * 1024)
+
+// Length of the first chunk of data[0..len). If more data follows, callers
+// must pass at least CHUNK_MAX_SIZE bytes so the cut is not truncated.
+size_t chunker_next_cut(const uint8_t *data, size_t len);
+
+#endif // CHUNKER_H
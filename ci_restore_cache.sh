@@ -1,5 +1,9 @@
 #!/usr/bin/env bash
 # Requires AWS CLI configured with credentials.
+# Not needed with a remote CAS (remote_cas_url): reprovm then fetches the
+# records and objects a build uses on demand. Restoring one file from
+# `reprovm cache export` with `reprovm cache import` is also much faster
+# than syncing the two directory trees file by file.
 
 set -euo pipefail
 
@@ -3,8 +3,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 
-// Note: This is a stub implementation. Full implementation would use zlib, lz4, etc.
+// Only the LZ4 codec is built in; other algorithms fall back to it.
 
 CompressionConfig g_compression_config = {
     .algorithm = COMPRESS_NONE,
@@ -13,14 +14,32 @@ CompressionConfig g_compression_config = {
 };
 
 void compression_init(CompressionAlgorithm algorithm, int level) {
+    if (algorithm != COMPRESS_NONE && algorithm != COMPRESS_LZ4) {
+        LOG_WARN("Compression algorithm %s is not built in, using lz4",
+                 compression_algorithm_name(algorithm));
+        algorithm = COMPRESS_LZ4;
+    }
     g_compression_config.algorithm = algorithm;
     g_compression_config.level = level;
     g_compression_config.enabled = (algorithm != COMPRESS_NONE);
 
-    LOG_INFO("Compression initialized: algorithm=%s, level=%d",
+    LOG_DEBUG("Compression initialized: algorithm=%s, level=%d",
              compression_algorithm_name(algorithm), level);
 }
 
+int compression_algorithm_from_name(const char *name, CompressionAlgorithm *out) {
+    static const CompressionAlgorithm all[] = {
+        COMPRESS_NONE, COMPRESS_ZLIB, COMPRESS_GZIP, COMPRESS_LZ4, COMPRESS_ZSTD
+    };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); ++i) {
+        if (strcmp(name, compression_algorithm_name(all[i])) == 0) {
+            *out = all[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
 const char* compression_algorithm_name(CompressionAlgorithm algorithm) {
     switch (algorithm) {
         case COMPRESS_NONE: return "none";
@@ -32,54 +51,234 @@ const char* compression_algorithm_name(CompressionAlgorithm algorithm) {
     }
 }
 
-// Stub implementation - would use actual compression libraries
+/*
+ * In-tree LZ4 block codec (the LZ4 block format: token, literals, 16-bit
+ * offset, match length). A greedy single-probe matcher keeps compression
+ * fast; decompression checks every length and offset against its buffers,
+ * so damaged input fails instead of overrunning.
+ */
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 13
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t compression_lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    uint32_t table[1 << LZ4_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const uint8_t *ip = src, *anchor = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+    if (n >= LZ4_MFLIMIT) {
+        const uint8_t *mflimit = iend - LZ4_MFLIMIT;
+        const uint8_t *matchlimit = iend - LZ4_LAST_LITERALS;
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash4(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(ref) != seq) {
+                ip += 1 + ((size_t)(ip - anchor) >> 6); // skip faster through literal runs
+                continue;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *mp = ip + LZ4_MIN_MATCH, *rp = ref + LZ4_MIN_MATCH;
+            while (mp < matchlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            size_t lit = (size_t)(ip - anchor), mlen = (size_t)(mp - ip) - LZ4_MIN_MATCH;
+            if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1) return 0;
+            uint8_t *token = op++;
+            *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+            if (lit >= 15) op = put_length(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+            size_t offset = (size_t)(ip - ref);
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+            *token |= (uint8_t)(mlen >= 15 ? 15 : mlen);
+            if (mlen >= 15) op = put_length(op, mlen - 15);
+            ip = anchor = mp;
+        }
+    }
+    size_t lit = (size_t)(iend - anchor);
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit) return 0;
+    *op++ = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = put_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return (size_t)(op - dst);
+}
+
+int compression_lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_len) {
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + out_len;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break; // the last sequence is literals only
+        if (iend - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < mlen) return -1;
+        const uint8_t *m = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, m, mlen);
+            op += mlen;
+        } else {
+            while (mlen--) *op++ = *m++; // overlapping copy repeats the pattern
+        }
+    }
+    return op == oend ? 0 : -1;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t compression_encode_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    // only keep the compressed form if it is strictly smaller
+    size_t stored = n ? compression_lz4_compress(src, n, dst + COMPRESSION_BLOCK_HEADER, n - 1) : 0;
+    if (stored == 0) {
+        memcpy(dst + COMPRESSION_BLOCK_HEADER, src, n);
+        stored = n;
+    }
+    put_le32(dst, (uint32_t)n);
+    put_le32(dst + 4, (uint32_t)stored);
+    return COMPRESSION_BLOCK_HEADER + stored;
+}
+
+int compression_block_header(const uint8_t hdr[COMPRESSION_BLOCK_HEADER], size_t *raw_len, size_t *stored_len) {
+    *raw_len = get_le32(hdr);
+    *stored_len = get_le32(hdr + 4);
+    return (*raw_len <= COMPRESSION_BLOCK_SIZE && *stored_len <= *raw_len) ? 0 : -1;
+}
+
+int compression_decode_block(const uint8_t *payload, size_t stored_len, uint8_t *dst, size_t raw_len) {
+    if (stored_len == raw_len) {
+        memcpy(dst, payload, raw_len);
+        return 0;
+    }
+    return compression_lz4_decompress(payload, stored_len, dst, raw_len);
+}
+
+static int lz4_active(void) {
+    return g_compression_config.enabled && g_compression_config.algorithm == COMPRESS_LZ4;
+}
+
 int compression_compress(const unsigned char *input, size_t input_len,
                         unsigned char **output, size_t *output_len) {
-    if (!g_compression_config.enabled || g_compression_config.algorithm == COMPRESS_NONE) {
+    if (!lz4_active()) {
         // No compression - just copy
-        *output = malloc(input_len);
+        *output = malloc(input_len ? input_len : 1);
         if (!*output) return -1;
         memcpy(*output, input, input_len);
         *output_len = input_len;
         return 0;
     }
 
-    // Stub: In production, use actual compression libraries
-    // For zlib: use compress2()
-    // For lz4: use LZ4_compress_default()
-    // For zstd: use ZSTD_compress()
-
-    LOG_DEBUG("Compression stub called (algorithm=%s, input_len=%zu)",
-              compression_algorithm_name(g_compression_config.algorithm), input_len);
-
-    // For now, just copy the data (no actual compression)
-    *output = malloc(input_len);
+    size_t blocks = (input_len + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE;
+    *output = malloc(input_len + blocks * COMPRESSION_BLOCK_HEADER + 1);
     if (!*output) return -1;
-    memcpy(*output, input, input_len);
-    *output_len = input_len;
+    size_t out = 0;
+    for (size_t off = 0; off < input_len; off += COMPRESSION_BLOCK_SIZE) {
+        size_t n = input_len - off < COMPRESSION_BLOCK_SIZE ? input_len - off : COMPRESSION_BLOCK_SIZE;
+        out += compression_encode_block(input + off, n, *output + out);
+    }
+    *output_len = out;
 
+    LOG_DEBUG("Compressed %zu -> %zu bytes (%s)", input_len, out,
+              compression_algorithm_name(g_compression_config.algorithm));
     return 0;
 }
 
 int compression_decompress(const unsigned char *input, size_t input_len,
                           unsigned char **output, size_t *output_len) {
-    if (!g_compression_config.enabled || g_compression_config.algorithm == COMPRESS_NONE) {
-        *output = malloc(input_len);
+    if (!lz4_active()) {
+        *output = malloc(input_len ? input_len : 1);
         if (!*output) return -1;
         memcpy(*output, input, input_len);
         *output_len = input_len;
         return 0;
     }
 
-    // Stub: In production, use actual decompression libraries
-    LOG_DEBUG("Decompression stub called (algorithm=%s, input_len=%zu)",
-              compression_algorithm_name(g_compression_config.algorithm), input_len);
-
-    *output = malloc(input_len);
+    // first pass validates the block headers and sizes the output
+    size_t total = 0, pos = 0;
+    while (pos < input_len) {
+        size_t raw, stored;
+        if (input_len - pos < COMPRESSION_BLOCK_HEADER ||
+            compression_block_header(input + pos, &raw, &stored) != 0 ||
+            input_len - pos - COMPRESSION_BLOCK_HEADER < stored)
+            return -1;
+        total += raw;
+        pos += COMPRESSION_BLOCK_HEADER + stored;
+    }
+    *output = malloc(total ? total : 1);
     if (!*output) return -1;
-    memcpy(*output, input, input_len);
-    *output_len = input_len;
-
+    size_t out = 0;
+    for (pos = 0; pos < input_len;) {
+        size_t raw, stored;
+        compression_block_header(input + pos, &raw, &stored);
+        if (compression_decode_block(input + pos + COMPRESSION_BLOCK_HEADER, stored, *output + out, raw) != 0) {
+            LOG_WARN("Corrupt compressed block at offset %zu", pos);
+            free(*output);
+            *output = NULL;
+            return -1;
+        }
+        out += raw;
+        pos += COMPRESSION_BLOCK_HEADER + stored;
+    }
+    *output_len = out;
     return 0;
 }
 
@@ -186,7 +385,7 @@ double compression_estimate_ratio(const unsigned char *data, size_t len) {
     for (int i = 0; i < 256; i++) {
         if (byte_count[i] > 0) {
             double p = (double)byte_count[i] / len;
-            entropy -= p * (log(p) / log(2.0));
+            entropy -= p * log2(p);
         }
     }
 
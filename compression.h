@@ -2,6 +2,7 @@
 #define COMPRESSION_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 // Compression algorithms
 typedef enum {
@@ -25,7 +26,11 @@ extern CompressionConfig g_compression_config;
 // Initialize compression
 void compression_init(CompressionAlgorithm algorithm, int level);
 
-// Compress data
+// Look up an algorithm by the name compression_algorithm_name() gives it
+int compression_algorithm_from_name(const char *name, CompressionAlgorithm *out);
+
+// Compress data: a sequence of independent blocks (see below) when LZ4 is
+// enabled, a plain copy otherwise
 int compression_compress(const unsigned char *input, size_t input_len,
                         unsigned char **output, size_t *output_len);
 
@@ -42,7 +47,26 @@ int compression_decompress_file(const char *input_path, const char *output_path)
 // Get algorithm name
 const char* compression_algorithm_name(CompressionAlgorithm algorithm);
 
-// Estimate compression ratio
+// Estimate compression ratio (order-0 entropy / 8 bits, clamped to >= 0.3).
+// Values near 1.0 mean the data is already compressed or random.
 double compression_estimate_ratio(const unsigned char *data, size_t len);
 
+// Raw LZ4 block format. compress returns the compressed size, or 0 if it
+// does not fit in cap; decompress returns 0 only if exactly out_len bytes
+// were produced.
+size_t compression_lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+int compression_lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_len);
+
+// Block stream, decodable block by block:
+//   repeated { uint32 raw_len; uint32 stored_len; stored bytes } (little-endian)
+// stored_len == raw_len means the block is kept uncompressed.
+#define COMPRESSION_BLOCK_SIZE (256 * 1024)
+#define COMPRESSION_BLOCK_HEADER 8
+
+// Encode n <= COMPRESSION_BLOCK_SIZE bytes into dst, which must hold
+// COMPRESSION_BLOCK_HEADER + n bytes. Returns the bytes written.
+size_t compression_encode_block(const uint8_t *src, size_t n, uint8_t *dst);
+int compression_block_header(const uint8_t hdr[COMPRESSION_BLOCK_HEADER], size_t *raw_len, size_t *stored_len);
+int compression_decode_block(const uint8_t *payload, size_t stored_len, uint8_t *dst, size_t raw_len);
+
 #endif // COMPRESSION_H
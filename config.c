@@ -7,6 +7,19 @@
 // Global configuration instance
 ReproVMConfig g_config;
 
+// Copy value into a fixed-size field. A value that does not fit is
+// rejected with a warning, leaving the field as it was, rather than being
+// truncated into something else. Returns 0 if it was set.
+static int set_string(char *field, size_t size, const char *name, const char *value) {
+    size_t len = strlen(value);
+    if (len >= size) {
+        fprintf(stderr, "Warning: %s is longer than %zu characters, ignored\n", name, size - 1);
+        return -1;
+    }
+    memcpy(field, value, len + 1);
+    return 0;
+}
+
 void config_init_defaults(ReproVMConfig *config) {
     memset(config, 0, sizeof(ReproVMConfig));
 
@@ -19,12 +32,19 @@ void config_init_defaults(ReproVMConfig *config) {
     strcpy(config->cache_dir, ".reprovm");
     config->max_cache_size_mb = 10240; // 10GB
     config->cache_ttl_hours = 168;     // 1 week
+    strcpy(config->materialize_strategy, "reflink");
+    config->chunk_threshold_kb = 0;
+    strcpy(config->compression, "none");
+    strcpy(config->digest_algorithm, "sha256");
+    strcpy(config->durability, "batched");
 
     // Execution defaults
     config->parallel_jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
     if (config->parallel_jobs <= 0) {
         config->parallel_jobs = 4;
     }
+    config->hash_threads = 0;
+    strcpy(config->io_backend, "sync");
     config->retry_attempts = 3;
     config->retry_delay_ms = 1000;
     config->timeout_seconds = 3600; // 1 hour
@@ -44,6 +64,8 @@ void config_init_defaults(ReproVMConfig *config) {
     strcpy(config->remote_cas_url, "");
     strcpy(config->remote_cas_access_key, "");
     strcpy(config->remote_cas_secret_key, "");
+    config->remote_cas_transfers = 0;
+    config->remote_cas_inflight_mb = 0;
 
     // Feature defaults
     config->enable_colors = 1;
@@ -64,7 +86,7 @@ void config_load_from_env(ReproVMConfig *config) {
     }
 
     if ((env = getenv("REPROVM_LOG_FILE"))) {
-        strncpy(config->log_file, env, sizeof(config->log_file) - 1);
+        set_string(config->log_file, sizeof(config->log_file), "REPROVM_LOG_FILE", env);
     }
 
     if ((env = getenv("REPROVM_NO_COLOR"))) {
@@ -74,18 +96,50 @@ void config_load_from_env(ReproVMConfig *config) {
 
     // Cache
     if ((env = getenv("REPROVM_CACHE_DIR"))) {
-        strncpy(config->cache_dir, env, sizeof(config->cache_dir) - 1);
+        set_string(config->cache_dir, sizeof(config->cache_dir), "REPROVM_CACHE_DIR", env);
     }
 
     if ((env = getenv("REPROVM_MAX_CACHE_SIZE"))) {
         config->max_cache_size_mb = atoi(env);
     }
 
+    if ((env = getenv("REPROVM_CACHE_TTL_HOURS"))) {
+        config->cache_ttl_hours = atoi(env);
+    }
+
+    if ((env = getenv("REPROVM_MATERIALIZE"))) {
+        set_string(config->materialize_strategy, sizeof(config->materialize_strategy), "REPROVM_MATERIALIZE", env);
+    }
+
+    if ((env = getenv("REPROVM_CHUNK_THRESHOLD_KB"))) {
+        config->chunk_threshold_kb = atoi(env);
+    }
+
+    if ((env = getenv("REPROVM_COMPRESSION"))) {
+        set_string(config->compression, sizeof(config->compression), "REPROVM_COMPRESSION", env);
+    }
+
+    if ((env = getenv("REPROVM_DIGEST"))) {
+        set_string(config->digest_algorithm, sizeof(config->digest_algorithm), "REPROVM_DIGEST", env);
+    }
+
+    if ((env = getenv("REPROVM_DURABILITY"))) {
+        set_string(config->durability, sizeof(config->durability), "REPROVM_DURABILITY", env);
+    }
+
     // Execution
     if ((env = getenv("REPROVM_JOBS"))) {
         config->parallel_jobs = atoi(env);
     }
 
+    if ((env = getenv("REPROVM_HASH_THREADS"))) {
+        config->hash_threads = atoi(env);
+    }
+
+    if ((env = getenv("REPROVM_IO_BACKEND"))) {
+        set_string(config->io_backend, sizeof(config->io_backend), "REPROVM_IO_BACKEND", env);
+    }
+
     if ((env = getenv("REPROVM_RETRY_ATTEMPTS"))) {
         config->retry_attempts = atoi(env);
     }
@@ -96,16 +150,24 @@ void config_load_from_env(ReproVMConfig *config) {
 
     // Remote CAS
     if ((env = getenv("REPROVM_REMOTE_CAS_URL"))) {
-        strncpy(config->remote_cas_url, env, sizeof(config->remote_cas_url) - 1);
-        config->enable_remote_cas = 1;
+        if (set_string(config->remote_cas_url, sizeof(config->remote_cas_url), "REPROVM_REMOTE_CAS_URL", env) == 0)
+            config->enable_remote_cas = 1;
     }
 
     if ((env = getenv("REPROVM_REMOTE_CAS_ACCESS_KEY"))) {
-        strncpy(config->remote_cas_access_key, env, sizeof(config->remote_cas_access_key) - 1);
+        set_string(config->remote_cas_access_key, sizeof(config->remote_cas_access_key), "REPROVM_REMOTE_CAS_ACCESS_KEY", env);
     }
 
     if ((env = getenv("REPROVM_REMOTE_CAS_SECRET_KEY"))) {
-        strncpy(config->remote_cas_secret_key, env, sizeof(config->remote_cas_secret_key) - 1);
+        set_string(config->remote_cas_secret_key, sizeof(config->remote_cas_secret_key), "REPROVM_REMOTE_CAS_SECRET_KEY", env);
+    }
+
+    if ((env = getenv("REPROVM_REMOTE_CAS_TRANSFERS"))) {
+        config->remote_cas_transfers = atoi(env);
+    }
+
+    if ((env = getenv("REPROVM_REMOTE_CAS_INFLIGHT_MB"))) {
+        config->remote_cas_inflight_mb = atoi(env);
     }
 
     // Features
@@ -159,16 +221,34 @@ int config_load_from_file(ReproVMConfig *config, const char *filename) {
 
         // Apply configuration
         if (strcmp(k, "log_file") == 0) {
-            strncpy(config->log_file, v, sizeof(config->log_file) - 1);
+            set_string(config->log_file, sizeof(config->log_file), "log_file", v);
         } else if (strcmp(k, "log_level") == 0) {
             if (strcmp(v, "DEBUG") == 0) config->log_level = LOG_DEBUG;
             else if (strcmp(v, "INFO") == 0) config->log_level = LOG_INFO;
             else if (strcmp(v, "WARN") == 0) config->log_level = LOG_WARN;
             else if (strcmp(v, "ERROR") == 0) config->log_level = LOG_ERROR;
         } else if (strcmp(k, "cache_dir") == 0) {
-            strncpy(config->cache_dir, v, sizeof(config->cache_dir) - 1);
+            set_string(config->cache_dir, sizeof(config->cache_dir), "cache_dir", v);
+        } else if (strcmp(k, "max_cache_size_mb") == 0) {
+            config->max_cache_size_mb = atoi(v);
+        } else if (strcmp(k, "cache_ttl_hours") == 0) {
+            config->cache_ttl_hours = atoi(v);
+        } else if (strcmp(k, "materialize_strategy") == 0) {
+            set_string(config->materialize_strategy, sizeof(config->materialize_strategy), "materialize_strategy", v);
+        } else if (strcmp(k, "chunk_threshold_kb") == 0) {
+            config->chunk_threshold_kb = atoi(v);
+        } else if (strcmp(k, "compression") == 0) {
+            set_string(config->compression, sizeof(config->compression), "compression", v);
+        } else if (strcmp(k, "digest_algorithm") == 0) {
+            set_string(config->digest_algorithm, sizeof(config->digest_algorithm), "digest_algorithm", v);
+        } else if (strcmp(k, "durability") == 0) {
+            set_string(config->durability, sizeof(config->durability), "durability", v);
         } else if (strcmp(k, "parallel_jobs") == 0) {
             config->parallel_jobs = atoi(v);
+        } else if (strcmp(k, "hash_threads") == 0) {
+            config->hash_threads = atoi(v);
+        } else if (strcmp(k, "io_backend") == 0) {
+            set_string(config->io_backend, sizeof(config->io_backend), "io_backend", v);
         } else if (strcmp(k, "retry_attempts") == 0) {
             config->retry_attempts = atoi(v);
         } else if (strcmp(k, "timeout_seconds") == 0) {
@@ -176,8 +256,12 @@ int config_load_from_file(ReproVMConfig *config, const char *filename) {
         } else if (strcmp(k, "enable_metrics") == 0) {
             config->enable_metrics = atoi(v);
         } else if (strcmp(k, "remote_cas_url") == 0) {
-            strncpy(config->remote_cas_url, v, sizeof(config->remote_cas_url) - 1);
-            config->enable_remote_cas = 1;
+            if (set_string(config->remote_cas_url, sizeof(config->remote_cas_url), "remote_cas_url", v) == 0)
+                config->enable_remote_cas = 1;
+        } else if (strcmp(k, "remote_cas_transfers") == 0) {
+            config->remote_cas_transfers = atoi(v);
+        } else if (strcmp(k, "remote_cas_inflight_mb") == 0) {
+            config->remote_cas_inflight_mb = atoi(v);
         }
     }
 
@@ -206,6 +290,11 @@ int config_validate(const ReproVMConfig *config) {
         return -1;
     }
 
+    if (config->cache_ttl_hours < 0) {
+        fprintf(stderr, "Error: cache_ttl_hours cannot be negative\n");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -219,8 +308,15 @@ void config_print(const ReproVMConfig *config) {
     printf("  cache_dir: %s\n", config->cache_dir);
     printf("  max_cache_size_mb: %d\n", config->max_cache_size_mb);
     printf("  cache_ttl_hours: %d\n", config->cache_ttl_hours);
+    printf("  materialize_strategy: %s\n", config->materialize_strategy);
+    printf("  chunk_threshold_kb: %d\n", config->chunk_threshold_kb);
+    printf("  compression: %s\n", config->compression);
+    printf("  digest_algorithm: %s\n", config->digest_algorithm);
+    printf("  durability: %s\n", config->durability);
     printf("\nExecution:\n");
     printf("  parallel_jobs: %d\n", config->parallel_jobs);
+    printf("  hash_threads: %d\n", config->hash_threads);
+    printf("  io_backend: %s\n", config->io_backend);
     printf("  retry_attempts: %d\n", config->retry_attempts);
     printf("  timeout_seconds: %d\n", config->timeout_seconds);
     printf("\nPerformance:\n");
@@ -233,6 +329,8 @@ void config_print(const ReproVMConfig *config) {
     printf("  enable_remote_cas: %d\n", config->enable_remote_cas);
     if (config->enable_remote_cas) {
         printf("  remote_cas_url: %s\n", config->remote_cas_url);
+        printf("  remote_cas_transfers: %d\n", config->remote_cas_transfers);
+        printf("  remote_cas_inflight_mb: %d\n", config->remote_cas_inflight_mb);
     }
     printf("\nFeatures:\n");
     printf("  enable_colors: %d\n", config->enable_colors);
@@ -257,9 +355,17 @@ int config_save_to_file(const ReproVMConfig *config, const char *filename) {
     fprintf(fp, "\n# Cache\n");
     fprintf(fp, "cache_dir=%s\n", config->cache_dir);
     fprintf(fp, "max_cache_size_mb=%d\n", config->max_cache_size_mb);
+    fprintf(fp, "cache_ttl_hours=%d\n", config->cache_ttl_hours);
+    fprintf(fp, "materialize_strategy=%s\n", config->materialize_strategy);
+    fprintf(fp, "chunk_threshold_kb=%d\n", config->chunk_threshold_kb);
+    fprintf(fp, "compression=%s\n", config->compression);
+    fprintf(fp, "digest_algorithm=%s\n", config->digest_algorithm);
+    fprintf(fp, "durability=%s\n", config->durability);
 
     fprintf(fp, "\n# Execution\n");
     fprintf(fp, "parallel_jobs=%d\n", config->parallel_jobs);
+    fprintf(fp, "hash_threads=%d\n", config->hash_threads);
+    fprintf(fp, "io_backend=%s\n", config->io_backend);
     fprintf(fp, "retry_attempts=%d\n", config->retry_attempts);
     fprintf(fp, "timeout_seconds=%d\n", config->timeout_seconds);
 
@@ -269,6 +375,8 @@ int config_save_to_file(const ReproVMConfig *config, const char *filename) {
     if (config->enable_remote_cas) {
         fprintf(fp, "\n# Remote CAS\n");
         fprintf(fp, "remote_cas_url=%s\n", config->remote_cas_url);
+        fprintf(fp, "remote_cas_transfers=%d\n", config->remote_cas_transfers);
+        fprintf(fp, "remote_cas_inflight_mb=%d\n", config->remote_cas_inflight_mb);
     }
 
     fclose(fp);
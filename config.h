@@ -14,9 +14,16 @@ typedef struct {
     char cache_dir[256];
     int max_cache_size_mb;
     int cache_ttl_hours;
+    char materialize_strategy[32]; // first restore strategy: reflink, hardlink, copy_range, copy
+    int chunk_threshold_kb;        // chunk files at least this large; 0 = off
+    char compression[16];          // CAS object compression: none or lz4
+    char digest_algorithm[16];     // content digest: sha256 or blake3 (separate stores)
+    char durability[16];           // crash safety of stores: none, batched or strict
 
     // Execution
     int parallel_jobs;
+    int hash_threads;   // file-hashing pool threads; 0 = one per CPU
+    char io_backend[16]; // batched CAS I/O: sync, uring or auto
     int retry_attempts;
     int retry_delay_ms;
     int timeout_seconds;
@@ -36,6 +43,8 @@ typedef struct {
     char remote_cas_url[512];
     char remote_cas_access_key[256];
     char remote_cas_secret_key[256];
+    int remote_cas_transfers;   // transfer engine threads; 0 = 8
+    int remote_cas_inflight_mb; // cap on object bytes on the wire; 0 = 64
 
     // Features
     int enable_colors;
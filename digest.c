@@ -0,0 +1,97 @@
+// digest.c
+#include "digest.h"
+#include "util.h"
+#include <string.h>
+
+int digest_cmp(const Digest *a, const Digest *b) {
+    return memcmp(a->b, b->b, DIGEST_SIZE);
+}
+
+bool digest_eq(const Digest *a, const Digest *b) {
+    return memcmp(a->b, b->b, DIGEST_SIZE) == 0;
+}
+
+bool digest_is_zero(const Digest *d) {
+    static const Digest zero;
+    return memcmp(d->b, zero.b, DIGEST_SIZE) == 0;
+}
+
+uint64_t digest_hash(const Digest *d) {
+    uint64_t h;
+    memcpy(&h, d->b, sizeof(h));
+    return h;
+}
+
+char *digest_to_hex(const Digest *d, char out[DIGEST_HEX_SIZE]) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < DIGEST_SIZE; ++i) {
+        out[2*i]   = hex[d->b[i] >> 4];
+        out[2*i+1] = hex[d->b[i] & 0xF];
+    }
+    out[DIGEST_SIZE * 2] = '\0';
+    return out;
+}
+
+int digest_from_hex(const char *hex, Digest *out) {
+    return hex_decode(hex, out->b, DIGEST_SIZE);
+}
+
+int digest_qsort_cmp(const void *a, const void *b) {
+    return digest_cmp(a, b);
+}
+
+static DigestAlgorithm current_algorithm = DIGEST_SHA256;
+static const char *const algorithm_names[] = { "sha256", "blake3" };
+
+void digest_set_algorithm(DigestAlgorithm a) {
+    current_algorithm = a;
+}
+
+DigestAlgorithm digest_algorithm(void) {
+    return current_algorithm;
+}
+
+const char *digest_algorithm_name(DigestAlgorithm a) {
+    return (a == DIGEST_SHA256 || a == DIGEST_BLAKE3) ? algorithm_names[a] : "unknown";
+}
+
+int digest_algorithm_from_name(const char *name, DigestAlgorithm *out) {
+    if (!name) return -1;
+    for (int i = 0; i < 2; ++i) {
+        if (strcmp(name, algorithm_names[i]) == 0) {
+            *out = (DigestAlgorithm)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void digest_init(DigestCtx *ctx) {
+    ctx->algo = current_algorithm;
+    if (ctx->algo == DIGEST_BLAKE3) blake3_init(&ctx->u.blake3);
+    else sha256_init(&ctx->u.sha256);
+}
+
+void digest_update(DigestCtx *ctx, const void *data, size_t len) {
+    if (ctx->algo == DIGEST_BLAKE3) blake3_update(&ctx->u.blake3, data, len);
+    else sha256_update(&ctx->u.sha256, data, len);
+}
+
+void digest_final(DigestCtx *ctx, Digest *out) {
+    if (ctx->algo == DIGEST_BLAKE3) blake3_final(&ctx->u.blake3, out->b);
+    else sha256_final(&ctx->u.sha256, out->b);
+}
+
+void digest_buffer(const void *data, size_t len, Digest *out) {
+    if (current_algorithm == DIGEST_BLAKE3) blake3_digest(data, len, out->b);
+    else sha256_digest(data, len, out->b);
+}
+
+void digest_buffers(const uint8_t *const data[], const size_t lens[], int n, Digest out[]) {
+    if (current_algorithm == DIGEST_SHA256) {
+        sha256_digest_many(data, lens, n, (uint8_t (*)[SHA256_DIGEST_SIZE])out);
+        return;
+    }
+    // BLAKE3 already runs SIMD lanes across the chunks of one buffer
+    for (int i = 0; i < n; ++i) blake3_digest(data[i], lens[i], out[i].b);
+}
@@ -0,0 +1,68 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "blake3.h"
+#include "sha256.h"
+
+/*
+ * Content digest as raw bytes. Digests are passed by value or pointer and
+ * compared with memcmp; hex is produced only for file names, .meta records
+ * and display. The all-zero digest means "not computed / absent".
+ */
+
+#define DIGEST_SIZE 32
+#define DIGEST_HEX_SIZE (DIGEST_SIZE * 2 + 1)
+
+typedef struct {
+    uint8_t b[DIGEST_SIZE];
+} Digest;
+
+int digest_cmp(const Digest *a, const Digest *b); // memcmp order == hex string order
+bool digest_eq(const Digest *a, const Digest *b);
+bool digest_is_zero(const Digest *d);
+uint64_t digest_hash(const Digest *d); // for hash tables; digests are already uniform
+
+// out must hold DIGEST_HEX_SIZE bytes; returns out
+char *digest_to_hex(const Digest *d, char out[DIGEST_HEX_SIZE]);
+// Exactly 64 hex characters; returns 0 on success
+int digest_from_hex(const char *hex, Digest *out);
+
+// qsort comparator over Digest arrays
+int digest_qsort_cmp(const void *a, const void *b);
+
+/*
+ * Content digest algorithm. It is process-wide: the object store of each
+ * algorithm lives in its own directory (cas.h), so it is set once, before
+ * cas_init. Digests of task records and packs stay SHA-256 either way.
+ */
+typedef enum {
+    DIGEST_SHA256,
+    DIGEST_BLAKE3, // tree hash: large inputs are hashed on the hash pool
+} DigestAlgorithm;
+
+void digest_set_algorithm(DigestAlgorithm a);
+DigestAlgorithm digest_algorithm(void);
+const char *digest_algorithm_name(DigestAlgorithm a); // "sha256", "blake3"
+int digest_algorithm_from_name(const char *name, DigestAlgorithm *out); // 0 on success
+
+// Streaming content digest with the algorithm current at digest_init
+typedef struct {
+    DigestAlgorithm algo;
+    union {
+        SHA256_CTX sha256;
+        BLAKE3_CTX blake3;
+    } u;
+} DigestCtx;
+
+void digest_init(DigestCtx *ctx);
+void digest_update(DigestCtx *ctx, const void *data, size_t len);
+void digest_final(DigestCtx *ctx, Digest *out);
+
+void digest_buffer(const void *data, size_t len, Digest *out);
+// Many small buffers at once (SHA-256 hashes them in parallel SIMD lanes)
+void digest_buffers(const uint8_t *const data[], const size_t lens[], int n, Digest out[]);
+
+#endif // DIGEST_H
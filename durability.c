@@ -0,0 +1,207 @@
+// durability.c
+#define _GNU_SOURCE
+#include "durability.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PENDING_FAILED 0x100 // not durable: never linked
+
+// A file published in batched mode, waiting for the commit
+typedef struct {
+    DurableFile f;
+    int dirfd;
+    char name[256];
+    int flags;
+} Pending;
+
+static DurabilityMode current_mode = DURABILITY_NONE;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static Pending queue[DURABLE_MAX_PENDING];
+static int n_queued = 0;
+static int commit_failed = 0; // a commit the queue ran by itself failed
+static int tmpfile_ok = -1;   // O_TMPFILE can be linked: unknown until first use
+static unsigned side_seq = 0;
+
+static const char *mode_names[] = { "none", "batched", "strict" };
+
+void durability_set_mode(DurabilityMode mode) {
+    // files queued under batched must not wait for a commit that never comes
+    if (mode != DURABILITY_BATCHED) durability_commit();
+    __atomic_store_n(&current_mode, mode, __ATOMIC_RELAXED);
+}
+
+DurabilityMode durability_mode(void) {
+    return __atomic_load_n(&current_mode, __ATOMIC_RELAXED);
+}
+
+const char *durability_mode_name(DurabilityMode mode) {
+    return mode >= DURABILITY_NONE && mode <= DURABILITY_STRICT ? mode_names[mode] : "unknown";
+}
+
+int durability_mode_from_name(const char *name, DurabilityMode *out) {
+    for (int m = DURABILITY_NONE; name && m <= DURABILITY_STRICT; ++m) {
+        if (strcmp(name, mode_names[m]) == 0) {
+            *out = (DurabilityMode)m;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int durable_create(const char *dir, DurableFile *f) {
+    f->tmp[0] = '\0';
+    // an O_TMPFILE is linked through /proc (AT_EMPTY_PATH needs privilege)
+    if (tmpfile_ok < 0) tmpfile_ok = access("/proc/self/fd", X_OK) == 0;
+    if (tmpfile_ok) {
+        f->fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0444);
+        if (f->fd >= 0) return 0;
+        // filesystem or kernel without it
+        if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL) return -1;
+    }
+    snprintf(f->tmp, sizeof(f->tmp), "%s/tmp-XXXXXX", dir);
+    f->fd = mkostemp(f->tmp, O_CLOEXEC);
+    if (f->fd < 0) return -1;
+    fchmod(f->fd, 0444);
+    return 0;
+}
+
+void durable_abort(DurableFile *f) {
+    if (f->fd >= 0) close(f->fd);
+    if (f->tmp[0]) unlink(f->tmp);
+    f->fd = -1;
+    f->tmp[0] = '\0';
+}
+
+// Give f its name. Without DURABLE_REPLACE an existing file keeps it.
+static int link_file(DurableFile *f, int dirfd, const char *name, int flags) {
+    char proc[64];
+    const char *from = f->tmp;
+    if (!from[0]) {
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", f->fd);
+        from = proc;
+    }
+    if (!(flags & DURABLE_REPLACE))
+        return linkat(AT_FDCWD, from, dirfd, name, AT_SYMLINK_FOLLOW) == 0 || errno == EEXIST ? 0 : -1;
+    if (f->tmp[0]) {
+        if (renameat(AT_FDCWD, f->tmp, dirfd, name) != 0) return -1;
+        f->tmp[0] = '\0';
+        return 0;
+    }
+    // an O_TMPFILE cannot be linked over a name: link it beside, rename over
+    char side[300];
+    snprintf(side, sizeof(side), ".%.200s.%ld.%u", name, (long)getpid(),
+             __atomic_fetch_add(&side_seq, 1, __ATOMIC_RELAXED));
+    if (linkat(AT_FDCWD, from, dirfd, side, AT_SYMLINK_FOLLOW) != 0) return -1;
+    if (renameat(dirfd, side, dirfd, name) != 0) {
+        unlinkat(dirfd, side, 0);
+        return -1;
+    }
+    return 0;
+}
+
+// Directories to fsync once each
+typedef struct {
+    int fd[DURABLE_MAX_PENDING];
+    int n;
+} DirSet;
+
+static void dir_add(DirSet *s, int fd) {
+    for (int i = 0; i < s->n; ++i)
+        if (s->fd[i] == fd) return;
+    s->fd[s->n++] = fd;
+}
+
+static int dir_sync(DirSet *s) {
+    int rc = 0;
+    for (int i = 0; i < s->n; ++i)
+        if (fsync(s->fd[i]) != 0) rc = -1;
+    s->n = 0;
+    return rc;
+}
+
+// The group commit. Data first, all files at once (their writeback started
+// at publish), then the names, then each directory once.
+static int commit_locked(void) {
+    int n = n_queued, failed = 0;
+    if (n == 0) return 0;
+    for (int i = 0; i < n; ++i)
+        if (fdatasync(queue[i].f.fd) != 0) queue[i].flags |= PENDING_FAILED;
+    static DirSet dirs;
+    dirs.n = 0;
+    for (int i = 0; i < n; ++i) {
+        Pending *p = &queue[i];
+        if ((p->flags & DURABLE_ORDERED) && dir_sync(&dirs) != 0) failed = 1;
+        // an ordered file after a failure could refer to what was lost
+        if ((p->flags & PENDING_FAILED) || ((p->flags & DURABLE_ORDERED) && failed) ||
+            link_file(&p->f, p->dirfd, p->name, p->flags) != 0)
+            failed = 1;
+        else
+            dir_add(&dirs, p->dirfd);
+    }
+    if (dir_sync(&dirs) != 0) failed = 1;
+    for (int i = 0; i < n; ++i) durable_abort(&queue[i].f);
+    __atomic_store_n(&n_queued, 0, __ATOMIC_RELEASE);
+    return failed ? -1 : 0;
+}
+
+int durability_commit(void) {
+    pthread_mutex_lock(&queue_lock);
+    int rc = commit_locked();
+    if (commit_failed) rc = -1;
+    commit_failed = 0;
+    pthread_mutex_unlock(&queue_lock);
+    return rc;
+}
+
+int durable_publish(DurableFile *f, int dirfd, const char *name, int flags) {
+    DurabilityMode mode = durability_mode();
+    if (strlen(name) >= sizeof(queue[0].name)) {
+        durable_abort(f);
+        return -1;
+    }
+    if (mode == DURABILITY_BATCHED) {
+        // start writeback now, so the commit mostly waits for metadata
+        sync_file_range(f->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        pthread_mutex_lock(&queue_lock);
+        if (n_queued == DURABLE_MAX_PENDING && commit_locked() != 0) commit_failed = 1;
+        Pending *p = &queue[n_queued];
+        p->f = *f;
+        p->dirfd = dirfd;
+        strcpy(p->name, name);
+        p->flags = flags & (DURABLE_REPLACE | DURABLE_ORDERED);
+        __atomic_store_n(&n_queued, n_queued + 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&queue_lock);
+        f->fd = -1;
+        f->tmp[0] = '\0';
+        return 0;
+    }
+    int rc = 0;
+    if ((flags & DURABLE_ORDERED) && __atomic_load_n(&n_queued, __ATOMIC_ACQUIRE) > 0) rc = durability_commit();
+    if (rc == 0 && mode == DURABILITY_STRICT && fdatasync(f->fd) != 0) rc = -1;
+    if (rc == 0) rc = link_file(f, dirfd, name, flags);
+    if (rc == 0 && mode == DURABILITY_STRICT) rc = fsync(dirfd);
+    durable_abort(f);
+    return rc;
+}
+
+int durable_pending_open(int dirfd, const char *name) {
+    if (durability_mode() != DURABILITY_BATCHED && __atomic_load_n(&n_queued, __ATOMIC_ACQUIRE) == 0) return -1;
+    pthread_mutex_lock(&queue_lock);
+    int fd = -1, found = 0;
+    // the newest wins, as a later replace would
+    for (int i = n_queued - 1; i >= 0 && !found; --i) {
+        if (queue[i].dirfd != dirfd || strcmp(queue[i].name, name) != 0) continue;
+        found = 1;
+        fd = fcntl(queue[i].f.fd, F_DUPFD_CLOEXEC, 0);
+    }
+    // a commit since the caller looked may have just linked it
+    if (!found) fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    pthread_mutex_unlock(&queue_lock);
+    return fd;
+}
@@ -0,0 +1,65 @@
+#ifndef DURABILITY_H
+#define DURABILITY_H
+
+/*
+ * Crash-safe publication of new files (CAS objects, task records). A file is
+ * written unnamed, as an O_TMPFILE in the directory it will live in (or a
+ * named temp there when the filesystem lacks O_TMPFILE), and only linked
+ * under its final name once complete, so a reader or a crash never sees a
+ * partial file under a real name. What is made durable, and when, depends
+ * on the mode:
+ *
+ *   none     link at once, never fsync. A process crash cannot tear a file;
+ *            a power cut can lose recent ones or leave them empty.
+ *   batched  group commit: published files are queued unlinked (their
+ *            writeback already started) and durability_commit(), called at
+ *            every task boundary, fdatasyncs them all, links them and then
+ *            fsyncs each directory it touched once. A file published
+ *            DURABLE_ORDERED is linked only after everything queued before
+ *            it is durable, so a task record never outlives its objects.
+ *   strict   fdatasync, link and fsync the directory for every file.
+ *
+ * Queued files are not on disk under their names yet; durable_pending_open
+ * lets the publishing process read them back meanwhile. The queue commits
+ * by itself once DURABLE_MAX_PENDING files are waiting.
+ */
+
+#define DURABLE_MAX_PENDING 256 // open files held by the batched queue
+
+typedef enum {
+    DURABILITY_NONE,
+    DURABILITY_BATCHED,
+    DURABILITY_STRICT
+} DurabilityMode;
+
+// durable_publish flags
+#define DURABLE_REPLACE 1 // replace an existing file (else an existing one wins)
+#define DURABLE_ORDERED 2 // durable only after everything published before it
+
+// A file being written
+typedef struct {
+    int fd;          // read/write
+    char tmp[1200];  // named temp, "" for an O_TMPFILE
+} DurableFile;
+
+void durability_set_mode(DurabilityMode mode);
+DurabilityMode durability_mode(void);
+const char *durability_mode_name(DurabilityMode mode);
+// "none", "batched" or "strict". Returns 0, or -1 for anything else.
+int durability_mode_from_name(const char *name, DurabilityMode *out);
+
+// Start a file in directory dir, mode 0444. Returns 0 or -1.
+int durable_create(const char *dir, DurableFile *f);
+// Drop a file that will not be published
+void durable_abort(DurableFile *f);
+// Give the complete file the name dirfd/name (same filesystem as its dir).
+// Always consumes f. dirfd must stay open until the next durability_commit.
+// Returns 0 on success, including when the name exists and wins.
+int durable_publish(DurableFile *f, int dirfd, const char *name, int flags);
+// A new fd on the queued file to become dirfd/name, or -1 if none is queued
+int durable_pending_open(int dirfd, const char *name);
+// Make every queued file durable under its name. Returns 0, or -1 if any
+// could not be (those are dropped).
+int durability_commit(void);
+
+#endif // DURABILITY_H
@@ -0,0 +1,733 @@
+// gc.c
+#define _GNU_SOURCE
+#include "gc.h"
+#include "cas.h"
+#include "pack.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define META_SUFFIX ".meta"
+#define ACCESS_FILE "access.idx"
+#define PENDING_FILE "quarantine.pending"
+#define ACCESS_ENTRY_SIZE 12
+// Records whose mtime is this close to the start of a collection are re-read
+// under the exclusive lock (timestamps lag the clock by up to a tick)
+#define MTIME_SLACK_NS 1000000000LL
+
+static void cache_path(const char *name, char *out, size_t sz) {
+    snprintf(out, sz, "%s/%s", cas_get_cache_root(), name);
+}
+
+static int open_cache_file(const char *name, int flags) {
+    char path[1200];
+    cache_path(name, path, sizeof(path));
+    return open(path, flags | O_CLOEXEC, 0644);
+}
+
+static int flock_retry(int fd, int op) {
+    int rc;
+    while ((rc = flock(fd, op)) != 0 && errno == EINTR) {}
+    return rc;
+}
+
+/* ---- lock protocol ---- */
+
+static pthread_mutex_t lock_mu = PTHREAD_MUTEX_INITIALIZER;
+static int lock_fd = -1;
+static int lock_holders = 0;
+
+// flock belongs to the open file, which all threads share: only the first
+// holder takes it and only the last one drops it
+void gc_lock_shared(void) {
+    pthread_mutex_lock(&lock_mu);
+    if (lock_fd < 0) lock_fd = open_cache_file("gc.lock", O_RDWR | O_CREAT);
+    if (lock_fd >= 0 && lock_holders++ == 0) flock_retry(lock_fd, LOCK_SH);
+    pthread_mutex_unlock(&lock_mu);
+}
+
+void gc_unlock_shared(void) {
+    pthread_mutex_lock(&lock_mu);
+    if (lock_fd >= 0 && lock_holders > 0 && --lock_holders == 0) flock(lock_fd, LOCK_UN);
+    pthread_mutex_unlock(&lock_mu);
+}
+
+/* ---- access index ---- */
+
+void gc_note_access(const Digest *task_hash) {
+    uint32_t now = (uint32_t)time(NULL);
+    unsigned char e[ACCESS_ENTRY_SIZE];
+    memcpy(e, task_hash->b, 8);
+    for (int i = 0; i < 4; ++i) e[8 + i] = (unsigned char)(now >> (8 * i));
+    // O_APPEND keeps concurrent entries whole; losing one only ages a record
+    int fd = open_cache_file(ACCESS_FILE, O_WRONLY | O_APPEND | O_CREAT);
+    if (fd < 0) return;
+    ssize_t w = write(fd, e, sizeof(e));
+    (void)w;
+    close(fd);
+}
+
+typedef struct {
+    uint64_t key; // first 8 bytes of the task hash
+    uint32_t when;
+} AccessEntry;
+
+static uint64_t access_key(const Digest *d) {
+    uint64_t k;
+    memcpy(&k, d->b, 8);
+    return k;
+}
+
+static int cmp_access(const void *a, const void *b) {
+    uint64_t x = ((const AccessEntry *)a)->key, y = ((const AccessEntry *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+// Load access.idx folded to the latest use per key, sorted by key
+static int load_access(AccessEntry **out, size_t *n) {
+    *out = NULL;
+    *n = 0;
+    int fd = open_cache_file(ACCESS_FILE, O_RDONLY);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+    struct stat st;
+    unsigned char *buf = NULL;
+    size_t len = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        len = (size_t)st.st_size - (size_t)st.st_size % ACCESS_ENTRY_SIZE; // a torn tail is dropped
+        buf = malloc(len ? len : 1);
+        if (buf && pread(fd, buf, len, 0) != (ssize_t)len) len = 0;
+    }
+    close(fd);
+    size_t count = len / ACCESS_ENTRY_SIZE;
+    AccessEntry *a = buf ? malloc(sizeof(AccessEntry) * (count ? count : 1)) : NULL;
+    if (!a) {
+        free(buf);
+        return buf || len == 0 ? 0 : -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char *e = buf + i * ACCESS_ENTRY_SIZE;
+        memcpy(&a[i].key, e, 8);
+        a[i].when = (uint32_t)e[8] | (uint32_t)e[9] << 8 | (uint32_t)e[10] << 16 | (uint32_t)e[11] << 24;
+    }
+    free(buf);
+    qsort(a, count, sizeof(AccessEntry), cmp_access);
+    size_t m = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (m > 0 && a[m - 1].key == a[i].key) {
+            if (a[i].when > a[m - 1].when) a[m - 1].when = a[i].when;
+        } else {
+            a[m++] = a[i];
+        }
+    }
+    *out = a;
+    *n = m;
+    return 0;
+}
+
+static uint32_t access_time(const AccessEntry *a, size_t n, const Digest *task) {
+    AccessEntry want = { access_key(task), 0 };
+    const AccessEntry *e = n ? bsearch(&want, a, n, sizeof(AccessEntry), cmp_access) : NULL;
+    return e ? e->when : 0;
+}
+
+/* ---- collection ---- */
+
+typedef struct {
+    Digest d;
+    uint64_t size;
+    uint32_t refs;
+    uint8_t used;
+    uint8_t loose;
+    uint8_t packed;
+} ObjEntry;
+
+enum { REC_LIVE, REC_EXPIRED, REC_EVICTED };
+
+typedef struct {
+    Digest task; // names the record file
+    int64_t mtime_ns;
+    int64_t last_used; // seconds
+    uint64_t size;
+    Digest *refs;
+    size_t n_refs;
+    int state;
+} Record;
+
+typedef struct {
+    ObjEntry *objs;
+    size_t cap, n_objs;
+    Record *recs;
+    size_t n_recs, cap_recs;
+    AccessEntry *access;
+    size_t n_access;
+    uint64_t live_bytes;
+} GcState;
+
+static ObjEntry *obj_slot(GcState *g, const Digest *d) {
+    size_t i = access_key(d) & (g->cap - 1);
+    while (g->objs[i].used && memcmp(g->objs[i].d.b, d->b, DIGEST_SIZE) != 0) i = (i + 1) & (g->cap - 1);
+    return &g->objs[i];
+}
+
+static ObjEntry *obj_find(GcState *g, const Digest *d) {
+    if (g->cap == 0) return NULL;
+    ObjEntry *o = obj_slot(g, d);
+    return o->used ? o : NULL;
+}
+
+static ObjEntry *obj_insert(GcState *g, const Digest *d) {
+    if ((g->n_objs + 1) * 4 >= g->cap * 3) {
+        size_t cap = g->cap ? g->cap * 2 : 4096;
+        ObjEntry *old = g->objs, *table = calloc(cap, sizeof(ObjEntry));
+        if (!table) return NULL;
+        size_t old_cap = g->cap;
+        g->objs = table;
+        g->cap = cap;
+        for (size_t i = 0; i < old_cap; ++i)
+            if (old[i].used) *obj_slot(g, &old[i].d) = old[i];
+        free(old);
+    }
+    ObjEntry *o = obj_slot(g, d);
+    if (!o->used) {
+        memset(o, 0, sizeof(*o));
+        o->d = *d;
+        o->used = 1;
+        g->n_objs++;
+    }
+    return o;
+}
+
+static void ref_object(GcState *g, const Digest *d) {
+    ObjEntry *o = obj_find(g, d);
+    if (!o || o->refs++ > 0) return;
+    g->live_bytes += o->size;
+    Digest *refs;
+    size_t n;
+    if (cas_object_refs(d, &refs, &n) == 1) {
+        for (size_t i = 0; i < n; ++i) ref_object(g, &refs[i]);
+        free(refs);
+    }
+}
+
+static void unref_object(GcState *g, const Digest *d) {
+    ObjEntry *o = obj_find(g, d);
+    if (!o || o->refs == 0 || --o->refs > 0) return;
+    g->live_bytes -= o->size;
+    Digest *refs;
+    size_t n;
+    if (cas_object_refs(d, &refs, &n) == 1) {
+        for (size_t i = 0; i < n; ++i) unref_object(g, &refs[i]);
+        free(refs);
+    }
+}
+
+static void keep_record(GcState *g, Record *r) {
+    if (r->state == REC_LIVE) return;
+    r->state = REC_LIVE;
+    for (size_t i = 0; i < r->n_refs; ++i) ref_object(g, &r->refs[i]);
+    g->live_bytes += r->size;
+}
+
+static void drop_record(GcState *g, Record *r, int state) {
+    if (r->state != REC_LIVE) return;
+    r->state = state;
+    for (size_t i = 0; i < r->n_refs; ++i) unref_object(g, &r->refs[i]);
+    g->live_bytes -= r->size;
+}
+
+// Read the blobs a record points at ("output <path> <hash>" lines)
+static void record_path(const Digest *task, char *out, size_t sz) {
+    char hex[DIGEST_HEX_SIZE];
+    snprintf(out, sz, "%s/%s%s", cas_get_cache_root(), digest_to_hex(task, hex), META_SUFFIX);
+}
+
+static int read_record(Record *r, const struct stat *st) {
+    char path[1200];
+    record_path(&r->task, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    free(r->refs);
+    r->refs = NULL;
+    r->n_refs = 0;
+    size_t cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, f)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ')) line[--len] = '\0';
+        if (strncmp(line, "output ", 7) != 0 && strncmp(line, "tree ", 5) != 0) continue;
+        char *hash = strrchr(line, ' ');
+        Digest d;
+        if (!hash || digest_from_hex(hash + 1, &d) != 0) continue;
+        if (r->n_refs == cap) {
+            size_t new_cap = cap ? cap * 2 : 8;
+            Digest *grown = realloc(r->refs, sizeof(Digest) * new_cap);
+            if (!grown) break;
+            r->refs = grown;
+            cap = new_cap;
+        }
+        r->refs[r->n_refs++] = d;
+    }
+    free(line);
+    fclose(f);
+    r->size = (uint64_t)st->st_size;
+    r->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    return 0;
+}
+
+static int is_record_name(const char *name, Digest *task) {
+    size_t len = strlen(name);
+    if (len != 64 + strlen(META_SUFFIX) || strcmp(name + 64, META_SUFFIX) != 0) return 0;
+    char hex[DIGEST_HEX_SIZE], canon[DIGEST_HEX_SIZE];
+    memcpy(hex, name, 64);
+    hex[64] = '\0';
+    return digest_from_hex(hex, task) == 0 && strcmp(digest_to_hex(task, canon), hex) == 0;
+}
+
+static Record *add_record(GcState *g, const Digest *task) {
+    if (g->n_recs == g->cap_recs) {
+        size_t cap = g->cap_recs ? g->cap_recs * 2 : 256;
+        Record *grown = realloc(g->recs, sizeof(Record) * cap);
+        if (!grown) return NULL;
+        g->recs = grown;
+        g->cap_recs = cap;
+    }
+    Record *r = &g->recs[g->n_recs++];
+    memset(r, 0, sizeof(*r));
+    r->task = *task;
+    r->state = REC_EXPIRED; // not yet counted; keep_record makes it live
+    return r;
+}
+
+static int cmp_record(const void *a, const void *b) {
+    return memcmp(((const Record *)a)->task.b, ((const Record *)b)->task.b, DIGEST_SIZE);
+}
+
+static Record *find_record(GcState *g, size_t sorted, const Digest *task) {
+    Record key;
+    key.task = *task;
+    Record *r = bsearch(&key, g->recs, sorted, sizeof(Record), cmp_record);
+    for (size_t i = sorted; !r && i < g->n_recs; ++i)
+        if (cmp_record(&g->recs[i], &key) == 0) r = &g->recs[i];
+    return r;
+}
+
+static int64_t record_last_used(const GcState *g, const Record *r) {
+    int64_t used = access_time(g->access, g->n_access, &r->task);
+    int64_t written = r->mtime_ns / 1000000000LL;
+    return used > written ? used : written;
+}
+
+// Every record in the cache root, sorted by task hash
+static int scan_records(GcState *g) {
+    DIR *d = opendir(cas_get_cache_root());
+    if (!d) return -1;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        Digest task;
+        struct stat st;
+        char path[1200];
+        if (!is_record_name(de->d_name, &task)) continue;
+        cache_path(de->d_name, path, sizeof(path));
+        if (stat(path, &st) != 0) continue;
+        Record *r = add_record(g, &task);
+        if (!r || read_record(r, &st) != 0) {
+            if (r) g->n_recs--;
+            continue;
+        }
+        r->last_used = record_last_used(g, r);
+    }
+    closedir(d);
+    qsort(g->recs, g->n_recs, sizeof(Record), cmp_record);
+    return 0;
+}
+
+static int add_packed(const uint8_t digest[32], void *arg) {
+    GcState *g = arg;
+    Digest d;
+    PackRef ref;
+    memcpy(d.b, digest, DIGEST_SIZE);
+    if (!pack_find(digest, &ref)) return 0;
+    ObjEntry *o = obj_insert(g, &d);
+    if (!o) return 1;
+    if (!o->loose) o->size = ref.length;
+    o->packed = 1;
+    return 0;
+}
+
+// Every object with its stored size; loose and packed copies count once
+static int scan_objects(GcState *g) {
+    for (int b = 0; b < 256; ++b) {
+        char shard[1200];
+        snprintf(shard, sizeof(shard), "%s/%02x", cas_get_objects_root(), b);
+        DIR *d = opendir(shard);
+        if (!d) continue;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (strlen(de->d_name) != 62) continue;
+            char hex[DIGEST_HEX_SIZE];
+            Digest dg;
+            struct stat st;
+            snprintf(hex, sizeof(hex), "%02x%s", b, de->d_name);
+            if (digest_from_hex(hex, &dg) != 0 || fstatat(dirfd(d), de->d_name, &st, 0) != 0) continue;
+            ObjEntry *o = obj_insert(g, &dg);
+            if (!o) {
+                closedir(d);
+                return -1;
+            }
+            o->size = (uint64_t)st.st_size;
+            o->loose = 1;
+        }
+        closedir(d);
+    }
+    pack_reload();
+    return pack_for_each(add_packed, g);
+}
+
+static int cmp_last_used(const void *a, const void *b) {
+    const Record *x = *(Record *const *)a, *y = *(Record *const *)b;
+    return x->last_used < y->last_used ? -1 : x->last_used > y->last_used;
+}
+
+// Drop expired records, then the least recently used until under budget
+static void choose_records(GcState *g, const GcOptions *opts, int64_t now) {
+    for (size_t i = 0; i < g->n_recs; ++i) {
+        Record *r = &g->recs[i];
+        if (opts->ttl_seconds > 0 && r->last_used + opts->ttl_seconds < now) r->state = REC_EXPIRED;
+        else keep_record(g, r);
+    }
+    if (opts->max_bytes == 0 || g->live_bytes <= opts->max_bytes) return;
+    Record **order = malloc(sizeof(Record *) * (g->n_recs ? g->n_recs : 1));
+    if (!order) return;
+    size_t n = 0;
+    for (size_t i = 0; i < g->n_recs; ++i)
+        if (g->recs[i].state == REC_LIVE) order[n++] = &g->recs[i];
+    qsort(order, n, sizeof(Record *), cmp_last_used);
+    for (size_t i = 0; i < n && g->live_bytes > opts->max_bytes; ++i) drop_record(g, order[i], REC_EVICTED);
+    free(order);
+}
+
+// Under the exclusive lock: records written or used since the collection
+// started are live whatever was decided for them
+static void protect_recent(GcState *g, int64_t start_ns) {
+    size_t sorted = g->n_recs;
+    DIR *d = opendir(cas_get_cache_root());
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        Digest task;
+        struct stat st;
+        char path[1200];
+        if (!is_record_name(de->d_name, &task)) continue;
+        cache_path(de->d_name, path, sizeof(path));
+        if (stat(path, &st) != 0) continue;
+        int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        Record *r = find_record(g, sorted, &task);
+        if (r && mtime < start_ns - MTIME_SLACK_NS) continue;
+        if (!r && !(r = add_record(g, &task))) continue;
+        drop_record(g, r, REC_EVICTED); // let go of the references it had when marked
+        if (read_record(r, &st) == 0) keep_record(g, r);
+    }
+    if (d) closedir(d);
+    free(g->access);
+    load_access(&g->access, &g->n_access);
+    for (size_t i = 0; i < g->n_recs; ++i) {
+        Record *r = &g->recs[i];
+        if (r->state != REC_LIVE && access_time(g->access, g->n_access, &r->task) >= start_ns / 1000000000LL)
+            keep_record(g, r);
+    }
+}
+
+static int keep_packed(const uint8_t digest[32], void *arg) {
+    Digest d;
+    memcpy(d.b, digest, DIGEST_SIZE);
+    ObjEntry *o = obj_find(arg, &d);
+    return !o || o->refs > 0;
+}
+
+// Rewrite access.idx with one entry per surviving record
+static void compact_access(GcState *g) {
+    char path[1200], tmp[1300];
+    cache_path(ACCESS_FILE, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return;
+    for (size_t i = 0; i < g->n_recs; ++i) {
+        const Record *r = &g->recs[i];
+        uint32_t when = access_time(g->access, g->n_access, &r->task);
+        if (r->state != REC_LIVE || when == 0) continue;
+        unsigned char e[ACCESS_ENTRY_SIZE];
+        memcpy(e, r->task.b, 8);
+        for (int k = 0; k < 4; ++k) e[8 + k] = (unsigned char)(when >> (8 * k));
+        fwrite(e, 1, sizeof(e), f);
+    }
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) unlink(tmp);
+}
+
+static void sweep(GcState *g, GcStats *stats) {
+    for (size_t i = 0; i < g->n_recs; ++i) {
+        const Record *r = &g->recs[i];
+        if (r->state == REC_LIVE) continue;
+        char path[1200];
+        record_path(&r->task, path, sizeof(path));
+        if (unlink(path) == 0 || errno == ENOENT) stats->bytes_freed += r->size;
+    }
+    for (size_t i = 0; i < g->cap; ++i) {
+        ObjEntry *o = &g->objs[i];
+        if (!o->used || o->refs > 0) continue;
+        stats->objects_removed++;
+        if (!o->loose) continue;
+        char path[1200];
+        cas_get_object_path(&o->d, path, sizeof(path));
+        if (unlink(path) == 0) stats->bytes_freed += o->size;
+    }
+    PackPruneStats ps;
+    if (pack_prune(keep_packed, g, &ps) == 0 || ps.objects_dropped > 0) {
+        stats->bytes_freed += ps.bytes_dropped;
+        stats->packs_rewritten += ps.packs_rewritten + ps.packs_deleted;
+    }
+    compact_access(g);
+    // deleted objects would stay in the object filter as false positives
+    if (stats->objects_removed > 0) cas_rebuild_filter(NULL);
+}
+
+int gc_run(const GcOptions *opts, GcStats *stats) {
+    GcStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    int run_fd = open_cache_file("gc.run", O_RDWR | O_CREAT);
+    if (run_fd < 0) return -1;
+    if (flock(run_fd, LOCK_EX | LOCK_NB) != 0) {
+        close(run_fd);
+        return 1;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t start_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    GcState g;
+    memset(&g, 0, sizeof(g));
+    int rc = load_access(&g.access, &g.n_access) == 0 && scan_objects(&g) == 0 && scan_records(&g) == 0 ? 0 : -1;
+    if (rc == 0) {
+        for (size_t i = 0; i < g.cap; ++i)
+            if (g.objs[i].used) stats->bytes_before += g.objs[i].size;
+        for (size_t i = 0; i < g.n_recs; ++i) stats->bytes_before += g.recs[i].size;
+        stats->objects = g.n_objs;
+        stats->records = g.n_recs;
+        choose_records(&g, opts, ts.tv_sec);
+    }
+    int ex = -1;
+    if (rc == 0 && !opts->dry_run) {
+        ex = open_cache_file("gc.lock", O_RDWR | O_CREAT);
+        if (ex < 0 || flock_retry(ex, LOCK_EX) != 0) rc = -1;
+        else protect_recent(&g, start_ns);
+    }
+    if (rc == 0) {
+        for (size_t i = 0; i < g.n_recs; ++i) {
+            if (g.recs[i].state == REC_EXPIRED) stats->records_expired++;
+            else if (g.recs[i].state == REC_EVICTED) stats->records_evicted++;
+        }
+        if (opts->dry_run) {
+            stats->bytes_freed = stats->bytes_before - g.live_bytes;
+            for (size_t i = 0; i < g.cap; ++i)
+                if (g.objs[i].used && g.objs[i].refs == 0) stats->objects_removed++;
+        } else {
+            sweep(&g, stats);
+        }
+    }
+    if (ex >= 0) close(ex); // drops the lock
+    for (size_t i = 0; i < g.n_recs; ++i) free(g.recs[i].refs);
+    free(g.recs);
+    free(g.objs);
+    free(g.access);
+    close(run_fd);
+    return rc;
+}
+
+int gc_repack(CasRepackStats *stats) {
+    int run_fd = open_cache_file("gc.run", O_RDWR | O_CREAT);
+    if (run_fd < 0) return -1;
+    if (flock(run_fd, LOCK_EX | LOCK_NB) != 0) {
+        close(run_fd);
+        if (stats) memset(stats, 0, sizeof(*stats));
+        return 1;
+    }
+    int rc = cas_repack(stats);
+    close(run_fd);
+    return rc;
+}
+
+/* ---- quarantine ---- */
+
+static int push_digest(Digest **list, size_t *n, size_t *cap, const Digest *d) {
+    if (*n == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 64;
+        Digest *grown = realloc(*list, sizeof(Digest) * new_cap);
+        if (!grown) return -1;
+        *list = grown;
+        *cap = new_cap;
+    }
+    (*list)[(*n)++] = *d;
+    return 0;
+}
+
+// Digests of a quarantine that was interrupted, appended to list
+static void load_pending(Digest **list, size_t *n, size_t *cap) {
+    char path[1200], line[128];
+    cache_path(PENDING_FILE, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        Digest d;
+        line[strcspn(line, "\n")] = '\0';
+        if (digest_from_hex(line, &d) != 0) continue;
+        if (push_digest(list, n, cap, &d) != 0) break;
+    }
+    if (f) fclose(f);
+}
+
+static int save_pending(const Digest *list, size_t n) {
+    char path[1200], tmp[1300], hex[DIGEST_HEX_SIZE];
+    cache_path(PENDING_FILE, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    for (size_t i = 0; i < n; ++i) fprintf(f, "%s\n", digest_to_hex(&list[i], hex));
+    int failed = ferror(f) || fflush(f) != 0 || fsync(fileno(f)) != 0;
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    Digest *d;
+    size_t n, cap;
+} Via;
+
+// Whether an output needs one of the sorted digests in bad: itself, a
+// chunk, or anything in its tree. With via, every tree and chunk list on
+// the way to a bad object is appended there (duplicates included).
+static int needs_any(const Digest *out, const Digest *bad, size_t n, Via *via) {
+    if (bsearch(out, bad, n, sizeof(Digest), digest_qsort_cmp)) return 1;
+    Digest *refs;
+    size_t m;
+    int hit = 0;
+    if (cas_object_refs(out, &refs, &m) == 1) {
+        for (size_t i = 0; i < m && (via || !hit); ++i)
+            if (needs_any(&refs[i], bad, n, via)) hit = 1;
+        free(refs);
+    }
+    if (hit && via) push_digest(&via->d, &via->n, &via->cap, out);
+    return hit;
+}
+
+// The trees and chunk lists that the records reach a bad object through,
+// sorted and without duplicates
+static void parents_needing(const Digest *bad, size_t n, Via *via) {
+    DIR *d = opendir(cas_get_cache_root());
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        Record r;
+        struct stat st;
+        char path[1200];
+        memset(&r, 0, sizeof(r));
+        if (!is_record_name(de->d_name, &r.task)) continue;
+        cache_path(de->d_name, path, sizeof(path));
+        if (stat(path, &st) != 0 || read_record(&r, &st) != 0) continue;
+        for (size_t i = 0; i < r.n_refs; ++i) needs_any(&r.refs[i], bad, n, via);
+        free(r.refs);
+    }
+    if (d) closedir(d);
+    qsort(via->d, via->n, sizeof(Digest), digest_qsort_cmp);
+    size_t m = 0;
+    for (size_t i = 0; i < via->n; ++i)
+        if (m == 0 || !digest_eq(&via->d[m - 1], &via->d[i])) via->d[m++] = via->d[i];
+    via->n = m;
+}
+
+static uint64_t drop_records_needing(const Digest *bad, size_t n) {
+    uint64_t removed = 0;
+    DIR *d = opendir(cas_get_cache_root());
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        Record r;
+        struct stat st;
+        char path[1200];
+        memset(&r, 0, sizeof(r));
+        if (!is_record_name(de->d_name, &r.task)) continue;
+        cache_path(de->d_name, path, sizeof(path));
+        if (stat(path, &st) != 0 || read_record(&r, &st) != 0) continue;
+        int bad_record = 0;
+        for (size_t i = 0; i < r.n_refs && !bad_record; ++i) bad_record = needs_any(&r.refs[i], bad, n, NULL);
+        if (bad_record && unlink(path) == 0) removed++;
+        free(r.refs);
+    }
+    if (d) closedir(d);
+    return removed;
+}
+
+int gc_quarantine(const Digest bad[], size_t n, uint64_t *records_removed) {
+    if (records_removed) *records_removed = 0;
+    char pending[1200];
+    cache_path(PENDING_FILE, pending, sizeof(pending));
+    if (n == 0 && access(pending, F_OK) != 0) return 0;
+    // a collection rewrites packs too: the two take turns
+    int run_fd = open_cache_file("gc.run", O_RDWR | O_CREAT);
+    if (run_fd < 0) return -1;
+    int ex = -1, rc = flock_retry(run_fd, LOCK_EX) == 0 ? 0 : -1;
+    if (rc == 0) {
+        ex = open_cache_file("gc.lock", O_RDWR | O_CREAT);
+        if (ex < 0 || flock_retry(ex, LOCK_EX) != 0) rc = -1;
+    }
+    Digest *all = NULL;
+    size_t n_all = 0, cap = 0;
+    if (rc == 0) {
+        load_pending(&all, &n_all, &cap);
+        Digest *grown = n > 0 ? realloc(all, sizeof(Digest) * (n_all + n)) : NULL;
+        if (grown) {
+            memcpy(grown + n_all, bad, sizeof(Digest) * n);
+            all = grown;
+            n_all += n;
+            cap = n_all;
+        } else if (n > 0) {
+            rc = -1;
+        }
+    }
+    // Objects go first and records after, so a crash in between must be
+    // finished by the next call: the list is kept until the records are gone
+    if (rc == 0 && n_all > 0) {
+        if (save_pending(all, n_all) != 0 || cas_quarantine_objects(all, n_all) != 0) rc = -1;
+        size_t gone = 0;
+        for (size_t i = 0; i < n_all; ++i) // stored again since, intact
+            if (!cas_blob_exists(&all[i])) all[gone++] = all[i];
+        qsort(all, gone, sizeof(Digest), digest_qsort_cmp);
+        // the trees and chunk lists above a bad object go too: the stat
+        // index would otherwise keep reusing them, and the object they name
+        // would never be stored again
+        Via via = { NULL, 0, 0 };
+        if (gone) parents_needing(all, gone, &via);
+        n_all = gone;
+        for (size_t i = 0; i < via.n; ++i)
+            if (push_digest(&all, &n_all, &cap, &via.d[i]) != 0) rc = -1;
+        if (via.n > 0 && rc == 0 && (save_pending(all, n_all) != 0 || cas_quarantine_objects(via.d, via.n) != 0))
+            rc = -1;
+        free(via.d);
+        gone = n_all;
+        qsort(all, gone, sizeof(Digest), digest_qsort_cmp);
+        uint64_t removed = gone ? drop_records_needing(all, gone) : 0;
+        if (records_removed) *records_removed = removed;
+        if (rc == 0) unlink(pending);
+    }
+    free(all);
+    if (ex >= 0) close(ex);
+    close(run_fd);
+    return rc;
+}
@@ -0,0 +1,72 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stdint.h>
+#include "cas.h"
+#include "digest.h"
+
+/*
+ * Cache garbage collection. Every object reachable from a task record
+ * (.meta in the cache root, through chunk lists and trees) is live; everything else is
+ * garbage. Records unused for longer than the TTL are dropped, then the
+ * least recently used ones until the live objects and records fit the size
+ * budget, and the objects they alone kept alive go with them.
+ *
+ * Builds and a collection share the store through gc.lock in the cache
+ * root. A build holds it shared from the moment it stores outputs (or reads
+ * a record) until the record is written (or its outputs are restored). The
+ * collector marks without the lock, then takes it exclusively, re-reads the
+ * records written or used since it started, and only then deletes. Objects
+ * added after the collector listed the store are never candidates.
+ *
+ * Record use is tracked in access.idx, a compact side index of 12-byte
+ * entries { uint8 task_hash[0..8); uint32 unix_seconds } (little-endian),
+ * appended on every cache hit and folded to one entry per record by the
+ * collector. Filesystem atime is never consulted.
+ */
+
+typedef struct {
+    uint64_t max_bytes; // budget for objects plus records; 0 = no budget
+    int64_t ttl_seconds; // drop records unused this long; 0 = keep
+    int dry_run;        // report only
+} GcOptions;
+
+typedef struct {
+    uint64_t records;         // records found
+    uint64_t records_expired; // dropped for the TTL
+    uint64_t records_evicted; // dropped for the size budget
+    uint64_t objects;         // objects found, loose and packed
+    uint64_t objects_removed;
+    uint64_t bytes_before;    // objects plus records
+    uint64_t bytes_freed;
+    uint64_t packs_rewritten;
+} GcStats;
+
+// Collect the store set up by cas_init. Returns 0 on success, 1 if another
+// collection is running, -1 on error.
+int gc_run(const GcOptions *opts, GcStats *stats);
+
+// cas_repack under gc.run, so a repack never rewrites packs while a
+// collection or quarantine prunes them. Returns 0 on success, 1 if one of
+// those (or another repack) is running, -1 on error.
+int gc_repack(CasRepackStats *stats);
+
+// Hold gc.lock shared (see above). Nests across threads of one process.
+// Failing to open the lock is not an error: the build then runs unprotected.
+void gc_lock_shared(void);
+void gc_unlock_shared(void);
+
+// Record a use of the task record named by task_hash
+void gc_note_access(const Digest *task_hash);
+
+// Quarantine damaged objects (cas_quarantine_objects) and delete every
+// record whose outputs need one of them, directly, as a chunk or in a tree, so no
+// later build restores from them. The trees and chunk lists those records
+// reach them through are quarantined too, so the stat index cannot reuse
+// them and a rebuild stores the objects again. Runs under gc.run and the
+// exclusive gc.lock. The digests are kept in quarantine.pending until the
+// records are gone; a call with n = 0 finishes an interrupted quarantine.
+// *records_removed (optional) gets the records deleted. Returns 0 on success.
+int gc_quarantine(const Digest bad[], size_t n, uint64_t *records_removed);
+
+#endif // GC_H
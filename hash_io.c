@@ -0,0 +1,124 @@
+// hash_io.c
+#define _GNU_SOURCE
+#include "hash_io.h"
+#include "sha256.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const char *const strategy_names[HASH_IO_COUNT] = { "auto", "pread", "read", "mmap" };
+
+const char *hash_io_strategy_name(HashIoStrategy s) {
+    return (s >= 0 && s < HASH_IO_COUNT) ? strategy_names[s] : "unknown";
+}
+
+HashIoStrategy hash_io_choose(const struct stat *st) {
+    if (!S_ISREG(st->st_mode)) return HASH_IO_READ;
+    if (st->st_size <= HASH_IO_PREAD_MAX) return HASH_IO_PREAD;
+    if (st->st_size >= HASH_IO_MMAP_MIN) return HASH_IO_MMAP;
+    return HASH_IO_READ;
+}
+
+static int deliver(const unsigned char *data, size_t len, size_t piece, hash_io_fn fn, void *ctx) {
+    for (size_t off = 0; off < len; off += piece) {
+        size_t n = len - off < piece ? len - off : piece;
+        if (fn(data + off, n, ctx) != 0) return -1;
+    }
+    return 0;
+}
+
+// pread from pos to EOF through buf. On a regular file a short read is EOF,
+// which saves the final zero-length read.
+static int scan_read_from(int fd, off_t pos, unsigned char *buf, size_t cap, hash_io_fn fn, void *ctx) {
+    for (;;) {
+        ssize_t r = pread(fd, buf, cap, pos);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) return 0;
+        if (deliver(buf, (size_t)r, HASH_IO_PIECE, fn, ctx) != 0) return -1;
+        if ((size_t)r < cap) return 0;
+        pos += r;
+    }
+}
+
+static int scan_pread(int fd, const struct stat *st, hash_io_fn fn, void *ctx) {
+    // one byte of slack tells "exactly st_size" from "grew since fstat"
+    size_t cap = (size_t)st->st_size + 1;
+    if (cap > HASH_IO_PIECE) cap = HASH_IO_PIECE;
+    unsigned char *buf = malloc(cap);
+    if (!buf) return -1;
+    int rc = scan_read_from(fd, 0, buf, cap, fn, ctx);
+    free(buf);
+    return rc;
+}
+
+static int scan_read(int fd, const struct stat *st, hash_io_fn fn, void *ctx) {
+    void *buf = NULL;
+    if (posix_memalign(&buf, 4096, HASH_IO_READ_BUF) != 0) return -1;
+    if (S_ISREG(st->st_mode)) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int rc = 0;
+    if (S_ISREG(st->st_mode)) {
+        rc = scan_read_from(fd, 0, buf, HASH_IO_READ_BUF, fn, ctx);
+    } else {
+        // pipes and devices cannot pread
+        for (;;) {
+            ssize_t r = read(fd, buf, HASH_IO_READ_BUF);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0 || deliver(buf, (size_t)r, HASH_IO_PIECE, fn, ctx) != 0) {
+                rc = r == 0 ? 0 : -1;
+                break;
+            }
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+static int scan_mmap(int fd, const struct stat *st, size_t piece, hash_io_fn fn, void *ctx) {
+    size_t len = (size_t)st->st_size;
+    if (len == 0) return scan_pread(fd, st, fn, ctx);
+    unsigned char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return scan_read(fd, st, fn, ctx);
+    madvise(map, len, MADV_SEQUENTIAL);
+    int rc = deliver(map, len, piece, fn, ctx);
+    munmap(map, len);
+    if (rc != 0) return -1;
+    // anything appended after fstat, so every strategy reads to EOF
+    unsigned char tail[4096];
+    return scan_read_from(fd, (off_t)len, tail, sizeof(tail), fn, ctx);
+}
+
+static int scan(int fd, HashIoStrategy s, size_t map_piece, hash_io_fn fn, void *ctx) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    if (s == HASH_IO_AUTO || !S_ISREG(st.st_mode)) s = hash_io_choose(&st);
+    switch (s) {
+        case HASH_IO_PREAD: return scan_pread(fd, &st, fn, ctx);
+        case HASH_IO_MMAP:  return scan_mmap(fd, &st, map_piece, fn, ctx);
+        default:            return scan_read(fd, &st, fn, ctx);
+    }
+}
+
+int hash_io_scan(int fd, HashIoStrategy s, hash_io_fn fn, void *ctx) {
+    return scan(fd, s, HASH_IO_PIECE, fn, ctx);
+}
+
+int hash_io_scan_mapped(int fd, HashIoStrategy s, hash_io_fn fn, void *ctx) {
+    return scan(fd, s, SIZE_MAX, fn, ctx);
+}
+
+static int sha256_piece(const unsigned char *data, size_t len, void *ctx) {
+    sha256_update(ctx, data, len);
+    return 0;
+}
+
+int hash_io_sha256_fd(int fd, HashIoStrategy s, uint8_t out[32]) {
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    if (hash_io_scan(fd, s, sha256_piece, &ctx) != 0) return -1;
+    sha256_final(&ctx, out);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef HASH_IO_H
+#define HASH_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * Sequential file reading for hashing and ingest. The strategy follows the
+ * file size: tiny files take one pread, medium files stream through a large
+ * page-aligned buffer with posix_fadvise(SEQUENTIAL), and large files are
+ * mmap'd with MADV_SEQUENTIAL so their pages are hashed without a copy.
+ * Content is always delivered in order, in pieces of at most HASH_IO_PIECE.
+ * As with any mmap reader, truncating a file while it is being mapped and
+ * hashed raises SIGBUS; inputs are not expected to change mid-task.
+ */
+
+typedef enum {
+    HASH_IO_AUTO,  // pick by size (hash_io_choose)
+    HASH_IO_PREAD, // pread into a buffer sized to the file
+    HASH_IO_READ,  // read() through an aligned HASH_IO_READ_BUF buffer
+    HASH_IO_MMAP,  // map the file; bytes appended after fstat are read()
+    HASH_IO_COUNT
+} HashIoStrategy;
+
+#define HASH_IO_PIECE (256 * 1024)
+#define HASH_IO_READ_BUF (256 * 1024)     // larger buffers fall out of L2 and measure slower
+#define HASH_IO_PREAD_MAX (64 * 1024)       // at most this: one pread
+#define HASH_IO_MMAP_MIN (4 * 1024 * 1024)  // at least this: mmap
+
+// Called for each piece in file order; nonzero stops the scan
+typedef int (*hash_io_fn)(const unsigned char *data, size_t len, void *ctx);
+
+// Deliver the whole content of fd (read from its start) to fn. Returns 0 on
+// success, -1 on an I/O error or if fn stopped the scan.
+int hash_io_scan(int fd, HashIoStrategy s, hash_io_fn fn, void *ctx);
+
+// As hash_io_scan, except that a mapped file comes in one piece, for hashes
+// that split large inputs across threads (BLAKE3)
+int hash_io_scan_mapped(int fd, HashIoStrategy s, hash_io_fn fn, void *ctx);
+
+// SHA-256 of the whole content of fd
+int hash_io_sha256_fd(int fd, HashIoStrategy s, uint8_t out[32]);
+
+HashIoStrategy hash_io_choose(const struct stat *st);
+const char *hash_io_strategy_name(HashIoStrategy s);
+
+#endif // HASH_IO_H
@@ -0,0 +1,139 @@
+// hash_pool.c
+#define _POSIX_C_SOURCE 200809L
+#include "hash_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define HASH_POOL_MAX_THREADS 64
+
+// One hash_pool_run call. Lives on the caller's stack while it is queued.
+typedef struct Batch {
+    void (*fn)(void *ctx, int i);
+    void *ctx;
+    int n;
+    int next;     // next index to hand out
+    int finished; // indices completed
+    struct Batch *next_batch;
+} Batch;
+
+static pthread_mutex_t pool_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+static Batch *queue_head = NULL, *queue_tail = NULL;
+static pthread_t workers[HASH_POOL_MAX_THREADS];
+static int n_workers = 0;  // running threads
+static int want_workers = -1; // -1 until configured or defaulted
+static int stopping = 0;
+
+static int default_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 1 ? (int)cpus - 1 : 0;
+}
+
+int hash_pool_init(int threads) {
+    pthread_mutex_lock(&pool_mu);
+    if (threads <= 0) threads = default_threads();
+    want_workers = threads > HASH_POOL_MAX_THREADS ? HASH_POOL_MAX_THREADS : threads;
+    pthread_mutex_unlock(&pool_mu);
+    return 0;
+}
+
+int hash_pool_size(void) {
+    pthread_mutex_lock(&pool_mu);
+    if (want_workers < 0) want_workers = default_threads();
+    int n = n_workers ? n_workers : want_workers;
+    pthread_mutex_unlock(&pool_mu);
+    return n;
+}
+
+// Claim the next index of the head batch; caller holds pool_mu
+static Batch *claim_locked(int *index) {
+    Batch *b = queue_head;
+    if (!b) return NULL;
+    *index = b->next++;
+    if (b->next == b->n) {
+        queue_head = b->next_batch;
+        if (!queue_head) queue_tail = NULL;
+    }
+    return b;
+}
+
+static void finish_locked(Batch *b) {
+    if (++b->finished == b->n) pthread_cond_broadcast(&done_cv);
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool_mu);
+    for (;;) {
+        while (!queue_head && !stopping) pthread_cond_wait(&work_cv, &pool_mu);
+        if (stopping) break;
+        int i;
+        Batch *b = claim_locked(&i);
+        pthread_mutex_unlock(&pool_mu);
+        b->fn(b->ctx, i);
+        pthread_mutex_lock(&pool_mu);
+        finish_locked(b);
+    }
+    pthread_mutex_unlock(&pool_mu);
+    return NULL;
+}
+
+// Start the threads on first use; caller holds pool_mu
+static void start_locked(void) {
+    if (want_workers < 0) want_workers = default_threads();
+    while (n_workers < want_workers) {
+        if (pthread_create(&workers[n_workers], NULL, worker_main, NULL) != 0) break;
+        n_workers++;
+    }
+}
+
+void hash_pool_run(int n, void (*fn)(void *ctx, int i), void *ctx) {
+    if (n <= 0) return;
+    Batch b = { fn, ctx, n, 0, 0, NULL };
+    pthread_mutex_lock(&pool_mu);
+    start_locked();
+    if (n == 1 || n_workers == 0) {
+        pthread_mutex_unlock(&pool_mu);
+        for (int i = 0; i < n; ++i) fn(ctx, i);
+        return;
+    }
+    if (queue_tail) queue_tail->next_batch = &b;
+    else queue_head = &b;
+    queue_tail = &b;
+    pthread_cond_broadcast(&work_cv);
+    // help with our own batch only, so a small batch never waits behind a big one
+    while (b.next < b.n) {
+        int i = b.next++;
+        if (b.next == b.n) {
+            // unlink: b is not necessarily at the head
+            Batch **p = &queue_head, *prev = NULL;
+            while (*p != &b) {
+                prev = *p;
+                p = &(*p)->next_batch;
+            }
+            *p = b.next_batch;
+            if (queue_tail == &b) queue_tail = prev;
+        }
+        pthread_mutex_unlock(&pool_mu);
+        fn(ctx, i);
+        pthread_mutex_lock(&pool_mu);
+        finish_locked(&b);
+    }
+    while (b.finished < b.n) pthread_cond_wait(&done_cv, &pool_mu);
+    pthread_mutex_unlock(&pool_mu);
+}
+
+void hash_pool_shutdown(void) {
+    pthread_mutex_lock(&pool_mu);
+    stopping = 1;
+    pthread_cond_broadcast(&work_cv);
+    int n = n_workers;
+    pthread_mutex_unlock(&pool_mu);
+    for (int i = 0; i < n; ++i) pthread_join(workers[i], NULL);
+    pthread_mutex_lock(&pool_mu);
+    n_workers = 0;
+    stopping = 0;
+    pthread_mutex_unlock(&pool_mu);
+}
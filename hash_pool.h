@@ -0,0 +1,26 @@
+#ifndef HASH_POOL_H
+#define HASH_POOL_H
+
+/*
+ * Process-wide worker pool for file hashing. Callers hand over a batch of n
+ * independent jobs and block until all are done; job i writes only its own
+ * result slot, so results do not depend on scheduling. The calling thread
+ * works on its own batch too, so batches from many threads (e.g. executor
+ * workers) share the pool without deadlock, and at most
+ * threads + callers jobs run at once.
+ */
+
+// Set the number of pool threads (0 = one per online CPU, less the
+// caller). Takes effect when the pool starts, on first use. Returns 0.
+int hash_pool_init(int threads);
+
+// Run fn(ctx, i) for every i in [0, n), then return
+void hash_pool_run(int n, void (*fn)(void *ctx, int i), void *ctx);
+
+// Pool threads that will serve batches (the pool may not be started yet)
+int hash_pool_size(void);
+
+// Stop and join the pool threads; a later hash_pool_run starts them again
+void hash_pool_shutdown(void);
+
+#endif // HASH_POOL_H
@@ -2,6 +2,7 @@
 #define HEALTH_CHECK_H
 
 #include <time.h>
+#include <stdint.h>
 
 // Health status
 typedef enum {
@@ -0,0 +1,350 @@
+// http.c
+#define _GNU_SOURCE
+#include "http.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define HTTP_MAX_LINE 8192
+#define HTTP_MAX_HEADERS 100
+
+int http_parse_url(const char *url, char *host, size_t host_sz, char *port, size_t port_sz,
+                   char *prefix, size_t prefix_sz) {
+    const char *scheme = "http://";
+    if (strncasecmp(url, scheme, strlen(scheme)) != 0) return -1;
+    const char *p = url + strlen(scheme);
+    const char *path = p + strcspn(p, "/");
+    const char *colon = memchr(p, ':', (size_t)(path - p));
+    const char *host_end = colon ? colon : path;
+    if (host_end == p || (size_t)(host_end - p) >= host_sz) return -1;
+    memcpy(host, p, (size_t)(host_end - p));
+    host[host_end - p] = '\0';
+    if (colon) {
+        size_t n = (size_t)(path - colon - 1);
+        if (n == 0 || n >= port_sz || strspn(colon + 1, "0123456789") < n) return -1;
+        memcpy(port, colon + 1, n);
+        port[n] = '\0';
+    } else {
+        snprintf(port, port_sz, "80");
+    }
+    size_t n = strlen(path);
+    while (n > 0 && path[n - 1] == '/') n--;
+    if (n >= prefix_sz) return -1;
+    memcpy(prefix, path, n);
+    prefix[n] = '\0';
+    return 0;
+}
+
+static void set_socket_options(int fd) {
+    struct timeval tv = { HTTP_TIMEOUT_SEC, 0 };
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    // pipelined requests are small and must not wait for each other's ACKs
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+void http_conn_init(HttpConn *c, const char *host, const char *port) {
+    c->fd = -1;
+    snprintf(c->host, sizeof(c->host), "%s", host ? host : "");
+    snprintf(c->port, sizeof(c->port), "%s", port ? port : "");
+    c->pos = c->len = 0;
+    c->connects = 0;
+}
+
+void http_attach(HttpConn *c, int fd) {
+    http_conn_init(c, NULL, NULL);
+    c->fd = fd;
+    set_socket_options(fd);
+}
+
+int http_connect(HttpConn *c) {
+    if (c->fd >= 0) return 0;
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(c->host, c->port, &hints, &res) != 0) return -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        set_socket_options(fd);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            c->fd = fd;
+            c->connects++;
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(res);
+    c->pos = c->len = 0;
+    return c->fd >= 0 ? 0 : -1;
+}
+
+void http_close(HttpConn *c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->pos = c->len = 0;
+}
+
+// Refill the buffer. Returns bytes read, 0 at end of stream, -1 on error.
+static ssize_t fill(HttpConn *c) {
+    if (c->pos == c->len) c->pos = c->len = 0;
+    for (;;) {
+        ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) c->len += (size_t)n;
+        return n;
+    }
+}
+
+// One CRLF- (or LF-) terminated line without its terminator. Returns 0,
+// 1 at end of stream before any byte, -1 on error or an overlong line.
+static int read_line(HttpConn *c, char *line, size_t cap) {
+    size_t n = 0;
+    for (;;) {
+        while (c->pos < c->len) {
+            char ch = (char)c->buf[c->pos++];
+            if (ch == '\n') {
+                if (n > 0 && line[n - 1] == '\r') n--;
+                line[n] = '\0';
+                return 0;
+            }
+            if (n + 1 >= cap) return -1;
+            line[n++] = ch;
+        }
+        ssize_t r = fill(c);
+        if (r == 0) return n == 0 ? 1 : -1;
+        if (r < 0) return -1;
+    }
+}
+
+int http_read_head(HttpConn *c, HttpHead *h, int is_response) {
+    char line[HTTP_MAX_LINE];
+    memset(h, 0, sizeof(*h));
+    h->content_length = -1;
+    int r;
+    // tolerate blank lines between pipelined messages
+    while ((r = read_line(c, line, sizeof(line))) == 0 && line[0] == '\0') {}
+    if (r != 0) return r;
+
+    char *save = NULL, *tok = strtok_r(line, " ", &save);
+    for (int i = 0; i < 3 && tok; ++i) {
+        snprintf(h->start[i], sizeof(h->start[i]), "%s", tok);
+        tok = strtok_r(NULL, i == 1 ? "" : " ", &save);
+    }
+    const char *version = is_response ? h->start[0] : h->start[2];
+    if (strncmp(version, "HTTP/1.", 7) != 0) return -1;
+    h->close = strcmp(version, "HTTP/1.0") == 0;
+    if (is_response) {
+        h->status = atoi(h->start[1]);
+        if (h->status < 100 || h->status > 599) return -1;
+    } else if (h->start[1][0] == '\0') {
+        return -1;
+    }
+
+    for (int i = 0;; ++i) {
+        if (i > HTTP_MAX_HEADERS || read_line(c, line, sizeof(line)) != 0) return -1;
+        if (line[0] == '\0') return 0;
+        char *colon = strchr(line, ':');
+        if (!colon) return -1;
+        *colon = '\0';
+        char *value = colon + 1;
+        value += strspn(value, " \t");
+        if (strcasecmp(line, "Content-Length") == 0) {
+            char *end;
+            errno = 0;
+            long long v = strtoll(value, &end, 10);
+            if (errno || end == value || v < 0) return -1;
+            h->content_length = v;
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+            h->chunked = strcasestr(value, "chunked") != NULL;
+        } else if (strcasecmp(line, "Connection") == 0) {
+            if (strcasestr(value, "close")) h->close = 1;
+            else if (strcasestr(value, "keep-alive")) h->close = 0;
+        }
+    }
+}
+
+// Pass exactly len bytes of the stream to sink (or drop them)
+static int read_exact(HttpConn *c, uint64_t len, HttpSink sink, void *ctx) {
+    while (len > 0) {
+        if (c->pos == c->len) {
+            ssize_t r = fill(c);
+            if (r <= 0) return -1;
+        }
+        size_t n = c->len - c->pos;
+        if (n > len) n = (size_t)len;
+        if (sink && sink(c->buf + c->pos, n, ctx) != 0) return -1;
+        c->pos += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int http_read_body(HttpConn *c, const HttpHead *h, int no_body, HttpSink sink, void *ctx) {
+    if (no_body || (h->status >= 100 && h->status < 200) || h->status == 204 || h->status == 304)
+        return 0;
+    if (h->chunked) {
+        char line[HTTP_MAX_LINE];
+        for (;;) {
+            if (read_line(c, line, sizeof(line)) != 0) return -1;
+            char *end;
+            errno = 0;
+            unsigned long long size = strtoull(line, &end, 16);
+            if (errno || end == line) return -1;
+            if (size == 0) break;
+            if (read_exact(c, size, sink, ctx) != 0 || read_line(c, line, sizeof(line)) != 0 ||
+                line[0] != '\0')
+                return -1;
+        }
+        // trailers
+        do {
+            if (read_line(c, line, sizeof(line)) != 0) return -1;
+        } while (line[0] != '\0');
+        return 0;
+    }
+    if (h->content_length >= 0) return read_exact(c, (uint64_t)h->content_length, sink, ctx);
+    if (h->status == 0) return 0; // a request without a length has no body
+    // a response without either runs to the end of the stream
+    for (;;) {
+        if (c->pos < c->len) {
+            if (sink && sink(c->buf + c->pos, c->len - c->pos, ctx) != 0) return -1;
+            c->pos = c->len;
+        }
+        ssize_t r = fill(c);
+        if (r == 0) return 0;
+        if (r < 0) return -1;
+    }
+}
+
+static int send_flags(int fd, const void *data, size_t len, int flags) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, flags | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int http_write_all(int fd, const void *data, size_t len) {
+    return send_flags(fd, data, len, 0);
+}
+
+int http_send_file(int fd, int src, off_t off, uint64_t len) {
+    // pread + send rather than sendfile, which would raise SIGPIPE on a
+    // peer that went away
+    unsigned char buf[HTTP_READ_BUF];
+    while (len > 0) {
+        size_t want = len < sizeof(buf) ? (size_t)len : sizeof(buf);
+        ssize_t n = pread(src, buf, want, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        if (send_flags(fd, buf, (size_t)n, len > (uint64_t)n ? MSG_MORE : 0) != 0) return -1;
+        off += n;
+        len -= (uint64_t)n;
+    }
+    return 0;
+}
+
+void http_op_init(HttpOp *op, const char *method, const char *path) {
+    memset(op, 0, sizeof(*op));
+    op->method = method;
+    snprintf(op->path, sizeof(op->path), "%s", path);
+    op->body_fd = -1;
+    op->length = -1;
+}
+
+static int has_body(const HttpOp *op) {
+    return strcmp(op->method, "GET") != 0 && strcmp(op->method, "HEAD") != 0;
+}
+
+// Whether the response may be large; PUT answers are only a status
+static int has_reply(const HttpOp *op) {
+    return strcmp(op->method, "HEAD") != 0 && strcmp(op->method, "PUT") != 0;
+}
+
+static int send_request(HttpConn *c, const HttpOp *op) {
+    char head[HTTP_MAX_LINE];
+    int n;
+    if (has_body(op))
+        n = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s:%s\r\nContent-Length: %llu\r\n\r\n",
+                     op->method, op->path, c->host, c->port, (unsigned long long)op->body_len);
+    else
+        n = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s:%s\r\n\r\n",
+                     op->method, op->path, c->host, c->port);
+    if (n < 0 || (size_t)n >= sizeof(head)) return -1;
+    int more = has_body(op) && op->body_len > 0;
+    if (send_flags(c->fd, head, (size_t)n, more ? MSG_MORE : 0) != 0) return -1;
+    if (!more) return 0;
+    if (op->body_fd >= 0) return http_send_file(c->fd, op->body_fd, op->body_off, op->body_len);
+    return op->body ? http_write_all(c->fd, op->body, (size_t)op->body_len) : -1;
+}
+
+int http_pipeline(HttpConn *c, HttpOp *ops, int n) {
+    for (int i = 0; i < n; ++i) {
+        ops[i].status = 0;
+        ops[i].length = -1;
+    }
+    int done = 0, stalls = 0;
+    while (done < n) {
+        int start = done, sent = done, replies = 0, broke = 0;
+        if (http_connect(c) != 0) return -1;
+        while (done < n) {
+            while (sent < n && sent - done < HTTP_PIPELINE_DEPTH) {
+                // a request body is not written while a response body may
+                // be queued behind it on the server: both sides would block
+                if (has_body(&ops[sent]) && replies > 0) break;
+                if (send_request(c, &ops[sent]) != 0) {
+                    broke = 1;
+                    break;
+                }
+                if (has_reply(&ops[sent])) replies++;
+                sent++;
+            }
+            if (broke) break;
+
+            HttpOp *op = &ops[done];
+            HttpHead h;
+            if (http_read_head(c, &h, 1) != 0) {
+                broke = 1;
+                break;
+            }
+            if (h.status < 200) continue; // interim
+            int ok = h.status >= 200 && h.status < 300;
+            op->length = h.content_length; // for the sink, which may want the size
+            if (http_read_body(c, &h, strcmp(op->method, "HEAD") == 0, ok ? op->sink : NULL,
+                               op->ctx) != 0) {
+                broke = 1;
+                break;
+            }
+            op->status = h.status;
+            if (has_reply(op)) replies--;
+            done++;
+            int to_eof = h.content_length < 0 && !h.chunked && h.status != 204 && h.status != 304 &&
+                         strcmp(op->method, "HEAD") != 0;
+            if (h.close || to_eof) {
+                http_close(c); // the rest go out again on a new connection
+                break;
+            }
+        }
+        if (!broke) continue;
+        http_close(c);
+        // give up only after two connections in a row got nothing done
+        stalls = done == start ? stalls + 1 : 0;
+        if (stalls > 1) return -1;
+        if (done < n && ops[done].reset) ops[done].reset(ops[done].ctx);
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Minimal HTTP/1.1 over plain POSIX sockets, shared by the remote CAS
+ * client and reprovm-cas-server. Connections are kept alive and requests
+ * are pipelined: a batch is written back to back and the responses are
+ * read in order, so n small requests cost one round trip, not n.
+ * Bodies are streamed: a request body can come straight from a file and a
+ * response body goes to a sink callback, so neither side holds a whole
+ * blob in memory. Only identity and chunked response bodies are read;
+ * requests always carry Content-Length. No TLS.
+ */
+
+#define HTTP_READ_BUF 65536
+#define HTTP_PIPELINE_DEPTH 32 // requests in flight on one connection
+#define HTTP_TIMEOUT_SEC 30
+
+// A buffered connection. fd is -1 while not connected.
+typedef struct {
+    int fd;
+    char host[256];
+    char port[16];
+    unsigned char buf[HTTP_READ_BUF];
+    size_t pos, len; // unread bytes are buf[pos..len)
+    uint64_t connects; // connections opened, for callers' statistics
+} HttpConn;
+
+// The start line and the headers this code acts on
+typedef struct {
+    char start[3][1024];    // method, target, version; or version, status, reason
+    int status;             // responses only
+    int64_t content_length; // -1 if absent
+    int chunked;
+    int close;              // Connection: close, or HTTP/1.0 without keep-alive
+} HttpHead;
+
+// Receives body bytes; returns 0 to continue
+typedef int (*HttpSink)(const unsigned char *data, size_t len, void *ctx);
+
+// Split "http://host[:port][/prefix]" into its parts; prefix loses any
+// trailing '/'. Returns -1 for other schemes (https included) or bad syntax.
+int http_parse_url(const char *url, char *host, size_t host_sz, char *port, size_t port_sz,
+                   char *prefix, size_t prefix_sz);
+
+// Bind to host and port without connecting yet; http_attach for an
+// accepted socket.
+void http_conn_init(HttpConn *c, const char *host, const char *port);
+void http_attach(HttpConn *c, int fd);
+int http_connect(HttpConn *c); // no-op when already connected
+void http_close(HttpConn *c);
+
+// Read a request or response head. Returns 0, 1 on a clean end of stream
+// before the first byte, -1 on error or malformed input.
+int http_read_head(HttpConn *c, HttpHead *h, int is_response);
+
+// Read the body h announces (none for HEAD responses, 1xx, 204 and 304:
+// pass no_body) into sink, which may be NULL to discard it.
+int http_read_body(HttpConn *c, const HttpHead *h, int no_body, HttpSink sink, void *ctx);
+
+// Blocking writes that never raise SIGPIPE
+int http_write_all(int fd, const void *data, size_t len);
+int http_send_file(int fd, int src, off_t off, uint64_t len);
+
+// One request of a pipeline. The body, if any, comes from memory
+// (body/body_len) or from body_fd at body_off; sink receives the response
+// body and reset, if set, is called before a retried request streams it
+// again. The client fills status (0 if no response arrived) and length,
+// the announced body size (-1 if unknown), which is set before the first
+// byte reaches sink.
+typedef struct {
+    const char *method; // "GET", "HEAD", "PUT" or "POST"
+    char path[1024];
+    const unsigned char *body;
+    int body_fd;        // -1 for none
+    off_t body_off;
+    uint64_t body_len;
+    HttpSink sink;
+    void (*reset)(void *ctx);
+    void *ctx;
+    int status;
+    int64_t length;
+} HttpOp;
+
+// Initialize op with no body and no sink
+void http_op_init(HttpOp *op, const char *method, const char *path);
+
+// Send ops over c and read their responses, keeping up to
+// HTTP_PIPELINE_DEPTH requests in flight. A request body waits until no
+// response that may carry one (GET, POST) is outstanding, or both ends
+// could block writing. A dropped connection (a kept alive one the server
+// timed out, or Connection: close) is reopened and the unanswered
+// requests sent again; every request used here is idempotent, POST
+// included. Returns 0 if every op got a response, whatever its status,
+// -1 otherwise.
+int http_pipeline(HttpConn *c, HttpOp *ops, int n);
+
+#endif // HTTP_H
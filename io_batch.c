@@ -0,0 +1,432 @@
+// io_batch.c
+#define _GNU_SOURCE
+#include "io_batch.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+static const char *const backend_names[] = { "sync", "uring", "auto" };
+static IoBatchBackend backend = IO_BATCH_SYNC; // never AUTO once set
+
+const char *io_batch_backend_name(IoBatchBackend b) {
+    return (b >= IO_BATCH_SYNC && b <= IO_BATCH_AUTO) ? backend_names[b] : "unknown";
+}
+
+IoBatchBackend io_batch_backend(void) {
+    return backend;
+}
+
+static void run_sync(IoOp *op) {
+    long r;
+    do {
+        switch (op->kind) {
+        case IO_OP_STAT: r = fstatat(op->dirfd, op->path, op->st, op->flags); break;
+        case IO_OP_OPEN: r = openat(op->dirfd, op->path, op->flags, op->mode); break;
+        case IO_OP_READ: r = pread(op->fd, op->buf, op->len, (off_t)op->off); break;
+        case IO_OP_WRITE: r = pwrite(op->fd, op->buf, op->len, (off_t)op->off); break;
+        case IO_OP_CLOSE: r = close(op->fd); break;
+        case IO_OP_RENAME: r = renameat(op->dirfd, op->path, op->dirfd2, op->path2); break;
+        case IO_OP_UNLINK: r = unlinkat(op->dirfd, op->path, op->flags); break;
+        case IO_OP_LINK: r = linkat(op->dirfd, op->path, op->dirfd2, op->path2, op->flags); break;
+        default: r = -1; errno = EINVAL; break;
+        }
+    } while (r < 0 && errno == EINTR && op->kind != IO_OP_CLOSE);
+    op->res = r < 0 ? -errno : (int)r;
+}
+
+#ifdef HAVE_IO_URING
+
+#define OP_KINDS (IO_OP_LINK + 1)
+
+static const uint8_t uring_opcode[OP_KINDS] = {
+    IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE,
+    IORING_OP_CLOSE, IORING_OP_RENAMEAT, IORING_OP_UNLINKAT, IORING_OP_LINKAT
+};
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+    int broken;                // an enter failed with ops still in flight
+    uint8_t supported[OP_KINDS];
+    // An in-flight op owns a slot: user_data is the slot, which maps back to
+    // the op and holds the statx buffer a STAT needs
+    int *slot_op;
+    unsigned *free_slots;
+    unsigned n_free;
+    struct statx *stx;
+} Ring;
+
+static __thread Ring *thread_ring = NULL;
+static __thread int thread_ring_failed = 0;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void ring_destroy(Ring *r) {
+    if (!r) return;
+    if (r->sqes) munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    if (r->fd >= 0) close(r->fd);
+    free(r->slot_op);
+    free(r->free_slots);
+    free(r->stx);
+    free(r);
+}
+
+static void ring_release(void *arg) {
+    Ring *r = arg;
+    if (!r->broken) ring_destroy(r); // a broken ring may still write into caller buffers
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, ring_release);
+}
+
+// Which of our ops this kernel runs through the ring
+static void ring_probe(Ring *r) {
+    size_t sz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *p = calloc(1, sz);
+    if (!p) return;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, p, 256) == 0) {
+        for (int k = 0; k < OP_KINDS; ++k) {
+            unsigned code = uring_opcode[k];
+            r->supported[k] = code <= p->last_op && (p->ops[code].flags & IO_URING_OP_SUPPORTED);
+        }
+    }
+    free(p);
+}
+
+static Ring *ring_create(void) {
+    Ring *r = calloc(1, sizeof(Ring));
+    if (!r) return NULL;
+    r->fd = -1;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, IO_BATCH_DEPTH, &p);
+    if (r->fd < 0) goto fail;
+    r->entries = p.sq_entries;
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                     IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                         IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            goto fail;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->slot_op = malloc(sizeof(*r->slot_op) * r->entries);
+    r->free_slots = malloc(sizeof(*r->free_slots) * r->entries);
+    r->stx = malloc(sizeof(*r->stx) * r->entries);
+    if (!r->slot_op || !r->free_slots || !r->stx) goto fail;
+    for (unsigned i = 0; i < r->entries; ++i) r->free_slots[i] = i;
+    r->n_free = r->entries;
+    ring_probe(r);
+    return r;
+fail:
+    ring_destroy(r);
+    return NULL;
+}
+
+// The calling thread's ring, created on first use; NULL if io_uring is unusable
+static Ring *ring_get(void) {
+    if (thread_ring || thread_ring_failed) return thread_ring;
+    pthread_once(&ring_key_once, make_ring_key);
+    thread_ring = ring_create();
+    if (!thread_ring) thread_ring_failed = 1;
+    else pthread_setspecific(ring_key, thread_ring);
+    return thread_ring;
+}
+
+static void statx_to_stat(const struct statx *x, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(x->stx_dev_major, x->stx_dev_minor);
+    st->st_ino = x->stx_ino;
+    st->st_mode = x->stx_mode;
+    st->st_nlink = x->stx_nlink;
+    st->st_uid = x->stx_uid;
+    st->st_gid = x->stx_gid;
+    st->st_rdev = makedev(x->stx_rdev_major, x->stx_rdev_minor);
+    st->st_size = (off_t)x->stx_size;
+    st->st_blksize = x->stx_blksize;
+    st->st_blocks = (blkcnt_t)x->stx_blocks;
+    st->st_atim.tv_sec = x->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = x->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = x->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = x->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = x->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = x->stx_ctime.tv_nsec;
+}
+
+static void prep_sqe(struct io_uring_sqe *sqe, const IoOp *op, unsigned slot, struct statx *stx) {
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = uring_opcode[op->kind];
+    sqe->user_data = slot;
+    switch (op->kind) {
+    case IO_OP_STAT:
+        sqe->fd = op->dirfd;
+        sqe->addr = (uintptr_t)op->path;
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = (uintptr_t)stx;
+        sqe->statx_flags = (uint32_t)op->flags;
+        break;
+    case IO_OP_OPEN:
+        sqe->fd = op->dirfd;
+        sqe->addr = (uintptr_t)op->path;
+        sqe->len = op->mode;
+        sqe->open_flags = (uint32_t)op->flags;
+        break;
+    case IO_OP_READ:
+    case IO_OP_WRITE:
+        sqe->fd = op->fd;
+        sqe->addr = (uintptr_t)op->buf;
+        sqe->len = (uint32_t)op->len;
+        sqe->off = op->off;
+        break;
+    case IO_OP_CLOSE:
+        sqe->fd = op->fd;
+        break;
+    case IO_OP_RENAME:
+    case IO_OP_LINK:
+        sqe->fd = op->dirfd;
+        sqe->addr = (uintptr_t)op->path;
+        sqe->len = (uint32_t)op->dirfd2;
+        sqe->off = (uintptr_t)op->path2;
+        if (op->kind == IO_OP_LINK) sqe->hardlink_flags = (uint32_t)op->flags;
+        break;
+    case IO_OP_UNLINK:
+        sqe->fd = op->dirfd;
+        sqe->addr = (uintptr_t)op->path;
+        sqe->unlink_flags = (uint32_t)op->flags;
+        break;
+    }
+}
+
+static int ring_takes(const Ring *r, const IoOp *op) {
+    if (op->kind < 0 || op->kind >= OP_KINDS || !r->supported[op->kind]) return 0;
+    // READ/WRITE lengths are 32-bit in the SQE; results are ints
+    return !((op->kind == IO_OP_READ || op->kind == IO_OP_WRITE) && op->len > 0x7fffffff);
+}
+
+static unsigned reap(Ring *r, IoOp *ops) {
+    unsigned head = *r->cq_head, reaped = 0;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head, ++reaped) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        unsigned slot = (unsigned)cqe->user_data;
+        IoOp *op = &ops[r->slot_op[slot]];
+        op->res = cqe->res;
+        if (op->kind == IO_OP_STAT && op->res == 0) statx_to_stat(&r->stx[slot], op->st);
+        r->free_slots[r->n_free++] = slot;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+// Keep up to entries ops in flight, topping the ring up after every wait
+static void ring_run(Ring *r, IoOp *ops, int n) {
+    int next = 0;
+    unsigned queued = 0, inflight = 0;
+    while (next < n || queued + inflight > 0) {
+        unsigned tail = *r->sq_tail;
+        while (next < n && r->n_free > 0) {
+            IoOp *op = &ops[next];
+            if (!ring_takes(r, op)) {
+                run_sync(op);
+                next++;
+                continue;
+            }
+            unsigned slot = r->free_slots[--r->n_free];
+            unsigned idx = tail & *r->sq_mask;
+            r->slot_op[slot] = next++;
+            prep_sqe(&r->sqes[idx], op, slot, &r->stx[slot]);
+            r->sq_array[idx] = idx;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+        if (queued + inflight == 0) continue;
+        long got = syscall(__NR_io_uring_enter, r->fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (got >= 0) {
+            queued -= (unsigned)got;
+            inflight += (unsigned)got;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // Take back what the kernel has not consumed and run it here
+            unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+            for (unsigned t = head; t != tail; ++t) {
+                unsigned slot = (unsigned)r->sqes[r->sq_array[t & *r->sq_mask]].user_data;
+                run_sync(&ops[r->slot_op[slot]]);
+                r->free_slots[r->n_free++] = slot;
+            }
+            __atomic_store_n(r->sq_tail, head, __ATOMIC_RELEASE);
+            queued = 0;
+            if (inflight > 0) {
+                // cannot wait for them: leave them to the kernel and stop using the ring
+                r->broken = 1;
+                thread_ring = NULL;
+                thread_ring_failed = 1;
+                pthread_setspecific(ring_key, NULL);
+                for (int i = next; i < n; ++i) run_sync(&ops[i]);
+                LOG_WARN("io_uring wait failed (%s), using synchronous I/O", strerror(errno));
+                return;
+            }
+        }
+        inflight -= reap(r, ops);
+    }
+}
+
+#endif // HAVE_IO_URING
+
+int io_batch_set_backend(const char *name) {
+    int want = -1;
+    for (int b = IO_BATCH_SYNC; b <= IO_BATCH_AUTO; ++b)
+        if (name && strcmp(name, backend_names[b]) == 0) want = b;
+    if (want < 0) return -1;
+    backend = IO_BATCH_SYNC;
+    if (want == IO_BATCH_SYNC) return 0;
+#ifdef HAVE_IO_URING
+    if (ring_get()) {
+        backend = IO_BATCH_URING;
+        LOG_DEBUG("Batched I/O backend: io_uring");
+        return 0;
+    }
+#endif
+    if (want == IO_BATCH_URING) LOG_WARN("io_uring is not available, using synchronous I/O");
+    return 0;
+}
+
+int io_batch_run(IoOp *ops, int n) {
+#ifdef HAVE_IO_URING
+    Ring *r = backend == IO_BATCH_URING ? ring_get() : NULL;
+    if (r) ring_run(r, ops, n);
+    else
+#endif
+        for (int i = 0; i < n; ++i) run_sync(&ops[i]);
+    for (int i = 0; i < n; ++i)
+        if (ops[i].res < 0) return -1;
+    return 0;
+}
+
+void io_batch_shutdown(void) {
+#ifdef HAVE_IO_URING
+    if (thread_ring) {
+        pthread_setspecific(ring_key, NULL);
+        ring_destroy(thread_ring);
+        thread_ring = NULL;
+    }
+    thread_ring_failed = 0;
+#endif
+}
+
+static void op_init(IoOp *op, IoOpKind kind) {
+    memset(op, 0, sizeof(*op));
+    op->kind = kind;
+    op->dirfd = AT_FDCWD;
+    op->dirfd2 = AT_FDCWD;
+    op->fd = -1;
+}
+
+void io_op_stat(IoOp *op, int dirfd, const char *path, int flags, struct stat *st) {
+    op_init(op, IO_OP_STAT);
+    op->dirfd = dirfd;
+    op->path = path;
+    op->flags = flags;
+    op->st = st;
+}
+
+void io_op_open(IoOp *op, int dirfd, const char *path, int flags, mode_t mode) {
+    op_init(op, IO_OP_OPEN);
+    op->dirfd = dirfd;
+    op->path = path;
+    op->flags = flags;
+    op->mode = mode;
+}
+
+void io_op_read(IoOp *op, int fd, void *buf, size_t len, uint64_t off) {
+    op_init(op, IO_OP_READ);
+    op->fd = fd;
+    op->buf = buf;
+    op->len = len;
+    op->off = off;
+}
+
+void io_op_write(IoOp *op, int fd, const void *buf, size_t len, uint64_t off) {
+    op_init(op, IO_OP_WRITE);
+    op->fd = fd;
+    op->buf = (void *)buf;
+    op->len = len;
+    op->off = off;
+}
+
+void io_op_close(IoOp *op, int fd) {
+    op_init(op, IO_OP_CLOSE);
+    op->fd = fd;
+}
+
+void io_op_rename(IoOp *op, int olddirfd, const char *oldpath, int newdirfd, const char *newpath) {
+    op_init(op, IO_OP_RENAME);
+    op->dirfd = olddirfd;
+    op->path = oldpath;
+    op->dirfd2 = newdirfd;
+    op->path2 = newpath;
+}
+
+void io_op_unlink(IoOp *op, int dirfd, const char *path, int flags) {
+    op_init(op, IO_OP_UNLINK);
+    op->dirfd = dirfd;
+    op->path = path;
+    op->flags = flags;
+}
+
+void io_op_link(IoOp *op, int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags) {
+    op_init(op, IO_OP_LINK);
+    op->dirfd = olddirfd;
+    op->path = oldpath;
+    op->dirfd2 = newdirfd;
+    op->path2 = newpath;
+    op->flags = flags;
+}
@@ -0,0 +1,81 @@
+#ifndef IO_BATCH_H
+#define IO_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Batched filesystem calls. A batch is a set of independent operations
+ * (no op may depend on another op of the same batch); each op's result lands
+ * in its res field, as the plain syscall would return it but with -errno
+ * instead of -1. With the io_uring backend the whole batch is in flight at
+ * once, up to IO_BATCH_DEPTH operations per submission, so one thread can
+ * keep the disk and the kernel busy without a syscall per file. The sync
+ * backend runs each op with the ordinary syscall; so does the io_uring
+ * backend for opcodes the running kernel does not support. Rings are per
+ * thread and created on first use.
+ */
+
+#define IO_BATCH_DEPTH 256
+
+typedef enum {
+    IO_BATCH_SYNC,  // plain syscalls, one at a time
+    IO_BATCH_URING, // io_uring
+    IO_BATCH_AUTO   // io_uring when the kernel has it, else sync
+} IoBatchBackend;
+
+typedef enum {
+    IO_OP_STAT,     // fstatat(dirfd, path, st, flags); AT_EMPTY_PATH with path "" stats fd dirfd
+    IO_OP_OPEN,     // openat(dirfd, path, flags, mode) -> fd
+    IO_OP_READ,     // pread(fd, buf, len, off) -> bytes
+    IO_OP_WRITE,    // pwrite(fd, buf, len, off) -> bytes
+    IO_OP_CLOSE,    // close(fd)
+    IO_OP_RENAME,   // renameat(dirfd, path, dirfd2, path2)
+    IO_OP_UNLINK,   // unlinkat(dirfd, path, flags)
+    IO_OP_LINK      // linkat(dirfd, path, dirfd2, path2, flags)
+} IoOpKind;
+
+typedef struct {
+    IoOpKind kind;
+    int dirfd;
+    const char *path;
+    int dirfd2;
+    const char *path2;
+    int fd;
+    int flags;
+    mode_t mode;
+    void *buf;
+    size_t len;
+    uint64_t off;
+    struct stat *st;
+    int res;
+} IoOp;
+
+// Choose the backend by name ("sync", "uring", "auto"). Returns -1 if the
+// name is unknown. Asking for io_uring where it is unavailable falls back to
+// sync with a warning.
+int io_batch_set_backend(const char *name);
+
+// Backend batches actually use (never AUTO: resolved by io_batch_set_backend)
+IoBatchBackend io_batch_backend(void);
+const char *io_batch_backend_name(IoBatchBackend b);
+
+// Run ops[0..n) and fill in every res. Returns 0, or -1 if any op failed.
+int io_batch_run(IoOp *ops, int n);
+
+// Release the calling thread's ring (other threads release theirs on exit)
+void io_batch_shutdown(void);
+
+// Builders for the common ops
+void io_op_stat(IoOp *op, int dirfd, const char *path, int flags, struct stat *st);
+void io_op_open(IoOp *op, int dirfd, const char *path, int flags, mode_t mode);
+void io_op_read(IoOp *op, int fd, void *buf, size_t len, uint64_t off);
+void io_op_write(IoOp *op, int fd, const void *buf, size_t len, uint64_t off);
+void io_op_close(IoOp *op, int fd);
+void io_op_rename(IoOp *op, int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
+void io_op_unlink(IoOp *op, int dirfd, const char *path, int flags);
+void io_op_link(IoOp *op, int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags);
+
+#endif // IO_BATCH_H
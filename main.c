@@ -2,6 +2,14 @@
 #include "task.h"
 #include "cas.h"
 #include "util.h"
+#include "config.h"
+#include "compression.h"
+#include "durability.h"
+#include "hash_pool.h"
+#include "io_batch.h"
+#include "remote_cas.h"
+#include "subcommands.h"
+#include "tree.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +17,7 @@
 
 void usage(const char *prog) {
     fprintf(stderr, "Usage: %s <manifest> [target1 target2 ...]\n", prog);
+    subcommands_usage(prog);
     fprintf(stderr, "Example manifest format:\n");
     fprintf(stderr, "task build {\n");
     fprintf(stderr, "  cmd = gcc -o hello hello.c\n");
@@ -37,11 +46,52 @@ int main(int argc, char **argv) {
         targets = &argv[2];
     }
 
+    config_init_defaults(&g_config);
+    config_load_from_file(&g_config, ".reprovm/reprovm.conf");
+    config_load_from_env(&g_config);
+    // The digest algorithm picks the store, so it is set before cas_init
+    DigestAlgorithm digest;
+    if (digest_algorithm_from_name(g_config.digest_algorithm, &digest) == 0)
+        digest_set_algorithm(digest);
+    else
+        fprintf(stderr, "Warning: unknown digest_algorithm '%s', using sha256\n", g_config.digest_algorithm);
     // Initialize CAS under current directory
     if (cas_init(".") != 0) {
         fprintf(stderr, "Failed to initialize CAS\n");
         return 1;
     }
+    atexit(cas_shutdown);
+
+    if (cas_set_materialize_strategy(g_config.materialize_strategy) != 0)
+        fprintf(stderr, "Warning: unknown materialize_strategy '%s', using reflink\n",
+                g_config.materialize_strategy);
+    if (g_config.chunk_threshold_kb > 0)
+        cas_set_chunk_threshold((uint64_t)g_config.chunk_threshold_kb * 1024);
+    hash_pool_init(g_config.hash_threads);
+    if (io_batch_set_backend(g_config.io_backend) != 0)
+        fprintf(stderr, "Warning: unknown io_backend '%s', using sync\n", g_config.io_backend);
+    CompressionAlgorithm algorithm;
+    if (compression_algorithm_from_name(g_config.compression, &algorithm) == 0)
+        compression_init(algorithm, 1);
+    else
+        fprintf(stderr, "Warning: unknown compression '%s', storing objects uncompressed\n",
+                g_config.compression);
+    DurabilityMode durability;
+    if (durability_mode_from_name(g_config.durability, &durability) == 0)
+        durability_set_mode(durability);
+    else
+        fprintf(stderr, "Warning: unknown durability '%s', using none\n", g_config.durability);
+    if (g_config.enable_remote_cas) {
+        int mb = g_config.remote_cas_inflight_mb;
+        remote_cas_set_transfer_limits(g_config.remote_cas_transfers, mb > 0 ? (uint64_t)mb << 20 : 0);
+        if (remote_cas_init(REMOTE_CAS_HTTP, g_config.remote_cas_url, g_config.remote_cas_access_key,
+                            g_config.remote_cas_secret_key) == 0)
+            atexit(remote_cas_cleanup);
+        else
+            fprintf(stderr, "Warning: remote CAS disabled\n");
+    }
+
+    if (is_subcommand(argv[1])) return run_subcommand(argc - 1, argv + 1);
 
     TaskList *list = parse_manifest(manifest);
     if (!list) {
@@ -57,11 +107,14 @@ int main(int argc, char **argv) {
         free(needed);
         return 0;
     }
+    // outputs of cache hits start coming in from the remote while the rest is set up
+    prefetch_task_outputs(needed, needed_n);
     // topo sort
     int sorted_n = 0;
     Task **sorted = topo_sort(needed, needed_n, &sorted_n);
     if (!sorted) {
         fprintf(stderr, "Dependency cycle or topo sort failed.\n");
+        prefetch_wait();
         free_tasklist(list);
         free(needed);
         return 1;
@@ -79,7 +132,7 @@ int main(int argc, char **argv) {
         // Before computing its hash, ensure that its dependencies have their result_hash filled.
         // They should if they ran successfully or were cached.
         // Compute task hash
-        if (!t->task_hash) {
+        if (digest_is_zero(&t->task_hash)) {
             if (compute_task_hash(t) != 0) {
                 t->status = STATUS_FAILED;
                 overall_failed = 1;
@@ -94,6 +147,7 @@ int main(int argc, char **argv) {
             break;
         }
     }
+    prefetch_wait();
 
     if (overall_failed) {
         fprintf(stderr, "One or more tasks failed.\n");
@@ -105,6 +159,9 @@ int main(int argc, char **argv) {
 
     printf("All tasks completed (some may have been cached). Final graph:\n");
     print_task_graph(sorted, sorted_n);
+    cas_print_stats(stdout);
+    tree_print_stats(stdout);
+    remote_cas_print_stats(stdout);
 
     free_tasklist(list);
     free(needed);
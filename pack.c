@@ -0,0 +1,527 @@
+// pack.c
+#define _GNU_SOURCE
+#include "pack.h"
+#include "sha256.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * On-disk format (host byte order, like the stat index):
+ *   pack-<name>.pack: "RVMPACK1" | uint32 version | uint32 reserved | object bytes...
+ *   pack-<name>.idx:  "RVMPIDX1" | uint32 version | uint32 count
+ *                     uint32 fanout[256]   (fanout[b] = entries with first byte <= b)
+ *                     count x { uint8 digest[32]; uint64 offset; uint64 length }
+ *                     SHA-256 of everything above (checked on load)
+ * Entries are sorted by digest. <name> is the SHA-256 of the sorted digests,
+ * so repacking the same set of objects twice yields the same pack.
+ */
+
+#define PACK_MAGIC "RVMPACK1"
+#define IDX_MAGIC "RVMPIDX1"
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 16
+#define IDX_HEADER_SIZE (16 + 256 * 4)
+#define IDX_ENTRY_SIZE 48
+
+typedef struct {
+    char name[80];
+    int fd;
+    uint8_t *map;
+    size_t map_len;
+    uint32_t count;
+} Pack;
+
+static Pack *packs = NULL;
+static int n_packs = 0;
+static int cap_packs = 0;
+static char pack_dir[1024] = {0};
+static struct timespec dir_mtime;
+static pthread_rwlock_t packs_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static uint32_t fanout_at(const Pack *p, int b) {
+    uint32_t v;
+    memcpy(&v, p->map + 16 + (size_t)b * 4, 4);
+    return v;
+}
+
+static const uint8_t *entry_at(const Pack *p, uint32_t i) {
+    return p->map + IDX_HEADER_SIZE + (size_t)i * IDX_ENTRY_SIZE;
+}
+
+static int loaded_locked(const char *name) {
+    for (int i = 0; i < n_packs; ++i)
+        if (strcmp(packs[i].name, name) == 0) return 1;
+    return 0;
+}
+
+// Map one index and open its pack; caller holds the write lock
+static int load_pack_locked(const char *idx_name) {
+    size_t len = strlen(idx_name);
+    if (len < 5 || len >= sizeof(packs[0].name) || strcmp(idx_name + len - 4, ".idx") != 0) return -1;
+    char name[80];
+    memcpy(name, idx_name, len - 4);
+    name[len - 4] = '\0';
+    if (loaded_locked(name)) return 0;
+
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/%s.idx", pack_dir, name);
+    int ifd = open(path, O_RDONLY | O_CLOEXEC);
+    if (ifd < 0) return -1;
+    struct stat st;
+    if (fstat(ifd, &st) != 0 || st.st_size < IDX_HEADER_SIZE + 32) {
+        close(ifd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, ifd, 0);
+    close(ifd);
+    if (map == MAP_FAILED) return -1;
+
+    Pack p = { .fd = -1, .map = map, .map_len = (size_t)st.st_size };
+    snprintf(p.name, sizeof(p.name), "%s", name);
+    uint32_t version;
+    memcpy(&version, map + 8, 4);
+    memcpy(&p.count, map + 12, 4);
+    int ok = memcmp(map, IDX_MAGIC, 8) == 0 && version == PACK_VERSION &&
+             p.map_len == IDX_HEADER_SIZE + (size_t)p.count * IDX_ENTRY_SIZE + 32;
+    for (int b = 0; ok && b < 256; ++b)
+        if ((b > 0 && fanout_at(&p, b) < fanout_at(&p, b - 1)) || fanout_at(&p, b) > p.count) ok = 0;
+    if (ok) ok = fanout_at(&p, 255) == p.count;
+    if (ok) {
+        // a damaged entry would send reads to the wrong bytes
+        uint8_t sum[32];
+        sha256_digest(map, p.map_len - 32, sum);
+        ok = memcmp(sum, map + p.map_len - 32, 32) == 0;
+    }
+    if (ok) {
+        snprintf(path, sizeof(path), "%s/%s.pack", pack_dir, name);
+        p.fd = open(path, O_RDONLY | O_CLOEXEC);
+        ok = p.fd >= 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Warning: ignoring damaged pack index %s/%s.idx\n", pack_dir, name);
+        munmap(map, p.map_len);
+        return -1;
+    }
+    madvise(map, p.map_len, MADV_RANDOM);
+    if (n_packs == cap_packs) {
+        int new_cap = cap_packs ? cap_packs * 2 : 8;
+        Pack *grown = realloc(packs, sizeof(Pack) * new_cap);
+        if (!grown) {
+            close(p.fd);
+            munmap(map, p.map_len);
+            return -1;
+        }
+        packs = grown;
+        cap_packs = new_cap;
+    }
+    packs[n_packs++] = p;
+    return 0;
+}
+
+static void drop_locked(int i) {
+    close(packs[i].fd);
+    munmap(packs[i].map, packs[i].map_len);
+    memmove(&packs[i], &packs[i + 1], sizeof(Pack) * (size_t)(n_packs - i - 1));
+    n_packs--;
+}
+
+static int scan_locked(void) {
+    struct stat st;
+    if (stat(pack_dir, &st) != 0) return 0;
+    if (st.st_mtim.tv_sec == dir_mtime.tv_sec && st.st_mtim.tv_nsec == dir_mtime.tv_nsec) return 0;
+    dir_mtime = st.st_mtim;
+    // another process's gc or prune may have deleted packs we still map
+    for (int i = n_packs - 1; i >= 0; --i) {
+        char path[1200];
+        snprintf(path, sizeof(path), "%s/%s.idx", pack_dir, packs[i].name);
+        if (access(path, F_OK) != 0 && errno == ENOENT) drop_locked(i);
+    }
+    DIR *d = opendir(pack_dir);
+    if (!d) return 0;
+    int before = n_packs;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, "pack-", 5) == 0 && strstr(de->d_name, ".idx"))
+            load_pack_locked(de->d_name);
+    }
+    closedir(d);
+    return n_packs > before;
+}
+
+int pack_open_dir(const char *dir) {
+    pack_close_all();
+    pthread_rwlock_wrlock(&packs_lock);
+    snprintf(pack_dir, sizeof(pack_dir), "%s", dir);
+    scan_locked();
+    pthread_rwlock_unlock(&packs_lock);
+    return 0;
+}
+
+void pack_close_all(void) {
+    pthread_rwlock_wrlock(&packs_lock);
+    for (int i = 0; i < n_packs; ++i) {
+        close(packs[i].fd);
+        munmap(packs[i].map, packs[i].map_len);
+    }
+    free(packs);
+    packs = NULL;
+    n_packs = cap_packs = 0;
+    memset(&dir_mtime, 0, sizeof(dir_mtime));
+    pthread_rwlock_unlock(&packs_lock);
+}
+
+int pack_reload(void) {
+    if (pack_dir[0] == '\0') return 0;
+    pthread_rwlock_wrlock(&packs_lock);
+    int added = scan_locked();
+    pthread_rwlock_unlock(&packs_lock);
+    return added;
+}
+
+int pack_find(const uint8_t digest[32], PackRef *ref) {
+    int found = 0;
+    pthread_rwlock_rdlock(&packs_lock);
+    for (int i = n_packs - 1; i >= 0 && !found; --i) {
+        const Pack *p = &packs[i];
+        uint32_t lo = digest[0] ? fanout_at(p, digest[0] - 1) : 0;
+        uint32_t hi = fanout_at(p, digest[0]);
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            const uint8_t *e = entry_at(p, mid);
+            int c = memcmp(e, digest, 32);
+            if (c == 0) {
+                if (ref) {
+                    ref->fd = p->fd;
+                    memcpy(&ref->offset, e + 32, 8);
+                    memcpy(&ref->length, e + 40, 8);
+                }
+                found = 1;
+                break;
+            }
+            if (c < 0) lo = mid + 1;
+            else hi = mid;
+        }
+    }
+    pthread_rwlock_unlock(&packs_lock);
+    return found;
+}
+
+uint64_t pack_object_count(void) {
+    uint64_t total = 0;
+    pthread_rwlock_rdlock(&packs_lock);
+    for (int i = 0; i < n_packs; ++i) total += packs[i].count;
+    pthread_rwlock_unlock(&packs_lock);
+    return total;
+}
+
+// Entries whose first byte is in [first, last]
+static int for_each_in(int first, int last, int (*fn)(const uint8_t digest[32], void *ctx), void *ctx) {
+    // copy the digests out so fn may call back into pack_* (including reloads)
+    pthread_rwlock_rdlock(&packs_lock);
+    uint64_t total = 0;
+    for (int i = 0; i < n_packs; ++i)
+        total += fanout_at(&packs[i], last) - (first ? fanout_at(&packs[i], first - 1) : 0);
+    uint8_t *all = malloc(total ? total * 32 : 1);
+    uint64_t n = 0;
+    for (int i = 0; all && i < n_packs; ++i) {
+        uint32_t end = fanout_at(&packs[i], last);
+        for (uint32_t j = first ? fanout_at(&packs[i], first - 1) : 0; j < end; ++j)
+            memcpy(all + 32 * n++, entry_at(&packs[i], j), 32);
+    }
+    pthread_rwlock_unlock(&packs_lock);
+    if (!all) return -1;
+    for (uint64_t i = 0; i < n; ++i) {
+        if (fn(all + 32 * i, ctx) != 0) break;
+    }
+    free(all);
+    return 0;
+}
+
+int pack_for_each(int (*fn)(const uint8_t digest[32], void *ctx), void *ctx) {
+    return for_each_in(0, 255, fn, ctx);
+}
+
+int pack_for_each_prefix(uint8_t first, int (*fn)(const uint8_t digest[32], void *ctx), void *ctx) {
+    return for_each_in(first, first, fn, ctx);
+}
+
+/* ---- writer ---- */
+
+typedef struct {
+    uint8_t digest[32];
+    uint64_t offset;
+    uint64_t length;
+} WriterEntry;
+
+struct PackWriter {
+    char dir[1024];
+    char tmp_path[1100];
+    int fd;
+    uint64_t size;
+    WriterEntry *ents;
+    size_t n, cap;
+};
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+PackWriter *pack_writer_begin(const char *dir) {
+    if (ensure_dir_recursive(dir) != 0) return NULL;
+    PackWriter *w = calloc(1, sizeof(PackWriter));
+    if (!w) return NULL;
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    snprintf(w->tmp_path, sizeof(w->tmp_path), "%s/tmp-pack-XXXXXX", dir);
+    w->fd = mkstemp(w->tmp_path);
+    unsigned char header[PACK_HEADER_SIZE] = PACK_MAGIC;
+    uint32_t version = PACK_VERSION;
+    memcpy(header + 8, &version, 4);
+    if (w->fd < 0 || write_full(w->fd, header, sizeof(header)) != 0) {
+        pack_writer_abort(w);
+        return NULL;
+    }
+    fchmod(w->fd, 0444);
+    w->size = PACK_HEADER_SIZE;
+    return w;
+}
+
+int pack_writer_add(PackWriter *w, const uint8_t digest[32], const void *data, size_t len) {
+    if (w->n == w->cap) {
+        size_t new_cap = w->cap ? w->cap * 2 : 1024;
+        WriterEntry *grown = realloc(w->ents, sizeof(WriterEntry) * new_cap);
+        if (!grown) return -1;
+        w->ents = grown;
+        w->cap = new_cap;
+    }
+    if (write_full(w->fd, data, len) != 0) return -1;
+    WriterEntry *e = &w->ents[w->n++];
+    memcpy(e->digest, digest, 32);
+    e->offset = w->size;
+    e->length = len;
+    w->size += len;
+    return 0;
+}
+
+uint64_t pack_writer_size(const PackWriter *w) {
+    return w->size;
+}
+
+void pack_writer_abort(PackWriter *w) {
+    if (!w) return;
+    if (w->fd >= 0) {
+        close(w->fd);
+        unlink(w->tmp_path);
+    }
+    free(w->ents);
+    free(w);
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    return memcmp(((const WriterEntry *)a)->digest, ((const WriterEntry *)b)->digest, 32);
+}
+
+static void fsync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int pack_writer_commit(PackWriter *w) {
+    if (w->n == 0) {
+        pack_writer_abort(w);
+        return 0;
+    }
+    qsort(w->ents, w->n, sizeof(WriterEntry), cmp_entry);
+    SHA256_CTX name_ctx;
+    sha256_init(&name_ctx);
+    for (size_t i = 0; i < w->n; ++i) sha256_update(&name_ctx, w->ents[i].digest, 32);
+    uint8_t name_digest[32];
+    sha256_final(&name_ctx, name_digest);
+    char *name_hex = hex_encode(name_digest, 32);
+    if (!name_hex || fsync(w->fd) != 0) {
+        free(name_hex);
+        pack_writer_abort(w);
+        return -1;
+    }
+    close(w->fd);
+    w->fd = -1;
+
+    char pack_path[1200], idx_path[1200], idx_tmp[1200];
+    snprintf(pack_path, sizeof(pack_path), "%s/pack-%s.pack", w->dir, name_hex);
+    snprintf(idx_path, sizeof(idx_path), "%s/pack-%s.idx", w->dir, name_hex);
+    snprintf(idx_tmp, sizeof(idx_tmp), "%s/tmp-idx-%s", w->dir, name_hex);
+    if (file_exists(idx_path)) {
+        // the same set of objects is already packed
+        unlink(w->tmp_path);
+        free(name_hex);
+        pack_writer_abort(w);
+        return 0;
+    }
+    if (rename(w->tmp_path, pack_path) != 0) {
+        unlink(w->tmp_path);
+        free(name_hex);
+        pack_writer_abort(w);
+        return -1;
+    }
+
+    int rc = -1;
+    int ifd = open(idx_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0444);
+    if (ifd >= 0) {
+        SHA256_CTX ctx;
+        sha256_init(&ctx);
+        unsigned char header[IDX_HEADER_SIZE] = IDX_MAGIC;
+        uint32_t version = PACK_VERSION, count = (uint32_t)w->n;
+        memcpy(header + 8, &version, 4);
+        memcpy(header + 12, &count, 4);
+        size_t at = 0;
+        for (int b = 0; b < 256; ++b) {
+            while (at < w->n && w->ents[at].digest[0] <= b) at++;
+            uint32_t v = (uint32_t)at;
+            memcpy(header + 16 + b * 4, &v, 4);
+        }
+        sha256_update(&ctx, header, sizeof(header));
+        int ok = write_full(ifd, header, sizeof(header)) == 0;
+        for (size_t i = 0; ok && i < w->n; ++i) {
+            uint8_t rec[IDX_ENTRY_SIZE];
+            memcpy(rec, w->ents[i].digest, 32);
+            memcpy(rec + 32, &w->ents[i].offset, 8);
+            memcpy(rec + 40, &w->ents[i].length, 8);
+            sha256_update(&ctx, rec, sizeof(rec));
+            ok = write_full(ifd, rec, sizeof(rec)) == 0;
+        }
+        uint8_t trailer[32];
+        sha256_final(&ctx, trailer);
+        if (ok) ok = write_full(ifd, trailer, sizeof(trailer)) == 0 && fsync(ifd) == 0;
+        if (close(ifd) != 0) ok = 0;
+        if (ok && rename(idx_tmp, idx_path) == 0) rc = 0;
+        else unlink(idx_tmp);
+    }
+    if (rc == 0) {
+        fsync_dir(w->dir);
+        char idx_name[160];
+        snprintf(idx_name, sizeof(idx_name), "pack-%s.idx", name_hex);
+        pthread_rwlock_wrlock(&packs_lock);
+        if (strcmp(pack_dir, w->dir) == 0) load_pack_locked(idx_name);
+        pthread_rwlock_unlock(&packs_lock);
+    } else {
+        unlink(pack_path);
+    }
+    free(name_hex);
+    free(w->ents);
+    free(w);
+    return rc;
+}
+
+/* ---- pruning ---- */
+
+// Rewrite one pack without the objects keep() rejects; caller holds no lock
+static int prune_pack(const char *name, int (*keep)(const uint8_t digest[32], void *ctx), void *ctx,
+                      PackPruneStats *stats) {
+    pthread_rwlock_rdlock(&packs_lock);
+    int at = -1;
+    for (int i = 0; i < n_packs; ++i)
+        if (strcmp(packs[i].name, name) == 0) at = i;
+    uint32_t count = at >= 0 ? packs[at].count : 0;
+    uint8_t *ents = at >= 0 ? malloc((size_t)count * IDX_ENTRY_SIZE + 1) : NULL;
+    int fd = ents ? dup(packs[at].fd) : -1;
+    if (ents && fd >= 0) memcpy(ents, entry_at(&packs[at], 0), (size_t)count * IDX_ENTRY_SIZE);
+    pthread_rwlock_unlock(&packs_lock);
+    if (at < 0) return 0;
+    if (!ents || fd < 0) {
+        free(ents);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    uint32_t dropped = 0;
+    uint64_t dropped_bytes = 0;
+    uint8_t *drop = calloc(count + 1, 1);
+    for (uint32_t i = 0; drop && i < count; ++i) {
+        if (keep(ents + (size_t)i * IDX_ENTRY_SIZE, ctx)) continue;
+        uint64_t len;
+        memcpy(&len, ents + (size_t)i * IDX_ENTRY_SIZE + 40, 8);
+        drop[i] = 1;
+        dropped++;
+        dropped_bytes += len;
+    }
+    int rc = drop ? 0 : -1;
+    if (rc == 0 && dropped > 0 && dropped < count) {
+        // survivors go to a new pack, committed before the old one disappears
+        PackWriter *w = pack_writer_begin(pack_dir);
+        rc = w ? 0 : -1;
+        for (uint32_t i = 0; rc == 0 && i < count; ++i) {
+            if (drop[i]) continue;
+            const uint8_t *e = ents + (size_t)i * IDX_ENTRY_SIZE;
+            uint64_t off, len;
+            memcpy(&off, e + 32, 8);
+            memcpy(&len, e + 40, 8);
+            void *buf = malloc(len ? (size_t)len : 1);
+            if (!buf || pread(fd, buf, (size_t)len, (off_t)off) != (ssize_t)len ||
+                pack_writer_add(w, e, buf, (size_t)len) != 0)
+                rc = -1;
+            free(buf);
+        }
+        if (w && rc != 0) pack_writer_abort(w);
+        else if (w && pack_writer_commit(w) != 0) rc = -1;
+    }
+    if (rc == 0 && dropped > 0) {
+        // the index goes first: without it the pack is invisible
+        char path[1200];
+        snprintf(path, sizeof(path), "%s/%s.idx", pack_dir, name);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%s.pack", pack_dir, name);
+        unlink(path);
+        pthread_rwlock_wrlock(&packs_lock);
+        for (int i = 0; i < n_packs; ++i) {
+            if (strcmp(packs[i].name, name) != 0) continue;
+            drop_locked(i);
+            break;
+        }
+        pthread_rwlock_unlock(&packs_lock);
+        stats->objects_dropped += dropped;
+        stats->bytes_dropped += dropped_bytes;
+        if (dropped == count) stats->packs_deleted++;
+        else stats->packs_rewritten++;
+    }
+    free(drop);
+    free(ents);
+    close(fd);
+    return rc;
+}
+
+int pack_prune(int (*keep)(const uint8_t digest[32], void *ctx), void *ctx, PackPruneStats *stats) {
+    PackPruneStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    pthread_rwlock_rdlock(&packs_lock);
+    int n = n_packs;
+    char (*names)[80] = malloc(sizeof(*names) * (size_t)(n > 0 ? n : 1));
+    for (int i = 0; names && i < n; ++i) memcpy(names[i], packs[i].name, sizeof(names[i]));
+    pthread_rwlock_unlock(&packs_lock);
+    if (!names) return -1;
+    int rc = 0;
+    for (int i = 0; i < n; ++i)
+        if (prune_pack(names[i], keep, ctx, stats) != 0) rc = -1;
+    free(names);
+    return rc;
+}
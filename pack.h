@@ -0,0 +1,74 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Packfiles: many small CAS objects concatenated into one append-only file,
+ * located through a sorted ".idx" with a 256-entry fanout table. Indexes are
+ * mmap'd, so a lookup is a binary search over the few entries sharing the
+ * digest's first byte and costs no syscalls.
+ */
+
+// Objects at most this large are moved into packs by a repack
+#define PACK_MAX_OBJECT (64 * 1024)
+// A pack is closed and a new one started past this size
+#define PACK_MAX_BYTES (512ULL * 1024 * 1024)
+
+// Where an object lives inside a pack. fd stays open until its pack is
+// pruned or dropped by a reload, or pack_close_all().
+typedef struct {
+    int fd;
+    uint64_t offset;
+    uint64_t length;
+} PackRef;
+
+// Map every pack-*.idx under dir. Returns 0 on success (a missing dir is empty).
+int pack_open_dir(const char *dir);
+
+// Unmap everything
+void pack_close_all(void);
+
+// Returns 1 and fills ref if digest is in any open pack, 0 otherwise.
+int pack_find(const uint8_t digest[32], PackRef *ref);
+
+// Pick up packs written by other processes since the last scan and drop the
+// ones they deleted. Returns 1 if any were added. Cheap when nothing changed
+// (one stat of the pack dir).
+int pack_reload(void);
+
+// Number of objects across all open packs
+uint64_t pack_object_count(void);
+
+// Call fn for each object in the open packs until it returns nonzero.
+// Returns 0 on success, -1 if out of memory.
+int pack_for_each(int (*fn)(const uint8_t digest[32], void *ctx), void *ctx);
+
+// pack_for_each for the digests starting with byte first, found through
+// the fanout tables without walking the other entries
+int pack_for_each_prefix(uint8_t first, int (*fn)(const uint8_t digest[32], void *ctx), void *ctx);
+
+// Remove objects from the open packs: each pack holding an object keep()
+// returns 0 for is rewritten with the rest (committed before the old pack is
+// deleted, so lookups never miss a kept object), or deleted if nothing stays.
+typedef struct {
+    uint64_t objects_dropped;
+    uint64_t bytes_dropped;
+    uint64_t packs_rewritten;
+    uint64_t packs_deleted;
+} PackPruneStats;
+
+int pack_prune(int (*keep)(const uint8_t digest[32], void *ctx), void *ctx, PackPruneStats *stats);
+
+// Building a pack: add objects, then commit to make them visible atomically
+// (the .idx is renamed into place after its pack).
+typedef struct PackWriter PackWriter;
+
+PackWriter *pack_writer_begin(const char *dir);
+int pack_writer_add(PackWriter *w, const uint8_t digest[32], const void *data, size_t len);
+uint64_t pack_writer_size(const PackWriter *w);
+int pack_writer_commit(PackWriter *w); // frees w; 0 on success
+void pack_writer_abort(PackWriter *w); // frees w
+
+#endif // PACK_H
@@ -75,7 +75,7 @@ static void *worker_main(void *arg) {
         t->status = STATUS_RUNNING;
 
         // Compute task hash if needed (dependencies' result_hashes should have been set already via ordering)
-        if (!t->task_hash) {
+        if (digest_is_zero(&t->task_hash)) {
             if (compute_task_hash(t) != 0) {
                 fprintf(stderr, "Failed to compute hash for task %s\n", t->name);
                 t->status = STATUS_FAILED;
@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE
 #include "rate_limiter.h"
 #include "logger.h"
 #include "metrics.h"
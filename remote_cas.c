@@ -1,15 +1,151 @@
+#define _GNU_SOURCE
 #include "remote_cas.h"
+#include "cas.h"
+#include "http.h"
 #include "logger.h"
+#include <ctype.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 RemoteCASConfig g_remote_cas_config = {0};
 
+/*
+ * HTTP protocol (served by reprovm-cas-server):
+ *   HEAD <prefix>/cas/<hex>  200 with Content-Length if present, else 404
+ *   GET  <prefix>/cas/<hex>  the object in its stored form (cas_read_object)
+ *   PUT  <prefix>/cas/<hex>  store it; 200 or 201
+ *   POST <prefix>/cas:findMissing
+ *        body: raw 32-byte digests; answer: those the server lacks, in order
+ *   GET  <prefix>/cas?limit=N[&after=<hex>]
+ *        up to N raw digests the server holds, ascending, after <hex>
+ *   GET  <prefix>/ac/<task hash hex>  the task record (.meta), or 404
+ *   PUT  <prefix>/ac/<task hash hex>  store or replace it
+ * Objects are addressed by the digest of the local store. The server does
+ * not check what it is sent; cas_write_object verifies every download.
+ */
+
+#define POOL_MAX 16       // idle keep-alive connections kept
+#define PROBE_BATCH 256   // HEADs per pipeline call
+#define FIND_BATCH 16384  // digests per findMissing request or listing page
+#define UPLOAD_BATCH 64   // PUTs per pipeline call (each holds an open fd)
+#define DOWNLOAD_BATCH 16 // GETs per pipeline call
+#define XFER_WORKERS 8    // transfer engine threads, each with its own connection
+#define XFER_MAX_WORKERS 64
+#define XFER_INFLIGHT (64ull << 20) // bytes of objects being moved at once
+#define CLAIM_BUCKETS 1024 // power of two
+
+static char http_host[256];
+static char http_port[16];
+static char http_prefix[512];
+
+static HttpConn *idle[POOL_MAX];
+static int n_idle = 0;
+static RemoteCASStats stats;
+static pthread_mutex_t pool_mu = PTHREAD_MUTEX_INITIALIZER;
+
+static int valid_hex(const char *hash) {
+    size_t n = 0;
+    for (; hash[n]; ++n)
+        if (!isxdigit((unsigned char)hash[n])) return 0;
+    return n == DIGEST_HEX_SIZE - 1;
+}
+
+// A connection to url: a pooled one for the configured endpoint, else a
+// fresh one. *prefix gets the path prefix.
+static HttpConn *acquire(const char *url, char *prefix, size_t prefix_sz) {
+    if (strcmp(url, g_remote_cas_config.endpoint) == 0) {
+        snprintf(prefix, prefix_sz, "%s", http_prefix);
+        pthread_mutex_lock(&pool_mu);
+        HttpConn *c = n_idle > 0 ? idle[--n_idle] : NULL;
+        pthread_mutex_unlock(&pool_mu);
+        if (c) return c;
+        c = malloc(sizeof(*c));
+        if (c) http_conn_init(c, http_host, http_port);
+        return c;
+    }
+    char host[256], port[16];
+    if (http_parse_url(url, host, sizeof(host), port, sizeof(port), prefix, prefix_sz) != 0) {
+        LOG_ERROR("Unsupported remote CAS URL: %s", url);
+        return NULL;
+    }
+    HttpConn *c = malloc(sizeof(*c));
+    if (c) http_conn_init(c, host, port);
+    return c;
+}
+
+// Return c to the pool if it still talks to the configured endpoint
+static void release(HttpConn *c) {
+    int pooled = 0;
+    pthread_mutex_lock(&pool_mu);
+    stats.connections += c->connects;
+    c->connects = 0;
+    if (c->fd >= 0 && n_idle < POOL_MAX && strcmp(c->host, http_host) == 0 &&
+        strcmp(c->port, http_port) == 0) {
+        idle[n_idle++] = c;
+        pooled = 1;
+    }
+    pthread_mutex_unlock(&pool_mu);
+    if (!pooled) {
+        http_close(c);
+        free(c);
+    }
+}
+
+static void count(uint64_t requests, uint64_t up, uint64_t down, uint64_t objects_up,
+                  uint64_t objects_down) {
+    pthread_mutex_lock(&pool_mu);
+    stats.requests += requests;
+    stats.bytes_uploaded += up;
+    stats.bytes_downloaded += down;
+    stats.objects_uploaded += objects_up;
+    stats.objects_downloaded += objects_down;
+    pthread_mutex_unlock(&pool_mu);
+}
+
+static void object_path(HttpOp *op, const char *method, const char *prefix, const char *hex) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/cas/%s", prefix, hex);
+    http_op_init(op, method, path);
+}
+
+// Growing buffer for a GET
+typedef struct {
+    unsigned char *data;
+    size_t len, cap;
+} Buf;
+
+static int buf_sink(const unsigned char *data, size_t len, void *ctx) {
+    Buf *b = ctx;
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 65536;
+        while (cap < b->len + len) cap *= 2;
+        unsigned char *p = realloc(b->data, cap);
+        if (!p) return -1;
+        b->data = p;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static void buf_reset(void *ctx) {
+    ((Buf *)ctx)->len = 0;
+}
+
+// The tier behind the local store (cas_set_fetch_handler): a restore
+// that misses waits for the object ahead of background transfers
+static int read_through(const Digest d[], size_t n) {
+    return remote_cas_fetch_objects(d, n, REMOTE_CAS_URGENT);
+}
+
 int remote_cas_init(RemoteCASBackend backend, const char *endpoint,
                     const char *access_key, const char *secret_key) {
     g_remote_cas_config.backend = backend;
     g_remote_cas_config.enabled = (backend != REMOTE_CAS_NONE);
-    g_remote_cas_config.use_ssl = 1;
+    g_remote_cas_config.use_ssl = endpoint && strncasecmp(endpoint, "https://", 8) == 0;
 
     if (endpoint) {
         strncpy(g_remote_cas_config.endpoint, endpoint,
@@ -26,8 +162,20 @@ int remote_cas_init(RemoteCASBackend backend, const char *endpoint,
                 sizeof(g_remote_cas_config.secret_key) - 1);
     }
 
-    LOG_INFO("Remote CAS initialized: backend=%d, endpoint=%s",
-             backend, endpoint ? endpoint : "none");
+    if (backend == REMOTE_CAS_HTTP &&
+        http_parse_url(g_remote_cas_config.endpoint, http_host, sizeof(http_host), http_port,
+                       sizeof(http_port), http_prefix, sizeof(http_prefix)) != 0) {
+        LOG_ERROR("Remote CAS endpoint must be http://host[:port][/prefix]%s: %s",
+                  g_remote_cas_config.use_ssl ? " (put a TLS proxy in front for https)" : "",
+                  g_remote_cas_config.endpoint);
+        g_remote_cas_config.enabled = 0;
+        return -1;
+    }
+
+    if (backend == REMOTE_CAS_HTTP) cas_set_fetch_handler(read_through);
+
+    LOG_DEBUG("Remote CAS initialized: backend=%d, endpoint=%s",
+              backend, endpoint ? endpoint : "none");
 
     return 0;
 }
@@ -67,7 +215,10 @@ int remote_cas_retrieve(const char *hash, unsigned char **data, size_t *len) {
 int remote_cas_exists(const char *hash) {
     if (!g_remote_cas_config.enabled) return 0;
 
-    // Try to retrieve (would be optimized with HEAD request)
+    if (g_remote_cas_config.backend == REMOTE_CAS_HTTP)
+        return remote_cas_http_exists(g_remote_cas_config.endpoint, hash) == 1;
+
+    // other backends have no metadata-only probe yet
     unsigned char *data = NULL;
     size_t len = 0;
     int result = remote_cas_retrieve(hash, &data, &len);
@@ -76,24 +227,85 @@ int remote_cas_exists(const char *hash) {
     return (result == 0) ? 1 : 0;
 }
 
-// HTTP implementation stubs
+// HEADs for hashes[0..n) over c, pipelined
+static int probe(HttpConn *c, const char *prefix, const char *const hashes[], int n, int out[]) {
+    HttpOp *ops = malloc((size_t)(n < PROBE_BATCH ? n : PROBE_BATCH) * sizeof(HttpOp));
+    if (!ops && n > 0) return -1;
+    int rc = 0;
+    for (int start = 0; rc == 0 && start < n; start += PROBE_BATCH) {
+        int m = n - start < PROBE_BATCH ? n - start : PROBE_BATCH;
+        for (int i = 0; i < m; ++i) object_path(&ops[i], "HEAD", prefix, hashes[start + i]);
+        rc = http_pipeline(c, ops, m);
+        for (int i = 0; rc == 0 && i < m; ++i) {
+            if (ops[i].status == 200) out[start + i] = 1;
+            else if (ops[i].status == 404) out[start + i] = 0;
+            else rc = -1;
+        }
+        count((uint64_t)m, 0, 0, 0, 0);
+    }
+    free(ops);
+    return rc;
+}
+
+int remote_cas_http_exists(const char *url, const char *hash) {
+    if (!valid_hex(hash)) return -1;
+    char prefix[512];
+    HttpConn *c = acquire(url, prefix, sizeof(prefix));
+    if (!c) return -1;
+    int out = -1;
+    if (probe(c, prefix, &hash, 1, &out) != 0) out = -1;
+    release(c);
+    return out;
+}
+
 int remote_cas_http_store(const char *url, const char *hash,
                           const unsigned char *data, size_t len) {
-    LOG_DEBUG("HTTP store stub: url=%s, hash=%s, size=%zu", url, hash, len);
-    // Would use libcurl to PUT data
-    return 0;
+    if (!valid_hex(hash)) return -1;
+    char prefix[512];
+    HttpConn *c = acquire(url, prefix, sizeof(prefix));
+    if (!c) return -1;
+    HttpOp op;
+    object_path(&op, "PUT", prefix, hash);
+    op.body = data;
+    op.body_len = len;
+    int rc = http_pipeline(c, &op, 1) == 0 && op.status >= 200 && op.status < 300 ? 0 : -1;
+    release(c);
+    count(1, rc == 0 ? len : 0, 0, rc == 0, 0);
+    if (rc != 0) LOG_WARN("HTTP PUT %s failed (status %d)", hash, op.status);
+    return rc;
 }
 
 int remote_cas_http_retrieve(const char *url, const char *hash,
                              unsigned char **data, size_t *len) {
-    LOG_DEBUG("HTTP retrieve stub: url=%s, hash=%s", url, hash);
-    // Would use libcurl to GET data
-    return -1;
+    *data = NULL;
+    *len = 0;
+    if (!valid_hex(hash)) return -1;
+    char prefix[512];
+    HttpConn *c = acquire(url, prefix, sizeof(prefix));
+    if (!c) return -1;
+    Buf b = { NULL, 0, 0 };
+    HttpOp op;
+    object_path(&op, "GET", prefix, hash);
+    op.sink = buf_sink;
+    op.reset = buf_reset;
+    op.ctx = &b;
+    int rc = http_pipeline(c, &op, 1) == 0 && op.status == 200 ? 0 : -1;
+    release(c);
+    count(1, 0, rc == 0 ? b.len : 0, 0, rc == 0);
+    if (rc != 0) {
+        if (op.status != 404) LOG_WARN("HTTP GET %s failed (status %d)", hash, op.status);
+        free(b.data);
+        return -1;
+    }
+    *data = b.data ? b.data : malloc(1);
+    *len = b.len;
+    return *data ? 0 : -1;
 }
 
 // S3 implementation stubs
 int remote_cas_s3_store(const char *bucket, const char *hash,
                         const unsigned char *data, size_t len) {
+    (void)data;
     LOG_DEBUG("S3 store stub: bucket=%s, hash=%s, size=%zu", bucket, hash, len);
     // Would use AWS SDK or boto3/CLI
     return 0;
@@ -101,27 +313,1110 @@ int remote_cas_s3_store(const char *bucket, const char *hash,
 
 int remote_cas_s3_retrieve(const char *bucket, const char *hash,
                            unsigned char **data, size_t *len) {
+    (void)data;
+    (void)len;
     LOG_DEBUG("S3 retrieve stub: bucket=%s, hash=%s", bucket, hash);
     // Would use AWS SDK
     return -1;
 }
 
+/* ---- batched probes ---- */
+
+// Server answered findMissing with 404, 405 or 501: probe with HEADs instead
+static int no_find_missing = 0;
+
+// missing[i] = 1 for each ds[i] the remote lacks. One POST per FIND_BATCH
+// digests; the body is the raw digests, the answer the ones the server
+// lacks, in the same order.
+static int find_missing(HttpConn *c, const char *prefix, const Digest *ds, size_t n, int missing[]) {
+    if (n == 0) return 0;
+    int rc = 1;
+    if (!__atomic_load_n(&no_find_missing, __ATOMIC_RELAXED)) {
+        size_t nops = (n + FIND_BATCH - 1) / FIND_BATCH;
+        HttpOp *ops = malloc(nops * sizeof(HttpOp));
+        Buf *bufs = calloc(nops, sizeof(Buf));
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/cas:findMissing", prefix);
+        rc = ops && bufs ? 0 : -1;
+        for (size_t k = 0; rc == 0 && k < nops; ++k) {
+            size_t base = k * FIND_BATCH;
+            http_op_init(&ops[k], "POST", path);
+            ops[k].body = ds[base].b;
+            ops[k].body_len = (uint64_t)((n - base < FIND_BATCH ? n - base : FIND_BATCH) * DIGEST_SIZE);
+            ops[k].sink = buf_sink;
+            ops[k].reset = buf_reset;
+            ops[k].ctx = &bufs[k];
+        }
+        if (rc == 0) rc = http_pipeline(c, ops, (int)nops);
+        for (size_t k = 0; rc == 0 && k < nops; ++k) {
+            if (ops[k].status == 404 || ops[k].status == 405 || ops[k].status == 501) {
+                __atomic_store_n(&no_find_missing, 1, __ATOMIC_RELAXED);
+                rc = 1;
+                break;
+            }
+            size_t base = k * FIND_BATCH, m = (size_t)(ops[k].body_len / DIGEST_SIZE), i = 0;
+            if (ops[k].status != 200 || bufs[k].len % DIGEST_SIZE != 0) {
+                rc = -1;
+                break;
+            }
+            memset(missing + base, 0, m * sizeof(int));
+            for (size_t j = 0; j < bufs[k].len; j += DIGEST_SIZE) {
+                while (i < m && memcmp(ds[base + i].b, bufs[k].data + j, DIGEST_SIZE) != 0) ++i;
+                if (i == m) {
+                    rc = -1; // not one of ours, or out of order
+                    break;
+                }
+                missing[base + i++] = 1;
+            }
+        }
+        if (ops) count(nops, 0, 0, 0, 0);
+        for (size_t k = 0; bufs && k < nops; ++k) free(bufs[k].data);
+        free(ops);
+        free(bufs);
+    }
+    if (rc != 1) return rc;
+
+    char (*hex)[DIGEST_HEX_SIZE] = malloc(n * sizeof(*hex));
+    const char **names = calloc(n, sizeof(*names));
+    rc = hex && names ? 0 : -1;
+    if (rc == 0) {
+        for (size_t i = 0; i < n; ++i) names[i] = digest_to_hex(&ds[i], hex[i]);
+        rc = probe(c, prefix, names, (int)n, missing);
+        for (size_t i = 0; rc == 0 && i < n; ++i) missing[i] = !missing[i];
+    }
+    free(hex);
+    free(names);
+    return rc;
+}
+
+int remote_cas_find_missing(const Digest ds[], size_t n, int missing[]) {
+    if (!g_remote_cas_config.enabled) return -1;
+    if (g_remote_cas_config.backend != REMOTE_CAS_HTTP) {
+        for (size_t i = 0; i < n; ++i) {
+            char hex[DIGEST_HEX_SIZE];
+            missing[i] = !remote_cas_exists(digest_to_hex(&ds[i], hex));
+        }
+        return 0;
+    }
+    char prefix[512];
+    HttpConn *c = acquire(g_remote_cas_config.endpoint, prefix, sizeof(prefix));
+    if (!c) return -1;
+    int rc = find_missing(c, prefix, ds, n, missing);
+    release(c);
+    return rc;
+}
+
+int remote_cas_exists_batch(const char *const hashes[], int n, int out[]) {
+    if (!g_remote_cas_config.enabled || g_remote_cas_config.backend != REMOTE_CAS_HTTP) {
+        for (int i = 0; i < n; ++i) out[i] = remote_cas_exists(hashes[i]);
+        return 0;
+    }
+    Digest *ds = malloc((size_t)n * sizeof(Digest) + 1);
+    int rc = ds ? 0 : -1;
+    for (int i = 0; rc == 0 && i < n; ++i) rc = digest_from_hex(hashes[i], &ds[i]) == 0 ? 0 : -1;
+    if (rc == 0) rc = remote_cas_find_missing(ds, (size_t)n, out);
+    for (int i = 0; rc == 0 && i < n; ++i) out[i] = !out[i];
+    free(ds);
+    return rc;
+}
+
+// One page of the remote's digests, ascending, all after *after (from the
+// start when after is NULL)
+static int list_page(HttpConn *c, const char *prefix, const Digest *after, Digest **out, size_t *n) {
+    char path[1024], hex[DIGEST_HEX_SIZE];
+    snprintf(path, sizeof(path), "%s/cas?limit=%d%s%s", prefix, FIND_BATCH, after ? "&after=" : "",
+             after ? digest_to_hex(after, hex) : "");
+    Buf b = { NULL, 0, 0 };
+    HttpOp op;
+    http_op_init(&op, "GET", path);
+    op.sink = buf_sink;
+    op.reset = buf_reset;
+    op.ctx = &b;
+    int rc = http_pipeline(c, &op, 1) == 0 && op.status == 200 && b.len % DIGEST_SIZE == 0 ? 0 : -1;
+    count(1, 0, 0, 0, 0);
+    *out = (Digest *)b.data;
+    *n = rc == 0 ? b.len / DIGEST_SIZE : 0;
+    if (rc != 0) LOG_WARN("Listing the remote CAS failed (status %d)", op.status);
+    return rc;
+}
+
+/* ---- object transfer ---- */
+
+// Digests already queued for upload, so an object reached both directly
+// and through a chunk list or tree goes up once
+typedef struct {
+    Digest *slots;
+    unsigned char *used;
+    size_t cap, n;
+} DigestSet;
+
+static size_t set_slot(const DigestSet *s, const Digest *d) {
+    size_t i = (size_t)digest_hash(d) & (s->cap - 1);
+    while (s->used[i] && !digest_eq(&s->slots[i], d)) i = (i + 1) & (s->cap - 1);
+    return i;
+}
+
+// 1 if d was added, 0 if already there, -1 out of memory
+static int set_add(DigestSet *s, const Digest *d) {
+    if ((s->n + 1) * 4 >= s->cap * 3) {
+        DigestSet g = { NULL, NULL, s->cap ? s->cap * 2 : 1024, 0 };
+        g.slots = malloc(g.cap * sizeof(Digest));
+        g.used = calloc(g.cap, 1);
+        if (!g.slots || !g.used) {
+            free(g.slots);
+            free(g.used);
+            return -1;
+        }
+        for (size_t i = 0; i < s->cap; ++i) {
+            if (!s->used[i]) continue;
+            size_t j = set_slot(&g, &s->slots[i]);
+            g.slots[j] = s->slots[i];
+            g.used[j] = 1;
+        }
+        g.n = s->n;
+        free(s->slots);
+        free(s->used);
+        *s = g;
+    }
+    size_t i = set_slot(s, d);
+    if (s->used[i]) return 0;
+    s->slots[i] = *d;
+    s->used[i] = 1;
+    s->n++;
+    return 1;
+}
+
+typedef struct {
+    Digest *d;
+    size_t n, cap;
+} DigestList;
+
+static int collect(const Digest *d, void *ctx) {
+    DigestList *l = ctx;
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 1024;
+        Digest *p = realloc(l->d, cap * sizeof(*p));
+        if (!p) return -1;
+        l->d = p;
+        l->cap = cap;
+    }
+    l->d[l->n++] = *d;
+    return 0;
+}
+
+/* ---- transfer engine ---- */
+
+// Objects one caller waits for. Lives on the caller's stack.
+typedef struct {
+    RemoteCASPriority prio; // raised when an urgent fetch waits on the group
+    size_t pending; // transfers not finished
+    size_t failed;  // objects that could not be moved
+    int broken;     // a pipeline got no answer: the remote is gone
+    // downloaded chunk lists and trees, stored once what they name is
+    CasObjectWriter **held;
+    Digest *held_d;
+    size_t n_held, cap_held;
+} XferGroup;
+
+typedef struct Xfer {
+    Digest d;
+    int upload;
+    RemoteCASPriority prio;
+    XferGroup *g;
+    struct Xfer *next;
+} Xfer;
+
+static pthread_mutex_t xfer_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;   // transfers queued, or stopping
+static pthread_cond_t budget_cv = PTHREAD_COND_INITIALIZER; // in-flight bytes released
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;   // a group finished
+static Xfer *queue_head[2], *queue_tail[2]; // by RemoteCASPriority
+static pthread_t xfer_threads[XFER_MAX_WORKERS];
+static int n_xfer_threads = 0;
+static int want_xfer_threads = XFER_WORKERS;
+static int stopping = 0;
+static uint64_t inflight_cap = XFER_INFLIGHT;
+static uint64_t inflight = 0;
+static int urgent_waiting = 0;
+
+// Objects a fetch has taken on, so another fetch of the same object waits
+// for it rather than downloading it again. A claim goes when its object
+// is stored or has failed.
+typedef struct Claim {
+    Digest d;
+    XferGroup *g;
+    struct Claim *next;
+} Claim;
+
+static Claim *claims[CLAIM_BUCKETS];
+
+// Where d's claim is, or would go. Caller holds xfer_mu.
+static Claim **claim_slot_locked(const Digest *d) {
+    Claim **p = &claims[digest_hash(d) & (CLAIM_BUCKETS - 1)];
+    while (*p && !digest_eq(&(*p)->d, d)) p = &(*p)->next;
+    return p;
+}
+
+// Drop g's claim on d, if it has one, and wake the fetches waiting for
+// it. Caller holds xfer_mu.
+static void unclaim_locked(const Digest *d, const XferGroup *g) {
+    Claim **p = claim_slot_locked(d);
+    Claim *c = *p;
+    if (!c || c->g != g) return;
+    *p = c->next;
+    free(c);
+    pthread_cond_broadcast(&done_cv);
+}
+
+void remote_cas_set_transfer_limits(int workers, uint64_t max_inflight_bytes) {
+    pthread_mutex_lock(&xfer_mu);
+    if (workers > 0) want_xfer_threads = workers < XFER_MAX_WORKERS ? workers : XFER_MAX_WORKERS;
+    if (max_inflight_bytes > 0) inflight_cap = max_inflight_bytes;
+    pthread_mutex_unlock(&xfer_mu);
+}
+
+// Take bytes of the in-flight cap, waiting for room unless nothing is in
+// flight (so a larger object still goes, alone). Background transfers
+// also wait while an urgent one does. With try set, fail rather than
+// wait. Caller holds xfer_mu.
+static int reserve_locked(uint64_t bytes, RemoteCASPriority prio, int try) {
+    for (;;) {
+        int room = inflight == 0 || inflight + bytes <= inflight_cap;
+        if (room && (prio == REMOTE_CAS_URGENT || urgent_waiting == 0)) break;
+        if (try) return -1;
+        if (prio == REMOTE_CAS_URGENT) urgent_waiting++;
+        pthread_cond_wait(&budget_cv, &xfer_mu);
+        if (prio == REMOTE_CAS_URGENT) urgent_waiting--;
+    }
+    inflight += bytes;
+    pthread_mutex_lock(&pool_mu);
+    if (inflight > stats.peak_inflight_bytes) stats.peak_inflight_bytes = inflight;
+    pthread_mutex_unlock(&pool_mu);
+    return 0;
+}
+
+static void unreserve_locked(uint64_t bytes) {
+    if (bytes == 0) return;
+    inflight -= bytes;
+    pthread_cond_broadcast(&budget_cv);
+}
+
+// The next transfer: the most urgent, or with upload >= 0 only one of
+// that kind and priority (to join a pipeline). Caller holds xfer_mu.
+static Xfer *pop_locked(int upload, RemoteCASPriority prio) {
+    for (int p = 0; p < 2; ++p) {
+        if (upload >= 0 && p != (int)prio) continue;
+        Xfer *x = queue_head[p];
+        if (!x || (upload >= 0 && x->upload != upload)) continue;
+        queue_head[p] = x->next;
+        if (!queue_head[p]) queue_tail[p] = NULL;
+        return x;
+    }
+    return NULL;
+}
+
+static void push_back_locked(Xfer *x) {
+    x->next = NULL;
+    if (queue_tail[x->prio]) queue_tail[x->prio]->next = x;
+    else queue_head[x->prio] = x;
+    queue_tail[x->prio] = x;
+}
+
+// An urgent fetch waits on g: its queued transfers, and those it queues
+// from now on, go ahead of background work. Caller holds xfer_mu.
+static void promote_locked(XferGroup *g) {
+    if (g->prio == REMOTE_CAS_URGENT) return;
+    g->prio = REMOTE_CAS_URGENT;
+    Xfer *x = queue_head[REMOTE_CAS_BACKGROUND];
+    queue_head[REMOTE_CAS_BACKGROUND] = queue_tail[REMOTE_CAS_BACKGROUND] = NULL;
+    while (x) {
+        Xfer *next = x->next;
+        if (x->g == g) x->prio = REMOTE_CAS_URGENT;
+        push_back_locked(x);
+        x = next;
+    }
+}
+
+static void push_front_locked(Xfer *x) {
+    x->next = queue_head[x->prio];
+    queue_head[x->prio] = x;
+    if (!queue_tail[x->prio]) queue_tail[x->prio] = x;
+}
+
+static void finish_locked(Xfer *x, int ok) {
+    if (!ok) x->g->failed++;
+    if (--x->g->pending == 0) pthread_cond_broadcast(&done_cv);
+    free(x);
+}
+
+// PUT a pipeline of objects of one priority, bodies streamed from the
+// store. The first waits for room under the in-flight cap; the others
+// join only while there is room.
+static void run_uploads(Xfer *x) {
+    Xfer *xs[UPLOAD_BATCH];
+    HttpOp ops[UPLOAD_BATCH];
+    int n = 0;
+    uint64_t reserved = 0;
+    char prefix[512];
+    HttpConn *c = acquire(g_remote_cas_config.endpoint, prefix, sizeof(prefix));
+    RemoteCASPriority prio = x->prio;
+    while (x) {
+        int fd;
+        off_t off;
+        uint64_t len;
+        int opened = cas_open_object(&x->d, &fd, &off, &len) == 0;
+        pthread_mutex_lock(&xfer_mu);
+        if (!opened) {
+            finish_locked(x, 0);
+        } else if (reserve_locked(len, prio, n > 0) != 0) {
+            push_front_locked(x);
+            pthread_mutex_unlock(&xfer_mu);
+            close(fd);
+            break;
+        } else {
+            char hex[DIGEST_HEX_SIZE];
+            reserved += len;
+            xs[n] = x;
+            object_path(&ops[n], "PUT", prefix, digest_to_hex(&x->d, hex));
+            ops[n].body_fd = fd;
+            ops[n].body_off = off;
+            ops[n].body_len = len;
+            n++;
+        }
+        x = n < UPLOAD_BATCH ? pop_locked(1, prio) : NULL;
+        pthread_mutex_unlock(&xfer_mu);
+    }
+    int rc = c && n > 0 ? http_pipeline(c, ops, n) : -1;
+    if (c) release(c);
+    uint64_t bytes = 0, sent = 0;
+    for (int i = 0; i < n; ++i) {
+        if (rc == 0 && ops[i].status >= 200 && ops[i].status < 300) {
+            bytes += ops[i].body_len;
+            sent++;
+        } else if (rc == 0) {
+            LOG_WARN("HTTP PUT %s failed (status %d)", ops[i].path, ops[i].status);
+        }
+        close(ops[i].body_fd);
+    }
+    count((uint64_t)n, bytes, 0, sent, 0);
+    pthread_mutex_lock(&xfer_mu);
+    unreserve_locked(reserved);
+    for (int i = 0; i < n; ++i) {
+        if (rc != 0) xs[i]->g->broken = 1;
+        finish_locked(xs[i], rc == 0 && ops[i].status >= 200 && ops[i].status < 300);
+    }
+    pthread_mutex_unlock(&xfer_mu);
+}
+
+// One GET of a download pipeline, streaming into a CasObjectWriter
+typedef struct {
+    Xfer *x;
+    HttpOp *op;
+    CasObjectWriter *w;
+    uint64_t *held; // the pipeline's share of the in-flight cap
+    uint64_t bytes;
+    int started;
+} Fetch;
+
+static int fetch_sink(const unsigned char *data, size_t len, void *ctx) {
+    Fetch *f = ctx;
+    if (!f->started) {
+        // responses come in order, so the one before this is all in and
+        // its share goes back before this one waits for room
+        uint64_t want = f->op->length > 0 ? (uint64_t)f->op->length : 0;
+        f->started = 1;
+        pthread_mutex_lock(&xfer_mu);
+        unreserve_locked(*f->held);
+        reserve_locked(want, f->x->prio, 0);
+        *f->held = want;
+        pthread_mutex_unlock(&xfer_mu);
+    }
+    f->bytes += len;
+    return f->w ? cas_object_writer_write(f->w, data, len) : -1;
+}
+
+static void fetch_reset(void *ctx) {
+    Fetch *f = ctx;
+    cas_object_writer_abort(f->w);
+    f->w = cas_object_writer_new(&f->x->d);
+    f->bytes = 0;
+}
+
+// Hold a downloaded chunk list or tree in its group. Caller holds xfer_mu.
+static int hold_locked(XferGroup *g, const Digest *d, CasObjectWriter *w) {
+    if (g->n_held == g->cap_held) {
+        size_t cap = g->cap_held ? g->cap_held * 2 : 64;
+        CasObjectWriter **h = realloc(g->held, cap * sizeof(*h));
+        if (h) g->held = h;
+        Digest *hd = realloc(g->held_d, cap * sizeof(*hd));
+        if (hd) g->held_d = hd;
+        if (!h || !hd) return -1;
+        g->cap_held = cap;
+    }
+    g->held[g->n_held] = w;
+    g->held_d[g->n_held++] = *d;
+    return 0;
+}
+
+// GET a pipeline of objects of one priority into the local store. Each
+// response takes its share of the in-flight cap as its body starts.
+// Objects that name others are held in their group, not stored yet.
+static void run_downloads(Xfer *x) {
+    Xfer *xs[DOWNLOAD_BATCH];
+    HttpOp ops[DOWNLOAD_BATCH];
+    Fetch fs[DOWNLOAD_BATCH];
+    uint64_t held = 0;
+    int n = 0;
+    char prefix[512];
+    HttpConn *c = acquire(g_remote_cas_config.endpoint, prefix, sizeof(prefix));
+    RemoteCASPriority prio = x->prio;
+    while (x && n < DOWNLOAD_BATCH) {
+        char hex[DIGEST_HEX_SIZE];
+        xs[n] = x;
+        object_path(&ops[n], "GET", prefix, digest_to_hex(&x->d, hex));
+        fs[n] = (Fetch){ x, &ops[n], cas_object_writer_new(&x->d), &held, 0, 0 };
+        ops[n].sink = fetch_sink;
+        ops[n].reset = fetch_reset;
+        ops[n].ctx = &fs[n];
+        n++;
+        pthread_mutex_lock(&xfer_mu);
+        x = n < DOWNLOAD_BATCH ? pop_locked(0, prio) : NULL;
+        pthread_mutex_unlock(&xfer_mu);
+    }
+    int rc = c ? http_pipeline(c, ops, n) : -1;
+    if (c) release(c);
+    uint64_t bytes = 0, stored = 0;
+    int ok[DOWNLOAD_BATCH], kept[DOWNLOAD_BATCH];
+    for (int i = 0; i < n; ++i) {
+        kept[i] = 0;
+        char hex[DIGEST_HEX_SIZE];
+        Digest *refs = NULL;
+        size_t nrefs = 0;
+        CasObjectWriter *w = fs[i].w;
+        ok[i] = rc == 0 && ops[i].status == 200 && w;
+        if (rc == 0 && ops[i].status != 200)
+            LOG_WARN("Remote CAS has no object %s (status %d)", digest_to_hex(&xs[i]->d, hex), ops[i].status);
+        if (ok[i]) bytes += fs[i].bytes;
+        int r = ok[i] ? cas_object_writer_refs(w, &refs, &nrefs) : 0;
+        free(refs);
+        if (r < 0) ok[i] = 0;
+        if (ok[i] && r > 0 && nrefs > 0) {
+            pthread_mutex_lock(&xfer_mu);
+            ok[i] = kept[i] = hold_locked(xs[i]->g, &xs[i]->d, w) == 0;
+            pthread_mutex_unlock(&xfer_mu);
+            if (ok[i]) continue;
+        } else if (ok[i]) {
+            // rejects content that does not match the digest
+            ok[i] = cas_object_writer_commit(w) == 0;
+            if (!ok[i]) LOG_WARN("Object %s from the remote CAS does not verify", digest_to_hex(&xs[i]->d, hex));
+            stored += ok[i];
+            continue;
+        }
+        cas_object_writer_abort(w);
+    }
+    count((uint64_t)n, 0, bytes, 0, stored);
+    pthread_mutex_lock(&xfer_mu);
+    unreserve_locked(held);
+    for (int i = 0; i < n; ++i) {
+        if (rc != 0) xs[i]->g->broken = 1;
+        // a held object is stored, and let go, with the rest of its group
+        if (!kept[i]) unclaim_locked(&xs[i]->d, xs[i]->g);
+        finish_locked(xs[i], ok[i]);
+    }
+    pthread_mutex_unlock(&xfer_mu);
+}
+
+static void *xfer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&xfer_mu);
+    for (;;) {
+        while (!queue_head[0] && !queue_head[1] && !stopping) pthread_cond_wait(&work_cv, &xfer_mu);
+        Xfer *x = pop_locked(-1, REMOTE_CAS_URGENT);
+        if (!x) break; // stopping, and everything queued has gone
+        pthread_mutex_unlock(&xfer_mu);
+        if (x->upload) run_uploads(x);
+        else run_downloads(x);
+        pthread_mutex_lock(&xfer_mu);
+    }
+    pthread_mutex_unlock(&xfer_mu);
+    return NULL;
+}
+
+// Queue one transfer for g, at g's priority; the workers start on first use
+static void xfer_submit(XferGroup *g, const Digest *d, int upload) {
+    Xfer *x = malloc(sizeof(*x));
+    pthread_mutex_lock(&xfer_mu);
+    while (n_xfer_threads < want_xfer_threads &&
+           pthread_create(&xfer_threads[n_xfer_threads], NULL, xfer_main, NULL) == 0)
+        n_xfer_threads++;
+    if (!x || n_xfer_threads == 0) {
+        g->failed++;
+        pthread_mutex_unlock(&xfer_mu);
+        free(x);
+        return;
+    }
+    *x = (Xfer){ *d, upload, g->prio, g, NULL };
+    push_back_locked(x);
+    g->pending++;
+    pthread_cond_signal(&work_cv);
+    pthread_mutex_unlock(&xfer_mu);
+}
+
+static void xfer_wait(XferGroup *g) {
+    pthread_mutex_lock(&xfer_mu);
+    while (g->pending > 0) pthread_cond_wait(&done_cv, &xfer_mu);
+    pthread_mutex_unlock(&xfer_mu);
+}
+
+// Let the workers finish what is queued, then join them
+static void xfer_shutdown(void) {
+    pthread_mutex_lock(&xfer_mu);
+    stopping = 1;
+    pthread_cond_broadcast(&work_cv);
+    int n = n_xfer_threads;
+    pthread_mutex_unlock(&xfer_mu);
+    for (int i = 0; i < n; ++i) pthread_join(xfer_threads[i], NULL);
+    pthread_mutex_lock(&xfer_mu);
+    n_xfer_threads = 0;
+    stopping = 0;
+    pthread_mutex_unlock(&xfer_mu);
+}
+
+/* ---- object transfer ---- */
+
+// An upload plan. Objects that name nothing go to the engine as they are
+// found; chunk lists and trees are listed after what they name and go up
+// last, in that order on one connection, so what names an object on the
+// remote is always complete.
+typedef struct {
+    HttpConn *c;
+    const char *prefix;
+    RemoteCASPriority prio;
+    XferGroup g;
+    DigestList parents;
+    size_t failed;
+    DigestSet queued;
+} Uploader;
+
+// Plan every object in ds[0..n) the remote lacks, and what it names
+static int upload_missing(Uploader *u, const Digest *ds, size_t n) {
+    int *missing = malloc(n * sizeof(*missing) + 1);
+    int rc = missing ? find_missing(u->c, u->prefix, ds, n, missing) : -1;
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        if (!missing[i]) continue;
+        int added = set_add(&u->queued, &ds[i]);
+        if (added < 0) rc = -1;
+        if (added <= 0) continue;
+        Digest *refs = NULL;
+        size_t nrefs = 0, failed = u->failed;
+        int r = cas_object_refs(&ds[i], &refs, &nrefs);
+        if (r > 0 && nrefs > 0) rc = upload_missing(u, refs, nrefs);
+        free(refs);
+        if (r < 0) u->failed++;
+        else if (rc == 0 && u->failed == failed && r > 0) rc = collect(&ds[i], &u->parents);
+        else if (rc == 0 && u->failed == failed) xfer_submit(&u->g, &ds[i], 1);
+    }
+    free(missing);
+    return rc;
+}
+
+// PUT ds[0..n) over c in order, bodies streamed from the store
+static int put_in_order(HttpConn *c, const char *prefix, const Digest *ds, size_t n, size_t *failed) {
+    HttpOp *ops = malloc(UPLOAD_BATCH * sizeof(HttpOp));
+    int rc = ops ? 0 : -1;
+    for (size_t start = 0; rc == 0 && start < n; start += UPLOAD_BATCH) {
+        int m = 0;
+        for (size_t i = start; i < n && i < start + UPLOAD_BATCH; ++i) {
+            int fd;
+            off_t off;
+            uint64_t len;
+            char hex[DIGEST_HEX_SIZE];
+            if (cas_open_object(&ds[i], &fd, &off, &len) != 0) {
+                (*failed)++;
+                continue;
+            }
+            object_path(&ops[m], "PUT", prefix, digest_to_hex(&ds[i], hex));
+            ops[m].body_fd = fd;
+            ops[m].body_off = off;
+            ops[m].body_len = len;
+            m++;
+        }
+        rc = http_pipeline(c, ops, m);
+        uint64_t bytes = 0, sent = 0;
+        for (int j = 0; j < m; ++j) {
+            if (rc == 0 && ops[j].status >= 200 && ops[j].status < 300) {
+                bytes += ops[j].body_len;
+                sent++;
+            } else {
+                (*failed)++;
+            }
+            close(ops[j].body_fd);
+        }
+        count((uint64_t)m, bytes, 0, sent, 0);
+    }
+    free(ops);
+    return rc;
+}
+
+// Upload objects ds[0..n) and what they name; *failed gets the objects
+// that could not be sent
+static int upload_objects(const Digest *ds, size_t n, RemoteCASPriority prio, size_t *failed) {
+    Uploader *u = calloc(1, sizeof(*u));
+    char prefix[512];
+    if (!u) return -1;
+    u->c = acquire(g_remote_cas_config.endpoint, prefix, sizeof(prefix));
+    u->prefix = prefix;
+    u->prio = prio;
+    u->g.prio = prio;
+    int rc = u->c ? 0 : -1;
+    // one findMissing round trip per FIND_BATCH objects, then the difference
+    for (size_t start = 0; rc == 0 && start < n; start += FIND_BATCH)
+        rc = upload_missing(u, ds + start, n - start < FIND_BATCH ? n - start : FIND_BATCH);
+    xfer_wait(&u->g);
+    u->failed += u->g.failed;
+    if (u->g.broken) rc = -1;
+    // a chunk list or tree goes up only once all it names is there
+    if (rc == 0 && u->failed == 0) rc = put_in_order(u->c, prefix, u->parents.d, u->parents.n, &u->failed);
+    else u->failed += u->parents.n;
+    if (u->c) release(u->c);
+    if (failed) *failed = u->failed;
+    if (u->failed) rc = -1;
+    free(u->parents.d);
+    free(u->queued.slots);
+    free(u->queued.used);
+    free(u);
+    return rc;
+}
+
+int remote_cas_upload_object(const Digest *d) {
+    if (!g_remote_cas_config.enabled) return 0;
+    if (g_remote_cas_config.backend == REMOTE_CAS_HTTP) return upload_objects(d, 1, REMOTE_CAS_BACKGROUND, NULL);
+
+    char hex[DIGEST_HEX_SIZE];
+    digest_to_hex(d, hex);
+    if (remote_cas_exists(hex)) return 0;
+
+    unsigned char *data = NULL;
+    size_t len = 0;
+    if (cas_read_object(d, &data, &len) != 0) return -1;
+
+    // chunks and tree children first, so what names them on the remote is
+    // always complete
+    Digest *chunks = NULL;
+    size_t n = 0;
+    int rc = cas_parse_object_refs(data, len, &chunks, &n) < 0 ? -1 : 0;
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        rc = remote_cas_upload_object(&chunks[i]);
+    }
+    free(chunks);
+
+    if (rc == 0) rc = remote_cas_store(hex, data, len);
+    free(data);
+    return rc;
+}
+
+// Store the chunk lists and trees a fetch held back, each once all it
+// names is present: newest first (a level never names an earlier one),
+// again while that makes progress (it may name one of its own level).
+// Returns the objects stored; the rest are counted in *failed.
+static uint64_t store_held(XferGroup *g, size_t *failed) {
+    size_t left = g->n_held;
+    uint64_t stored = 0;
+    int progress = 1;
+    while (left > 0 && progress) {
+        progress = 0;
+        for (size_t i = g->n_held; i-- > 0;) {
+            if (!g->held[i]) continue;
+            Digest *refs = NULL;
+            size_t nrefs = 0;
+            cas_object_writer_refs(g->held[i], &refs, &nrefs);
+            int *have = malloc(nrefs * sizeof(*have) + 1);
+            int ready = have && cas_blobs_exist_batch(refs, (int)nrefs, have) == 0;
+            for (size_t j = 0; ready && j < nrefs; ++j) ready = have[j];
+            free(have);
+            free(refs);
+            if (!ready) continue;
+            char hex[DIGEST_HEX_SIZE];
+            if (cas_object_writer_commit(g->held[i]) == 0) {
+                stored++;
+            } else {
+                LOG_WARN("Object %s from the remote CAS does not verify", digest_to_hex(&g->held_d[i], hex));
+                (*failed)++;
+            }
+            g->held[i] = NULL;
+            pthread_mutex_lock(&xfer_mu);
+            unclaim_locked(&g->held_d[i], g);
+            pthread_mutex_unlock(&xfer_mu);
+            left--;
+            progress = 1;
+        }
+    }
+    for (size_t i = 0; i < g->n_held; ++i) {
+        if (!g->held[i]) continue;
+        cas_object_writer_abort(g->held[i]);
+        (*failed)++;
+    }
+    return stored;
+}
+
+// Fetch every object in ds[0..n) missing locally, and what it names,
+// through the engine a level at a time: a level's chunk lists and trees
+// are held until the next levels bring in what they name. Each download
+// is verified against its digest. Objects that cannot be fetched or do
+// not verify are counted in *failed; -1 means the remote stopped
+// answering. An object another fetch already has in hand is not asked
+// for twice: this one waits for it (raising it to this one's priority)
+// and only fetches it itself if that fetch failed.
+static int fetch_objects(const Digest *ds, size_t n, RemoteCASPriority prio, size_t *failed) {
+    XferGroup g = { 0 };
+    DigestSet seen = { 0 };
+    DigestList roots = { NULL, 0, 0 }, others = { NULL, 0, 0 }, level = { NULL, 0, 0 };
+    int *have = malloc(n * sizeof(*have) + 1);
+    int rc = have && cas_blobs_exist_batch(ds, (int)n, have) == 0 ? 0 : -1;
+    size_t queued = 0;
+    g.prio = prio;
+    pthread_mutex_lock(&xfer_mu);
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        if (have[i]) continue;
+        Claim **p = claim_slot_locked(&ds[i]);
+        if (*p) {
+            if ((*p)->g == &g) continue; // listed twice
+            if (prio == REMOTE_CAS_URGENT) promote_locked((*p)->g);
+            rc = collect(&ds[i], &others);
+        } else if ((*p = malloc(sizeof(Claim))) == NULL) {
+            rc = -1;
+        } else {
+            **p = (Claim){ ds[i], &g, NULL };
+            rc = collect(&ds[i], &roots);
+        }
+    }
+    pthread_mutex_unlock(&xfer_mu);
+    free(have);
+    for (size_t i = 0; rc == 0 && i < roots.n; ++i) rc = collect(&roots.d[i], &level);
+    while (rc == 0 && level.n > 0) {
+        have = malloc(level.n * sizeof(*have));
+        rc = have && cas_blobs_exist_batch(level.d, (int)level.n, have) == 0 ? 0 : -1;
+        for (size_t i = 0; rc == 0 && i < level.n; ++i) {
+            int added = have[i] ? 0 : set_add(&seen, &level.d[i]);
+            if (added < 0) rc = -1;
+            if (added > 0) xfer_submit(&g, &level.d[i], 0);
+        }
+        free(have);
+        xfer_wait(&g);
+        if (g.broken) rc = -1;
+        // the next level: what the chunk lists and trees just fetched name
+        level.n = 0;
+        for (; rc == 0 && queued < g.n_held; ++queued) {
+            Digest *refs = NULL;
+            size_t nrefs = 0;
+            cas_object_writer_refs(g.held[queued], &refs, &nrefs);
+            for (size_t j = 0; rc == 0 && j < nrefs; ++j) rc = collect(&refs[j], &level);
+            free(refs);
+        }
+    }
+    *failed += g.failed;
+    uint64_t stored = store_held(&g, failed);
+    count(0, 0, 0, 0, stored);
+    // claims on objects an error left unsent
+    pthread_mutex_lock(&xfer_mu);
+    for (size_t i = 0; i < roots.n; ++i) unclaim_locked(&roots.d[i], &g);
+    // what other fetches have in hand: wait for them to let go
+    for (size_t i = 0; i < others.n;) {
+        if (*claim_slot_locked(&others.d[i])) pthread_cond_wait(&done_cv, &xfer_mu);
+        else ++i;
+    }
+    pthread_mutex_unlock(&xfer_mu);
+    if (others.n > 0) {
+        pthread_mutex_lock(&pool_mu);
+        stats.objects_coalesced += others.n;
+        pthread_mutex_unlock(&pool_mu);
+        // anything they could not bring in is tried once more from here
+        if (rc == 0) rc = fetch_objects(others.d, others.n, prio, failed);
+    }
+    free(g.held);
+    free(g.held_d);
+    free(roots.d);
+    free(others.d);
+    free(level.d);
+    free(seen.slots);
+    free(seen.used);
+    return rc;
+}
+
+int remote_cas_fetch_objects(const Digest ds[], size_t n, RemoteCASPriority prio) {
+    if (!g_remote_cas_config.enabled) return -1;
+    if (g_remote_cas_config.backend != REMOTE_CAS_HTTP) {
+        int rc = 0;
+        for (size_t i = 0; i < n; ++i)
+            if (remote_cas_download_object(&ds[i]) != 0) rc = -1;
+        return rc;
+    }
+    size_t failed = 0;
+    return fetch_objects(ds, n, prio, &failed) == 0 && failed == 0 ? 0 : -1;
+}
+
+int remote_cas_download_object(const Digest *d) {
+    if (cas_blob_exists(d)) return 0;
+
+    char hex[DIGEST_HEX_SIZE];
+    digest_to_hex(d, hex);
+    if (g_remote_cas_config.enabled && g_remote_cas_config.backend == REMOTE_CAS_HTTP) {
+        int rc = remote_cas_fetch_objects(d, 1, REMOTE_CAS_URGENT);
+        if (rc != 0) LOG_WARN("Failed to fetch %s from remote CAS", hex);
+        return rc;
+    }
+
+    unsigned char *data = NULL;
+    size_t len = 0;
+    if (remote_cas_retrieve(hex, &data, &len) != 0) return -1;
+
+    Digest *chunks = NULL;
+    size_t n = 0;
+    int rc = cas_parse_object_refs(data, len, &chunks, &n) < 0 ? -1 : 0;
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        rc = remote_cas_download_object(&chunks[i]);
+    }
+    free(chunks);
+
+    // rejects content that does not match the digest
+    if (rc == 0) rc = cas_write_object(d, data, len);
+    if (rc != 0) LOG_WARN("Failed to fetch %s from remote CAS", hex);
+    free(data);
+    return rc;
+}
+
 int remote_cas_sync_to_remote(void) {
     if (!g_remote_cas_config.enabled) return 0;
 
     LOG_INFO("Syncing local CAS to remote...");
-    // Walk local CAS and upload missing blobs
-    return 0;
+    // Chunks are objects of their own, so a walk over all objects sends
+    // each chunk at most once however many files share it.
+    DigestList all = { NULL, 0, 0 };
+    if (cas_for_each_object(collect, &all) != 0) {
+        free(all.d);
+        return -1;
+    }
+    size_t failed = 0;
+    int rc;
+    if (g_remote_cas_config.backend == REMOTE_CAS_HTTP) {
+        rc = upload_objects(all.d, all.n, REMOTE_CAS_BACKGROUND, &failed);
+    } else {
+        for (size_t i = 0; i < all.n; ++i)
+            if (remote_cas_upload_object(&all.d[i]) != 0) failed++;
+        rc = failed ? -1 : 0;
+    }
+    LOG_INFO("Remote sync done: %zu objects checked, %zu failed", all.n, failed);
+    free(all.d);
+    return rc;
 }
 
 int remote_cas_sync_from_remote(void) {
     if (!g_remote_cas_config.enabled) return 0;
+    if (g_remote_cas_config.backend != REMOTE_CAS_HTTP) {
+        LOG_WARN("Remote CAS backend cannot list its objects: %d", g_remote_cas_config.backend);
+        return -1;
+    }
 
     LOG_INFO("Syncing remote CAS to local...");
-    // Download remote blobs not in local
-    return 0;
+    // The remote's digests come a page at a time; each page is checked
+    // against the local store in one batch and only the difference fetched.
+    char prefix[512];
+    HttpConn *c = acquire(g_remote_cas_config.endpoint, prefix, sizeof(prefix));
+    if (!c) return -1;
+    Digest after;
+    size_t listed = 0, failed = 0;
+    int rc = 0;
+    for (;;) {
+        Digest *page;
+        size_t n;
+        rc = list_page(c, prefix, listed ? &after : NULL, &page, &n);
+        if (rc == 0 && n > 0) {
+            listed += n;
+            after = page[n - 1];
+            rc = fetch_objects(page, n, REMOTE_CAS_BACKGROUND, &failed);
+        }
+        free(page);
+        if (rc != 0 || n < FIND_BATCH) break;
+    }
+    release(c);
+    LOG_INFO("Remote sync done: %zu objects listed, %zu failed", listed, failed);
+    return rc == 0 && failed == 0 ? 0 : -1;
+}
+
+/* ---- action cache ---- */
+
+static void record_path(HttpOp *op, const char *method, const char *prefix, const Digest *key) {
+    char path[1024], hex[DIGEST_HEX_SIZE];
+    snprintf(path, sizeof(path), "%s/ac/%s", prefix, digest_to_hex(key, hex));
+    http_op_init(op, method, path);
+}
+
+int remote_cas_get_action(const Digest *key, unsigned char **data, size_t *len) {
+    *data = NULL;
+    *len = 0;
+    if (!g_remote_cas_config.enabled || g_remote_cas_config.backend != REMOTE_CAS_HTTP) return -1;
+    char prefix[512];
+    HttpConn *c = acquire(g_remote_cas_config.endpoint, prefix, sizeof(prefix));
+    if (!c) return -1;
+    Buf b = { NULL, 0, 0 };
+    HttpOp op;
+    record_path(&op, "GET", prefix, key);
+    op.sink = buf_sink;
+    op.reset = buf_reset;
+    op.ctx = &b;
+    int rc = http_pipeline(c, &op, 1);
+    release(c);
+    count(1, 0, 0, 0, 0);
+    if (rc == 0 && op.status == 200) {
+        *data = b.data ? b.data : malloc(1);
+        *len = b.len;
+        return *data ? 1 : -1;
+    }
+    free(b.data);
+    if (rc == 0 && op.status == 404) return 0;
+    LOG_WARN("Fetching a task record from the remote cache failed (status %d)", op.status);
+    return -1;
+}
+
+int remote_cas_put_action(const Digest *key, const unsigned char *data, size_t len) {
+    if (!g_remote_cas_config.enabled || g_remote_cas_config.backend != REMOTE_CAS_HTTP) return -1;
+    char prefix[512];
+    HttpConn *c = acquire(g_remote_cas_config.endpoint, prefix, sizeof(prefix));
+    if (!c) return -1;
+    HttpOp op;
+    record_path(&op, "PUT", prefix, key);
+    op.body = data;
+    op.body_len = len;
+    int rc = http_pipeline(c, &op, 1) == 0 && op.status >= 200 && op.status < 300 ? 0 : -1;
+    release(c);
+    count(1, 0, 0, 0, 0);
+    return rc;
+}
+
+// A record waiting to be published, after the objects it names
+typedef struct Action {
+    Digest key;
+    Digest *objects;
+    size_t n;
+    unsigned char *record;
+    size_t len;
+    struct Action *next;
+} Action;
+
+static pthread_mutex_t action_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t action_cv = PTHREAD_COND_INITIALIZER;
+static Action *action_head = NULL, *action_tail = NULL;
+static pthread_t action_thread;
+static int action_running = 0;
+static int action_stopping = 0;
+
+// Publishes queued records one at a time; the objects go up through the
+// engine in the background, so this thread mostly waits
+static void *action_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&action_mu);
+    for (;;) {
+        while (!action_head && !action_stopping) pthread_cond_wait(&action_cv, &action_mu);
+        Action *a = action_head;
+        if (!a) break; // stopping, and everything queued is out
+        action_head = a->next;
+        if (!action_head) action_tail = NULL;
+        pthread_mutex_unlock(&action_mu);
+        size_t failed = 0;
+        int rc = upload_objects(a->objects, a->n, REMOTE_CAS_BACKGROUND, &failed);
+        if (rc == 0) rc = remote_cas_put_action(&a->key, a->record, a->len);
+        char hex[DIGEST_HEX_SIZE];
+        if (rc != 0) LOG_WARN("Task record %s not published to the remote cache", digest_to_hex(&a->key, hex));
+        free(a->objects);
+        free(a->record);
+        free(a);
+        pthread_mutex_lock(&action_mu);
+    }
+    pthread_mutex_unlock(&action_mu);
+    return NULL;
+}
+
+void remote_cas_put_action_async(const Digest *key, const Digest objects[], size_t n, const unsigned char *data,
+                                 size_t len) {
+    if (!g_remote_cas_config.enabled || g_remote_cas_config.backend != REMOTE_CAS_HTTP) return;
+    Action *a = calloc(1, sizeof(*a));
+    if (a) {
+        a->objects = malloc(n * sizeof(Digest) + 1);
+        a->record = malloc(len + 1);
+    }
+    if (!a || !a->objects || !a->record) {
+        if (a) {
+            free(a->objects);
+            free(a->record);
+        }
+        free(a);
+        return;
+    }
+    a->key = *key;
+    memcpy(a->objects, objects, n * sizeof(Digest));
+    a->n = n;
+    memcpy(a->record, data, len);
+    a->len = len;
+    pthread_mutex_lock(&action_mu);
+    if (!action_running && pthread_create(&action_thread, NULL, action_main, NULL) == 0) action_running = 1;
+    if (!action_running) {
+        pthread_mutex_unlock(&action_mu);
+        free(a->objects);
+        free(a->record);
+        free(a);
+        return;
+    }
+    if (action_tail) action_tail->next = a;
+    else action_head = a;
+    action_tail = a;
+    pthread_cond_signal(&action_cv);
+    pthread_mutex_unlock(&action_mu);
+}
+
+// Publish every queued record, then stop the publisher
+static void action_shutdown(void) {
+    pthread_mutex_lock(&action_mu);
+    int running = action_running;
+    action_stopping = 1;
+    pthread_cond_broadcast(&action_cv);
+    pthread_mutex_unlock(&action_mu);
+    if (running) pthread_join(action_thread, NULL);
+    pthread_mutex_lock(&action_mu);
+    action_running = 0;
+    action_stopping = 0;
+    pthread_mutex_unlock(&action_mu);
+}
+
+void remote_cas_get_stats(RemoteCASStats *out) {
+    pthread_mutex_lock(&pool_mu);
+    *out = stats;
+    pthread_mutex_unlock(&pool_mu);
+}
+
+void remote_cas_print_stats(FILE *out) {
+    RemoteCASStats st;
+    remote_cas_get_stats(&st);
+    if (st.requests == 0) return;
+    fprintf(out, "Remote CAS: %llu requests over %llu connections, %llu objects (%llu bytes) up, "
+                 "%llu objects (%llu bytes) down\n",
+            (unsigned long long)st.requests, (unsigned long long)st.connections,
+            (unsigned long long)st.objects_uploaded, (unsigned long long)st.bytes_uploaded,
+            (unsigned long long)st.objects_downloaded, (unsigned long long)st.bytes_downloaded);
+    if (st.objects_coalesced > 0)
+        fprintf(out, "Remote CAS: %llu fetches joined one already in flight\n",
+                (unsigned long long)st.objects_coalesced);
 }
 
 void remote_cas_cleanup(void) {
-    // Cleanup
+    cas_set_fetch_handler(NULL);
+    action_shutdown();
+    xfer_shutdown();
+    pthread_mutex_lock(&pool_mu);
+    while (n_idle > 0) {
+        HttpConn *c = idle[--n_idle];
+        stats.connections += c->connects;
+        http_close(c);
+        free(c);
+    }
+    pthread_mutex_unlock(&pool_mu);
 }
@@ -2,6 +2,9 @@
 #define REMOTE_CAS_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "digest.h"
 
 // Remote CAS backends
 typedef enum {
@@ -38,27 +41,101 @@ int remote_cas_store(const char *hash, const unsigned char *data, size_t len);
 // Retrieve blob from remote
 int remote_cas_retrieve(const char *hash, unsigned char **data, size_t *len);
 
-// Check if blob exists remotely
+// Check if blob exists remotely (a HEAD request over HTTP)
 int remote_cas_exists(const char *hash);
 
-// Sync local to remote
+// Which of n digests the remote lacks: missing[i] is set to 1 or 0. Over
+// HTTP this is one findMissing request per 16384 digests (pipelined HEADs
+// against a server without it). Returns 0, or -1 if the remote could not
+// answer.
+int remote_cas_find_missing(const Digest d[], size_t n, int missing[]);
+
+// remote_cas_find_missing by hex name: out[i] is 1 if hashes[i] is present
+int remote_cas_exists_batch(const char *const hashes[], int n, int out[]);
+
+// Over HTTP, objects move through a transfer engine: a pool of worker
+// threads, each pipelining requests on its own kept-alive connection,
+// streaming bodies between the socket and the object files so no object
+// is held whole in memory. At most max_inflight_bytes of objects are on
+// the wire at once (a larger one goes alone). Urgent transfers, the
+// outputs a task is about to restore, are taken before background ones
+// and get the first room under the cap.
+typedef enum {
+    REMOTE_CAS_URGENT = 0,
+    REMOTE_CAS_BACKGROUND = 1
+} RemoteCASPriority;
+
+// Engine threads and in-flight byte cap (0 keeps the default: 8 threads,
+// 64 MiB). More threads start on the next transfer; fewer take effect
+// after remote_cas_cleanup.
+void remote_cas_set_transfer_limits(int workers, uint64_t max_inflight_bytes);
+
+// Copy one local object to the remote in its stored form. For a chunked
+// file only the chunks the remote lacks are sent, then the chunk list;
+// a chunk list or tree goes up only after everything it names.
+int remote_cas_upload_object(const Digest *d);
+
+// Fetch one object into the local CAS, fetching only the chunks of a
+// chunked file that are not already stored locally (urgent)
+int remote_cas_download_object(const Digest *d);
+
+// Fetch n objects and everything they name into the local CAS, skipping
+// what is already there, at the given priority. Returns 0 once all are
+// stored, -1 if any could not be fetched or did not verify.
+int remote_cas_fetch_objects(const Digest d[], size_t n, RemoteCASPriority prio);
+
+// Sync local to remote: uploads every local object the remote lacks. The
+// local digests go to the remote in large findMissing batches and only
+// the difference is sent, in the background.
 int remote_cas_sync_to_remote(void);
 
-// Sync remote to local
+// Sync remote to local: fetches every remote object the local store lacks,
+// reading the remote's digests a page at a time (HTTP only), in the
+// background
 int remote_cas_sync_from_remote(void);
 
+// Action cache (HTTP only): task records keyed by task hash, so a
+// machine can reuse results another produced. get returns 1 with the
+// record in *data (caller frees), 0 if the remote has none, -1 on error.
+int remote_cas_get_action(const Digest *task_hash, unsigned char **data, size_t *len);
+int remote_cas_put_action(const Digest *task_hash, const unsigned char *data, size_t len);
+
+// Publish a record without waiting: a background thread uploads the
+// objects it names (and what they name) and then the record, so the
+// remote never serves a record whose outputs it lacks. The arguments are
+// copied. remote_cas_cleanup waits for what is queued.
+void remote_cas_put_action_async(const Digest *task_hash, const Digest objects[], size_t n,
+                                 const unsigned char *data, size_t len);
+
 // Backend-specific implementations
 int remote_cas_http_store(const char *url, const char *hash,
                           const unsigned char *data, size_t len);
 int remote_cas_http_retrieve(const char *url, const char *hash,
                              unsigned char **data, size_t *len);
+int remote_cas_http_exists(const char *url, const char *hash); // 1, 0, or -1 on error
 
 int remote_cas_s3_store(const char *bucket, const char *hash,
                         const unsigned char *data, size_t len);
 int remote_cas_s3_retrieve(const char *bucket, const char *hash,
                            unsigned char **data, size_t *len);
 
-// Cleanup
+// Counters for this process
+typedef struct {
+    uint64_t requests;           // HTTP requests answered
+    uint64_t connections;        // connections opened (kept alive between requests)
+    uint64_t objects_uploaded;
+    uint64_t bytes_uploaded;
+    uint64_t objects_downloaded;
+    uint64_t bytes_downloaded;
+    uint64_t peak_inflight_bytes; // most object bytes the engine had on the wire at once
+    uint64_t objects_coalesced;   // fetches that waited on one of the same object instead
+} RemoteCASStats;
+
+void remote_cas_get_stats(RemoteCASStats *out);
+void remote_cas_print_stats(FILE *out); // nothing when the remote was not used
+
+// Publish queued records, let the engine finish queued transfers, stop
+// it and close pooled connections
 void remote_cas_cleanup(void);
 
 #endif // REMOTE_CAS_H
@@ -0,0 +1,415 @@
+// Reference server for the HTTP remote CAS (remote_cas.h): serves the
+// objects and task records in a directory to any number of clients over
+// HTTP/1.1 with keep-alive and pipelining, one thread per connection.
+//
+//   HEAD /cas/<hex>   200 with Content-Length, or 404
+//   GET  /cas/<hex>   the object
+//   PUT  /cas/<hex>   store it (201), or keep the copy already there (200)
+//   POST /cas:findMissing
+//        the body is raw 32-byte digests; the answer lists, in the same
+//        order, those not stored here
+//   GET  /cas?limit=N[&after=<hex>]
+//        up to N raw digests of stored objects, in ascending order, all
+//        after <hex>; fewer than N means the listing is complete
+//   GET  /ac/<hex>    the task record for that task hash, or 404
+//   PUT  /ac/<hex>    store or replace it (201)
+//
+// Objects are files under <dir>/cas/<2 hex>/<62 hex> and records under
+// <dir>/ac/<2 hex>/<62 hex>; an upload goes to <dir>/tmp first and is
+// renamed into place once synced, so readers never see part of one. Any
+// path prefix before /cas/ or /ac/ is ignored, which lets the server sit
+// behind a proxy that routes on a prefix.
+
+#define _GNU_SOURCE
+#include "http.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEX_LEN 64
+#define DIGEST_LEN 32
+#define MAX_BATCH 65536 // digests per findMissing request or listing page
+
+static char root[4096];
+static unsigned long tmp_seq = 0;
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--bind ADDR] [--port N] <dir>\n"
+            "  --bind ADDR  address to listen on (default: 127.0.0.1)\n"
+            "  --port N     port to listen on, 0 for any free one (default: 8080)\n"
+            "Serves the objects and task records in <dir> (created if missing) as a remote CAS.\n",
+            prog);
+}
+
+static int is_hex(const char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        char ch = p[i];
+        if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f'))) return 0;
+    }
+    return 1;
+}
+
+static void to_hex(const unsigned char *d, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < DIGEST_LEN; ++i) {
+        hex[2 * i] = digits[d[i] >> 4];
+        hex[2 * i + 1] = digits[d[i] & 15];
+    }
+    hex[HEX_LEN] = '\0';
+}
+
+static void from_hex(const char *hex, unsigned char *d) {
+    for (int i = 0; i < DIGEST_LEN; ++i) {
+        char pair[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        d[i] = (unsigned char)strtoul(pair, NULL, 16);
+    }
+}
+
+// Whether the path of a request target (the part before any query) ends
+// with suffix
+static int is_endpoint(const char *target, const char *suffix) {
+    size_t n = strcspn(target, "?#"), m = strlen(suffix);
+    return n >= m && strncmp(target + n - m, suffix, m) == 0;
+}
+
+// The file a request target names under /<space>/<hex> ("cas" for
+// objects, "ac" for task records), or -1 if it names none
+static int named_file(const char *target, const char *space, char *path, size_t sz, char *shard,
+                      size_t shard_sz) {
+    char sep[16];
+    int n = snprintf(sep, sizeof(sep), "/%s/", space);
+    const char *p = NULL;
+    for (const char *q = strstr(target, sep); q; q = strstr(q + 1, sep)) p = q + n;
+    if (!p || strcspn(p, "?#") != HEX_LEN || !is_hex(p, HEX_LEN)) return -1;
+    snprintf(shard, shard_sz, "%s/%s/%.2s", root, space, p);
+    return snprintf(path, sz, "%s/%.62s", shard, p + 2) < (int)sz ? 0 : -1;
+}
+
+static int respond(int fd, int status, const char *reason, uint64_t len, int close_after) {
+    char head[256];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %llu\r\n%s\r\n", status,
+                     reason, (unsigned long long)len, close_after ? "Connection: close\r\n" : "");
+    return http_write_all(fd, head, (size_t)n);
+}
+
+static int write_sink(const unsigned char *data, size_t len, void *ctx) {
+    int fd = *(int *)ctx;
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int serve_get(HttpConn *c, const char *path, int with_body) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        return respond(c->fd, 404, "Not Found", 0, 0);
+    }
+    int rc = respond(c->fd, 200, "OK", (uint64_t)st.st_size, 0);
+    if (rc == 0 && with_body) rc = http_send_file(c->fd, fd, 0, (uint64_t)st.st_size);
+    close(fd);
+    return rc;
+}
+
+// With replace unset, a copy already there wins. Returns -1 when the
+// connection must close: the body was not consumed.
+static int serve_put(HttpConn *c, const HttpHead *h, const char *path, const char *shard, int replace) {
+    if (h->chunked || h->content_length < 0) {
+        respond(c->fd, 411, "Length Required", 0, 1);
+        return -1;
+    }
+    if (!replace && access(path, F_OK) == 0) {
+        // content addressed: the copy already here is as good
+        if (http_read_body(c, h, 0, NULL, NULL) != 0) return -1;
+        return respond(c->fd, 200, "OK", 0, 0);
+    }
+    char tmp[4200];
+    snprintf(tmp, sizeof(tmp), "%s/tmp/%ld.%lu", root, (long)getpid(),
+             __atomic_add_fetch(&tmp_seq, 1, __ATOMIC_RELAXED));
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+    if (fd < 0) {
+        if (http_read_body(c, h, 0, NULL, NULL) != 0) return -1;
+        return respond(c->fd, 500, "Internal Server Error", 0, 0);
+    }
+    int rc = http_read_body(c, h, 0, write_sink, &fd);
+    int stored = rc == 0 && fsync(fd) == 0;
+    close(fd);
+    if (stored) {
+        mkdir(shard, 0755);
+        stored = rename(tmp, path) == 0;
+    }
+    if (!stored) unlink(tmp);
+    if (rc != 0) {
+        // a short body or a full disk mid-body: the stream is out of step
+        respond(c->fd, 500, "Internal Server Error", 0, 1);
+        return -1;
+    }
+    if (!stored) return respond(c->fd, 500, "Internal Server Error", 0, 0);
+    return respond(c->fd, 201, "Created", 0, 0);
+}
+
+static int append_sink(const unsigned char *data, size_t len, void *ctx) {
+    unsigned char **p = ctx;
+    memcpy(*p, data, len);
+    *p += len;
+    return 0;
+}
+
+static int serve_find_missing(HttpConn *c, const HttpHead *h) {
+    if (h->chunked || h->content_length < 0) {
+        respond(c->fd, 411, "Length Required", 0, 1);
+        return -1;
+    }
+    uint64_t len = (uint64_t)h->content_length;
+    if (len % DIGEST_LEN != 0 || len > (uint64_t)MAX_BATCH * DIGEST_LEN) {
+        if (http_read_body(c, h, 0, NULL, NULL) != 0) return -1;
+        return respond(c->fd, 413, "Payload Too Large", 0, 0);
+    }
+    unsigned char *in = malloc(len + 1), *out = malloc(len + 1), *end = in;
+    if (!in || !out || http_read_body(c, h, 0, append_sink, &end) != 0) {
+        free(in);
+        free(out);
+        respond(c->fd, 500, "Internal Server Error", 0, 1);
+        return -1;
+    }
+    size_t n_out = 0;
+    for (uint64_t i = 0; i < len; i += DIGEST_LEN) {
+        char hex[HEX_LEN + 1], path[4200];
+        to_hex(in + i, hex);
+        snprintf(path, sizeof(path), "%s/cas/%.2s/%s", root, hex, hex + 2);
+        if (access(path, F_OK) != 0) {
+            memcpy(out + n_out, in + i, DIGEST_LEN);
+            n_out += DIGEST_LEN;
+        }
+    }
+    int rc = respond(c->fd, 200, "OK", n_out, 0);
+    if (rc == 0) rc = http_write_all(c->fd, out, n_out);
+    free(in);
+    free(out);
+    return rc;
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Value of key in the query string of target, into out; 0 if present
+static int query_param(const char *target, const char *key, char *out, size_t sz) {
+    const char *q = strchr(target, '?');
+    size_t klen = strlen(key);
+    while (q) {
+        q++;
+        if (strncmp(q, key, klen) == 0 && q[klen] == '=') {
+            size_t n = strcspn(q + klen + 1, "&#");
+            if (n >= sz) return -1;
+            memcpy(out, q + klen + 1, n);
+            out[n] = '\0';
+            return 0;
+        }
+        q = strchr(q, '&');
+    }
+    return -1;
+}
+
+static int serve_list(HttpConn *c, const char *target) {
+    char value[128], after[HEX_LEN + 1] = "";
+    long limit = query_param(target, "limit", value, sizeof(value)) == 0 ? atol(value) : 1000;
+    if (limit <= 0 || limit > MAX_BATCH) limit = MAX_BATCH;
+    if (query_param(target, "after", value, sizeof(value)) == 0) {
+        if (strlen(value) != HEX_LEN || !is_hex(value, HEX_LEN)) return respond(c->fd, 400, "Bad Request", 0, 0);
+        memcpy(after, value, sizeof(after));
+    }
+    unsigned char *out = malloc((size_t)limit * DIGEST_LEN);
+    if (!out) return respond(c->fd, 500, "Internal Server Error", 0, 0);
+    long n = 0;
+    unsigned char start[DIGEST_LEN] = { 0 };
+    if (after[0]) from_hex(after, start);
+    for (int shard = start[0]; shard < 256 && n < limit; ++shard) {
+        char dir[4200];
+        snprintf(dir, sizeof(dir), "%s/cas/%02x", root, shard);
+        DIR *dp = opendir(dir);
+        if (!dp) continue;
+        char **names = NULL;
+        size_t count = 0, cap = 0;
+        struct dirent *e;
+        while ((e = readdir(dp))) {
+            if (strlen(e->d_name) != HEX_LEN - 2 || !is_hex(e->d_name, HEX_LEN - 2)) continue;
+            if (count == cap) {
+                cap = cap ? cap * 2 : 256;
+                char **p = realloc(names, cap * sizeof(*names));
+                if (!p) break;
+                names = p;
+            }
+            names[count] = strdup(e->d_name);
+            if (names[count]) count++;
+        }
+        closedir(dp);
+        qsort(names, count, sizeof(*names), cmp_names);
+        for (size_t i = 0; i < count; ++i) {
+            char hex[HEX_LEN + 1];
+            snprintf(hex, sizeof(hex), "%02x%s", shard, names[i]);
+            if (n < limit && strcmp(hex, after) > 0) from_hex(hex, out + DIGEST_LEN * n++);
+            free(names[i]);
+        }
+        free(names);
+    }
+    int rc = respond(c->fd, 200, "OK", (uint64_t)n * DIGEST_LEN, 0);
+    if (rc == 0) rc = http_write_all(c->fd, out, (size_t)n * DIGEST_LEN);
+    free(out);
+    return rc;
+}
+
+static int handle(HttpConn *c, const HttpHead *h) {
+    const char *method = h->start[0];
+    if (strcmp(method, "POST") == 0 && is_endpoint(h->start[1], "/cas:findMissing"))
+        return serve_find_missing(c, h);
+    if (strcmp(method, "GET") == 0 && is_endpoint(h->start[1], "/cas")) return serve_list(c, h->start[1]);
+    char path[4200], shard[4200];
+    int named = named_file(h->start[1], "cas", path, sizeof(path), shard, sizeof(shard)) == 0;
+    // a record is named by its task, not its content: a newer one replaces it
+    int record = !named && named_file(h->start[1], "ac", path, sizeof(path), shard, sizeof(shard)) == 0;
+    named = named || record;
+    if (named && strcmp(method, "HEAD") == 0) return serve_get(c, path, 0);
+    if (named && strcmp(method, "GET") == 0) return serve_get(c, path, 1);
+    if (named && strcmp(method, "PUT") == 0) return serve_put(c, h, path, shard, record);
+    // anything else: drop its body and refuse
+    if (h->chunked || http_read_body(c, h, 0, NULL, NULL) != 0) {
+        respond(c->fd, 400, "Bad Request", 0, 1);
+        return -1;
+    }
+    if (!named) return respond(c->fd, 404, "Not Found", 0, 0);
+    return respond(c->fd, 405, "Method Not Allowed", 0, 0);
+}
+
+static void *serve_connection(void *arg) {
+    HttpConn *c = arg;
+    for (;;) {
+        HttpHead h;
+        // end of stream, an idle timeout or garbage: just hang up, the
+        // client retries what it had in flight
+        if (http_read_head(c, &h, 0) != 0) break;
+        if (handle(c, &h) != 0 || h.close) break;
+    }
+    http_close(c);
+    free(c);
+    return NULL;
+}
+
+static int listen_on(const char *addr, const char *port) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(addr, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", addr, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 128) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) perror("listen");
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    const char *bind_addr = "127.0.0.1", *port = "8080", *dir = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc) {
+            bind_addr = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = argv[++i];
+        } else if (argv[i][0] != '-' && !dir) {
+            dir = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!dir) {
+        usage(argv[0]);
+        return 1;
+    }
+    snprintf(root, sizeof(root), "%s", dir);
+    char sub[4200];
+    mkdir(root, 0755);
+    snprintf(sub, sizeof(sub), "%s/cas", root);
+    mkdir(sub, 0755);
+    snprintf(sub, sizeof(sub), "%s/ac", root);
+    mkdir(sub, 0755);
+    snprintf(sub, sizeof(sub), "%s/tmp", root);
+    mkdir(sub, 0755);
+    if (access(sub, W_OK) != 0) {
+        perror(sub);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int lfd = listen_on(bind_addr, port);
+    if (lfd < 0) return 1;
+    struct sockaddr_storage ss;
+    socklen_t slen = sizeof(ss);
+    char host[256], serv[32];
+    if (getsockname(lfd, (struct sockaddr *)&ss, &slen) != 0 ||
+        getnameinfo((struct sockaddr *)&ss, slen, host, sizeof(host), serv, sizeof(serv),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        perror("getsockname");
+        return 1;
+    }
+    // the port line is what scripts read when they ask for port 0
+    printf("Serving %s on http://%s:%s\n", root, host, serv);
+    fflush(stdout);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                if (errno == EMFILE || errno == ENFILE) usleep(10000);
+                continue;
+            }
+            perror("accept");
+            return 1;
+        }
+        HttpConn *c = malloc(sizeof(*c));
+        pthread_t th;
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        http_attach(c, fd);
+        if (pthread_create(&th, &attr, serve_connection, c) != 0) {
+            http_close(c);
+            free(c);
+        }
+    }
+}
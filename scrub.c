@@ -0,0 +1,208 @@
+// scrub.c
+#define _GNU_SOURCE
+#include "scrub.h"
+#include "cas.h"
+#include "gc.h"
+#include "hash_pool.h"
+#include "rate_limiter.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATE_FILE "scrub.state"
+#define SCRUB_BATCH 64        // objects verified together on the hash pool
+#define CHECKPOINT_INTERVAL 1 // seconds between checkpoints
+
+typedef struct {
+    Digest cursor;
+    int have_cursor;
+    uint64_t objects, bytes, corrupt;
+    int64_t started;
+} ScrubState;
+
+static void cache_path(const char *name, char *out, size_t sz) {
+    snprintf(out, sz, "%s/%s", cas_get_cache_root(), name);
+}
+
+static void load_state(ScrubState *s) {
+    char path[1200], key[32], val[128];
+    memset(s, 0, sizeof(*s));
+    cache_path(STATE_FILE, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    while (fscanf(f, "%31s %127s", key, val) == 2) {
+        if (strcmp(key, "cursor") == 0) s->have_cursor = digest_from_hex(val, &s->cursor) == 0;
+        else if (strcmp(key, "objects") == 0) s->objects = strtoull(val, NULL, 10);
+        else if (strcmp(key, "bytes") == 0) s->bytes = strtoull(val, NULL, 10);
+        else if (strcmp(key, "corrupt") == 0) s->corrupt = strtoull(val, NULL, 10);
+        else if (strcmp(key, "started") == 0) s->started = strtoll(val, NULL, 10);
+    }
+    fclose(f);
+}
+
+static int save_state(const ScrubState *s) {
+    char path[1200], tmp[1300], hex[DIGEST_HEX_SIZE];
+    cache_path(STATE_FILE, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    fprintf(f, "cursor %s\nobjects %llu\nbytes %llu\ncorrupt %llu\nstarted %lld\n", digest_to_hex(&s->cursor, hex),
+            (unsigned long long)s->objects, (unsigned long long)s->bytes, (unsigned long long)s->corrupt,
+            (long long)s->started);
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    Digest *d;
+    size_t n, cap;
+    int failed;
+} DigestList;
+
+static int collect(const Digest *d, void *arg) {
+    DigestList *l = arg;
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 1024;
+        Digest *grown = realloc(l->d, sizeof(Digest) * cap);
+        if (!grown) return (l->failed = 1);
+        l->d = grown;
+        l->cap = cap;
+    }
+    l->d[l->n++] = *d;
+    return 0;
+}
+
+// The objects of shard b after the cursor, sorted, each once (a repack can
+// show one both loose and packed)
+static int list_shard(int b, const ScrubState *s, DigestList *l) {
+    l->n = 0;
+    if (cas_for_each_object_in_shard(b, collect, l) != 0 || l->failed) return -1;
+    size_t got = l->n;
+    qsort(l->d, got, sizeof(Digest), digest_qsort_cmp);
+    l->n = 0;
+    for (size_t i = 0; i < got; ++i) {
+        if (s->have_cursor && digest_cmp(&l->d[i], &s->cursor) <= 0) continue;
+        if (l->n > 0 && digest_eq(&l->d[l->n - 1], &l->d[i])) continue;
+        l->d[l->n++] = l->d[i];
+    }
+    return 0;
+}
+
+typedef struct {
+    const Digest *d;
+    int result[SCRUB_BATCH];
+    uint64_t bytes[SCRUB_BATCH];
+} VerifyJob;
+
+static void verify_one(void *arg, int i) {
+    VerifyJob *j = arg;
+    j->result[i] = cas_verify_object(&j->d[i], &j->bytes[i]);
+}
+
+// Charge bytes read to the limiter, in pieces it can grant
+static void throttle(RateLimiter *lim, uint64_t bytes) {
+    while (lim && bytes > 0) {
+        uint64_t piece = bytes < lim->capacity ? bytes : lim->capacity;
+        if (rate_limiter_wait(lim, piece, 10000) != 0) return;
+        bytes -= piece;
+    }
+}
+
+int scrub_run(const ScrubOptions *opts, ScrubStats *stats) {
+    ScrubStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    char path[1200];
+    cache_path("scrub.lock", path, sizeof(path));
+    int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0) return -1;
+    if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        close(lock);
+        return 1;
+    }
+    ScrubState st;
+    load_state(&st);
+    if (opts->restart) memset(&st, 0, sizeof(st));
+    stats->resumed = st.have_cursor;
+    if (st.started == 0) st.started = (int64_t)time(NULL);
+    // finish a quarantine that was interrupted
+    uint64_t removed = 0;
+    int rc = gc_quarantine(NULL, 0, &removed);
+    stats->records_invalidated += removed;
+
+    // a bucket of one second's worth: bursts stay short
+    uint64_t rate = opts->max_bytes_per_sec;
+    RateLimiter *lim = rate ? rate_limiter_create(rate, rate) : NULL;
+    time_t begin = time(NULL), saved = begin;
+    DigestList list = { NULL, 0, 0, 0 };
+    VerifyJob job;
+    int stopped = 0;
+    for (int b = st.have_cursor ? st.cursor.b[0] : 0; rc == 0 && !stopped && b < 256; ++b) {
+        if (list_shard(b, &st, &list) != 0) {
+            rc = -1;
+            break;
+        }
+        for (size_t i = 0; i < list.n; i += SCRUB_BATCH) {
+            if (opts->max_seconds > 0 && time(NULL) - begin >= opts->max_seconds) {
+                stopped = 1;
+                break;
+            }
+            int k = list.n - i < SCRUB_BATCH ? (int)(list.n - i) : SCRUB_BATCH;
+            job.d = list.d + i;
+            hash_pool_run(k, verify_one, &job);
+            Digest bad[SCRUB_BATCH];
+            size_t n_bad = 0;
+            uint64_t bytes = 0, verified = 0;
+            for (int j = 0; j < k; ++j) {
+                bytes += job.bytes[j];
+                if (job.result[j] < 0) {
+                    stats->vanished++;
+                    continue;
+                }
+                verified++;
+                if (job.result[j] == 1) bad[n_bad++] = job.d[j];
+            }
+            // the cursor only passes corrupt objects once they are quarantined
+            if (n_bad > 0 && gc_quarantine(bad, n_bad, &removed) != 0) {
+                rc = -1;
+                break;
+            }
+            stats->records_invalidated += n_bad > 0 ? removed : 0;
+            stats->objects += verified;
+            stats->bytes += bytes;
+            stats->corrupt += n_bad;
+            st.objects += verified;
+            st.bytes += bytes;
+            st.corrupt += n_bad;
+            st.cursor = job.d[k - 1];
+            st.have_cursor = 1;
+            throttle(lim, bytes);
+            if (time(NULL) - saved >= CHECKPOINT_INTERVAL) {
+                save_state(&st);
+                saved = time(NULL);
+            }
+        }
+    }
+    if (rc == 0 && !stopped) {
+        cache_path(STATE_FILE, path, sizeof(path));
+        unlink(path);
+        stats->complete = 1;
+    } else if (st.have_cursor && save_state(&st) != 0) {
+        rc = -1;
+    }
+    stats->pass_objects = st.objects;
+    stats->pass_bytes = st.bytes;
+    stats->pass_corrupt = st.corrupt;
+    free(list.d);
+    if (lim) rate_limiter_free(lim);
+    close(lock);
+    return rc;
+}
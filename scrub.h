@@ -0,0 +1,47 @@
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include <stdint.h>
+
+/*
+ * Store scrubbing: every object, loose and packed, is read back and rehashed
+ * on the hash pool, and any whose content no longer matches its name is
+ * quarantined along with the records that need it (gc_quarantine), so the
+ * next build stores it again instead of restoring damage.
+ *
+ * Objects are visited in digest order, a shard at a time, and the position
+ * reached is checkpointed in scrub.state in the cache root:
+ *   cursor <hex>   last digest verified
+ *   objects <n>    verified since the pass began
+ *   bytes <n>
+ *   corrupt <n>
+ *   started <unix seconds>
+ * A scrub that stops (time limit, crash, Ctrl-C) resumes there next time; a
+ * pass that reaches the end removes the file. Reading can be throttled to a
+ * byte rate, so a large store can be scrubbed a little every night.
+ */
+
+typedef struct {
+    uint64_t max_bytes_per_sec; // 0 = unthrottled
+    int64_t max_seconds;        // stop (and checkpoint) after this long; 0 = no limit
+    int restart;                // ignore the checkpoint and start a new pass
+} ScrubOptions;
+
+typedef struct {
+    uint64_t objects;             // verified by this run
+    uint64_t bytes;
+    uint64_t corrupt;             // found by this run
+    uint64_t vanished;            // deleted (gc, repack) before they were read
+    uint64_t records_invalidated; // records deleted because they needed a corrupt object
+    uint64_t pass_objects;        // verified since the pass began, this run included
+    uint64_t pass_bytes;
+    uint64_t pass_corrupt;
+    int resumed;                  // continued a checkpointed pass
+    int complete;                 // reached the end of the store
+} ScrubStats;
+
+// Scrub the store set up by cas_init. Returns 0 on success (whether or not
+// anything was corrupt), 1 if another scrub is running, -1 on error.
+int scrub_run(const ScrubOptions *opts, ScrubStats *stats);
+
+#endif // SCRUB_H
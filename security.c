@@ -1,9 +1,12 @@
+#define _DEFAULT_SOURCE
 #include "security.h"
 #include "logger.h"
 #include "error_handling.h"
+#include "cas.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -279,8 +282,15 @@ int verify_file_checksum(const char *filepath, const char *expected_hash) {
         return -1;
     }
 
-    // This would integrate with the CAS hashing functionality
-    // For now, just validate the hash format
-    LOG_DEBUG("Checksum verification for %s (expected: %s)", filepath, expected_hash);
+    char actual[65];
+    if (cas_hash_of_file(filepath, actual) != 0) {
+        LOG_ERROR("Cannot hash %s for checksum verification", filepath);
+        return -1;
+    }
+    if (strcasecmp(actual, expected_hash) != 0) {
+        LOG_WARN("Checksum mismatch for %s: expected %s, got %s", filepath, expected_hash, actual);
+        return -1;
+    }
+    LOG_DEBUG("Checksum verified for %s", filepath);
     return 0;
 }
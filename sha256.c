@@ -0,0 +1,652 @@
+// sha256.c
+#define _POSIX_C_SOURCE 200809L
+#include "sha256.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/*
+ * SHA-256 (FIPS PUB 180-4) with pluggable block kernels.
+ *
+ * All backends implement the same contract: consume whole 64-byte blocks and
+ * update the eight-word state. Buffering, padding and length encoding live in
+ * the shared update/final code below, so a backend is only the compression
+ * function. The portable kernel is always available and is the reference the
+ * accelerated kernels are checked against before they are used.
+ */
+
+static const uint32_t k[64] = {
+    0x428a2f98ul,0x71374491ul,0xb5c0fbcful,0xe9b5dba5ul,0x3956c25bul,0x59f111f1ul,0x923f82a4ul,0xab1c5ed5ul,
+    0xd807aa98ul,0x12835b01ul,0x243185beul,0x550c7dc3ul,0x72be5d74ul,0x80deb1feul,0x9bdc06a7ul,0xc19bf174ul,
+    0xe49b69c1ul,0xefbe4786ul,0x0fc19dc6ul,0x240ca1ccul,0x2de92c6ful,0x4a7484aaul,0x5cb0a9dcul,0x76f988daul,
+    0x983e5152ul,0xa831c66dul,0xb00327c8ul,0xbf597fc7ul,0xc6e00bf3ul,0xd5a79147ul,0x06ca6351ul,0x14292967ul,
+    0x27b70a85ul,0x2e1b2138ul,0x4d2c6dfcul,0x53380d13ul,0x650a7354ul,0x766a0abbul,0x81c2c92eul,0x92722c85ul,
+    0xa2bfe8a1ul,0xa81a664bul,0xc24b8b70ul,0xc76c51a3ul,0xd192e819ul,0xd6990624ul,0xf40e3585ul,0x106aa070ul,
+    0x19a4c116ul,0x1e376c08ul,0x2748774cul,0x34b0bcb5ul,0x391c0cb3ul,0x4ed8aa4aul,0x5b9cca4ful,0x682e6ff3ul,
+    0x748f82eeul,0x78a5636ful,0x84c87814ul,0x8cc70208ul,0x90befffaul,0xa4506cebul,0xbef9a3f7ul,0xc67178f2ul
+};
+
+static inline uint32_t rotr(uint32_t x, uint32_t n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+#define S0(a) (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22))
+#define S1(e) (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25))
+#define CH(e, f, g) (((e) & (f)) ^ (~(e) & (g)))
+#define MAJ(a, b, c) (((a) & (b)) ^ ((a) & (c)) ^ ((b) & (c)))
+
+// 64 rounds over a precomputed W[i] + K[i] schedule
+static inline void sha256_rounds(uint32_t state[8], const uint32_t wk[64]) {
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t temp1 = h + S1(e) + CH(e, f, g) + wk[i];
+        uint32_t temp2 = S0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void sha256_blocks_generic(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    uint32_t m[64];
+    while (nblocks--) {
+        for (int i = 0; i < 16; ++i)
+            m[i] = ((uint32_t)data[i*4] << 24) | ((uint32_t)data[i*4+1] << 16) |
+                   ((uint32_t)data[i*4+2] << 8) | ((uint32_t)data[i*4+3]);
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(m[i-15], 7) ^ rotr(m[i-15], 18) ^ (m[i-15] >> 3);
+            uint32_t s1 = rotr(m[i-2], 17) ^ rotr(m[i-2], 19) ^ (m[i-2] >> 10);
+            m[i] = m[i-16] + s0 + m[i-7] + s1;
+        }
+        for (int i = 0; i < 64; ++i) m[i] += k[i];
+        sha256_rounds(state, m);
+        data += SHA256_BLOCK_SIZE;
+    }
+}
+
+static int available_always(void) { return 1; }
+
+#ifdef SHA256_X86
+
+static int cpu_os_saves_ymm(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!(ecx & (1u << 27))) return 0; // OSXSAVE
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    (void)xcr0_hi;
+    return (xcr0_lo & 0x6) == 0x6;
+}
+
+static int available_avx2(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!cpu_os_saves_ymm()) return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx & (1u << 5)) && (ebx & (1u << 8)); // AVX2 + BMI2
+}
+
+static int available_shani(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!(ecx & (1u << 9)) || !(ecx & (1u << 19))) return 0; // SSSE3 + SSE4.1
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx & (1u << 29)) != 0; // SHA
+}
+
+/*
+ * AVX2 kernel: two blocks per iteration, one per 128-bit lane. The message
+ * schedule for both blocks is computed four words at a time in the vector
+ * unit (the sigma1 dependency on W[t-2] is resolved in two halves); the
+ * rounds then run in scalar registers, where BMI2 gives us rorx.
+ */
+#define AVX2_TARGET __attribute__((target("avx2,bmi2")))
+
+AVX2_TARGET static inline __m256i avx2_ror(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+AVX2_TARGET static inline __m256i avx2_sigma0(__m256i x) {
+    return _mm256_xor_si256(_mm256_xor_si256(avx2_ror(x, 7), avx2_ror(x, 18)), _mm256_srli_epi32(x, 3));
+}
+
+AVX2_TARGET static inline __m256i avx2_sigma1(__m256i x) {
+    return _mm256_xor_si256(_mm256_xor_si256(avx2_ror(x, 17), avx2_ror(x, 19)), _mm256_srli_epi32(x, 10));
+}
+
+AVX2_TARGET static void sha256_blocks_avx2(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                          12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    const __m256i keep_lo = _mm256_set_epi32(0, 0, -1, -1, 0, 0, -1, -1);
+    const __m256i keep_hi = _mm256_set_epi32(-1, -1, 0, 0, -1, -1, 0, 0);
+    uint32_t wk[2][64] __attribute__((aligned(32)));
+
+    while (nblocks > 0) {
+        const uint8_t *a = data;
+        const uint8_t *b = nblocks > 1 ? data + SHA256_BLOCK_SIZE : data;
+        __m256i x[4];
+        for (int i = 0; i < 4; ++i) {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(a + 16 * i));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(b + 16 * i));
+            x[i] = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), bswap);
+        }
+        for (int t = 0; t < 64; t += 4) {
+            __m256i w = x[(t / 4) & 3];
+            if (t >= 16) {
+                __m256i x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3];
+                __m256i w15 = _mm256_alignr_epi8(x1, x0, 4);
+                __m256i w7 = _mm256_alignr_epi8(x3, x2, 4);
+                __m256i tmp = _mm256_add_epi32(_mm256_add_epi32(x0, avx2_sigma0(w15)), w7);
+                __m256i w2 = _mm256_shuffle_epi32(x3, 0xFE);
+                w = _mm256_add_epi32(tmp, _mm256_and_si256(avx2_sigma1(w2), keep_lo));
+                w2 = _mm256_shuffle_epi32(w, 0x40);
+                w = _mm256_add_epi32(w, _mm256_and_si256(avx2_sigma1(w2), keep_hi));
+                x[0] = x1;
+                x[1] = x2;
+                x[2] = x3;
+                x[3] = w;
+            }
+            __m128i kk = _mm_loadu_si128((const __m128i *)&k[t]);
+            __m256i sum = _mm256_add_epi32(w, _mm256_broadcastsi128_si256(kk));
+            _mm_store_si128((__m128i *)&wk[0][t], _mm256_castsi256_si128(sum));
+            _mm_store_si128((__m128i *)&wk[1][t], _mm256_extracti128_si256(sum, 1));
+        }
+        sha256_rounds(state, wk[0]);
+        if (nblocks > 1) {
+            sha256_rounds(state, wk[1]);
+            data += 2 * SHA256_BLOCK_SIZE;
+            nblocks -= 2;
+        } else {
+            data += SHA256_BLOCK_SIZE;
+            nblocks -= 1;
+        }
+    }
+}
+
+/*
+ * SHA-NI kernel. The state is kept as ABEF/CDGH as the sha256rnds2
+ * instruction expects; each quad of rounds also advances the message
+ * schedule with sha256msg1/sha256msg2.
+ */
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+// Four rounds with message quad `cur`; `prv`/`nxt` are the neighbouring quads
+#define SHANI_QUAD(cur, prv, nxt, t, do_msg2, do_msg1)                           \
+    do {                                                                          \
+        msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i *)&k[t]));        \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                      \
+        if (do_msg2) {                                                            \
+            tmp = _mm_alignr_epi8(cur, prv, 4);                                   \
+            nxt = _mm_add_epi32(nxt, tmp);                                        \
+            nxt = _mm_sha256msg2_epu32(nxt, cur);                                 \
+        }                                                                         \
+        msg = _mm_shuffle_epi32(msg, 0x0E);                                       \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                      \
+        if (do_msg1) prv = _mm_sha256msg1_epu32(prv, cur);                        \
+    } while (0)
+
+SHANI_TARGET static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, msg, tmp, m0, m1, m2, m3, abef_save, cdgh_save;
+
+    tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);          // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);    // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);    // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+
+    while (nblocks--) {
+        abef_save = state0;
+        cdgh_save = state1;
+
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), bswap);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+
+        SHANI_QUAD(m0, m3, m1,  0, 0, 0);
+        SHANI_QUAD(m1, m0, m2,  4, 0, 1);
+        SHANI_QUAD(m2, m1, m3,  8, 0, 1);
+        SHANI_QUAD(m3, m2, m0, 12, 1, 1);
+        SHANI_QUAD(m0, m3, m1, 16, 1, 1);
+        SHANI_QUAD(m1, m0, m2, 20, 1, 1);
+        SHANI_QUAD(m2, m1, m3, 24, 1, 1);
+        SHANI_QUAD(m3, m2, m0, 28, 1, 1);
+        SHANI_QUAD(m0, m3, m1, 32, 1, 1);
+        SHANI_QUAD(m1, m0, m2, 36, 1, 1);
+        SHANI_QUAD(m2, m1, m3, 40, 1, 1);
+        SHANI_QUAD(m3, m2, m0, 44, 1, 1);
+        SHANI_QUAD(m0, m3, m1, 48, 1, 1);
+        SHANI_QUAD(m1, m0, m2, 52, 1, 0);
+        SHANI_QUAD(m2, m1, m3, 56, 1, 0);
+        SHANI_QUAD(m3, m2, m0, 60, 0, 0);
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        data += SHA256_BLOCK_SIZE;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);       // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);    // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0); // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);    // ABEF
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+/*
+ * Multi-buffer AVX2 kernel: eight independent messages, one per 32-bit lane.
+ * Every vector op advances all eight streams, so short messages (where a
+ * single stream is dominated by the serial round chain) hash at close to
+ * eight times the single-stream rate. State is word-major: st[word][lane].
+ */
+AVX2_TARGET static inline __m256i x8_load_words(const uint8_t *const blocks[8], int t) {
+    uint32_t v[8];
+    for (int l = 0; l < 8; ++l) {
+        uint32_t w;
+        memcpy(&w, blocks[l] + 4 * t, 4);
+        v[l] = __builtin_bswap32(w);
+    }
+    return _mm256_loadu_si256((const __m256i *)v);
+}
+
+AVX2_TARGET static void sha256_x8_avx2(uint32_t st[8][8], const uint8_t *const blocks[8]) {
+    __m256i w[16];
+    for (int t = 0; t < 16; ++t) w[t] = x8_load_words(blocks, t);
+
+    __m256i a = _mm256_loadu_si256((const __m256i *)st[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i *)st[1]);
+    __m256i c = _mm256_loadu_si256((const __m256i *)st[2]);
+    __m256i d = _mm256_loadu_si256((const __m256i *)st[3]);
+    __m256i e = _mm256_loadu_si256((const __m256i *)st[4]);
+    __m256i f = _mm256_loadu_si256((const __m256i *)st[5]);
+    __m256i g = _mm256_loadu_si256((const __m256i *)st[6]);
+    __m256i h = _mm256_loadu_si256((const __m256i *)st[7]);
+
+    for (int t = 0; t < 64; ++t) {
+        if (t >= 16) {
+            w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(avx2_sigma1(w[(t - 2) & 15]), w[(t - 7) & 15]),
+                                         _mm256_add_epi32(avx2_sigma0(w[(t - 15) & 15]), w[t & 15]));
+        }
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(avx2_ror(e, 6), avx2_ror(e, 11)), avx2_ror(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(h, s1),
+                                         _mm256_add_epi32(_mm256_add_epi32(ch, w[t & 15]),
+                                                          _mm256_set1_epi32((int)k[t])));
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(avx2_ror(a, 2), avx2_ror(a, 13)), avx2_ror(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i temp2 = _mm256_add_epi32(s0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, temp1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(temp1, temp2);
+    }
+
+    __m256i *out = (__m256i *)st;
+    _mm256_storeu_si256(out + 0, _mm256_add_epi32(_mm256_loadu_si256(out + 0), a));
+    _mm256_storeu_si256(out + 1, _mm256_add_epi32(_mm256_loadu_si256(out + 1), b));
+    _mm256_storeu_si256(out + 2, _mm256_add_epi32(_mm256_loadu_si256(out + 2), c));
+    _mm256_storeu_si256(out + 3, _mm256_add_epi32(_mm256_loadu_si256(out + 3), d));
+    _mm256_storeu_si256(out + 4, _mm256_add_epi32(_mm256_loadu_si256(out + 4), e));
+    _mm256_storeu_si256(out + 5, _mm256_add_epi32(_mm256_loadu_si256(out + 5), f));
+    _mm256_storeu_si256(out + 6, _mm256_add_epi32(_mm256_loadu_si256(out + 6), g));
+    _mm256_storeu_si256(out + 7, _mm256_add_epi32(_mm256_loadu_si256(out + 7), h));
+}
+
+#endif // SHA256_X86
+
+// Ordered fastest first; the first available backend that passes the self-test wins
+static const Sha256Backend backends[] = {
+#ifdef SHA256_X86
+    { "shani", sha256_blocks_shani, available_shani },
+    { "avx2", sha256_blocks_avx2, available_avx2 },
+#endif
+    { "generic", sha256_blocks_generic, available_always },
+};
+#define N_BACKENDS ((int)(sizeof(backends) / sizeof(backends[0])))
+
+// Read by every hashing thread; sha256_set_backend may replace it at any time
+static const Sha256Backend *active_backend = NULL;
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+
+static void select_backend(void) {
+    const char *forced = getenv("REPROVM_SHA256_BACKEND");
+    for (int i = 0; i < N_BACKENDS; ++i) {
+        const Sha256Backend *b = &backends[i];
+        if (forced && *forced && strcmp(forced, b->name) != 0) continue;
+        if (!b->available() || sha256_self_test(b) != 0) continue;
+        __atomic_store_n(&active_backend, b, __ATOMIC_RELEASE);
+        return;
+    }
+    __atomic_store_n(&active_backend, &backends[N_BACKENDS - 1], __ATOMIC_RELEASE);
+}
+
+static const Sha256Backend *get_backend(void) {
+    pthread_once(&backend_once, select_backend);
+    return __atomic_load_n(&active_backend, __ATOMIC_ACQUIRE);
+}
+
+const char *sha256_backend_name(void) {
+    return get_backend()->name;
+}
+
+int sha256_set_backend(const char *name) {
+    if (!name) return -1;
+    get_backend();
+    for (int i = 0; i < N_BACKENDS; ++i) {
+        if (strcmp(backends[i].name, name) == 0) {
+            if (!backends[i].available()) return -1;
+            __atomic_store_n(&active_backend, &backends[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const Sha256Backend *sha256_backends(int *out_n) {
+    if (out_n) *out_n = N_BACKENDS;
+    return backends;
+}
+
+static void ctx_update(sha256_blocks_fn blocks, SHA256_CTX *ctx, const uint8_t *data, size_t len) {
+    // Top up a partially filled block first
+    if (ctx->datalen > 0) {
+        size_t take = SHA256_BLOCK_SIZE - ctx->datalen;
+        if (take > len) take = len;
+        memcpy(ctx->data + ctx->datalen, data, take);
+        ctx->datalen += take;
+        data += take;
+        len -= take;
+        if (ctx->datalen < SHA256_BLOCK_SIZE) return;
+        blocks(ctx->state, ctx->data, 1);
+        ctx->bitlen += 512;
+        ctx->datalen = 0;
+    }
+    // Whole blocks straight from the caller's buffer
+    size_t nblocks = len / SHA256_BLOCK_SIZE;
+    if (nblocks > 0) {
+        blocks(ctx->state, data, nblocks);
+        ctx->bitlen += (uint64_t)nblocks * 512;
+        data += nblocks * SHA256_BLOCK_SIZE;
+        len -= nblocks * SHA256_BLOCK_SIZE;
+    }
+    if (len > 0) {
+        memcpy(ctx->data, data, len);
+        ctx->datalen = len;
+    }
+}
+
+static void ctx_final(sha256_blocks_fn blocks, SHA256_CTX *ctx, uint8_t hash[]) {
+    size_t i = ctx->datalen;
+
+    // Pad whatever data is left in the buffer.
+    ctx->data[i++] = 0x80;
+    if (ctx->datalen >= 56) {
+        while (i < 64) ctx->data[i++] = 0x00;
+        blocks(ctx->state, ctx->data, 1);
+        i = 0;
+    }
+    while (i < 56) ctx->data[i++] = 0x00;
+
+    // Append to the padding the total message's length in bits and transform.
+    ctx->bitlen += ctx->datalen * 8;
+    for (int j = 0; j < 8; ++j) ctx->data[63 - j] = (uint8_t)(ctx->bitlen >> (8 * j));
+    blocks(ctx->state, ctx->data, 1);
+
+    // State words are big endian in the digest
+    for (int j = 0; j < 8; ++j) {
+        hash[j*4]     = (uint8_t)(ctx->state[j] >> 24);
+        hash[j*4 + 1] = (uint8_t)(ctx->state[j] >> 16);
+        hash[j*4 + 2] = (uint8_t)(ctx->state[j] >> 8);
+        hash[j*4 + 3] = (uint8_t)(ctx->state[j]);
+    }
+}
+
+void sha256_init(SHA256_CTX *ctx) {
+    ctx->datalen = 0;
+    ctx->bitlen = 0;
+    ctx->state[0] = 0x6a09e667ul;
+    ctx->state[1] = 0xbb67ae85ul;
+    ctx->state[2] = 0x3c6ef372ul;
+    ctx->state[3] = 0xa54ff53aul;
+    ctx->state[4] = 0x510e527ful;
+    ctx->state[5] = 0x9b05688cul;
+    ctx->state[6] = 0x1f83d9abul;
+    ctx->state[7] = 0x5be0cd19ul;
+}
+
+void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len) {
+    ctx_update(get_backend()->blocks, ctx, data, len);
+}
+
+void sha256_final(SHA256_CTX *ctx, uint8_t hash[]) {
+    ctx_final(get_backend()->blocks, ctx, hash);
+}
+
+void sha256_digest(const uint8_t *data, size_t len, uint8_t out[SHA256_DIGEST_SIZE]) {
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out);
+}
+
+static void digest_with(sha256_blocks_fn blocks, const uint8_t *data, size_t len, size_t split,
+                        uint8_t out[SHA256_DIGEST_SIZE]) {
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    if (split > len) split = len;
+    ctx_update(blocks, &ctx, data, split);
+    ctx_update(blocks, &ctx, data + split, len - split);
+    ctx_final(blocks, &ctx, out);
+}
+
+static int unhex_cmp(const uint8_t digest[SHA256_DIGEST_SIZE], const char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+        if (hex[2*i] != digits[digest[i] >> 4] || hex[2*i + 1] != digits[digest[i] & 0xF]) return -1;
+    }
+    return 0;
+}
+
+int sha256_self_test(const Sha256Backend *backend) {
+    static const struct { const char *msg; const char *hex; } vectors[] = {
+        { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+        { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+        { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+          "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+    };
+    sha256_blocks_fn blocks = backend ? backend->blocks : get_backend()->blocks;
+    uint8_t out[SHA256_DIGEST_SIZE];
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+        size_t len = strlen(vectors[i].msg);
+        digest_with(blocks, (const uint8_t *)vectors[i].msg, len, len / 3, out);
+        if (unhex_cmp(out, vectors[i].hex) != 0) return -1;
+    }
+
+    // Multi-block and odd block counts must agree with the portable kernel
+    uint8_t buf[1000];
+    uint32_t x = 0x12345678u;
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        x = x * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(x >> 16);
+    }
+    size_t lens[] = { 64, 128, 191, 320, 1000 };
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+        uint8_t ref[SHA256_DIGEST_SIZE];
+        digest_with(sha256_blocks_generic, buf, lens[i], 0, ref);
+        digest_with(blocks, buf, lens[i], 7, out);
+        if (memcmp(ref, out, SHA256_DIGEST_SIZE) != 0) return -1;
+    }
+    return 0;
+}
+
+#ifdef SHA256_X86
+/*
+ * Multi-buffer driver. Each lane owns one message at a time; its whole blocks
+ * are read in place and the padded tail (one or two blocks) is built in the
+ * lane. When a lane finishes, it emits its digest and picks up the next
+ * message, so n can be any size and messages of mixed length share lanes.
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t full_blocks;
+    size_t total_blocks;
+    size_t next_block;
+    int msg;                 // index into the caller's arrays, -1 when idle
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+} MbLane;
+
+static void mb_lane_load(MbLane *lane, const uint8_t *data, size_t len, int msg) {
+    lane->data = data;
+    lane->full_blocks = len / SHA256_BLOCK_SIZE;
+    lane->next_block = 0;
+    lane->msg = msg;
+    size_t rem = len % SHA256_BLOCK_SIZE;
+    size_t tail_blocks = rem < 56 ? 1 : 2;
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if (rem) memcpy(lane->tail, data + lane->full_blocks * SHA256_BLOCK_SIZE, rem);
+    lane->tail[rem] = 0x80;
+    uint64_t bitlen = (uint64_t)len * 8;
+    uint8_t *end = lane->tail + tail_blocks * SHA256_BLOCK_SIZE;
+    for (int j = 0; j < 8; ++j) end[-1 - j] = (uint8_t)(bitlen >> (8 * j));
+    lane->total_blocks = lane->full_blocks + tail_blocks;
+}
+
+static const uint8_t *mb_lane_block(const MbLane *lane) {
+    if (lane->next_block < lane->full_blocks) return lane->data + lane->next_block * SHA256_BLOCK_SIZE;
+    return lane->tail + (lane->next_block - lane->full_blocks) * SHA256_BLOCK_SIZE;
+}
+
+static void digest_lanes(const uint8_t *const data[], const size_t lens[], int n,
+                         uint8_t out[][SHA256_DIGEST_SIZE]) {
+    static const uint32_t iv[8] = {
+        0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul,
+        0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul
+    };
+    static const uint8_t idle_block[SHA256_BLOCK_SIZE] = {0};
+    MbLane lanes[SHA256_MB_LANES];
+    uint32_t st[8][8];
+    int next_msg = 0, active = 0;
+
+    for (int l = 0; l < SHA256_MB_LANES; ++l) {
+        lanes[l].msg = -1;
+        if (next_msg < n) {
+            mb_lane_load(&lanes[l], data[next_msg], lens[next_msg], next_msg);
+            next_msg++;
+            active++;
+        }
+        for (int w = 0; w < 8; ++w) st[w][l] = iv[w];
+    }
+
+    while (active > 0) {
+        const uint8_t *blocks[SHA256_MB_LANES];
+        for (int l = 0; l < SHA256_MB_LANES; ++l)
+            blocks[l] = lanes[l].msg >= 0 ? mb_lane_block(&lanes[l]) : idle_block;
+        sha256_x8_avx2(st, blocks);
+
+        for (int l = 0; l < SHA256_MB_LANES; ++l) {
+            MbLane *lane = &lanes[l];
+            if (lane->msg < 0 || ++lane->next_block < lane->total_blocks) continue;
+            for (int w = 0; w < 8; ++w) {
+                out[lane->msg][w*4]     = (uint8_t)(st[w][l] >> 24);
+                out[lane->msg][w*4 + 1] = (uint8_t)(st[w][l] >> 16);
+                out[lane->msg][w*4 + 2] = (uint8_t)(st[w][l] >> 8);
+                out[lane->msg][w*4 + 3] = (uint8_t)(st[w][l]);
+                st[w][l] = iv[w];
+            }
+            lane->msg = -1;
+            active--;
+            if (next_msg < n) {
+                mb_lane_load(lane, data[next_msg], lens[next_msg], next_msg);
+                next_msg++;
+                active++;
+            }
+        }
+    }
+}
+
+// The lanes against the portable kernel, over more messages than lanes and
+// lengths around the one- and two-block padding boundaries
+static int lanes_ok = 0;
+static pthread_once_t lanes_once = PTHREAD_ONCE_INIT;
+
+static void lanes_self_test(void) {
+    enum { N_MSGS = 19 };
+    uint8_t buf[N_MSGS + 300];
+    uint32_t x = 0x9e3779b9u;
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        x = x * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(x >> 16);
+    }
+    const uint8_t *msgs[N_MSGS];
+    size_t lens[N_MSGS];
+    uint8_t got[N_MSGS][SHA256_DIGEST_SIZE];
+    for (int m = 0; m < N_MSGS; ++m) {
+        msgs[m] = buf + m;
+        lens[m] = (size_t)(m * 37) % 300;
+    }
+    digest_lanes(msgs, lens, N_MSGS, got);
+    for (int m = 0; m < N_MSGS; ++m) {
+        uint8_t want[SHA256_DIGEST_SIZE];
+        digest_with(sha256_blocks_generic, msgs[m], lens[m], 0, want);
+        if (memcmp(want, got[m], SHA256_DIGEST_SIZE) != 0) return;
+    }
+    lanes_ok = 1;
+}
+#endif
+
+// Eight AVX2 lanes stand in for the AVX2 backend only, whether it was
+// chosen on its own or forced: a forced generic backend stays portable, and
+// a single SHA-NI stream already outruns the lanes.
+static int mb_use_lanes(void) {
+#ifdef SHA256_X86
+    if (get_backend()->blocks != sha256_blocks_avx2) return 0;
+    pthread_once(&lanes_once, lanes_self_test);
+    return lanes_ok;
+#else
+    return 0;
+#endif
+}
+
+const char *sha256_mb_backend_name(void) {
+    return mb_use_lanes() ? "avx2x8" : get_backend()->name;
+}
+
+void sha256_digest_many(const uint8_t *const data[], const size_t lens[], int n,
+                        uint8_t out[][SHA256_DIGEST_SIZE]) {
+    if (n <= 0) return;
+#ifdef SHA256_X86
+    if (n > 1 && mb_use_lanes()) {
+        digest_lanes(data, lens, n, out);
+        return;
+    }
+#endif
+    for (int i = 0; i < n; ++i) sha256_digest(data[i], lens[i], out[i]);
+}
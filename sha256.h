@@ -0,0 +1,53 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+// Streaming SHA-256 context
+typedef struct {
+    uint8_t data[SHA256_BLOCK_SIZE];
+    size_t datalen;
+    uint64_t bitlen;
+    uint32_t state[8];
+} SHA256_CTX;
+
+// Compression kernel: runs nblocks consecutive 64-byte blocks through state
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data, size_t nblocks);
+
+// Hash backend descriptor
+typedef struct {
+    const char *name;          // "generic", "avx2", "shani"
+    sha256_blocks_fn blocks;
+    int (*available)(void);    // nonzero if the CPU supports this backend
+} Sha256Backend;
+
+void sha256_init(SHA256_CTX *ctx);
+void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len);
+void sha256_final(SHA256_CTX *ctx, uint8_t hash[]);
+
+// One-shot helper
+void sha256_digest(const uint8_t *data, size_t len, uint8_t out[SHA256_DIGEST_SIZE]);
+
+// Multi-buffer: hash n independent messages, SHA256_MB_LANES at a time in
+// parallel SIMD lanes when that beats the single-stream backend.
+#define SHA256_MB_LANES 8
+void sha256_digest_many(const uint8_t *const data[], const size_t lens[], int n,
+                        uint8_t out[][SHA256_DIGEST_SIZE]);
+const char *sha256_mb_backend_name(void);
+
+// Backend selection. The fastest backend that passes the self-test is chosen
+// on first use; REPROVM_SHA256_BACKEND=<name> overrides it. Multi-buffer
+// hashing follows the choice: it runs in lanes only for the AVX2 backend.
+// sha256_set_backend is safe while other threads hash.
+const char *sha256_backend_name(void);
+int sha256_set_backend(const char *name); // returns -1 if unknown or unsupported
+const Sha256Backend *sha256_backends(int *out_n);
+
+// Run the known-answer vectors against one backend (NULL = active). Returns 0 on success.
+int sha256_self_test(const Sha256Backend *backend);
+
+#endif // SHA256_H
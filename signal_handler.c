@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE
 #include "signal_handler.h"
 #include "logger.h"
 #include "metrics.h"
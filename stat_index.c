@@ -0,0 +1,306 @@
+// stat_index.c
+#define _POSIX_C_SOURCE 200809L
+#include "stat_index.h"
+#include "sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * On-disk format (host byte order, the index is machine local):
+ *   "RVMSIDX1" | uint32 version | uint32 count
+ *   count x { uint64 dev, ino, size; int64 mtime_ns, ctime_ns, hashed_ns;
+ *             uint8 digest[32]; uint16 path_len; path bytes }
+ *   SHA-256 of everything above
+ * A file whose trailer does not match is ignored and rebuilt.
+ * A directory entry is filed under its path plus "/": size and ctime_ns
+ * hold the first 16 bytes of its fingerprint, mtime_ns the newest timestamp
+ * in the subtree (for the racy check).
+ */
+
+#define INDEX_MAGIC "RVMSIDX1"
+#define INDEX_VERSION 1
+
+typedef struct {
+    char *path;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    int64_t hashed_ns;
+    uint8_t digest[32];
+} IndexEntry;
+
+// Open-addressing table keyed by path
+static IndexEntry *entries = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+static int dirty = 0;
+static char index_path[1024] = {0};
+static pthread_mutex_t index_mu = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t path_hash(const char *s) {
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static IndexEntry *find_slot(IndexEntry *table, size_t cap, const char *path) {
+    size_t i = path_hash(path) & (cap - 1);
+    while (table[i].path && strcmp(table[i].path, path) != 0) i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+static int grow(void) {
+    size_t new_cap = capacity ? capacity * 2 : 1024;
+    IndexEntry *table = calloc(new_cap, sizeof(IndexEntry));
+    if (!table) return -1;
+    for (size_t i = 0; i < capacity; ++i) {
+        if (entries[i].path) *find_slot(table, new_cap, entries[i].path) = entries[i];
+    }
+    free(entries);
+    entries = table;
+    capacity = new_cap;
+    return 0;
+}
+
+static void clear_entries(void) {
+    for (size_t i = 0; i < capacity; ++i) free(entries[i].path);
+    free(entries);
+    entries = NULL;
+    capacity = 0;
+    count = 0;
+}
+
+static int64_t ts_ns(struct timespec ts) {
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t stat_index_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts_ns(ts);
+}
+
+// Insert or overwrite; caller holds index_mu. Takes ownership of nothing.
+static IndexEntry *put_locked(const char *path) {
+    if ((count + 1) * 4 >= capacity * 3 && grow() != 0) return NULL;
+    IndexEntry *e = find_slot(entries, capacity, path);
+    if (!e->path) {
+        size_t len = strlen(path);
+        e->path = malloc(len + 1);
+        if (!e->path) return NULL;
+        memcpy(e->path, path, len + 1);
+        count++;
+    }
+    return e;
+}
+
+static int read_exact(FILE *f, void *buf, size_t len, SHA256_CTX *ctx) {
+    if (fread(buf, 1, len, f) != len) return -1;
+    sha256_update(ctx, buf, len);
+    return 0;
+}
+
+int stat_index_open(const char *path) {
+    pthread_mutex_lock(&index_mu);
+    clear_entries();
+    dirty = 0;
+    snprintf(index_path, sizeof(index_path), "%s", path);
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        pthread_mutex_unlock(&index_mu);
+        return 0; // first run
+    }
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    char magic[8];
+    uint32_t version = 0, n = 0;
+    int ok = read_exact(f, magic, sizeof(magic), &ctx) == 0 && memcmp(magic, INDEX_MAGIC, 8) == 0 &&
+             read_exact(f, &version, sizeof(version), &ctx) == 0 && version == INDEX_VERSION &&
+             read_exact(f, &n, sizeof(n), &ctx) == 0;
+    for (uint32_t i = 0; ok && i < n; ++i) {
+        IndexEntry e;
+        uint16_t len = 0;
+        char buf[65536];
+        ok = read_exact(f, &e.dev, sizeof(e.dev), &ctx) == 0 &&
+             read_exact(f, &e.ino, sizeof(e.ino), &ctx) == 0 &&
+             read_exact(f, &e.size, sizeof(e.size), &ctx) == 0 &&
+             read_exact(f, &e.mtime_ns, sizeof(e.mtime_ns), &ctx) == 0 &&
+             read_exact(f, &e.ctime_ns, sizeof(e.ctime_ns), &ctx) == 0 &&
+             read_exact(f, &e.hashed_ns, sizeof(e.hashed_ns), &ctx) == 0 &&
+             read_exact(f, e.digest, sizeof(e.digest), &ctx) == 0 &&
+             read_exact(f, &len, sizeof(len), &ctx) == 0 &&
+             read_exact(f, buf, len, &ctx) == 0;
+        if (!ok) break;
+        buf[len] = '\0';
+        IndexEntry *slot = put_locked(buf);
+        if (!slot) { ok = 0; break; }
+        e.path = slot->path;
+        *slot = e;
+    }
+    uint8_t want[32], got[32];
+    sha256_final(&ctx, want);
+    if (ok) ok = fread(got, 1, sizeof(got), f) == sizeof(got) && memcmp(want, got, sizeof(got)) == 0;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Warning: ignoring damaged stat index %s\n", path);
+        clear_entries();
+        dirty = 1;
+    }
+    pthread_mutex_unlock(&index_mu);
+    return 0;
+}
+
+int stat_index_lookup(const char *path, const struct stat *st, uint8_t digest[32]) {
+    int hit = 0;
+    pthread_mutex_lock(&index_mu);
+    if (capacity > 0) {
+        IndexEntry *e = find_slot(entries, capacity, path);
+        if (e->path &&
+            e->dev == (uint64_t)st->st_dev && e->ino == (uint64_t)st->st_ino &&
+            e->size == (uint64_t)st->st_size &&
+            e->mtime_ns == ts_ns(st->st_mtim) && e->ctime_ns == ts_ns(st->st_ctim) &&
+            e->mtime_ns + STAT_INDEX_RACY_NS <= e->hashed_ns) {
+            memcpy(digest, e->digest, 32);
+            hit = 1;
+        }
+    }
+    pthread_mutex_unlock(&index_mu);
+    return hit;
+}
+
+void stat_index_update(const char *path, const struct stat *st, const uint8_t digest[32],
+                       int64_t hashed_ns) {
+    if (strlen(path) >= 65535) return;
+    pthread_mutex_lock(&index_mu);
+    IndexEntry *e = put_locked(path);
+    if (e) {
+        e->dev = (uint64_t)st->st_dev;
+        e->ino = (uint64_t)st->st_ino;
+        e->size = (uint64_t)st->st_size;
+        e->mtime_ns = ts_ns(st->st_mtim);
+        e->ctime_ns = ts_ns(st->st_ctim);
+        e->hashed_ns = hashed_ns;
+        memcpy(e->digest, digest, 32);
+        dirty = 1;
+    }
+    pthread_mutex_unlock(&index_mu);
+}
+
+// A directory is filed under its path plus "/", which no file can have
+static int tree_key(const char *path, char *key, size_t sz) {
+    return snprintf(key, sz, "%s/", path) < (int)sz ? 0 : -1;
+}
+
+int stat_index_lookup_tree(const char *path, const struct stat *st, const uint8_t fp[32],
+                           uint8_t digest[32]) {
+    char key[4096];
+    uint64_t fp_lo, fp_hi;
+    if (tree_key(path, key, sizeof(key)) != 0) return 0;
+    memcpy(&fp_lo, fp, 8);
+    memcpy(&fp_hi, fp + 8, 8);
+    int hit = 0;
+    pthread_mutex_lock(&index_mu);
+    if (capacity > 0) {
+        IndexEntry *e = find_slot(entries, capacity, key);
+        if (e->path &&
+            e->dev == (uint64_t)st->st_dev && e->ino == (uint64_t)st->st_ino &&
+            e->size == fp_lo && (uint64_t)e->ctime_ns == fp_hi &&
+            e->mtime_ns + STAT_INDEX_RACY_NS <= e->hashed_ns) {
+            memcpy(digest, e->digest, 32);
+            hit = 1;
+        }
+    }
+    pthread_mutex_unlock(&index_mu);
+    return hit;
+}
+
+void stat_index_update_tree(const char *path, const struct stat *st, const uint8_t fp[32],
+                            int64_t newest_ns, const uint8_t digest[32], int64_t hashed_ns) {
+    char key[4096];
+    if (tree_key(path, key, sizeof(key)) != 0 || strlen(key) >= 65535) return;
+    pthread_mutex_lock(&index_mu);
+    IndexEntry *e = put_locked(key);
+    if (e) {
+        uint64_t fp_hi;
+        e->dev = (uint64_t)st->st_dev;
+        e->ino = (uint64_t)st->st_ino;
+        memcpy(&e->size, fp, 8);
+        memcpy(&fp_hi, fp + 8, 8);
+        e->ctime_ns = (int64_t)fp_hi;
+        e->mtime_ns = newest_ns;
+        e->hashed_ns = hashed_ns;
+        memcpy(e->digest, digest, 32);
+        dirty = 1;
+    }
+    pthread_mutex_unlock(&index_mu);
+}
+
+static void write_hashed(FILE *f, const void *buf, size_t len, SHA256_CTX *ctx) {
+    fwrite(buf, 1, len, f);
+    sha256_update(ctx, buf, len);
+}
+
+int stat_index_save(void) {
+    pthread_mutex_lock(&index_mu);
+    if (!dirty || index_path[0] == '\0') {
+        pthread_mutex_unlock(&index_mu);
+        return 0;
+    }
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", index_path, (long)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        pthread_mutex_unlock(&index_mu);
+        return -1;
+    }
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    uint32_t version = INDEX_VERSION, n = (uint32_t)count;
+    write_hashed(f, INDEX_MAGIC, 8, &ctx);
+    write_hashed(f, &version, sizeof(version), &ctx);
+    write_hashed(f, &n, sizeof(n), &ctx);
+    for (size_t i = 0; i < capacity; ++i) {
+        IndexEntry *e = &entries[i];
+        if (!e->path) continue;
+        uint16_t len = (uint16_t)strlen(e->path);
+        write_hashed(f, &e->dev, sizeof(e->dev), &ctx);
+        write_hashed(f, &e->ino, sizeof(e->ino), &ctx);
+        write_hashed(f, &e->size, sizeof(e->size), &ctx);
+        write_hashed(f, &e->mtime_ns, sizeof(e->mtime_ns), &ctx);
+        write_hashed(f, &e->ctime_ns, sizeof(e->ctime_ns), &ctx);
+        write_hashed(f, &e->hashed_ns, sizeof(e->hashed_ns), &ctx);
+        write_hashed(f, e->digest, sizeof(e->digest), &ctx);
+        write_hashed(f, &len, sizeof(len), &ctx);
+        write_hashed(f, e->path, len, &ctx);
+    }
+    uint8_t trailer[32];
+    sha256_final(&ctx, trailer);
+    fwrite(trailer, 1, sizeof(trailer), f);
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    if (failed || rename(tmp, index_path) != 0) {
+        unlink(tmp);
+        pthread_mutex_unlock(&index_mu);
+        return -1;
+    }
+    dirty = 0;
+    pthread_mutex_unlock(&index_mu);
+    return 0;
+}
+
+void stat_index_close(void) {
+    stat_index_save();
+    pthread_mutex_lock(&index_mu);
+    clear_entries();
+    index_path[0] = '\0';
+    pthread_mutex_unlock(&index_mu);
+}
@@ -0,0 +1,45 @@
+#ifndef STAT_INDEX_H
+#define STAT_INDEX_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * Persistent stat-fingerprint index: maps a path plus its
+ * (dev, inode, size, mtime_ns, ctime_ns) to the content digest, so unchanged
+ * files are stat'ed instead of re-read. Entries whose timestamps are too close
+ * to the moment they were hashed are "racy" (a same-tick rewrite would leave
+ * the fingerprint unchanged) and are never trusted, as in git's index.
+ */
+
+// Timestamps within this window of the hashing time make an entry racy
+#define STAT_INDEX_RACY_NS 2000000000LL
+
+// Load the index from path (a missing or corrupt file starts empty). Returns 0 on success.
+int stat_index_open(const char *path);
+
+// Returns 1 and fills digest if path's fingerprint matches a trusted entry, 0 otherwise.
+int stat_index_lookup(const char *path, const struct stat *st, uint8_t digest[32]);
+
+// Record the digest of path as read with fingerprint st; hashed_ns is when st was taken.
+void stat_index_update(const char *path, const struct stat *st, const uint8_t digest[32],
+                       int64_t hashed_ns);
+
+// Directories, for tree digests (tree.h). fp is a fingerprint of the stat of
+// everything below path; newest_ns is the newest timestamp among them, so a
+// directory with a racy file in it is never trusted either.
+int stat_index_lookup_tree(const char *path, const struct stat *st, const uint8_t fp[32],
+                           uint8_t digest[32]);
+void stat_index_update_tree(const char *path, const struct stat *st, const uint8_t fp[32],
+                            int64_t newest_ns, const uint8_t digest[32], int64_t hashed_ns);
+
+// Write the index back if it changed (atomic replace). Returns 0 on success.
+int stat_index_save(void);
+
+// Save and drop all entries
+void stat_index_close(void);
+
+// Current wall clock in nanoseconds (same clock as file timestamps)
+int64_t stat_index_now_ns(void);
+
+#endif // STAT_INDEX_H
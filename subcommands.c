@@ -0,0 +1,423 @@
+// subcommands.c
+#include "subcommands.h"
+#include "bloom.h"
+#include "bundle.h"
+#include "cas.h"
+#include "config.h"
+#include "durability.h"
+#include "gc.h"
+#include "remote_cas.h"
+#include "scrub.h"
+#include "task.h"
+#include "tree.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void subcommands_usage(const char *prog) {
+    fprintf(stderr, "       %s cas repack      move small loose objects into packfiles\n", prog);
+    fprintf(stderr, "       %s cas rebuild-filter  rebuild the object filter from a scan of the store\n", prog);
+    fprintf(stderr, "       %s cas gc [--dry-run] [--max-size-mb N] [--ttl-hours N]\n"
+                    "                          delete unreferenced objects and stale records\n", prog);
+    fprintf(stderr, "       %s cas verify [--max-mb-per-sec N] [--max-seconds N] [--restart]\n"
+                    "                          rehash every object, quarantining corrupt ones\n", prog);
+    fprintf(stderr, "       %s cas migrate-hash <manifest> [--to sha256|blake3]\n"
+                    "                          re-key the manifest's cached results under another digest\n", prog);
+    fprintf(stderr, "       %s cas push        upload every object the remote CAS (remote_cas_url) lacks\n", prog);
+    fprintf(stderr, "       %s cas pull        fetch every object the remote CAS has and this store lacks\n", prog);
+    fprintf(stderr, "       %s cache export <manifest> <bundle> [--targets t1 t2 ...]\n"
+                    "                          write the targets' cached results into one bundle file\n", prog);
+    fprintf(stderr, "       %s cache import <bundle|->  load a bundle into the store, skipping objects it has\n", prog);
+    fprintf(stderr, "       %s cache list <bundle>    count what a bundle holds\n", prog);
+}
+
+static int cmd_cas_repack(void) {
+    CasRepackStats st;
+    int rc = gc_repack(&st);
+    if (rc == 1) {
+        fprintf(stderr, "A gc or repack is already running\n");
+        return 1;
+    }
+    printf("Packed %llu objects (%llu bytes) into %llu packs\n",
+           (unsigned long long)st.objects_packed, (unsigned long long)st.bytes_packed,
+           (unsigned long long)st.packs_written);
+    if (st.duplicates_removed)
+        printf("Removed %llu loose objects that were already packed\n",
+               (unsigned long long)st.duplicates_removed);
+    if (st.loose_kept)
+        printf("Kept %llu large objects loose\n", (unsigned long long)st.loose_kept);
+    if (st.corrupt_skipped)
+        printf("Skipped %llu corrupt objects\n", (unsigned long long)st.corrupt_skipped);
+    if (rc != 0) fprintf(stderr, "Repack failed\n");
+    return rc == 0 ? 0 : 1;
+}
+
+static int cmd_cas_rebuild_filter(void) {
+    uint64_t objects = 0;
+    int rc = cas_rebuild_filter(&objects);
+    BloomInfo info;
+    bloom_get_info(&info);
+    printf("Object filter: %llu objects in %llu KB, estimated false-positive rate %.4f%%\n",
+           (unsigned long long)objects, (unsigned long long)(info.bits / 8 / 1024),
+           100.0 * info.estimated_fp_rate);
+    if (rc != 0) fprintf(stderr, "Filter rebuild failed\n");
+    return rc == 0 ? 0 : 1;
+}
+
+static int cmd_cas_gc(int argc, char **argv) {
+    GcOptions opts = { (uint64_t)g_config.max_cache_size_mb * 1024 * 1024,
+                       (int64_t)g_config.cache_ttl_hours * 3600, 0 };
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--dry-run") == 0) {
+            opts.dry_run = 1;
+        } else if (strcmp(argv[i], "--max-size-mb") == 0 && i + 1 < argc) {
+            opts.max_bytes = (uint64_t)strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        } else if (strcmp(argv[i], "--ttl-hours") == 0 && i + 1 < argc) {
+            opts.ttl_seconds = (int64_t)strtoll(argv[++i], NULL, 10) * 3600;
+        } else {
+            fprintf(stderr, "Unknown gc option '%s'\n", argv[i]);
+            subcommands_usage("reprovm");
+            return 1;
+        }
+    }
+    GcStats st;
+    int rc = gc_run(&opts, &st);
+    if (rc == 1) {
+        fprintf(stderr, "Another gc is already running\n");
+        return 1;
+    }
+    const char *verb = opts.dry_run ? "Would remove" : "Removed";
+    printf("%s %llu of %llu records (%llu expired, %llu over budget)\n", verb,
+           (unsigned long long)(st.records_expired + st.records_evicted), (unsigned long long)st.records,
+           (unsigned long long)st.records_expired, (unsigned long long)st.records_evicted);
+    printf("%s %llu of %llu objects, freeing %llu of %llu bytes\n", verb,
+           (unsigned long long)st.objects_removed, (unsigned long long)st.objects,
+           (unsigned long long)st.bytes_freed, (unsigned long long)st.bytes_before);
+    if (st.packs_rewritten)
+        printf("Rewrote %llu packs\n", (unsigned long long)st.packs_rewritten);
+    if (rc != 0) fprintf(stderr, "Garbage collection failed\n");
+    return rc == 0 ? 0 : 1;
+}
+
+// Exits 2 if the scrub found corrupt objects, so scheduled runs can alert
+static int cmd_cas_verify(int argc, char **argv) {
+    ScrubOptions opts = { 0, 0, 0 };
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--restart") == 0) {
+            opts.restart = 1;
+        } else if (strcmp(argv[i], "--max-mb-per-sec") == 0 && i + 1 < argc) {
+            opts.max_bytes_per_sec = (uint64_t)strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        } else if (strcmp(argv[i], "--max-seconds") == 0 && i + 1 < argc) {
+            opts.max_seconds = (int64_t)strtoll(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Unknown verify option '%s'\n", argv[i]);
+            subcommands_usage("reprovm");
+            return 1;
+        }
+    }
+    ScrubStats st;
+    int rc = scrub_run(&opts, &st);
+    if (rc == 1) {
+        fprintf(stderr, "Another verify is already running\n");
+        return 1;
+    }
+    printf("Verified %llu objects (%llu MB)%s, %llu corrupt\n", (unsigned long long)st.objects,
+           (unsigned long long)(st.bytes / (1024 * 1024)), st.resumed ? ", resuming the last pass" : "",
+           (unsigned long long)st.corrupt);
+    if (st.corrupt)
+        printf("Quarantined them in %s and removed %llu records that used them\n", cas_get_quarantine_root(),
+               (unsigned long long)st.records_invalidated);
+    if (st.vanished)
+        printf("Skipped %llu objects deleted while verifying\n", (unsigned long long)st.vanished);
+    if (st.complete)
+        printf("Pass complete: %llu objects, %llu corrupt\n", (unsigned long long)st.pass_objects,
+               (unsigned long long)st.pass_corrupt);
+    else if (rc == 0)
+        printf("Stopped after %llu objects of this pass; run again to resume\n",
+               (unsigned long long)st.pass_objects);
+    if (rc != 0) fprintf(stderr, "Verify failed\n");
+    return rc != 0 ? 1 : st.corrupt ? 2 : 0;
+}
+
+// Outputs in transit between stores are staged as files named by their old digest
+static void stage_path(const char *dir, const Digest *d, char *path, size_t sz) {
+    char hex[DIGEST_HEX_SIZE];
+    snprintf(path, sz, "%s/%s", dir, digest_to_hex(d, hex));
+}
+
+/*
+ * Records are keyed by a task hash over the digests of the task's inputs,
+ * and do not list those inputs, so they are re-keyed from the manifest: with
+ * the current algorithm each task's record is found and its outputs copied
+ * out of the store; then the other store is opened, the outputs stored
+ * there and each record written under the task's new hash. Inputs that
+ * changed since a task last ran leave its record behind, as a rebuild would.
+ */
+static int cmd_cas_migrate_hash(int argc, char **argv) {
+    if (argc < 3) {
+        subcommands_usage("reprovm");
+        return 1;
+    }
+    DigestAlgorithm from = digest_algorithm();
+    DigestAlgorithm to = from == DIGEST_SHA256 ? DIGEST_BLAKE3 : DIGEST_SHA256;
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--to") == 0 && i + 1 < argc && digest_algorithm_from_name(argv[i + 1], &to) == 0) {
+            ++i;
+        } else {
+            fprintf(stderr, "Unknown migrate-hash option '%s'\n", argv[i]);
+            subcommands_usage("reprovm");
+            return 1;
+        }
+    }
+    if (to == from) {
+        printf("Results are already keyed by %s\n", digest_algorithm_name(to));
+        return 0;
+    }
+    TaskList *list = parse_manifest(argv[2]);
+    if (!list) return 1;
+    char stage[256];
+    snprintf(stage, sizeof(stage), ".reprovm/migrate.%ld", (long)getpid());
+    if (ensure_dir_recursive(stage) != 0) {
+        free_tasklist(list);
+        return 1;
+    }
+    // outs[i] holds task i's recorded outputs (NULL: no record to move)
+    Digest **outs = calloc(list->n > 0 ? list->n : 1, sizeof(Digest *));
+    int rc = outs ? 0 : -1, found = 0, moved = 0;
+    for (int i = 0; rc == 0 && i < list->n; ++i) {
+        Task *t = list->tasks[i];
+        if (compute_task_hash(t) != 0) continue;
+        outs[i] = calloc(t->n_outputs > 0 ? t->n_outputs : 1, sizeof(Digest));
+        if (!outs[i] || read_task_record(t, outs[i]) != 1) {
+            free(outs[i]);
+            outs[i] = NULL;
+            continue;
+        }
+        found++;
+        for (int j = 0; j < t->n_outputs; ++j) {
+            char path[512];
+            if (digest_is_zero(&outs[i][j])) continue;
+            stage_path(stage, &outs[i][j], path, sizeof(path));
+            int tree = cas_is_tree(&outs[i][j]) == 1;
+            if (!file_exists(path) && (tree ? tree_restore(&outs[i][j], path)
+                                            : cas_restore_blob_to_file(&outs[i][j], path)) != 0) {
+                fprintf(stderr, "Cannot read output '%s' of task '%s' from the store\n", t->outputs[j], t->name);
+                rc = -1;
+            }
+        }
+    }
+    if (rc == 0) {
+        cas_shutdown();
+        digest_set_algorithm(to);
+        if (cas_init(".") != 0) {
+            fprintf(stderr, "Failed to open the %s store\n", digest_algorithm_name(to));
+            rc = -1;
+        }
+    }
+    for (int i = 0; rc == 0 && i < list->n; ++i) {
+        Task *t = list->tasks[i];
+        if (!outs[i]) continue;
+        memset(&t->task_hash, 0, sizeof(Digest));
+        if (compute_task_hash(t) != 0) continue;
+        int ok = 1;
+        for (int j = 0; ok && j < t->n_outputs; ++j) {
+            char path[512];
+            if (digest_is_zero(&outs[i][j])) continue;
+            stage_path(stage, &outs[i][j], path, sizeof(path));
+            const char *staged = path;
+            ok = tree_store_paths(&staged, 1, &outs[i][j]) == 0;
+        }
+        gc_lock_shared();
+        if (ok && write_task_record_for(t, outs[i]) == 0 && durability_commit() == 0) moved++;
+        else rc = -1;
+        gc_unlock_shared();
+    }
+    printf("Migrated %d of %d cached results from %s to %s\n", moved, found,
+           digest_algorithm_name(from), digest_algorithm_name(to));
+    for (int i = 0; outs && i < list->n; ++i) free(outs[i]);
+    free(outs);
+    free_tasklist(list);
+    tree_remove(stage);
+    if (rc != 0) fprintf(stderr, "Migration failed\n");
+    return rc == 0 ? 0 : 1;
+}
+
+static int cmd_cas_push(void) {
+    if (!g_remote_cas_config.enabled) {
+        fprintf(stderr, "No remote CAS configured: set remote_cas_url or REPROVM_REMOTE_CAS_URL\n");
+        return 1;
+    }
+    // gc must not delete an object between the walk and its upload
+    gc_lock_shared();
+    int rc = remote_cas_sync_to_remote();
+    gc_unlock_shared();
+    remote_cas_print_stats(stdout);
+    if (rc != 0) fprintf(stderr, "Push failed\n");
+    return rc == 0 ? 0 : 1;
+}
+
+static int cmd_cas_pull(void) {
+    if (!g_remote_cas_config.enabled) {
+        fprintf(stderr, "No remote CAS configured: set remote_cas_url or REPROVM_REMOTE_CAS_URL\n");
+        return 1;
+    }
+    // nothing references the fetched objects yet, so keep gc out until
+    // the pull is done
+    gc_lock_shared();
+    int rc = remote_cas_sync_from_remote();
+    gc_unlock_shared();
+    remote_cas_print_stats(stdout);
+    if (rc != 0) fprintf(stderr, "Pull failed\n");
+    return rc == 0 ? 0 : 1;
+}
+
+static int run_cas(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: reprovm cas <command>\n");
+        subcommands_usage("reprovm");
+        return 1;
+    }
+    if (strcmp(argv[1], "repack") == 0) return cmd_cas_repack();
+    if (strcmp(argv[1], "rebuild-filter") == 0) return cmd_cas_rebuild_filter();
+    if (strcmp(argv[1], "gc") == 0) return cmd_cas_gc(argc, argv);
+    if (strcmp(argv[1], "verify") == 0) return cmd_cas_verify(argc, argv);
+    if (strcmp(argv[1], "migrate-hash") == 0) return cmd_cas_migrate_hash(argc, argv);
+    if (strcmp(argv[1], "push") == 0) return cmd_cas_push();
+    if (strcmp(argv[1], "pull") == 0) return cmd_cas_pull();
+    fprintf(stderr, "Unknown cas command '%s'\n", argv[1]);
+    subcommands_usage("reprovm");
+    return 1;
+}
+
+/*
+ * Export picks records the way a build would look them up: the targets and
+ * their dependencies are hashed from the manifest and the workspace, and
+ * each task with a record is taken along with everything the record reaches.
+ */
+static int cmd_cache_export(int argc, char **argv) {
+    if (argc < 4) {
+        subcommands_usage("reprovm");
+        return 1;
+    }
+    char **targets = NULL;
+    int n_targets = 0;
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--targets") == 0 && !targets) {
+            targets = &argv[i + 1];
+            n_targets = argc - i - 1;
+            break;
+        }
+        fprintf(stderr, "Unknown export option '%s'\n", argv[i]);
+        subcommands_usage("reprovm");
+        return 1;
+    }
+    TaskList *list = parse_manifest(argv[2]);
+    if (!list) return 1;
+    int needed_n = 0;
+    Task **needed = collect_needed_tasks(list, targets, n_targets, &needed_n);
+    Digest *keys = calloc(needed_n > 0 ? needed_n : 1, sizeof(Digest));
+    size_t n = 0;
+    for (int i = 0; keys && i < needed_n; ++i) {
+        Task *t = needed[i];
+        Digest *outs = calloc(t->n_outputs > 0 ? t->n_outputs : 1, sizeof(Digest));
+        if (outs && compute_task_hash(t) == 0 && read_task_record(t, outs) == 1) {
+            keys[n++] = t->task_hash;
+            // outputs that only the remote CAS holds come in first
+            int m = 0;
+            for (int j = 0; j < t->n_outputs; ++j)
+                if (!digest_is_zero(&outs[j])) outs[m++] = outs[j];
+            cas_fetch_missing(outs, m);
+        }
+        free(outs);
+    }
+    BundleStats st;
+    // gc must not delete an object between the walk and its copy
+    gc_lock_shared();
+    int rc = keys ? bundle_export(argv[3], keys, n, &st) : -1;
+    gc_unlock_shared();
+    if (rc == 0) {
+        printf("Exported %llu of %d task records and %llu objects (%llu bytes) to %s\n",
+               (unsigned long long)st.records, needed_n, (unsigned long long)st.objects,
+               (unsigned long long)st.bytes, argv[3]);
+        if (st.missing)
+            printf("Left out %llu records whose objects are missing from the store\n",
+                   (unsigned long long)(n - st.records));
+    } else {
+        fprintf(stderr, "Export failed\n");
+    }
+    free(keys);
+    free(needed);
+    free_tasklist(list);
+    return rc == 0 ? 0 : 1;
+}
+
+static int cmd_cache_import(int argc, char **argv) {
+    if (argc != 3) {
+        subcommands_usage("reprovm");
+        return 1;
+    }
+    BundleStats st;
+    // nothing references the objects until their records are in
+    gc_lock_shared();
+    int rc = bundle_import(argv[2], &st);
+    gc_unlock_shared();
+    printf("Imported %llu task records and %llu objects (%llu bytes); %llu objects were already present\n",
+           (unsigned long long)st.records, (unsigned long long)st.objects, (unsigned long long)st.bytes,
+           (unsigned long long)st.objects_present);
+    if (rc != 0) fprintf(stderr, "Import failed\n");
+    return rc == 0 ? 0 : 1;
+}
+
+static int cmd_cache_list(int argc, char **argv) {
+    if (argc != 3) {
+        subcommands_usage("reprovm");
+        return 1;
+    }
+    BundleEntry *entries;
+    size_t n;
+    if (bundle_read_index(argv[2], &entries, &n) != 0) {
+        fprintf(stderr, "Cannot read the index of '%s'\n", argv[2]);
+        return 1;
+    }
+    uint64_t records = 0, objects = 0, bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (entries[i].kind == BUNDLE_RECORD) {
+            char hex[DIGEST_HEX_SIZE];
+            printf("record %s\n", digest_to_hex(&entries[i].d, hex));
+            records++;
+        } else if (entries[i].kind == BUNDLE_OBJECT) {
+            objects++;
+            bytes += entries[i].length;
+        }
+    }
+    printf("%llu task records and %llu objects (%llu bytes)\n", (unsigned long long)records,
+           (unsigned long long)objects, (unsigned long long)bytes);
+    free(entries);
+    return 0;
+}
+
+static int run_cache(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: reprovm cache <command>\n");
+        subcommands_usage("reprovm");
+        return 1;
+    }
+    if (strcmp(argv[1], "export") == 0) return cmd_cache_export(argc, argv);
+    if (strcmp(argv[1], "import") == 0) return cmd_cache_import(argc, argv);
+    if (strcmp(argv[1], "list") == 0) return cmd_cache_list(argc, argv);
+    fprintf(stderr, "Unknown cache command '%s'\n", argv[1]);
+    subcommands_usage("reprovm");
+    return 1;
+}
+
+int is_subcommand(const char *name) {
+    return strcmp(name, "cas") == 0 || strcmp(name, "cache") == 0;
+}
+
+int run_subcommand(int argc, char **argv) {
+    if (strcmp(argv[0], "cas") == 0) return run_cas(argc, argv);
+    if (strcmp(argv[0], "cache") == 0) return run_cache(argc, argv);
+    return 1;
+}
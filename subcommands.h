@@ -0,0 +1,17 @@
+#ifndef SUBCOMMANDS_H
+#define SUBCOMMANDS_H
+
+// Maintenance commands: `reprovm cas <command> ...` and
+// `reprovm cache <command> ...`.
+// The CAS must already be initialized.
+
+// Returns 1 if name is a subcommand group handled here
+int is_subcommand(const char *name);
+
+// Run argv[0] (the group) with its arguments. Returns the process exit code.
+int run_subcommand(int argc, char **argv);
+
+// Usage lines for the subcommands
+void subcommands_usage(const char *prog);
+
+#endif // SUBCOMMANDS_H
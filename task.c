@@ -2,12 +2,18 @@
 #include "task.h"
 #include "util.h"
 #include "cas.h"
+#include "tree.h"
+#include "gc.h"
+#include "durability.h"
+#include "remote_cas.h"
+#include "sha256.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #define META_EXT ".meta"
 
@@ -28,8 +34,7 @@ static void task_free(Task *t) {
     free(t->outputs);
     for (int i = 0; i < t->n_deps; ++i) free(t->deps[i]);
     free(t->deps);
-    free(t->task_hash);
-    free(t->result_hash);
+    free(t->output_hashes);
     for (int i = 0; i < t->n_dependents; ++i) ; // dependents are borrowed
     free(t->dependents);
     free(t);
@@ -263,241 +268,360 @@ Task **topo_sort(Task **subset, int n, int *out_n) {
     return result;
 }
 
+// Feed a digest to ctx as lowercase hex. Record hashes are defined over the
+// hex text so existing cache keys stay valid.
+static void sha256_update_hex(SHA256_CTX *ctx, const Digest *d) {
+    char hex[DIGEST_HEX_SIZE];
+    sha256_update(ctx, (const uint8_t *)digest_to_hex(d, hex), DIGEST_SIZE * 2);
+}
+
+static void sha256_update_str(SHA256_CTX *ctx, const char *s) {
+    sha256_update(ctx, (const uint8_t *)s, strlen(s));
+}
+
 // Compute task hash based on command + inputs' blob hashes + deps' result hashes.
-int compute_task_hash(Task *task) {
+// An input that is a directory contributes the digest of its tree.
+// Preimage: "cmd=<cmd>\ninputs=<sorted hex, comma separated>\ndeps=<one field per dep>\n",
+// followed by "digest=<algorithm>\n" when inputs are not hashed with SHA-256.
+// With indexed_only, the input digests come from the stat index alone and
+// an input it cannot vouch for fails the hash quietly
+static int task_hash(Task *task, int indexed_only) {
     if (!task) return -1;
     // Compute input blob hashes
-    char **input_hashes = NULL;
+    Digest *input_hashes = NULL;
     int n_inputs = task->n_inputs;
     if (n_inputs > 0) {
-        input_hashes = malloc(sizeof(char*) * n_inputs);
-        for (int i = 0; i < n_inputs; ++i) {
-            char *h = cas_store_blob_from_file(task->inputs[i]);
-            if (!h) {
-                fprintf(stderr, "Failed to hash input file '%s' for task '%s'\n", task->inputs[i], task->name);
-                for (int j = 0; j < i; ++j) free(input_hashes[j]);
-                free(input_hashes);
-                return -1;
+        input_hashes = malloc(sizeof(Digest) * n_inputs);
+        if (!input_hashes) return -1;
+        const char *const *inputs = (const char *const *)task->inputs;
+        if ((indexed_only ? tree_lookup_paths(inputs, n_inputs, input_hashes)
+                          : tree_hash_paths(inputs, n_inputs, input_hashes)) != 0) {
+            for (int i = 0; !indexed_only && i < n_inputs; ++i) {
+                if (digest_is_zero(&input_hashes[i]))
+                    fprintf(stderr, "Failed to hash input file '%s' for task '%s'\n", task->inputs[i], task->name);
             }
-            input_hashes[i] = h;
-        }
-    }
-    // Collect dependency result hashes
-    char **dep_hashes = NULL;
-    int n_dep_hashes = task->n_deps;
-    if (n_dep_hashes > 0) {
-        dep_hashes = malloc(sizeof(char*) * n_dep_hashes);
-        for (int i = 0; i < task->n_deps; ++i) {
-            // we expect that dependent tasks have result_hash already computed (since topo order)
-            // If not, fallback to empty string
-            char *depname = task->deps[i];
-            // result_hash needs to be accessible; this assumes upstream has been run/hashed
-            // For safety, we allow missing to be empty
-            dep_hashes[i] = strdup_safe("");
-            (void)depname; // actual assignment happens outside; we'll fix this below
-        }
-        // better approach: since we don't have a mapping here, we rely on caller having populated task->deps' result_hash somewhere else
-    }
-    // Actually, easier: instead of trying to look up dependency objects here (since Task* graph is available),
-    // we will expect the caller sets up a list of dependency result hashes via their Task structs.
-    // So to get those, we need external mapping; adjust: we will not use dep_hashes here. Instead, caller must
-    // pass in dependency result hashes via concatenation externally. To not complicate, we'll reconstruct a string:
-    size_t bufcap = 4096;
-    char *buf = malloc(bufcap);
-    buf[0] = '\0';
-    // command
-    strcat(buf, "cmd=");
-    strcat(buf, task->cmd ? task->cmd : "");
-    strcat(buf, "\n");
-    // inputs (sorted for determinism)
-    if (n_inputs > 0) {
-        // sort input hashes
-        for (int i = 0; i < n_inputs; ++i)
-            for (int j = i+1; j < n_inputs; ++j)
-                if (strcmp(input_hashes[i], input_hashes[j]) > 0) {
-                    char *tmp = input_hashes[i];
-                    input_hashes[i] = input_hashes[j];
-                    input_hashes[j] = tmp;
-                }
-        strcat(buf, "inputs=");
-        for (int i = 0; i < n_inputs; ++i) {
-            strcat(buf, input_hashes[i]);
-            if (i + 1 < n_inputs) strcat(buf, ",");
-        }
-        strcat(buf, "\n");
-    } else {
-        strcat(buf, "inputs=\n");
-    }
-    // dependencies' result_hashes (we can find the Task* if we had global list – assume caller already ensured their result_hash is set)
-    if (task->n_deps > 0) {
-        // because we don't have a reverse pointer to dependency Task* here, we do a small hack:
-        strcat(buf, "deps=");
-        for (int i = 0; i < task->n_deps; ++i) {
-            // Try to find the dependency's result hash by scanning the environment:
-            // In practice the caller will have already computed dependent task->result_hash.
-            // Here we assume dependency names correspond; this will be patched in caller before calling this function.
-            // So we append placeholder if missing.
-            strcat(buf, ""); // placeholder
-            if (i + 1 < task->n_deps) strcat(buf, ",");
+            free(input_hashes);
+            return -1;
         }
-        strcat(buf, "\n");
-    } else {
-        strcat(buf, "deps=\n");
+        // sorted for determinism
+        qsort(input_hashes, n_inputs, sizeof(Digest), digest_qsort_cmp);
     }
-
-    // Hash the buffer
-    unsigned char digest[32];
-    // reuse SHA256 functions from cas.h
     SHA256_CTX ctx;
     sha256_init(&ctx);
-    sha256_update(&ctx, (unsigned char*)buf, strlen(buf));
-    sha256_final(&ctx, digest);
-    char *hex = hex_encode(digest, 32);
-    if (!hex) {
-        free(buf);
-        if (input_hashes) {
-            for (int i = 0; i < n_inputs; ++i) free(input_hashes[i]);
-            free(input_hashes);
-        }
-        return -1;
-    }
-    // assign
-    task->task_hash = strdup_safe(hex);
-    free(hex);
-    free(buf);
-    if (input_hashes) {
-        for (int i = 0; i < n_inputs; ++i) free(input_hashes[i]);
-        free(input_hashes);
-    }
+    sha256_update_str(&ctx, "cmd=");
+    sha256_update_str(&ctx, task->cmd ? task->cmd : "");
+    sha256_update_str(&ctx, "\ninputs=");
+    for (int i = 0; i < n_inputs; ++i) {
+        sha256_update_hex(&ctx, &input_hashes[i]);
+        if (i + 1 < n_inputs) sha256_update_str(&ctx, ",");
+    }
+    sha256_update_str(&ctx, "\ndeps=");
+    // dependencies' result hashes are not resolvable from here (no Task* for
+    // deps); each dependency contributes an empty field
+    for (int i = 0; i + 1 < task->n_deps; ++i) sha256_update_str(&ctx, ",");
+    sha256_update_str(&ctx, "\n");
+    if (digest_algorithm() != DIGEST_SHA256) {
+        sha256_update_str(&ctx, "digest=");
+        sha256_update_str(&ctx, digest_algorithm_name(digest_algorithm()));
+        sha256_update_str(&ctx, "\n");
+    }
+    sha256_final(&ctx, task->task_hash.b);
+    free(input_hashes);
     return 0;
 }
 
-// Load existing record if present
-int try_load_task_record(Task *task) {
-    if (!task || !task->task_hash) return 0;
+int compute_task_hash(Task *task) {
+    return task_hash(task, 0);
+}
+
+static void meta_path_for(const Task *task, char *out, size_t sz) {
+    char hex[DIGEST_HEX_SIZE];
+    snprintf(out, sz, "%s/%s%s", cas_get_cache_root(), digest_to_hex(&task->task_hash, hex), META_EXT);
+}
+
+// Parse the record for task->task_hash: its result hash and the digest of
+// each declared output (have[j] is 1 for a file, 2 for a directory, 0 if not
+// recorded; a later line for the same output wins). Records name their
+// digest algorithm on a "digest:" line, absent for SHA-256; one written
+// under another algorithm is not a hit.
+static int parse_record(const Task *task, Digest *result, Digest *outputs, int *have) {
     char meta_path[2048];
-    snprintf(meta_path, sizeof(meta_path), "%s/%s%s", cas_get_cache_root(), task->task_hash, META_EXT);
+    meta_path_for(task, meta_path, sizeof(meta_path));
     if (!file_exists(meta_path)) return 0;
-    // open
     FILE *f = fopen(meta_path, "r");
     if (!f) return -1;
     char *line = NULL;
     size_t cap = 0;
-    char *output_names[64];
-    char *output_hashes[64];
-    int n_outputs = 0;
-    char result_hash_buf[256] = {0};
+    DigestAlgorithm algo = DIGEST_SHA256;
+    int known = 1;
+    memset(result, 0, sizeof(Digest));
+    for (int j = 0; j < task->n_outputs; ++j) have[j] = 0;
     while (getline(&line, &cap, f) != -1) {
         trim(line);
-        if (strncmp(line, "result_hash:", 12) == 0) {
+        if (strncmp(line, "digest:", 7) == 0) {
+            char *p = line + 7;
+            while (*p && isspace((unsigned char)*p)) p++;
+            known = digest_algorithm_from_name(p, &algo) == 0;
+        } else if (strncmp(line, "result_hash:", 12) == 0) {
             char *p = line + 12;
             while (*p && isspace((unsigned char)*p)) p++;
-            strncpy(result_hash_buf, p, sizeof(result_hash_buf)-1);
-        } else if (strncmp(line, "output ", 7) == 0) {
-            char *p = line + 7;
-            // format: output <filename> <blob_hash>
+            if (*p && digest_from_hex(p, result) != 0) memset(result, 0, sizeof(Digest));
+        } else if (strncmp(line, "output ", 7) == 0 || strncmp(line, "tree ", 5) == 0) {
+            int tree = line[0] == 't';
+            char *p = line + (tree ? 5 : 7);
+            // format: output <filename> <blob_hash>, or tree <dirname> <tree_hash>
             char *fname = strtok(p, " ");
             char *h = strtok(NULL, " ");
-            if (fname && h) {
-                output_names[n_outputs] = strdup_safe(fname);
-                output_hashes[n_outputs] = strdup_safe(h);
-                n_outputs++;
+            Digest d;
+            if (!fname || !h || digest_from_hex(h, &d) != 0) continue;
+            // only outputs the task declares
+            for (int j = 0; j < task->n_outputs; ++j) {
+                if (strcmp(task->outputs[j], fname) != 0) continue;
+                outputs[j] = d;
+                have[j] = tree ? 2 : 1;
             }
         }
     }
     free(line);
     fclose(f);
-    if (strlen(result_hash_buf) > 0) {
-        task->result_hash = strdup_safe(result_hash_buf);
-    } else {
-        task->result_hash = strdup_safe("");
+    return known && algo == digest_algorithm() ? 1 : 0;
+}
+
+// Load existing record if present
+int try_load_task_record(Task *task) {
+    if (!task || digest_is_zero(&task->task_hash)) return 0;
+    int n = task->n_outputs > 0 ? task->n_outputs : 1;
+    // outputs are restored together once the record is read
+    Digest *blobs = malloc(sizeof(Digest) * n);
+    const char **dests = malloc(sizeof(char *) * n);
+    int *have = malloc(sizeof(int) * n);
+    if (!blobs || !dests || !have) {
+        free(blobs);
+        free(dests);
+        free(have);
+        return -1;
     }
-    // If outputs exist, restore them to allow user to have them available when using cached result
-    for (int i = 0; i < n_outputs; ++i) {
-        // locate task->outputs to match by name; only restore if output is declared in task
+    Digest result;
+    int rc = parse_record(task, &result, blobs, have);
+    if (rc == 1) {
+        int n_restore = 0, failed = 0;
         for (int j = 0; j < task->n_outputs; ++j) {
-            if (strcmp(task->outputs[j], output_names[i]) == 0) {
-                cas_restore_blob_to_file(output_hashes[i], task->outputs[j]);
+            int dup = 0;
+            for (int k = 0; k < j && !dup; ++k) dup = strcmp(task->outputs[k], task->outputs[j]) == 0;
+            if (!have[j] || dup) continue;
+            // a directory is brought in line with its tree entry by entry
+            if (have[j] == 2) {
+                if (tree_restore(&blobs[j], task->outputs[j]) != 0) failed = 1;
+                continue;
             }
+            blobs[n_restore] = blobs[j];
+            dests[n_restore++] = task->outputs[j];
+        }
+        if (cas_restore_blobs_batch(blobs, dests, n_restore) != 0) failed = 1;
+        if (failed) {
+            // an output is missing or damaged: run the command instead
+            fprintf(stderr, "Warning: could not restore every output of '%s' from the cache\n", task->name);
+            rc = 0;
+        } else {
+            task->result_hash = result;
+            task->status = STATUS_SKIPPED;
         }
-        free(output_names[i]);
-        free(output_hashes[i]);
     }
-    task->status = STATUS_SKIPPED;
-    return 1;
+    free(blobs);
+    free(dests);
+    free(have);
+    return rc;
 }
 
-int write_task_record(Task *task) {
-    if (!task || !task->task_hash) return -1;
+// The objects a record's "output" and "tree" lines name, in *out (caller
+// frees). Returns 0, or -1 if out of memory.
+static int record_objects(const unsigned char *data, size_t len, Digest **out, size_t *n) {
+    char *text = malloc(len + 1);
+    *out = malloc(sizeof(Digest) * (len / DIGEST_HEX_SIZE + 1));
+    *n = 0;
+    if (!text || !*out) {
+        free(text);
+        free(*out);
+        *out = NULL;
+        return -1;
+    }
+    memcpy(text, data, len);
+    text[len] = '\0';
+    // output <filename> <blob_hash>, or tree <dirname> <tree_hash>
+    char *save = NULL;
+    for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (strncmp(line, "output ", 7) != 0 && strncmp(line, "tree ", 5) != 0) continue;
+        char *h = strrchr(line, ' ');
+        if (h && digest_from_hex(h + 1, &(*out)[*n]) == 0) (*n)++;
+    }
+    free(text);
+    return 0;
+}
+
+// Copy the remote action cache's record for task->task_hash into the
+// local cache, so try_load_task_record can use it. The objects it names
+// are fetched first and the record committed after them, as a local
+// record is. Returns 1 if one was copied, 0 if there is none (or it is
+// not this task's, or its outputs cannot be had), -1 on error.
+static int fetch_remote_record(const Task *task) {
+    unsigned char *data;
+    size_t len;
+    int rc = remote_cas_get_action(&task->task_hash, &data, &len);
+    if (rc != 1) return rc;
+    // the record must name the task it was asked for
+    char hex[DIGEST_HEX_SIZE], first[16 + DIGEST_HEX_SIZE];
+    int n = snprintf(first, sizeof(first), "task_hash: %s\n", digest_to_hex(&task->task_hash, hex));
+    if (len < (size_t)n || memcmp(data, first, (size_t)n) != 0) {
+        fprintf(stderr, "Warning: the remote record for '%s' is for another task\n", task->name);
+        free(data);
+        return 0;
+    }
+    Digest *objects;
+    size_t n_objects;
+    if (record_objects(data, len, &objects, &n_objects) != 0) {
+        free(data);
+        return -1;
+    }
+    if (n_objects > 0 && remote_cas_fetch_objects(objects, n_objects, REMOTE_CAS_URGENT) != 0) {
+        fprintf(stderr, "Warning: could not fetch every output of '%s' from the remote CAS\n", task->name);
+        rc = 0;
+    }
+    char name[DIGEST_HEX_SIZE + sizeof(META_EXT)];
+    snprintf(name, sizeof(name), "%s%s", hex, META_EXT);
+    if (rc == 1 && (cas_write_cache_file(name, data, len) != 0 || durability_commit() != 0)) rc = -1;
+    free(objects);
+    free(data);
+    return rc;
+}
+
+// Bring in from the remote CAS what a cache hit on task needs: the outputs
+// its local record names (those here already are not asked for), or on a
+// local miss the record another machine wrote. These are network
+// round-trips, so they happen before the collector's lock is taken; a
+// collection in between can only make the restore fail, which is a miss.
+static void fetch_remote(const Task *task) {
     char meta_path[2048];
-    snprintf(meta_path, sizeof(meta_path), "%s/%s%s", cas_get_cache_root(), task->task_hash, META_EXT);
-    FILE *f = fopen(meta_path, "w");
+    meta_path_for(task, meta_path, sizeof(meta_path));
+    if (!file_exists(meta_path)) {
+        fetch_remote_record(task);
+        return;
+    }
+    size_t len;
+    char *text = read_entire_file(meta_path, &len);
+    Digest *objects;
+    size_t n_objects;
+    if (text && record_objects((const unsigned char *)text, len, &objects, &n_objects) == 0) {
+        if (n_objects > 0 && remote_cas_fetch_objects(objects, n_objects, REMOTE_CAS_URGENT) != 0)
+            fprintf(stderr, "Warning: could not fetch every output of '%s' from the remote CAS\n", task->name);
+        free(objects);
+    }
+    free(text);
+}
+
+// Hand a newly written record to the remote action cache, with the
+// outputs it names; the upload happens in the background
+static void publish_record(const Task *task) {
+    char meta_path[2048];
+    meta_path_for(task, meta_path, sizeof(meta_path));
+    size_t len;
+    char *text = read_entire_file(meta_path, &len);
+    Digest *objects = malloc(sizeof(Digest) * (task->n_outputs > 0 ? task->n_outputs : 1));
+    if (text && objects) {
+        size_t n = 0;
+        for (int i = 0; task->output_hashes && i < task->n_outputs; ++i)
+            if (!digest_is_zero(&task->output_hashes[i])) objects[n++] = task->output_hashes[i];
+        remote_cas_put_action_async(&task->task_hash, objects, n, (const unsigned char *)text, len);
+    }
+    free(text);
+    free(objects);
+}
+
+int read_task_record(const Task *task, Digest *outputs) {
+    if (!task || digest_is_zero(&task->task_hash)) return 0;
+    int *have = malloc(sizeof(int) * (task->n_outputs > 0 ? task->n_outputs : 1));
+    if (!have) return -1;
+    Digest result;
+    int rc = parse_record(task, &result, outputs, have);
+    for (int j = 0; j < task->n_outputs; ++j)
+        if (!have[j]) memset(&outputs[j], 0, sizeof(Digest));
+    free(have);
+    return rc;
+}
+
+// With store_missing, outputs without a digest yet are stored from the
+// workspace; otherwise they are left out of the record
+// The record is composed in memory and published whole (never edited in
+// place), ordered after the objects it names
+static int write_record(Task *task, int store_missing) {
+    if (!task || digest_is_zero(&task->task_hash)) return -1;
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
     if (!f) return -1;
-    fprintf(f, "task_hash: %s\n", task->task_hash);
-    fprintf(f, "result_hash: %s\n", task->result_hash ? task->result_hash : "");
+    char hex[DIGEST_HEX_SIZE];
+    fprintf(f, "task_hash: %s\n", digest_to_hex(&task->task_hash, hex));
+    if (digest_algorithm() != DIGEST_SHA256) fprintf(f, "digest: %s\n", digest_algorithm_name(digest_algorithm()));
+    fprintf(f, "result_hash: %s\n", digest_is_zero(&task->result_hash) ? "" : digest_to_hex(&task->result_hash, hex));
     for (int i = 0; i < task->n_outputs; ++i) {
         char *out = task->outputs[i];
-        // compute its blob hash from stored CAS by re-hashing its file (should match existing)
-        char *h = cas_store_blob_from_file(out);
-        if (!h) continue;
-        fprintf(f, "output %s %s\n", out, h);
-        free(h);
+        // outputs were ingested by compute_result_hash; only store here if that was skipped
+        Digest d;
+        if (task->output_hashes && !digest_is_zero(&task->output_hashes[i])) d = task->output_hashes[i];
+        else if (!store_missing || tree_store_paths((const char *const *)&out, 1, &d) != 0) continue;
+        fprintf(f, "%s %s %s\n", cas_is_tree(&d) == 1 ? "tree" : "output", out, digest_to_hex(&d, hex));
+    }
+    int rc = fclose(f) == 0 ? 0 : -1;
+    char name[DIGEST_HEX_SIZE + sizeof(META_EXT)];
+    snprintf(name, sizeof(name), "%s%s", digest_to_hex(&task->task_hash, hex), META_EXT);
+    if (rc == 0) rc = cas_write_cache_file(name, text, len);
+    free(text);
+    return rc;
+}
+
+int write_task_record(Task *task) {
+    return write_record(task, 1);
+}
+
+// Keep the outputs' digests and derive result_hash from them: the sorted
+// hex digests, comma separated, with an empty field for a missing output
+static int set_output_hashes(Task *task, const Digest *outputs) {
+    int n = task->n_outputs;
+    Digest *sorted = malloc(sizeof(Digest) * (n > 0 ? n : 1));
+    if (!sorted) return -1;
+    memcpy(sorted, outputs, sizeof(Digest) * n);
+    free(task->output_hashes);
+    task->output_hashes = malloc(sizeof(Digest) * (n > 0 ? n : 1));
+    if (task->output_hashes) memcpy(task->output_hashes, outputs, sizeof(Digest) * n);
+    qsort(sorted, n, sizeof(Digest), digest_qsort_cmp);
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    for (int i = 0; i < n; ++i) {
+        if (!digest_is_zero(&sorted[i])) sha256_update_hex(&ctx, &sorted[i]);
+        if (i + 1 < n) sha256_update_str(&ctx, ",");
     }
-    fclose(f);
+    sha256_final(&ctx, task->result_hash.b);
+    free(sorted);
     return 0;
 }
 
-// Helper to compute result_hash from outputs (sort output hashes and hash their concatenation)
+// Helper to compute result_hash from outputs (sort output hashes and hash their concatenation).
+// Also stores the outputs in the CAS and keeps their hashes in task->output_hashes.
 static int compute_result_hash(Task *task) {
     if (!task) return -1;
-    char **hashes = malloc(sizeof(char*) * task->n_outputs);
-    for (int i = 0; i < task->n_outputs; ++i) {
-        if (!file_exists(task->outputs[i])) {
-            hashes[i] = strdup_safe("");
-        } else {
-            char *h = cas_store_blob_from_file(task->outputs[i]);
-            if (!h) hashes[i] = strdup_safe("");
-            else hashes[i] = h;
-        }
-    }
-    // sort
-    for (int i = 0; i < task->n_outputs; ++i)
-        for (int j = i+1; j < task->n_outputs; ++j)
-            if (strcmp(hashes[i], hashes[j]) > 0) {
-                char *t = hashes[i];
-                hashes[i] = hashes[j];
-                hashes[j] = t;
-            }
-    // concatenate
-    size_t bufcap = 4096;
-    char *buf = malloc(bufcap);
-    buf[0] = '\0';
-    for (int i = 0; i < task->n_outputs; ++i) {
-        strcat(buf, hashes[i]);
-        if (i + 1 < task->n_outputs) strcat(buf, ",");
-    }
-    // hash this
-    extern void sha256_init(SHA256_CTX *ctx);
-    extern void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len);
-    extern void sha256_final(SHA256_CTX *ctx, uint8_t hash[]);
-    SHA256_CTX ctx;
-    uint8_t digest[32];
-    sha256_init(&ctx);
-    sha256_update(&ctx, (unsigned char*)buf, strlen(buf));
-    sha256_final(&ctx, digest);
-    char *hex = hex_encode(digest, 32);
-    if (!hex) {
-        free(buf);
-        for (int i = 0; i < task->n_outputs; ++i) free(hashes[i]);
-        free(hashes);
-        return -1;
-    }
-    task->result_hash = strdup_safe(hex);
-    free(hex);
-    free(buf);
-    for (int i = 0; i < task->n_outputs; ++i) free(hashes[i]);
+    int n = task->n_outputs;
+    Digest *hashes = malloc(sizeof(Digest) * (n > 0 ? n : 1));
+    if (!hashes) return -1;
+    // hash and store each output in a single read (a directory as a tree);
+    // missing or unreadable outputs stay zero and contribute an empty field
+    tree_store_paths((const char *const *)task->outputs, n, hashes);
+    int rc = set_output_hashes(task, hashes);
     free(hashes);
-    return 0;
+    return rc;
+}
+
+int write_task_record_for(Task *task, const Digest *outputs) {
+    if (set_output_hashes(task, outputs) != 0) return -1;
+    return write_record(task, 0);
 }
 
 // Execute a task: check cache, run if needed, update outputs
@@ -505,15 +629,21 @@ int execute_task(Task *task) {
     if (!task) return -1;
     task->status = STATUS_RUNNING;
     // compute task hash (requires that dependency tasks already have result_hash set)
-    if (!task->task_hash) {
+    if (digest_is_zero(&task->task_hash)) {
         if (compute_task_hash(task) != 0) {
             fprintf(stderr, "Failed to compute hash for task %s\n", task->name);
             task->status = STATUS_FAILED;
             return -1;
         }
     }
-    // Try cache
+    // another machine may have run it: the remote is asked before the lock
+    if (g_remote_cas_config.enabled) fetch_remote(task);
+    // Try cache; the collector cannot delete the record's objects while
+    // they are being restored
+    gc_lock_shared();
     int cache_hit = try_load_task_record(task);
+    if (cache_hit == 1) gc_note_access(&task->task_hash);
+    gc_unlock_shared();
     if (cache_hit == 1) {
         // already loaded outputs
         task->status = STATUS_SKIPPED;
@@ -522,6 +652,9 @@ int execute_task(Task *task) {
         // error reading
         fprintf(stderr, "Error reading cache metadata for task %s\n", task->name);
     }
+    // Outputs restored as hardlinks are read-only views of CAS objects; give
+    // the command private copies to overwrite
+    for (int i = 0; i < task->n_outputs; ++i) tree_detach(task->outputs[i]);
     // Run the command
     printf("==> Running task '%s': %s\n", task->name, task->cmd ? task->cmd : "(no cmd)"); fflush(stdout);
     int ret = system(task->cmd);
@@ -530,22 +663,107 @@ int execute_task(Task *task) {
         task->status = STATUS_FAILED;
         return -1;
     }
-    // After execution, compute result hash
+    // After execution, compute result hash. Outputs stored here are not
+    // referenced by any record until it is written, so hold off the collector
+    gc_lock_shared();
     if (compute_result_hash(task) != 0) {
+        gc_unlock_shared();
         fprintf(stderr, "Failed to compute result hash for task '%s'\n", task->name);
         task->status = STATUS_FAILED;
         return -1;
     }
-    // Write record (also stores outputs into CAS)
-    if (write_task_record(task) != 0) {
+    // Write record (also stores outputs into CAS). The task boundary is where
+    // batched durability commits, still under the lock so the collector
+    // never sees the objects linked without their record.
+    int written = write_task_record(task);
+    if (written == 0 && durability_commit() != 0) written = -1;
+    gc_unlock_shared();
+    if (written != 0) {
         fprintf(stderr, "Failed to write metadata for task '%s'\n", task->name);
         task->status = STATUS_FAILED;
         return -1;
     }
+    if (g_remote_cas_config.enabled) publish_record(task);
     task->status = STATUS_SUCCESS;
     return 0;
 }
 
+// One background prefetch at a time
+static pthread_t prefetch_thread;
+static int prefetch_running = 0;
+static int prefetch_stopping = 0;
+static Task **prefetch_tasks;
+static int prefetch_n;
+
+// Look up each task's record from its inputs as they are now, then fetch
+// what the records name in one go. The inputs' digests come from the stat
+// index alone, so the prefetch reads no file the executor is about to hash.
+// A task whose inputs are not all there yet (a dependency makes them) or
+// not indexed is passed over; its hit, if any, fetches on demand.
+static void *prefetch_main(void *arg) {
+    (void)arg;
+    Digest *all = NULL;
+    size_t n_all = 0, cap = 0;
+    for (int i = 0; i < prefetch_n && !__atomic_load_n(&prefetch_stopping, __ATOMIC_ACQUIRE); ++i) {
+        const Task *t = prefetch_tasks[i];
+        // only what the manifest fixed: the executor writes the rest
+        Task scratch = { 0 };
+        scratch.name = t->name;
+        scratch.cmd = t->cmd;
+        scratch.inputs = t->inputs;
+        scratch.n_inputs = t->n_inputs;
+        scratch.outputs = t->outputs;
+        scratch.n_outputs = t->n_outputs;
+        scratch.n_deps = t->n_deps;
+        if (t->n_outputs <= 0 || task_hash(&scratch, 1) != 0) continue;
+        Digest *objects = malloc(sizeof(Digest) * t->n_outputs);
+        size_t n = 0;
+        if (objects && read_task_record(&scratch, objects) == 1) {
+            n = (size_t)t->n_outputs;
+        } else {
+            unsigned char *data;
+            size_t len;
+            free(objects);
+            objects = NULL;
+            if (remote_cas_get_action(&scratch.task_hash, &data, &len) == 1) {
+                record_objects(data, len, &objects, &n);
+                free(data);
+            }
+        }
+        for (size_t j = 0; objects && j < n; ++j) {
+            if (digest_is_zero(&objects[j])) continue;
+            if (n_all == cap) {
+                size_t grown = cap ? cap * 2 : 256;
+                Digest *p = realloc(all, grown * sizeof(Digest));
+                if (!p) break;
+                all = p;
+                cap = grown;
+            }
+            all[n_all++] = objects[j];
+        }
+        free(objects);
+    }
+    if (n_all > 0 && !__atomic_load_n(&prefetch_stopping, __ATOMIC_ACQUIRE))
+        remote_cas_fetch_objects(all, n_all, REMOTE_CAS_BACKGROUND);
+    free(all);
+    return NULL;
+}
+
+void prefetch_task_outputs(Task **tasks, int n) {
+    if (!g_remote_cas_config.enabled || prefetch_running || n <= 0) return;
+    prefetch_tasks = tasks;
+    prefetch_n = n;
+    prefetch_stopping = 0;
+    prefetch_running = pthread_create(&prefetch_thread, NULL, prefetch_main, NULL) == 0;
+}
+
+void prefetch_wait(void) {
+    if (!prefetch_running) return;
+    __atomic_store_n(&prefetch_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(prefetch_thread, NULL);
+    prefetch_running = 0;
+}
+
 // Simple recursive print of graph; avoid infinite loops via visited set
 static void print_task_recursive(Task *t, int indent, Task **all, int all_n, int *visited_flags) {
     int idx = -1;
@@ -561,8 +779,9 @@ static void print_task_recursive(Task *t, int indent, Task **all, int all_n, int
 
     for (int i = 0; i < indent; ++i) printf("  ");
     printf("%s %s", sym, t->name);
-    if (t->task_hash) printf(" (hash=%s)", t->task_hash);
-    if (t->result_hash) printf(" res=%s", t->result_hash);
+    char hex[DIGEST_HEX_SIZE];
+    if (!digest_is_zero(&t->task_hash)) printf(" (hash=%s)", digest_to_hex(&t->task_hash, hex));
+    if (!digest_is_zero(&t->result_hash)) printf(" res=%s", digest_to_hex(&t->result_hash, hex));
     printf("\n");
     // show dependencies
     for (int i = 0; i < t->n_deps; ++i) {
@@ -2,6 +2,7 @@
 #define TASK_H
 
 #include <stdbool.h>
+#include "digest.h"
 
 typedef enum {
     STATUS_PENDING,
@@ -21,9 +22,10 @@ typedef struct Task {
     char **deps;
     int n_deps;
 
-    // content hashes
-    char *task_hash;       // computed from cmd + input hashes + deps' result hashes
-    char *result_hash;     // derived from outputs (after run)
+    // content hashes (all-zero until computed)
+    Digest task_hash;      // computed from cmd + input hashes + deps' result hashes
+    Digest result_hash;    // derived from outputs (after run)
+    Digest *output_hashes; // per-output blob digest, parallel to outputs (zero = not stored)
 
     task_status_t status;
 
@@ -64,9 +66,27 @@ int try_load_task_record(Task *task);
 // Write task record after successful run (stores outputs and result_hash). Returns 0 on success.
 int write_task_record(Task *task);
 
+// Read the record for task->task_hash without restoring anything:
+// outputs[j] gets the recorded digest of task->outputs[j], or zero. Returns
+// 1 if there is a record for the current digest algorithm, 0 if not, -1 on error.
+int read_task_record(const Task *task, Digest *outputs);
+
+// Record outputs that are already in the CAS: outputs[j] is the digest of
+// task->outputs[j] (zero if it was not produced). Sets result_hash as a run
+// would. Returns 0 on success.
+int write_task_record_for(Task *task, const Digest *outputs);
+
 // Execute a task, respecting cache. Returns 0 on success, nonzero on failure.
 int execute_task(Task *task);
 
+// With a remote CAS, fetch in the background the outputs of every task in
+// tasks[0..n) whose record (local, or in the remote action cache) can be
+// found from its inputs as they are now, so its cache hit finds them here.
+// prefetch_wait stops looking for more records, waits for the fetch
+// already asked for, and must come before the tasks are freed.
+void prefetch_task_outputs(Task **tasks, int n);
+void prefetch_wait(void);
+
 // Print dependency/status diagram for a set of tasks (roots inferred).
 void print_task_graph(Task **tasks, int n);
 
@@ -0,0 +1,57 @@
+// Existence probes for missing objects with and without the object filter,
+// against a store of the given number of objects (default 20000).
+#define _POSIX_C_SOURCE 200809L
+#include "../cas.h"
+#include "../bloom.h"
+#include "../sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Probe `probes` digests that are not in the store; returns probes per second
+static double run_probes(int probes, int *found) {
+    double t0 = now_sec();
+    *found = 0;
+    for (int i = 0; i < probes; ++i) {
+        char key[32];
+        Digest d;
+        int len = snprintf(key, sizeof(key), "missing %d", i);
+        sha256_digest((const unsigned char *)key, (size_t)len, d.b);
+        *found += cas_blob_exists(&d);
+    }
+    return probes / (now_sec() - t0);
+}
+
+int main(int argc, char **argv) {
+    int objects = argc > 1 ? atoi(argv[1]) : 20000;
+    int probes = 200000;
+    if (cas_init(".") != 0) { fprintf(stderr, "cas_init failed\n"); return 1; }
+    for (int i = 0; i < objects; ++i) {
+        char blob[32];
+        Digest d;
+        int len = snprintf(blob, sizeof(blob), "object %d", i);
+        if (cas_store_blob_from_memory((const unsigned char *)blob, (size_t)len, &d) != 0) return 1;
+    }
+    int found;
+    double with_filter = run_probes(probes, &found);
+    CasStats st;
+    cas_get_stats(&st);
+    BloomInfo info;
+    bloom_get_info(&info);
+    bloom_close(); // probes fall back to the filesystem
+    int found_stat;
+    double without = run_probes(probes, &found_stat);
+    printf("%d objects, %d probes for missing objects\n", objects, probes);
+    printf("  filter:  %10.0f probes/s  (false positives %.4f%%, estimated %.4f%%)\n", with_filter,
+           100.0 * cas_filter_fp_rate(&st), 100.0 * info.estimated_fp_rate);
+    printf("  stat:    %10.0f probes/s\n", without);
+    cas_shutdown();
+    return found || found_stat;
+}
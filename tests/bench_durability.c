@@ -0,0 +1,63 @@
+// Store throughput under each durability mode: tasks that each store a few
+// new objects and a record, with the commit at every task boundary.
+// Arguments: tasks (default 200), objects per task (8), object size in KiB (16).
+#define _POSIX_C_SOURCE 200809L
+#include "../cas.h"
+#include "../durability.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int tasks = argc > 1 ? atoi(argv[1]) : 200;
+    int per_task = argc > 2 ? atoi(argv[2]) : 8;
+    size_t size = (size_t)(argc > 3 ? atoi(argv[3]) : 16) * 1024;
+    unsigned char *buf = malloc(size);
+    if (!buf) return 1;
+    printf("%d tasks x %d objects of %zu KiB, commit per task\n", tasks, per_task, size / 1024);
+    double base = 0;
+    for (int m = DURABILITY_NONE; m <= DURABILITY_STRICT; ++m) {
+        // a fresh store per mode, so every object is new
+        char dir[64];
+        snprintf(dir, sizeof(dir), "store-%s", durability_mode_name((DurabilityMode)m));
+        mkdir(dir, 0755);
+        if (cas_init(dir) != 0) { fprintf(stderr, "cas_init failed\n"); return 1; }
+        durability_set_mode((DurabilityMode)m);
+        double t0 = now_sec();
+        for (int t = 0; t < tasks; ++t) {
+            char record[4096];
+            size_t len = 0;
+            for (int i = 0; i < per_task; ++i) {
+                // distinct and incompressible enough
+                uint32_t x = (uint32_t)(t * 7919 + i) * 2654435761u;
+                for (size_t j = 0; j < size; ++j) {
+                    x = x * 1103515245u + 12345u;
+                    buf[j] = (unsigned char)(x >> 16);
+                }
+                Digest d;
+                char hex[DIGEST_HEX_SIZE];
+                if (cas_store_blob_from_memory(buf, size, &d) != 0) return 1;
+                len += snprintf(record + len, sizeof(record) - len, "output out%d %s\n", i, digest_to_hex(&d, hex));
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "task%d.meta", t);
+            if (cas_write_cache_file(name, record, len) != 0 || durability_commit() != 0) return 1;
+        }
+        double secs = now_sec() - t0;
+        cas_shutdown();
+        double rate = tasks * per_task / secs;
+        if (m == DURABILITY_NONE) base = rate;
+        printf("  %-8s %9.0f objects/s  %8.1f MB/s  %6.1f tasks/s  (%.2fx of none)\n",
+               durability_mode_name((DurabilityMode)m), rate, rate * size / 1e6, tasks / secs, rate / base);
+    }
+    free(buf);
+    return 0;
+}
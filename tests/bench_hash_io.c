@@ -0,0 +1,64 @@
+// Hashing throughput of each hash_io read strategy across file sizes, on
+// the filesystem of the current directory. Files are hashed warm (in the
+// page cache), which is the common case for inputs written by earlier tasks.
+#define _POSIX_C_SOURCE 200809L
+#include "../hash_io.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t total_mb = argc > 1 ? (size_t)atoi(argv[1]) : 256;
+    static const size_t sizes[] = { 4 << 10, 64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20, 128 << 20 };
+    const char *path = "bench_hash_io.tmp";
+    unsigned char *block = malloc(1 << 20);
+    if (!block) return 1;
+    for (size_t i = 0; i < (1 << 20); ++i) block[i] = (unsigned char)(i * 131 + 7);
+
+    printf("%-10s", "size");
+    for (int s = HASH_IO_PREAD; s < HASH_IO_COUNT; ++s) printf(" %10s", hash_io_strategy_name((HashIoStrategy)s));
+    printf(" %10s\n", "auto uses");
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        size_t size = sizes[k];
+        FILE *f = fopen(path, "wb");
+        if (!f) { perror("fopen"); return 1; }
+        for (size_t done = 0; done < size; done += 1 << 20)
+            fwrite(block, 1, size - done < (1 << 20) ? size - done : (1 << 20), f);
+        fclose(f);
+        // the same number of bytes for every size, at least a few passes
+        size_t reps = (total_mb << 20) / size;
+        if (reps < 3) reps = 3;
+
+        char label[32];
+        if (size >= (1 << 20)) snprintf(label, sizeof(label), "%zuM", size >> 20);
+        else snprintf(label, sizeof(label), "%zuK", size >> 10);
+        printf("%-10s", label);
+        for (int s = HASH_IO_PREAD; s < HASH_IO_COUNT; ++s) {
+            uint8_t digest[32];
+            double start = now_sec();
+            for (size_t r = 0; r < reps; ++r) {
+                int fd = open(path, O_RDONLY);
+                if (fd < 0 || hash_io_sha256_fd(fd, (HashIoStrategy)s, digest) != 0) return 1;
+                close(fd);
+            }
+            double elapsed = now_sec() - start;
+            printf(" %8.1f/s", (double)reps * size / (1 << 20) / elapsed);
+        }
+        struct stat st;
+        stat(path, &st);
+        printf(" %10s\n", hash_io_strategy_name(hash_io_choose(&st)));
+    }
+    printf("(MB/s, includes open/close)\n");
+    remove(path);
+    free(block);
+    return 0;
+}
@@ -0,0 +1,69 @@
+// Throughput of each SHA-256 backend available on this CPU.
+#define _POSIX_C_SOURCE 200809L
+#include "../sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc > 1 ? (size_t)atoi(argv[1]) : 256;
+    size_t buf_len = 1 << 20;
+    unsigned char *buf = malloc(buf_len);
+    if (!buf) return 1;
+    for (size_t i = 0; i < buf_len; ++i) buf[i] = (unsigned char)(i * 131 + 7);
+
+    int n = 0;
+    const Sha256Backend *backends = sha256_backends(&n);
+    printf("%-10s %12s\n", "backend", "MB/s");
+    for (int i = 0; i < n; ++i) {
+        if (!backends[i].available()) {
+            printf("%-10s %12s\n", backends[i].name, "n/a");
+            continue;
+        }
+        sha256_set_backend(backends[i].name);
+        SHA256_CTX ctx;
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        double start = now_sec();
+        sha256_init(&ctx);
+        for (size_t j = 0; j < mb; ++j) sha256_update(&ctx, buf, buf_len);
+        sha256_final(&ctx, digest);
+        double elapsed = now_sec() - start;
+        printf("%-10s %12.1f\n", backends[i].name, mb / elapsed);
+    }
+
+    // Many small messages: single stream loop vs multi-buffer lanes
+    enum { N_SMALL = 4096 };
+    size_t small_len = 512;
+    const uint8_t *msgs[N_SMALL];
+    size_t lens[N_SMALL];
+    static uint8_t digests[N_SMALL][SHA256_DIGEST_SIZE];
+    for (int m = 0; m < N_SMALL; ++m) {
+        msgs[m] = buf + (m * 97) % (buf_len - small_len);
+        lens[m] = small_len;
+    }
+    printf("\n%-10s %12s %12s   (%d x %zu-byte messages)\n", "backend", "loop MB/s", "batch MB/s",
+           N_SMALL, small_len);
+    for (int i = 0; i < n; ++i) {
+        if (!backends[i].available()) continue;
+        sha256_set_backend(backends[i].name);
+        double total_mb = (double)N_SMALL * small_len * 32 / (1 << 20);
+        double start = now_sec();
+        for (int r = 0; r < 32; ++r)
+            for (int m = 0; m < N_SMALL; ++m) sha256_digest(msgs[m], lens[m], digests[m]);
+        double loop = now_sec() - start;
+        start = now_sec();
+        for (int r = 0; r < 32; ++r) sha256_digest_many(msgs, lens, N_SMALL, digests);
+        double batch = now_sec() - start;
+        printf("%-10s %12.1f %12.1f   [%s]\n", backends[i].name, total_mb / loop, total_mb / batch,
+               sha256_mb_backend_name());
+    }
+    free(buf);
+    return 0;
+}
@@ -66,7 +66,46 @@ DURATION=$(echo "$END - $START" | bc)
 echo "Cached execution time: ${DURATION}s"
 echo "Benchmark 3 - Cached: ${DURATION}s" >> $BENCHMARK_RESULTS
 
+# Benchmark 4: SHA-256 backend throughput
+echo ""
+echo "Benchmark 4: SHA-256 Backend Throughput"
+gcc -std=c99 -O2 ../sha256.c bench_sha256.c -o bench_sha256 -lpthread
+./bench_sha256 256 | tee -a $BENCHMARK_RESULTS
+
+# Benchmark 5: file read strategies for hashing (pread / read / mmap)
+echo ""
+echo "Benchmark 5: Hashing I/O Strategies by File Size"
+gcc -std=c99 -O2 ../hash_io.c ../sha256.c bench_hash_io.c -o bench_hash_io -lpthread
+./bench_hash_io 256 | tee -a $BENCHMARK_RESULTS
+
+# Benchmark 6: existence probes for missing objects, object filter vs stat
+echo ""
+echo "Benchmark 6: Missing-Object Probes (Object Filter vs stat)"
+gcc -std=c99 -O2 ../cas.c ../util.c ../sha256.c ../blake3.c ../stat_index.c ../pack.c ../digest.c ../chunker.c \
+    ../compression.c ../hash_pool.c ../hash_io.c ../io_batch.c ../bloom.c ../durability.c ../logger.c bench_bloom.c \
+    -o bench_bloom -lpthread -lm
+BLOOM_DIR=$(mktemp -d)
+(cd "$BLOOM_DIR" && "$OLDPWD/bench_bloom" 20000) | tee -a $BENCHMARK_RESULTS
+rm -rf "$BLOOM_DIR"
+
+# Benchmark 7: BLAKE3 tree hashing by backend and thread count, against SHA-256
+echo ""
+echo "Benchmark 7: BLAKE3 vs SHA-256 Throughput"
+gcc -std=c99 -O2 ../blake3.c ../hash_pool.c ../sha256.c bench_blake3.c -o bench_blake3 -lpthread
+./bench_blake3 256 | tee -a $BENCHMARK_RESULTS
+
+# Benchmark 8: store throughput under each durability mode
+echo ""
+echo "Benchmark 8: Durability Modes (none / batched / strict)"
+gcc -std=c99 -O2 ../cas.c ../util.c ../sha256.c ../blake3.c ../stat_index.c ../pack.c ../digest.c ../chunker.c \
+    ../compression.c ../hash_pool.c ../hash_io.c ../io_batch.c ../bloom.c ../durability.c ../logger.c \
+    bench_durability.c -o bench_durability -lpthread -lm
+DURABILITY_DIR=$(mktemp -d)
+(cd "$DURABILITY_DIR" && "$OLDPWD/bench_durability" 200 8 16) | tee -a $BENCHMARK_RESULTS
+rm -rf "$DURABILITY_DIR"
+
 # Cleanup
+rm -f bench_sha256 bench_hash_io bench_bloom bench_blake3 bench_durability
 rm -f bench_manifest.txt hello.o hello_bench output.txt
 
 echo ""
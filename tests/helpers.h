@@ -0,0 +1,84 @@
+// Fixtures shared by the C tests: objects with reproducible content and
+// task records written the way task.c writes them
+#ifndef TESTS_HELPERS_H
+#define TESTS_HELPERS_H
+
+#include "../cas.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CHECK(cond, msg) do { if (!(cond)) { fprintf(stderr, "FAIL: %s\n", msg); return 1; } } while (0)
+
+static inline void fill_random(unsigned char *buf, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (unsigned char)(seed >> 16);
+    }
+}
+
+static inline void write_random(const char *path, size_t len, uint32_t seed) {
+    unsigned char *buf = malloc(len ? len : 1);
+    if (buf) fill_random(buf, len, seed);
+    FILE *f = fopen(path, "wb");
+    if (!buf || !f || fwrite(buf, 1, len, f) != len || fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+    free(buf);
+}
+
+// Store len bytes seeded by tag; through a file so large blobs are chunked
+static inline Digest store(const char *tag, size_t len) {
+    uint32_t seed = 2166136261u;
+    for (const char *p = tag; *p; ++p) seed = (seed ^ (unsigned char)*p) * 16777619u;
+    write_random("tests_input.bin", len, seed);
+    Digest d;
+    if (cas_store_blob_from_file("tests_input.bin", &d) != 0) {
+        fprintf(stderr, "store %s failed\n", tag);
+        exit(1);
+    }
+    remove("tests_input.bin");
+    return d;
+}
+
+// A record naming outs as outputs, written age_seconds ago
+static inline Digest record(const char *tag, const Digest *outs, int n, long age_seconds) {
+    Digest task = store(tag, 8); // any distinct hash will do
+    char hex[DIGEST_HEX_SIZE], path[1200];
+    snprintf(path, sizeof(path), "%s/%s.meta", cas_get_cache_root(), digest_to_hex(&task, hex));
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(f, "task_hash: %s\nresult_hash: \n", hex);
+    for (int i = 0; i < n; ++i) fprintf(f, "output out_%s_%d %s\n", tag, i, digest_to_hex(&outs[i], hex));
+    fclose(f);
+    struct timeval tv[2];
+    gettimeofday(&tv[0], NULL);
+    tv[0].tv_sec -= age_seconds;
+    tv[1] = tv[0];
+    utimes(path, tv);
+    return task;
+}
+
+static inline int record_exists(const Digest *task) {
+    char hex[DIGEST_HEX_SIZE], path[1200];
+    snprintf(path, sizeof(path), "%s/%s.meta", cas_get_cache_root(), digest_to_hex(task, hex));
+    return access(path, F_OK) == 0;
+}
+
+// Whether d restores to content that hashes back to d
+static inline int restores(const Digest *d) {
+    if (cas_restore_blob_to_file(d, "tests_restore.bin") != 0) return 0;
+    char hex[DIGEST_HEX_SIZE], want[DIGEST_HEX_SIZE];
+    int ok = cas_hash_of_file("tests_restore.bin", hex) == 0;
+    remove("tests_restore.bin");
+    return ok && strcmp(hex, digest_to_hex(d, want)) == 0;
+}
+
+#endif // TESTS_HELPERS_H
@@ -10,7 +10,18 @@ make
 echo
 echo "=== Running individual tests ==="
 ./tests/test_util.sh
+./tests/test_sha256.sh
+./tests/test_blake3.sh
+./tests/test_hash_pool.sh
+./tests/test_io_batch.sh
+./tests/test_compression.sh
 ./tests/test_cas.sh
+./tests/test_gc.sh
+./tests/test_scrub.sh
+./tests/test_tree.sh
+./tests/test_bundle.sh
+./tests/test_remote_cas.sh
+./tests/test_stat_index.sh
 ./tests/test_manifest.sh
 ./tests/test_parallel.sh
 ./tests/test_crc32.sh
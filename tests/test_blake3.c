@@ -0,0 +1,109 @@
+#include "../blake3.h"
+#include "../hash_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void to_hex(const uint8_t *d, char *out) {
+    for (int i = 0; i < BLAKE3_OUT_LEN; ++i) sprintf(out + 2*i, "%02x", d[i]);
+}
+
+// Official vectors: input byte i is i % 251
+static const struct { size_t len; const char *hex; } vectors[] = {
+    { 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+    { 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+    { 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+    { 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+    { 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+    { 2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+    { 2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+    { 3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+    { 3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3" },
+    { 4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969" },
+    { 4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995" },
+    { 5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833" },
+    { 5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff" },
+    { 6144, "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205" },
+    { 6145, "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f" },
+    { 7168, "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a" },
+    { 7169, "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817" },
+    { 8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+    { 8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+    { 16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4" },
+    { 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+    { 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+    { 5243657, "fd703f88479a9e85a6e40de8b20d63834707ef57a7ecef671a23f58653f401cb" },
+};
+#define N_VECTORS (sizeof(vectors) / sizeof(vectors[0]))
+
+// Hash in pieces of growing, uneven size
+static void digest_pieces(const uint8_t *data, size_t len, char *hex) {
+    BLAKE3_CTX ctx;
+    uint8_t out[BLAKE3_OUT_LEN];
+    blake3_init(&ctx);
+    size_t off = 0, step = 1;
+    while (off < len) {
+        size_t take = step < len - off ? step : len - off;
+        blake3_update(&ctx, data + off, take);
+        off += take;
+        step = step * 3 + 1;
+    }
+    blake3_final(&ctx, out);
+    to_hex(out, hex);
+}
+
+static int check_all(const uint8_t *buf, const char *label) {
+    char hex[65];
+    uint8_t out[BLAKE3_OUT_LEN];
+    for (size_t i = 0; i < N_VECTORS; ++i) {
+        blake3_digest(buf, vectors[i].len, out);
+        to_hex(out, hex);
+        if (strcmp(hex, vectors[i].hex) != 0) {
+            fprintf(stderr, "%s: len %zu one-shot mismatch: %s\n", label, vectors[i].len, hex);
+            return 1;
+        }
+        digest_pieces(buf, vectors[i].len, hex);
+        if (strcmp(hex, vectors[i].hex) != 0) {
+            fprintf(stderr, "%s: len %zu streaming mismatch: %s\n", label, vectors[i].len, hex);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    size_t max_len = vectors[N_VECTORS - 1].len;
+    uint8_t *buf = malloc(max_len);
+    for (size_t i = 0; i < max_len; ++i) buf[i] = (uint8_t)(i % 251);
+
+    uint8_t out[BLAKE3_OUT_LEN];
+    char hex[65];
+    blake3_digest((const uint8_t *)"abc", 3, out);
+    to_hex(out, hex);
+    if (strcmp(hex, "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85") != 0) {
+        fprintf(stderr, "\"abc\" mismatch: %s\n", hex);
+        return 1;
+    }
+
+    const char *names[] = { "avx2", "generic" };
+    for (int i = 0; i < 2; ++i) {
+        if (blake3_set_backend(names[i]) != 0) {
+            printf("skip backend %s (not supported by this CPU)\n", names[i]);
+            continue;
+        }
+        if (blake3_self_test() != 0) {
+            fprintf(stderr, "self-test failed for backend %s\n", names[i]);
+            return 1;
+        }
+        // default pool size, then with the large vector split across threads
+        if (check_all(buf, names[i]) != 0) return 1;
+        hash_pool_init(3);
+        char label[64];
+        snprintf(label, sizeof(label), "%s, 3 threads", names[i]);
+        if (check_all(buf, label) != 0) return 1;
+        hash_pool_shutdown();
+        printf("backend %s OK\n", names[i]);
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_blake3..."
+gcc -std=c99 -O2 -Wall -Wextra -g blake3.c hash_pool.c tests/test_blake3.c -o tests/test_blake3 -lpthread
+./tests/test_blake3
+echo "PASS: blake3"
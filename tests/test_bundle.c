@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include "../bundle.h"
+#include "../cas.h"
+#include "../durability.h"
+#include "../hash_pool.h"
+#include "../util.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int write_file(const char *path, const unsigned char *data, size_t len) {
+    FILE *f = fopen(path, "wb");
+    int ok = f && fwrite(data, 1, len, f) == len;
+    if (f && fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+static int write_record(const Digest *task, const char *body) {
+    char hex[DIGEST_HEX_SIZE], name[100], text[1024];
+    digest_to_hex(task, hex);
+    snprintf(name, sizeof(name), "%s.meta", hex);
+    snprintf(text, sizeof(text), "task_hash: %s\nresult_hash: %s\n%s", hex, hex, body);
+    return cas_write_cache_file(name, text, strlen(text));
+}
+
+int main(void) {
+    hash_pool_init(3); // imports write across pool threads even on one CPU
+    mkdir("a", 0755);
+    mkdir("b", 0755);
+    CHECK(cas_init("a") == 0, "cas_init a");
+
+    // a chunked file, a file large enough to stream, and a tree of two leaves
+    enum { CHUNKED = 1 << 20, LARGE = 10 << 20 };
+    unsigned char *chunked = malloc(CHUNKED), *large = malloc(LARGE);
+    CHECK(chunked && large, "alloc");
+    fill_random(chunked, CHUNKED, 1);
+    fill_random(large, LARGE, 2);
+    CHECK(write_file("chunked.bin", chunked, CHUNKED) == 0 && write_file("large.bin", large, LARGE) == 0, "write inputs");
+    Digest d_large, d_chunked, d_x, d_y, d_tree, d_gone;
+    CHECK(cas_store_blob_from_file("large.bin", &d_large) == 0, "store large");
+    cas_set_chunk_threshold(256 * 1024);
+    CHECK(cas_store_blob_from_file("chunked.bin", &d_chunked) == 0, "store chunked");
+    cas_set_chunk_threshold(0);
+    Digest *chunks;
+    size_t n_chunks;
+    CHECK(cas_chunk_list(&d_chunked, &chunks, &n_chunks) == 1 && n_chunks > 1, "file is chunked");
+    CHECK(cas_store_blob_from_memory((const unsigned char *)"x\n", 2, &d_x) == 0 &&
+              cas_store_blob_from_memory((const unsigned char *)"y\n", 2, &d_y) == 0,
+          "store leaves");
+    CasTreeEntry entries[] = { { CAS_TREE_FILE, d_x, "x" }, { CAS_TREE_EXEC, d_y, "y" } };
+    CHECK(cas_put_tree(entries, 2, 1, &d_tree) == 0, "store tree");
+    digest_buffer("never stored", 12, &d_gone);
+
+    // task 1 names the files, task 2 the tree and a shared file, task 3 an
+    // object that is not there, task 4 has no record
+    Digest tasks[4];
+    for (int i = 0; i < 4; ++i) digest_buffer(&i, sizeof(i), &tasks[i]);
+    char body[1024], h1[DIGEST_HEX_SIZE], h2[DIGEST_HEX_SIZE];
+    snprintf(body, sizeof(body), "output large.bin %s\noutput chunked.bin %s\n", digest_to_hex(&d_large, h1),
+             digest_to_hex(&d_chunked, h2));
+    CHECK(write_record(&tasks[0], body) == 0, "record 1");
+    snprintf(body, sizeof(body), "tree d %s\noutput chunked.bin %s\n", digest_to_hex(&d_tree, h1),
+             digest_to_hex(&d_chunked, h2));
+    CHECK(write_record(&tasks[1], body) == 0, "record 2");
+    snprintf(body, sizeof(body), "output gone %s\n", digest_to_hex(&d_gone, h1));
+    CHECK(write_record(&tasks[2], body) == 0 && durability_commit() == 0, "record 3");
+
+    BundleStats st;
+    CHECK(bundle_export("c.bundle", tasks, 4, &st) == 0, "export");
+    // large, chunk list, chunks, x, y, tree; each once
+    uint64_t want_objects = 5 + n_chunks;
+    CHECK(st.records == 2 && st.missing == 1 && st.objects == want_objects, "export stats");
+
+    BundleEntry *index;
+    size_t n_index;
+    CHECK(bundle_read_index("c.bundle", &index, &n_index) == 0, "read index");
+    CHECK(n_index == want_objects + 2, "index size");
+    // children come before what names them, and records last
+    int pos_tree = -1, pos_x = -1, pos_list = -1, pos_chunk = -1, records = 0;
+    for (size_t i = 0; i < n_index; ++i) {
+        if (digest_eq(&index[i].d, &d_tree)) pos_tree = (int)i;
+        if (digest_eq(&index[i].d, &d_x)) pos_x = (int)i;
+        if (digest_eq(&index[i].d, &d_chunked)) pos_list = (int)i;
+        if (digest_eq(&index[i].d, &chunks[0])) pos_chunk = (int)i;
+        if (index[i].kind == BUNDLE_RECORD) records++;
+        else CHECK(records == 0, "record before an object");
+    }
+    CHECK(pos_x >= 0 && pos_x < pos_tree && pos_chunk >= 0 && pos_chunk < pos_list && records == 2, "entry order");
+    // an index entry points at the entry's bytes
+    FILE *f = fopen("c.bundle", "rb");
+    uint64_t x_offset = 0;
+    for (size_t i = 0; f && i < n_index; ++i) {
+        if (!digest_eq(&index[i].d, &d_x)) continue;
+        x_offset = index[i].offset;
+        char got[3] = { 0 };
+        CHECK(index[i].length == 2 && fseeko(f, (off_t)index[i].offset, SEEK_SET) == 0 && fread(got, 1, 2, f) == 2 &&
+                  strcmp(got, "x\n") == 0,
+              "index offset");
+    }
+    CHECK(f && fclose(f) == 0, "read bundle");
+    free(index);
+
+    cas_shutdown();
+    CHECK(cas_init("b") == 0, "cas_init b");
+    CHECK(bundle_import("c.bundle", &st) == 0, "import");
+    CHECK(st.records == 2 && st.objects == want_objects && st.objects_present == 0, "import stats");
+    CHECK(record_exists(&tasks[0]) && record_exists(&tasks[1]) && !record_exists(&tasks[2]) && !record_exists(&tasks[3]),
+          "records imported");
+    Digest all[] = { d_large, d_chunked, d_x, d_y, d_tree };
+    for (int i = 0; i < 5; ++i) CHECK(cas_verify_object(&all[i], NULL) == 0, "object verifies");
+    for (size_t i = 0; i < n_chunks; ++i) CHECK(cas_verify_object(&chunks[i], NULL) == 0, "chunk verifies");
+    size_t len;
+    CHECK(cas_restore_blob_to_file(&d_chunked, "chunked.out") == 0, "restore chunked");
+    unsigned char *back = (unsigned char *)read_entire_file("chunked.out", &len);
+    CHECK(back && len == CHUNKED && memcmp(back, chunked, CHUNKED) == 0, "chunked content");
+    free(back);
+    CHECK(cas_restore_blob_to_file(&d_large, "large.out") == 0, "restore large");
+    back = (unsigned char *)read_entire_file("large.out", &len);
+    CHECK(back && len == LARGE && memcmp(back, large, LARGE) == 0, "large content");
+    free(back);
+
+    // a second import only adds what is missing
+    CHECK(bundle_import("c.bundle", &st) == 0, "reimport");
+    CHECK(st.records == 2 && st.objects == 0 && st.objects_present == want_objects, "reimport skips");
+
+    // a damaged object keeps back the records after it
+    cas_shutdown();
+    mkdir("c", 0755);
+    CHECK(cas_init("c") == 0, "cas_init c");
+    unsigned char *raw = (unsigned char *)read_entire_file("c.bundle", &len);
+    CHECK(raw && len > x_offset, "read bundle");
+    raw[x_offset] = 'z';
+    CHECK(write_file("bad.bundle", raw, len) == 0, "write damaged bundle");
+    free(raw);
+    fprintf(stderr, "(expected) ");
+    CHECK(bundle_import("bad.bundle", &st) != 0 && !record_exists(&tasks[0]) && !record_exists(&tasks[1]), "damage refused");
+    CHECK(cas_blob_exists(&d_large), "good objects still stored");
+
+    // a truncated bundle fails and a file without a trailer has no index
+    CHECK(truncate("bad.bundle", 1000) == 0, "truncate");
+    fprintf(stderr, "(expected) ");
+    CHECK(bundle_import("bad.bundle", &st) != 0, "truncation refused");
+    CHECK(bundle_read_index("bad.bundle", &index, &n_index) != 0, "no index");
+
+    // a record filed under another task's name is not imported
+    char hex[DIGEST_HEX_SIZE], name[100], text[200];
+    snprintf(name, sizeof(name), "%s.meta", digest_to_hex(&tasks[3], hex));
+    snprintf(text, sizeof(text), "task_hash: %s\nresult_hash: \n", digest_to_hex(&tasks[0], hex));
+    CHECK(cas_write_cache_file(name, text, strlen(text)) == 0 && durability_commit() == 0, "misfiled record");
+    CHECK(bundle_export("m.bundle", &tasks[3], 1, &st) == 0 && st.records == 1, "export misfiled record");
+    cas_shutdown();
+    mkdir("d", 0755);
+    CHECK(cas_init("d") == 0, "cas_init d");
+    fprintf(stderr, "(expected) ");
+    CHECK(bundle_import("m.bundle", &st) == 0 && st.records == 0 && !record_exists(&tasks[3]), "misfiled record imported");
+
+    cas_shutdown();
+    free(chunks);
+    free(chunked);
+    free(large);
+    printf("OK\n");
+    return 0;
+}
@@ -1,11 +1,24 @@
+#define _GNU_SOURCE
 #include "../cas.h"
 #include "../util.h"
+#include "../chunker.h"
+#include "../compression.h"
+#include "../hash_pool.h"
+#include "../io_batch.h"
+#include "../bloom.h"
+#include "../durability.h"
+#include "../sha256.h"
+#include <dirent.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 int main(void) {
     if (cas_init(".") != 0) { fprintf(stderr, "cas_init failed\n"); return 1; }
+    hash_pool_init(3); // batches below are split across pool threads even on one CPU
 
     const char *infile = "tests_cas_input.txt";
     FILE *f = fopen(infile, "w");
@@ -37,6 +50,551 @@ int main(void) {
     if (!g) { fprintf(stderr, "CAS object missing at %s\n", caspath); return 1; }
     fclose(g);
 
+    // batch hashing agrees with single-file hashing, including large files
+    enum { N_BATCH = 12 };
+    char names[N_BATCH][64];
+    const char *paths[N_BATCH];
+    Digest batch[N_BATCH];
+    for (int i = 0; i < N_BATCH; ++i) {
+        snprintf(names[i], sizeof(names[i]), "tests_cas_batch_%d.txt", i);
+        paths[i] = names[i];
+        FILE *bf = fopen(names[i], "wb");
+        if (!bf) { perror("fopen"); return 1; }
+        size_t len = i == N_BATCH - 1 ? 200000 : (size_t)i * 37;
+        for (size_t j = 0; j < len; ++j) fputc((int)((i + j) & 0xff), bf);
+        fclose(bf);
+    }
+    if (cas_hash_files_batch(paths, N_BATCH, batch) != 0) { fprintf(stderr, "batch hash failed\n"); return 1; }
+    for (int i = 0; i < N_BATCH; ++i) {
+        char single[65], hex[DIGEST_HEX_SIZE];
+        if (cas_hash_of_file(paths[i], single) != 0 || strcmp(single, digest_to_hex(&batch[i], hex)) != 0) {
+            fprintf(stderr, "batch mismatch for %s\n", paths[i]);
+            return 1;
+        }
+    }
+
+    // batch store ingests every file and returns the same digests
+    Digest stored[N_BATCH];
+    if (cas_store_files_batch(paths, N_BATCH, stored) != 0) { fprintf(stderr, "batch store failed\n"); return 1; }
+    for (int i = 0; i < N_BATCH; ++i) {
+        char single[65], fetched[65], hex[DIGEST_HEX_SIZE];
+        const char *copy = "tests_cas_batch_fetch.txt";
+        if (cas_hash_of_file(paths[i], single) != 0 || strcmp(single, digest_to_hex(&stored[i], hex)) != 0 ||
+            !cas_blob_exists(&stored[i]) || cas_restore_blob_to_file(&stored[i], copy) != 0 ||
+            cas_hash_of_file(copy, fetched) != 0 || strcmp(fetched, single) != 0) {
+            fprintf(stderr, "batch store mismatch for %s\n", paths[i]);
+            return 1;
+        }
+        remove(copy);
+        remove(paths[i]);
+    }
+    const char *missing[1] = { "tests_cas_no_such_file" };
+    Digest none[1];
+    if (cas_hash_files_batch(missing, 1, none) == 0 || !digest_is_zero(&none[0])) {
+        fprintf(stderr, "batch hash of missing file should fail\n");
+        return 1;
+    }
+
+    // every materialization strategy restores the same bytes, falling back as needed
+    const char *names_mat[] = { "reflink", "hardlink", "copy_range", "copy" };
+    for (int s = 0; s < CAS_MAT_COUNT; ++s) {
+        CasStats before, after;
+        cas_get_stats(&before);
+        if (cas_set_materialize_strategy(names_mat[s]) != 0 || cas_fetch(hash1, out) != 0) {
+            fprintf(stderr, "restore with %s failed\n", names_mat[s]);
+            return 1;
+        }
+        cas_get_stats(&after);
+        uint64_t served = 0;
+        for (int k = s; k < CAS_MAT_COUNT; ++k) served += after.materialized[k] - before.materialized[k];
+        if (served != 1 || cas_hash_of_file(out, hash2) != 0 || strcmp(hash1, hash2) != 0) {
+            fprintf(stderr, "restore with %s produced wrong result\n", names_mat[s]);
+            return 1;
+        }
+        // a restored output can always be rewritten without touching the object
+        if (cas_detach_output(out) != 0) { fprintf(stderr, "detach failed\n"); return 1; }
+        FILE *w = fopen(out, "w");
+        if (!w) { fprintf(stderr, "restored output not writable (%s)\n", names_mat[s]); return 1; }
+        fputs("changed\n", w);
+        fclose(w);
+    }
+    if (cas_set_materialize_strategy("bogus") == 0) { fprintf(stderr, "bogus strategy accepted\n"); return 1; }
+    char objcheck[65];
+    if (cas_hash_of_file(caspath, objcheck) != 0 || strcmp(objcheck, hash1) != 0) {
+        fprintf(stderr, "CAS object modified through a restored output\n");
+        return 1;
+    }
+
+    // repack moves small loose objects into a pack; lookups and restores follow
+    cas_set_materialize_strategy("reflink");
+    const unsigned char big[] = "packed blob";
+    Digest packed, d1;
+    CasRepackStats rs;
+    if (cas_store_blob_from_memory(big, sizeof(big), &packed) != 0 || cas_repack(&rs) != 0 || rs.objects_packed < 2 || rs.packs_written != 1) {
+        fprintf(stderr, "repack failed\n");
+        return 1;
+    }
+    g = fopen(caspath, "rb");
+    if (g) { fclose(g); fprintf(stderr, "loose object survived repack\n"); return 1; }
+    if (digest_from_hex(hash1, &d1) != 0 || !cas_blob_exists(&d1) || !cas_blob_exists(&packed)) {
+        fprintf(stderr, "packed object not found\n");
+        return 1;
+    }
+    if (cas_fetch(hash1, out) != 0 || cas_hash_of_file(out, hash2) != 0 || strcmp(hash1, hash2) != 0) {
+        fprintf(stderr, "restore from pack failed\n");
+        return 1;
+    }
+    // storing an already-packed blob does not recreate a loose copy
+    cas_store_blob_from_memory(big, sizeof(big), &packed);
+    if (cas_repack(&rs) != 0 || rs.objects_packed != 0 || rs.duplicates_removed != 0) {
+        fprintf(stderr, "packed blob was stored loose again\n");
+        return 1;
+    }
+    // a pack index whose checksum does not match is not used
+    {
+        char idx[1200] = "";
+        DIR *pd = opendir(".reprovm/cas/objects/pack");
+        struct dirent *pe;
+        while (pd && (pe = readdir(pd)) != NULL)
+            if (strstr(pe->d_name, ".idx")) snprintf(idx, sizeof(idx), ".reprovm/cas/objects/pack/%s", pe->d_name);
+        if (pd) closedir(pd);
+        size_t idx_len = 0;
+        unsigned char *orig = (unsigned char *)read_entire_file(idx, &idx_len);
+        const size_t entry_offset = 16 + 256 * 4 + 32; // first entry's offset field
+        if (!orig || idx_len <= entry_offset) { fprintf(stderr, "pack index not found\n"); return 1; }
+        orig[entry_offset] ^= 0x40;
+        FILE *w = (chmod(idx, 0644) == 0) ? fopen(idx, "wb") : NULL;
+        if (!w || fwrite(orig, 1, idx_len, w) != idx_len || fclose(w) != 0) { fprintf(stderr, "cannot damage index\n"); return 1; }
+        cas_shutdown();
+        fprintf(stderr, "(expected) ");
+        if (cas_init(".") != 0 || cas_blob_exists(&d1) || cas_blob_exists(&packed)) {
+            fprintf(stderr, "damaged pack index was used\n");
+            return 1;
+        }
+        orig[entry_offset] ^= 0x40;
+        w = fopen(idx, "wb");
+        if (!w || fwrite(orig, 1, idx_len, w) != idx_len || fclose(w) != 0) return 1;
+        free(orig);
+        cas_shutdown();
+        if (cas_init(".") != 0 || !cas_blob_exists(&d1) || !cas_blob_exists(&packed)) {
+            fprintf(stderr, "repaired pack index not used\n");
+            return 1;
+        }
+        // a pack another process deletes stops answering lookups
+        char moved[1300];
+        snprintf(moved, sizeof(moved), "%s.moved", idx);
+        if (rename(idx, moved) != 0 || cas_blob_exists(&packed)) {
+            fprintf(stderr, "deleted pack still used\n");
+            return 1;
+        }
+        if (rename(moved, idx) != 0 || !cas_blob_exists(&packed)) {
+            fprintf(stderr, "restored pack not used\n");
+            return 1;
+        }
+    }
+
+    // large files are chunked: a local edit only stores the chunks around it
+    enum { BIG_LEN = 1 << 20 };
+    unsigned char *bigbuf = malloc(BIG_LEN);
+    if (!bigbuf) return 1;
+    uint64_t x = 88172645463325252ULL;
+    for (size_t j = 0; j < BIG_LEN; ++j) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        bigbuf[j] = (unsigned char)x;
+    }
+    const char *bigfile = "tests_cas_big.bin";
+    cas_set_chunk_threshold(256 * 1024);
+    char big1[65], big2[65], check[65];
+    CasStats c0, c1, c2;
+    cas_get_stats(&c0);
+    f = fopen(bigfile, "wb");
+    if (!f || fwrite(bigbuf, 1, BIG_LEN, f) != BIG_LEN) return 1;
+    fclose(f);
+    if (cas_store(bigfile, big1) != 0) { fprintf(stderr, "chunked store failed\n"); return 1; }
+    cas_get_stats(&c1);
+    bigbuf[BIG_LEN / 2] ^= 0xff;
+    remove(bigfile); // a new inode, so the stat index cannot answer
+    f = fopen(bigfile, "wb");
+    if (!f || fwrite(bigbuf, 1, BIG_LEN, f) != BIG_LEN) return 1;
+    fclose(f);
+    if (cas_store(bigfile, big2) != 0) { fprintf(stderr, "chunked store failed\n"); return 1; }
+    cas_get_stats(&c2);
+    if (c2.chunked_files - c0.chunked_files != 2 || c1.chunk_stored_bytes - c0.chunk_stored_bytes != BIG_LEN ||
+        c2.chunk_stored_bytes - c1.chunk_stored_bytes > 3 * CHUNK_MAX_SIZE) {
+        fprintf(stderr, "chunk dedup not effective\n");
+        return 1;
+    }
+    if (cas_hash_of_file(bigfile, check) != 0 || strcmp(check, big2) != 0) {
+        fprintf(stderr, "chunked file digest differs from its content hash\n");
+        return 1;
+    }
+    Digest bd, *chunks = NULL;
+    size_t n_chunks = 0;
+    if (digest_from_hex(big1, &bd) != 0 || cas_chunk_list(&bd, &chunks, &n_chunks) != 1 || n_chunks < 2) {
+        fprintf(stderr, "chunk list missing\n");
+        return 1;
+    }
+    free(chunks);
+    remove(bigfile);
+    if (cas_fetch(big1, bigfile) != 0 || cas_hash_of_file(bigfile, check) != 0 || strcmp(check, big1) != 0 ||
+        cas_fetch(big2, bigfile) != 0 || cas_hash_of_file(bigfile, check) != 0 || strcmp(check, big2) != 0) {
+        fprintf(stderr, "chunked restore failed\n");
+        return 1;
+    }
+    // a well-formed chunk list is only accepted under the digest of what it reassembles
+    {
+        unsigned char *list;
+        size_t list_len;
+        Digest bd2, other;
+        digest_buffer("some other content", 18, &other);
+        if (digest_from_hex(big2, &bd2) != 0 || cas_read_object(&bd, &list, &list_len) != 0 ||
+            cas_write_object(&bd, list, list_len) != 0 || cas_write_object(&bd2, list, list_len) == 0 ||
+            cas_write_object(&other, list, list_len) == 0 || cas_blob_exists(&other)) {
+            fprintf(stderr, "chunk list accepted under another digest\n");
+            return 1;
+        }
+        free(list);
+    }
+    remove(bigfile);
+    cas_set_chunk_threshold(0);
+    free(bigbuf);
+
+    // content that looks like an object header is stored framed and restored intact
+    const unsigned char tricky[] = "\x89RVMOBJ\n\x01 not really a chunk list";
+    Digest td;
+    char tricky_hex[65];
+    if (cas_store_blob_from_memory(tricky, sizeof(tricky), &td) != 0 ||
+        cas_fetch(digest_to_hex(&td, tricky_hex), out) != 0 || cas_hash_of_file(out, check) != 0 ||
+        strcmp(check, tricky_hex) != 0) {
+        fprintf(stderr, "magic-prefixed blob did not round-trip\n");
+        return 1;
+    }
+
+    // with LZ4 enabled, compressible objects are stored smaller and restored intact,
+    // through both the in-memory and the streaming ingest paths
+    compression_init(COMPRESS_LZ4, 1);
+    enum { TEXT_LEN = 600000 };
+    char *text = malloc(TEXT_LEN);
+    if (!text) return 1;
+    for (size_t j = 0; j < TEXT_LEN; ++j) text[j] = "cmd = make all\ninputs = src/main.c\n"[j % 36];
+    const char *textfile = "tests_cas_text.txt";
+    f = fopen(textfile, "wb");
+    if (!f || fwrite(text, 1, TEXT_LEN, f) != TEXT_LEN) return 1;
+    fclose(f);
+    Digest small_text;
+    char text_hex[65], small_hex[65], objpath[1024];
+    struct stat obj_st;
+    if (cas_store(textfile, text_hex) != 0 ||
+        cas_store_blob_from_memory((const unsigned char *)text, 4000, &small_text) != 0) {
+        fprintf(stderr, "compressed store failed\n");
+        return 1;
+    }
+    digest_to_hex(&small_text, small_hex);
+    const char *hexes[2] = { text_hex, small_hex };
+    for (int i = 0; i < 2; ++i) {
+        Digest cd;
+        digest_from_hex(hexes[i], &cd);
+        cas_get_object_path(&cd, objpath, sizeof(objpath));
+        if (stat(objpath, &obj_st) != 0 || obj_st.st_size > (i ? 4000 : TEXT_LEN) / 4) {
+            fprintf(stderr, "object %s was not compressed\n", hexes[i]);
+            return 1;
+        }
+        remove(out);
+        if (cas_fetch(hexes[i], out) != 0 || cas_hash_of_file(out, check) != 0 || strcmp(check, hexes[i]) != 0) {
+            fprintf(stderr, "compressed object did not restore\n");
+            return 1;
+        }
+    }
+    remove(textfile);
+
+    // stored forms fed in small pieces to a fresh store: plain, framed and
+    // compressed objects large enough to stream to disk, and a tree held
+    // until its child is in
+    enum { W_LEN = 1 << 20, W_OBJS = 4 };
+    unsigned char *wbuf = malloc(W_LEN);
+    if (!wbuf) return 1;
+    for (size_t j = 0; j < W_LEN; ++j) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        wbuf[j] = (unsigned char)x;
+    }
+    memcpy(wbuf + W_LEN / 2, "\x89RVMOBJ\n", 8);
+    for (size_t j = 3 * W_LEN / 4, k = 0; j + 13 <= W_LEN; j += 13) snprintf((char *)wbuf + j, 14, "row %08zu\n", k++);
+    Digest wd[W_OBJS], wchild;
+    unsigned char *wobj[W_OBJS];
+    size_t wlen[W_OBJS];
+    if (cas_store_blob_from_memory(wbuf, W_LEN / 2, &wd[0]) != 0 ||
+        cas_store_blob_from_memory(wbuf + W_LEN / 2, W_LEN / 4, &wd[1]) != 0 ||
+        cas_store_blob_from_memory(wbuf + 3 * W_LEN / 4, W_LEN / 4, &wd[2]) != 0 ||
+        cas_store_blob_from_memory(wbuf, 100, &wchild) != 0 ||
+        cas_put_tree(&(CasTreeEntry){ CAS_TREE_FILE, wchild, "f" }, 1, 1, &wd[3]) != 0) {
+        fprintf(stderr, "store for writer failed\n");
+        return 1;
+    }
+    for (int i = 0; i < W_OBJS; ++i)
+        if (cas_read_object(&wd[i], &wobj[i], &wlen[i]) != 0) { fprintf(stderr, "read_object failed\n"); return 1; }
+    cas_shutdown();
+    mkdir("tests_cas_w", 0755);
+    if (cas_init("tests_cas_w") != 0) return 1;
+    for (int i = W_OBJS - 1; i >= 0; --i) {
+        CasObjectWriter *w = cas_object_writer_new(&wd[i]);
+        for (size_t off = 0; w && off < wlen[i]; off += 1000)
+            if (cas_object_writer_write(w, wobj[i] + off, wlen[i] - off < 1000 ? wlen[i] - off : 1000) != 0) return 1;
+        Digest *refs;
+        size_t nrefs;
+        int r = cas_object_writer_refs(w, &refs, &nrefs);
+        if (i == W_OBJS - 1) {
+            // the tree names a file this store does not have yet
+            if (r != 1 || nrefs != 1 || !digest_eq(&refs[0], &wchild) || cas_object_writer_commit(w) == 0) {
+                fprintf(stderr, "tree accepted before its child\n");
+                return 1;
+            }
+            free(refs);
+            continue;
+        }
+        if (r != 0 || cas_object_writer_commit(w) != 0 || cas_verify_object(&wd[i], NULL) != 0) {
+            fprintf(stderr, "streamed object %d not stored intact\n", i);
+            return 1;
+        }
+    }
+    CasObjectWriter *bad = cas_object_writer_new(&wd[0]);
+    if (!bad || cas_object_writer_write(bad, wobj[1], wlen[1]) != 0 || cas_object_writer_commit(bad) == 0) {
+        fprintf(stderr, "writer accepted content under the wrong digest\n");
+        return 1;
+    }
+    for (int i = 0; i < W_OBJS; ++i) free(wobj[i]);
+    free(wbuf);
+    cas_shutdown();
+    if (cas_init(".") != 0) return 1;
+
+    // the io_uring backend stores, probes and restores the same objects as
+    // the syscall path, including framed, compressed and large ones
+    io_batch_set_backend("auto");
+    enum { N_URING = 40 };
+    char unames[N_URING][64], udests[N_URING][64];
+    const char *upaths[N_URING], *udest_ptrs[N_URING];
+    Digest ustored[N_URING], uhashed[N_URING];
+    int uexist[N_URING + 1];
+    for (int i = 0; i < N_URING; ++i) {
+        snprintf(unames[i], sizeof(unames[i]), "tests_cas_uring_%d.txt", i);
+        snprintf(udests[i], sizeof(udests[i]), "tests_cas_uring_out_%d.txt", i);
+        upaths[i] = unames[i];
+        udest_ptrs[i] = udests[i];
+        FILE *uf = fopen(unames[i], "wb");
+        if (!uf) { perror("fopen"); return 1; }
+        if (i == 0) fwrite("\x89RVMOBJ\nnot really an object", 1, 29, uf);
+        else if (i == 1) fwrite(text, 1, 5000, uf);
+        else if (i == 2) fwrite(text, 1, 300000, uf);
+        else fprintf(uf, "uring file %d %*s", i, i * 50, "");
+        fclose(uf);
+    }
+    if (cas_hash_files_batch(upaths, N_URING, uhashed) != 0 ||
+        cas_store_files_batch(upaths, N_URING, ustored) != 0 ||
+        memcmp(uhashed, ustored, sizeof(ustored)) != 0) {
+        fprintf(stderr, "batched store with %s backend failed\n", io_batch_backend_name(io_batch_backend()));
+        return 1;
+    }
+    Digest probe[N_URING + 1];
+    memcpy(probe, ustored, sizeof(ustored));
+    memset(&probe[N_URING], 0x5a, sizeof(Digest)); // never stored
+    if (cas_blobs_exist_batch(probe, N_URING + 1, uexist) != 0 || uexist[N_URING]) {
+        fprintf(stderr, "batched existence probe failed\n");
+        return 1;
+    }
+    for (int i = 0; i < N_URING; ++i) {
+        if (!uexist[i]) { fprintf(stderr, "batched store lost %s\n", upaths[i]); return 1; }
+    }
+    for (int s = 0; s < CAS_MAT_COUNT; ++s) {
+        cas_set_materialize_strategy(names_mat[s]);
+        if (cas_restore_blobs_batch(ustored, udest_ptrs, N_URING) != 0) {
+            fprintf(stderr, "batched restore with %s failed\n", names_mat[s]);
+            return 1;
+        }
+        for (int i = 0; i < N_URING; ++i) {
+            char want[65], got[65];
+            if (cas_hash_of_file(upaths[i], want) != 0 || cas_hash_of_file(udests[i], got) != 0 ||
+                strcmp(want, got) != 0) {
+                fprintf(stderr, "batched restore of %s with %s is wrong\n", upaths[i], names_mat[s]);
+                return 1;
+            }
+        }
+    }
+    for (int i = 0; i < N_URING; ++i) {
+        remove(upaths[i]);
+        remove(udests[i]);
+    }
+    io_batch_set_backend("sync");
+    cas_set_materialize_strategy("reflink");
+    free(text);
+    compression_init(COMPRESS_NONE, 0);
+
+    // the object filter answers probes for missing objects from memory and
+    // never hides a stored one
+    CasStats before, after;
+    cas_get_stats(&before);
+    enum { N_FILTER = 2000 };
+    Digest kept[64];
+    for (int i = 0; i < N_FILTER; ++i) {
+        char blob[32];
+        int blen = snprintf(blob, sizeof(blob), "filter blob %d", i);
+        Digest fd;
+        if (i < 64 && cas_store_blob_from_memory((const unsigned char *)blob, (size_t)blen, &kept[i]) != 0) {
+            fprintf(stderr, "store for filter failed\n");
+            return 1;
+        }
+        sha256_digest((const unsigned char *)blob, (size_t)blen + 1, fd.b); // never stored
+        if (cas_blob_exists(&fd)) { fprintf(stderr, "filter reported a missing object\n"); return 1; }
+    }
+    for (int i = 0; i < 64; ++i) {
+        if (!cas_blob_exists(&kept[i])) { fprintf(stderr, "filter hid a stored object\n"); return 1; }
+    }
+    cas_get_stats(&after);
+    if (after.filter_negatives - before.filter_negatives < N_FILTER * 9 / 10 || cas_filter_fp_rate(&after) > 0.05) {
+        fprintf(stderr, "filter answered only %llu of %d misses\n",
+                (unsigned long long)(after.filter_negatives - before.filter_negatives), N_FILTER);
+        return 1;
+    }
+    // an object another process publishes after this one replaced the
+    // filter (its writer still on the old one) ends up in the new filter
+    Digest late;
+    sha256_digest((const unsigned char *)"published during a rebuild", 26, late.b);
+    int go[2];
+    if (pipe(go) != 0) { perror("pipe"); return 1; }
+    pid_t child = fork();
+    if (child == 0) {
+        char c;
+        close(go[1]);
+        if (read(go[0], &c, 1) != 1) _exit(2);
+        bloom_add(late.b);
+        _exit(0);
+    }
+    close(go[0]);
+    uint64_t filtered = 0;
+    if (cas_rebuild_filter(&filtered) != 0 || filtered < 64) { fprintf(stderr, "filter rebuild failed\n"); return 1; }
+    int status;
+    if (write(go[1], "x", 1) != 1 || waitpid(child, &status, 0) != child || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "child failed\n");
+        return 1;
+    }
+    close(go[1]);
+    if (bloom_check(late.b) != BLOOM_MAYBE) { fprintf(stderr, "rebuilt filter missed a new object\n"); return 1; }
+
+    // batched durability: objects and records are linked only at the commit,
+    // readable by this process meanwhile, and no temp files are left behind
+    durability_set_mode(DURABILITY_BATCHED);
+    Digest queued;
+    char queued_path[1200], record_path[1200];
+    if (cas_store_blob_from_memory((const unsigned char *)"queued for the commit", 21, &queued) != 0) {
+        fprintf(stderr, "batched store failed\n");
+        return 1;
+    }
+    cas_get_object_path(&queued, queued_path, sizeof(queued_path));
+    snprintf(record_path, sizeof(record_path), "%s/durable.meta", cas_get_cache_root());
+    if (cas_write_cache_file("durable.meta", "one\n", 4) != 0 || access(queued_path, F_OK) == 0 ||
+        access(record_path, F_OK) == 0) {
+        fprintf(stderr, "batched store linked before the commit\n");
+        return 1;
+    }
+    if (!cas_blob_exists(&queued) || cas_restore_blob_to_file(&queued, "tests_cas_queued.txt") != 0) {
+        fprintf(stderr, "queued object not readable\n");
+        return 1;
+    }
+    size_t queued_len;
+    char *queued_back = read_entire_file("tests_cas_queued.txt", &queued_len);
+    if (!queued_back || queued_len != 21 || memcmp(queued_back, "queued for the commit", 21) != 0) {
+        fprintf(stderr, "queued object restored wrong\n");
+        return 1;
+    }
+    free(queued_back);
+    remove("tests_cas_queued.txt");
+    if (durability_commit() != 0 || access(queued_path, F_OK) != 0 || access(record_path, F_OK) != 0) {
+        fprintf(stderr, "commit did not link\n");
+        return 1;
+    }
+    char tmp_dir[1200];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/tmp", cas_get_objects_root());
+    DIR *tmp_listing = opendir(tmp_dir);
+    struct dirent *tmp_ent;
+    while (tmp_listing && (tmp_ent = readdir(tmp_listing)) != NULL) {
+        if (tmp_ent->d_name[0] == '.') continue;
+        fprintf(stderr, "temp file left: %s\n", tmp_ent->d_name);
+        return 1;
+    }
+    if (tmp_listing) closedir(tmp_listing);
+    // strict: on disk at once, and a replaced record is whole
+    durability_set_mode(DURABILITY_STRICT);
+    if (cas_store_blob_from_memory((const unsigned char *)"stored strictly", 15, &queued) != 0 ||
+        cas_write_cache_file("durable.meta", "two\n", 4) != 0) {
+        fprintf(stderr, "strict store failed\n");
+        return 1;
+    }
+    cas_get_object_path(&queued, queued_path, sizeof(queued_path));
+    size_t record_len;
+    char *record_back = read_entire_file(record_path, &record_len);
+    if (access(queued_path, F_OK) != 0 || !record_back || record_len != 4 || memcmp(record_back, "two\n", 4) != 0) {
+        fprintf(stderr, "strict store not in place\n");
+        return 1;
+    }
+    free(record_back);
+    remove(record_path);
+    durability_set_mode(DURABILITY_NONE);
+
+    // a BLAKE3 store lives beside the SHA-256 one; each refuses the other's objects
+    Digest sha_abc;
+    if (cas_store_blob_from_memory((const unsigned char *)"abc", 3, &sha_abc) != 0) { fprintf(stderr, "store abc failed\n"); return 1; }
+    cas_shutdown();
+    digest_set_algorithm(DIGEST_BLAKE3);
+    if (cas_init(".") != 0) { fprintf(stderr, "cas_init (blake3) failed\n"); return 1; }
+    hash_pool_init(3);
+    Digest b3_abc;
+    char b3_hex[DIGEST_HEX_SIZE];
+    if (cas_store_blob_from_memory((const unsigned char *)"abc", 3, &b3_abc) != 0 ||
+        strcmp(digest_to_hex(&b3_abc, b3_hex), "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85") != 0) {
+        fprintf(stderr, "blake3 digest of abc: %s\n", b3_hex);
+        return 1;
+    }
+    if (strstr(cas_get_objects_root(), "/cas/blake3/objects") == NULL || cas_blob_exists(&sha_abc)) {
+        fprintf(stderr, "blake3 store shares the sha256 objects\n");
+        return 1;
+    }
+    // large enough to be hashed whole on the pool before a copy-only pass;
+    // stored twice, the second time only hashed
+    enum { B3_LEN = 6 * 1024 * 1024 + 4321 };
+    unsigned char *b3_buf = malloc(B3_LEN);
+    for (size_t j = 0; j < B3_LEN; ++j) b3_buf[j] = (unsigned char)(j * 2654435761u >> 13);
+    f = fopen("tests_cas_b3.bin", "wb");
+    if (!f || fwrite(b3_buf, 1, B3_LEN, f) != B3_LEN || fclose(f) != 0) { perror("write"); return 1; }
+    Digest b3_big, b3_want, b3_again;
+    blake3_digest(b3_buf, B3_LEN, b3_want.b);
+    if (cas_store_blob_from_file("tests_cas_b3.bin", &b3_big) != 0 || !digest_eq(&b3_big, &b3_want)) {
+        fprintf(stderr, "blake3 large file digest mismatch\n");
+        return 1;
+    }
+    remove("tests_cas_b3.bin");
+    if (cas_restore_blob_to_file(&b3_big, "tests_cas_b3.bin") != 0) { fprintf(stderr, "blake3 restore failed\n"); return 1; }
+    size_t b3_len;
+    char *b3_back = read_entire_file("tests_cas_b3.bin", &b3_len);
+    if (!b3_back || b3_len != B3_LEN || memcmp(b3_back, b3_buf, B3_LEN) != 0) { fprintf(stderr, "blake3 restore differs\n"); return 1; }
+    if (cas_hash_files_batch((const char *const[]){ "tests_cas_b3.bin" }, 1, &b3_again) != 0 || !digest_eq(&b3_again, &b3_want)) {
+        fprintf(stderr, "blake3 hash-only mismatch\n");
+        return 1;
+    }
+    free(b3_back);
+    free(b3_buf);
+    remove("tests_cas_b3.bin");
+    cas_shutdown();
+    // the stores are told apart by their ALGORITHM marker
+    f = fopen(".reprovm/cas/blake3/objects/ALGORITHM", "w");
+    if (!f) { perror("fopen"); return 1; }
+    fputs("sha256\n", f);
+    fclose(f);
+    if (cas_init(".") == 0) { fprintf(stderr, "store with the wrong marker opened\n"); return 1; }
+    f = fopen(".reprovm/cas/blake3/objects/ALGORITHM", "w");
+    fputs("blake3\n", f);
+    fclose(f);
+    digest_set_algorithm(DIGEST_SHA256);
+    if (cas_init(".") != 0 || !cas_blob_exists(&sha_abc)) { fprintf(stderr, "sha256 store lost\n"); return 1; }
+
     // cleanup
     remove(out);
     puts("OK");
@@ -0,0 +1,74 @@
+#include "../compression.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Compress and decompress one buffer through the block stream; returns the stream size or 0 on failure
+static size_t round_trip(const unsigned char *data, size_t len) {
+    unsigned char *packed = NULL, *unpacked = NULL;
+    size_t packed_len = 0, unpacked_len = 0;
+    if (compression_compress(data, len, &packed, &packed_len) != 0) return 0;
+    int ok = compression_decompress(packed, packed_len, &unpacked, &unpacked_len) == 0 &&
+             unpacked_len == len && memcmp(unpacked, data, len) == 0;
+    free(packed);
+    free(unpacked);
+    return ok ? packed_len + 1 : 0;
+}
+
+int main(void) {
+    compression_init(COMPRESS_LZ4, 1);
+    enum { LEN = 700000 };
+    unsigned char *text = malloc(LEN), *noise = malloc(LEN);
+    if (!text || !noise) return 1;
+    static const char *const words[] = { "task", "output", "cache", "hash", "input", "deps", "\n", " = " };
+    size_t pos = 0;
+    uint32_t x = 2463534242u;
+    while (pos < LEN) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        const char *w = words[x % 8];
+        for (size_t i = 0; w[i] && pos < LEN; ++i) text[pos++] = (unsigned char)w[i];
+    }
+    for (size_t i = 0; i < LEN; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        noise[i] = (unsigned char)x;
+    }
+
+    // text shrinks a lot, noise stays within the per-block header overhead
+    size_t text_packed = round_trip(text, LEN), noise_packed = round_trip(noise, LEN);
+    if (!text_packed || text_packed > LEN * 2 / 3) { fprintf(stderr, "text did not round-trip or compress\n"); return 1; }
+    if (!noise_packed || noise_packed > LEN + 64) { fprintf(stderr, "noise did not round-trip\n"); return 1; }
+    if (compression_estimate_ratio(noise, 65536) < 0.95 || compression_estimate_ratio(text, 65536) > 0.8) {
+        fprintf(stderr, "ratio estimate off\n");
+        return 1;
+    }
+
+    // short and edge-case inputs, including long runs (overlapping matches)
+    memset(text, 'a', 5000);
+    for (size_t n = 0; n < 40; ++n) {
+        if (!round_trip(text, n) || !round_trip(noise, n)) { fprintf(stderr, "length %zu failed\n", n); return 1; }
+    }
+    if (!round_trip(text, 5000)) { fprintf(stderr, "run failed\n"); return 1; }
+
+    // damaged raw blocks are rejected rather than overrunning
+    unsigned char block[COMPRESSION_BLOCK_HEADER + 5000], out[5000];
+    size_t n = compression_lz4_compress(text, 5000, block, sizeof(block));
+    if (n == 0 || compression_lz4_decompress(block, n, out, 5000) != 0 || memcmp(out, text, 5000) != 0) {
+        fprintf(stderr, "raw block round trip failed\n");
+        return 1;
+    }
+    if (compression_lz4_decompress(block, n, out, 4999) == 0 || compression_lz4_decompress(block, n - 1, out, 5000) == 0) {
+        fprintf(stderr, "damaged block accepted\n");
+        return 1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char saved = block[i];
+        block[i] ^= 0x5a;
+        compression_lz4_decompress(block, n, out, 5000); // must not crash
+        block[i] = saved;
+    }
+
+    free(text);
+    free(noise);
+    puts("OK");
+    return 0;
+}
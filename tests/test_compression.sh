@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_compression..."
+gcc -std=c99 -O2 -Wall -Wextra -g compression.c logger.c tests/test_compression.c -o tests/test_compression -lpthread -lm
+./tests/test_compression
+echo "PASS: compression"
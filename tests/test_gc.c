@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include "../cas.h"
+#include "../gc.h"
+#include "helpers.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(void) {
+    CHECK(cas_init(".") == 0, "cas_init");
+    cas_set_chunk_threshold(64 * 1024);
+
+    // A and the chunked D are referenced, C is not
+    Digest a = store("a", 3000), b = store("b", 3000), c = store("c", 3000), d = store("d", 1 << 20);
+    Digest *chunks;
+    size_t n_chunks;
+    CHECK(cas_chunk_list(&d, &chunks, &n_chunks) == 1 && n_chunks > 1, "large blob is not chunked");
+    Digest r_old_outs[] = { a }, r_new_outs[] = { b, d };
+    Digest r_old = record("r_old", r_old_outs, 1, 10 * 86400);
+    Digest r_new = record("r_new", r_new_outs, 2, 0);
+
+    GcOptions opts = { 0, 0, 1 };
+    GcStats st;
+    CHECK(gc_run(&opts, &st) == 0, "dry run");
+    CHECK(st.records == 2 && st.records_expired == 0 && st.records_evicted == 0, "dry run record counts");
+    // c and the two tasks' own placeholder blobs are unreferenced
+    CHECK(st.objects_removed == 3, "dry run object count");
+    CHECK(cas_blob_exists(&c), "dry run deleted an object");
+
+    opts.dry_run = 0;
+    CHECK(gc_run(&opts, &st) == 0, "gc");
+    CHECK(!cas_blob_exists(&c), "unreferenced object kept");
+    CHECK(st.bytes_freed >= 3000, "freed bytes not counted");
+    CHECK(restores(&a) && restores(&b) && restores(&d), "referenced object lost");
+    for (size_t i = 0; i < n_chunks; ++i) CHECK(cas_blob_exists(&chunks[i]), "chunk of referenced object lost");
+    CHECK(record_exists(&r_old) && record_exists(&r_new), "record deleted without a budget");
+
+    // packed objects: the garbage is pruned out of the pack, the rest stays
+    Digest e = store("e", 2000);
+    CasRepackStats rs;
+    CHECK(cas_repack(&rs) == 0 && rs.objects_packed >= 3, "repack");
+    CHECK(gc_run(&opts, &st) == 0, "gc of packed objects");
+    CHECK(st.objects_removed == 1 && st.packs_rewritten >= 1, "packed garbage not pruned");
+    CHECK(!cas_blob_exists(&e), "packed garbage still readable");
+    CHECK(restores(&a) && restores(&b), "packed live object lost");
+
+    // TTL: the record written ten days ago goes, and with it a
+    opts.ttl_seconds = 86400;
+    CHECK(gc_run(&opts, &st) == 0, "gc with ttl");
+    CHECK(st.records_expired == 1 && !record_exists(&r_old) && record_exists(&r_new), "ttl");
+    CHECK(!cas_blob_exists(&a) && restores(&b), "ttl objects");
+    opts.ttl_seconds = 0;
+
+    // LRU: three old records of ~4 KB each and room for about one; a recent
+    // hit outranks write time
+    Digest o1 = store("o1", 4000), o2 = store("o2", 4000), o3 = store("o3", 4000);
+    Digest l1 = record("l1", &o1, 1, 30 * 86400);
+    Digest l2 = record("l2", &o2, 1, 20 * 86400);
+    Digest l3 = record("l3", &o3, 1, 25 * 86400);
+    gc_note_access(&l1);
+    CHECK(gc_run(&opts, &st) == 0, "gc without budget");
+    uint64_t live = st.bytes_before - st.bytes_freed;
+    opts.max_bytes = live - 6000; // everything but about one 4 KB record
+    CHECK(gc_run(&opts, &st) == 0, "gc with budget");
+    CHECK(st.records_evicted == 2, "wrong number of records evicted");
+    CHECK(record_exists(&l1) && !record_exists(&l3) && !record_exists(&l2), "eviction not in LRU order");
+    CHECK(cas_blob_exists(&o1) && !cas_blob_exists(&o2) && !cas_blob_exists(&o3), "evicted objects");
+    CHECK(restores(&d), "budget dropped a newer record");
+    opts.max_bytes = 0;
+
+    // one collection at a time
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/gc.run", cas_get_cache_root());
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    CHECK(fd >= 0 && flock(fd, LOCK_EX) == 0, "lock gc.run");
+    CHECK(gc_run(&opts, &st) == 1, "concurrent gc not refused");
+    CHECK(gc_repack(&rs) == 1, "repack during a gc not refused");
+    close(fd);
+    CHECK(gc_repack(&rs) == 0, "repack");
+    // a build holding the shared lock does not block a dry run
+    gc_lock_shared();
+    opts.dry_run = 1;
+    CHECK(gc_run(&opts, &st) == 0, "dry run under a build");
+    gc_unlock_shared();
+
+    free(chunks);
+    cas_shutdown();
+    puts("OK");
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "../hash_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+enum { CALLERS = 6, JOBS = 500 };
+
+typedef struct {
+    int hits[JOBS];
+    int owner;
+} Counts;
+
+static void bump(void *ctx, int i) {
+    Counts *c = ctx;
+    __atomic_fetch_add(&c->hits[i], 1 + c->owner, __ATOMIC_RELAXED);
+}
+
+static void *caller(void *arg) {
+    Counts *c = arg;
+    for (int round = 0; round < 20; ++round) hash_pool_run(JOBS / (round + 1), bump, c);
+    return NULL;
+}
+
+int main(void) {
+    hash_pool_init(3);
+    if (hash_pool_size() != 3) { fprintf(stderr, "pool size not applied\n"); return 1; }
+
+    // batches from several threads at once: each index runs exactly once per batch
+    static Counts counts[CALLERS];
+    pthread_t threads[CALLERS];
+    for (int t = 0; t < CALLERS; ++t) {
+        memset(&counts[t], 0, sizeof(counts[t]));
+        counts[t].owner = t;
+        pthread_create(&threads[t], NULL, caller, &counts[t]);
+    }
+    for (int t = 0; t < CALLERS; ++t) pthread_join(threads[t], NULL);
+    for (int t = 0; t < CALLERS; ++t) {
+        for (int i = 0; i < JOBS; ++i) {
+            int runs = 0;
+            for (int round = 0; round < 20; ++round) runs += i < JOBS / (round + 1);
+            if (counts[t].hits[i] != runs * (1 + t)) {
+                fprintf(stderr, "caller %d index %d ran %d times, want %d\n", t, i,
+                        counts[t].hits[i] / (1 + t), runs);
+                return 1;
+            }
+        }
+    }
+
+    // the pool restarts after a shutdown
+    hash_pool_shutdown();
+    memset(&counts[0], 0, sizeof(counts[0]));
+    hash_pool_run(JOBS, bump, &counts[0]);
+    for (int i = 0; i < JOBS; ++i) {
+        if (counts[0].hits[i] != 1) { fprintf(stderr, "restart failed\n"); return 1; }
+    }
+    hash_pool_shutdown();
+    puts("OK");
+    return 0;
+}
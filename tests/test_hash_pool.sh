@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_hash_pool..."
+gcc -std=c99 -O2 -Wall -Wextra -g hash_pool.c tests/test_hash_pool.c -o tests/test_hash_pool -lpthread
+./tests/test_hash_pool
+echo "PASS: hash_pool"
@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_io_batch..."
+gcc -std=c99 -O2 -Wall -Wextra -g io_batch.c logger.c tests/test_io_batch.c -o tests/test_io_batch -lpthread
+./tests/test_io_batch
+echo "PASS: io_batch"
@@ -2,7 +2,7 @@
 set -euo pipefail
 
 # integration test for serial manifest execution
-ROOT=$(dirname "$0")/..
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
 cd "$ROOT"
 
 echo "Running manifest integration test..."
@@ -56,6 +56,23 @@ if ! grep '\[\*\]' run2.log >/dev/null; then
   exit 1
 fi
 
+# the store rehashes clean
+if ! "$ROOT"/reprovm cas verify > verify.log 2>&1 || ! grep "Pass complete" verify.log >/dev/null; then
+  echo "FAIL: cas verify on an intact store"
+  cat verify.log
+  exit 1
+fi
+
+# a record whose output object is gone is a miss: the command runs again
+sha_hash=$(grep -h "^output result.sha " .reprovm/cache/*.meta | awk '{print $3}')
+rm -f result.sha
+find .reprovm/cas -type f -name "*${sha_hash:2}*" -delete
+"$ROOT"/reprovm manifest.txt > run2b.log 2>&1
+if ! grep "Running task 'checksum'" run2b.log >/dev/null || [ ! -f result.sha ]; then
+  echo "FAIL: record with a missing output was taken as a hit"
+  exit 1
+fi
+
 # modify input
 cat <<'EOF' > hello.c
 #include <stdio.h>
@@ -68,4 +85,57 @@ if ! grep "Running task 'build'" run3.log >/dev/null; then
   exit 1
 fi
 
+# cached results move to a BLAKE3 store and hit there
+"$ROOT"/reprovm cas migrate-hash manifest.txt --to blake3 > migrate.log 2>&1
+if ! grep "Migrated 3 of 3" migrate.log >/dev/null; then
+  echo "FAIL: migrate-hash did not move every result"
+  cat migrate.log
+  exit 1
+fi
+rm -f hello result.txt result.sha
+REPROVM_DIGEST=blake3 "$ROOT"/reprovm manifest.txt > run4.log 2>&1
+if grep "Running task" run4.log >/dev/null || ! grep -q "Updated" result.txt; then
+  echo "FAIL: expected blake3 cache hits after migrate-hash"
+  exit 1
+fi
+
+# a task that generates a directory, and one that reads it
+mkdir -p dirs && cd dirs
+echo "one" > gen.src
+cat <<'EOF' > manifest.txt
+task codegen {
+  cmd = mkdir -p gen/sub && cp gen.src gen/a.txt && cp gen.src gen/sub/b.txt && chmod +x gen/a.txt
+  inputs = gen.src
+  outputs = gen
+  deps =
+}
+task consume {
+  cmd = cat gen/a.txt gen/sub/b.txt > all.txt
+  inputs = gen
+  outputs = all.txt
+  deps = codegen
+}
+EOF
+"$ROOT"/reprovm manifest.txt > run1.log 2>&1
+if ! grep -q "^tree gen " .reprovm/cache/*.meta || [ "$(cat all.txt)" != "$(printf 'one\none')" ]; then
+  echo "FAIL: directory output not recorded as a tree"
+  exit 1
+fi
+# the whole directory comes back from the cache, and stray files go
+rm -rf gen/sub all.txt
+touch gen/stray.txt
+"$ROOT"/reprovm manifest.txt > run2.log 2>&1
+if grep "Running task" run2.log >/dev/null || [ ! -f gen/sub/b.txt ] || [ -e gen/stray.txt ] || [ ! -x gen/a.txt ]; then
+  echo "FAIL: directory output not restored from its tree"
+  exit 1
+fi
+# a changed file inside a directory input reruns its reader
+echo "two" > gen.src
+"$ROOT"/reprovm manifest.txt > run3.log 2>&1
+if ! grep "Running task 'consume'" run3.log >/dev/null || [ "$(cat all.txt)" != "$(printf 'two\ntwo')" ]; then
+  echo "FAIL: change inside a directory input did not rerun its reader"
+  exit 1
+fi
+cd ..
+
 echo "PASS: manifest integration"
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include "../cas.h"
+#include "../remote_cas.h"
+#include "../tree.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void write_text(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f || fputs(text, f) < 0 || fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+enum { SHARED = 64 };
+static Digest shared[SHARED];
+
+static void *fetch_shared(void *arg) {
+    return (void *)(intptr_t)remote_cas_fetch_objects(shared, SHARED, (RemoteCASPriority)(intptr_t)arg);
+}
+
+int main(int argc, char **argv) {
+    CHECK(argc == 3, "usage: test_remote_cas <url> <server dir>");
+    const char *url = argv[1];
+    CHECK(cas_init(".") == 0, "cas_init");
+
+    CHECK(remote_cas_init(REMOTE_CAS_HTTP, "https://127.0.0.1:1/", NULL, NULL) != 0, "https accepted");
+    CHECK(remote_cas_init(REMOTE_CAS_HTTP, url, NULL, NULL) == 0, "remote_cas_init");
+    enum { WORKERS = 4, CAP = 256 * 1024 };
+    remote_cas_set_transfer_limits(WORKERS, CAP);
+
+    // store, probe and fetch opaque blobs
+    const char *text = "hello, remote";
+    Digest d;
+    char hex[DIGEST_HEX_SIZE];
+    digest_buffer(text, strlen(text), &d);
+    digest_to_hex(&d, hex);
+    CHECK(remote_cas_exists(hex) == 0, "empty remote has the blob");
+    CHECK(remote_cas_store(hex, (const unsigned char *)text, strlen(text)) == 0, "store");
+    CHECK(remote_cas_exists(hex) == 1, "HEAD after store");
+    unsigned char *data;
+    size_t len;
+    CHECK(remote_cas_retrieve(hex, &data, &len) == 0 && len == strlen(text) && memcmp(data, text, len) == 0,
+          "retrieve");
+    free(data);
+    CHECK(remote_cas_retrieve("00000000000000000000000000000000000000000000000000000000000000ff", &data, &len) != 0,
+          "retrieve of a missing blob");
+    CHECK(remote_cas_exists("../../etc/passwd") == 0, "bad hash probed");
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/cas/%.2s/%s", argv[2], hex, hex + 2);
+    CHECK(access(path, F_OK) == 0, "server layout");
+
+    // many probes are one findMissing request on the kept-alive connection
+    enum { N = 300 };
+    static char names[N][DIGEST_HEX_SIZE];
+    const char *hashes[N];
+    int have[N];
+    for (int i = 0; i < N; ++i) {
+        char blob[32];
+        int n = snprintf(blob, sizeof(blob), "blob %d", i);
+        Digest bd;
+        digest_buffer(blob, (size_t)n, &bd);
+        hashes[i] = digest_to_hex(&bd, names[i]);
+        if (i % 3 == 0) CHECK(remote_cas_store(hashes[i], (const unsigned char *)blob, (size_t)n) == 0, "store batch");
+    }
+    RemoteCASStats st, before, after;
+    remote_cas_get_stats(&before);
+    CHECK(remote_cas_exists_batch(hashes, N, have) == 0, "exists_batch");
+    remote_cas_get_stats(&after);
+    for (int i = 0; i < N; ++i) CHECK(have[i] == (i % 3 == 0), "exists_batch answer");
+    CHECK(after.requests == before.requests + 1, "probes not batched");
+    Digest ds[N];
+    int missing[N];
+    for (int i = 0; i < N; ++i) digest_from_hex(hashes[N - 1 - i], &ds[i]);
+    CHECK(remote_cas_find_missing(ds, N, missing) == 0, "find_missing");
+    for (int i = 0; i < N; ++i) CHECK(missing[i] == ((N - 1 - i) % 3 != 0), "find_missing answer");
+    remote_cas_get_stats(&st);
+    CHECK(st.connections == 1, "connection not kept alive");
+
+    // a directory with a chunked file goes up whole, children first
+    cas_set_chunk_threshold(64 * 1024);
+    mkdir("dir", 0755);
+    mkdir("dir/sub", 0755);
+    write_random("dir/big.bin", 1 << 20, 7);
+    write_text("dir/sub/small.txt", "small\n");
+    const char *dir = "dir";
+    Digest root;
+    CHECK(tree_store_paths(&dir, 1, &root) == 0, "store tree");
+    CHECK(remote_cas_upload_object(&root) == 0, "upload tree");
+    CHECK(remote_cas_exists(digest_to_hex(&root, hex)) == 1, "tree not uploaded");
+    Digest big, *chunks;
+    size_t n;
+    CHECK(cas_store_blob_from_file("dir/big.bin", &big) == 0 && cas_chunk_list(&big, &chunks, &n) == 1 && n > 1,
+          "big file not chunked");
+    for (size_t i = 0; i < n; ++i) CHECK(remote_cas_exists(digest_to_hex(&chunks[i], hex)) == 1, "chunk not uploaded");
+    free(chunks);
+    remote_cas_get_stats(&st);
+    CHECK(st.peak_inflight_bytes > 0 && st.peak_inflight_bytes <= CAP, "in-flight bytes over the cap");
+
+    // a second upload sends only what changed: the new file and the root
+    write_text("dir/new.txt", "new\n");
+    Digest root2;
+    CHECK(tree_store_paths(&dir, 1, &root2) == 0, "store edited tree");
+    remote_cas_get_stats(&before);
+    CHECK(remote_cas_upload_object(&root2) == 0, "upload edited tree");
+    remote_cas_get_stats(&after);
+    CHECK(after.objects_uploaded == before.objects_uploaded + 2, "unchanged objects uploaded again");
+
+    // an object over the cap goes alone, streamed from its file
+    cas_set_chunk_threshold(0);
+    write_random("large.bin", 3 << 20, 11);
+    Digest large;
+    CHECK(cas_store_blob_from_file("large.bin", &large) == 0, "store large");
+    CHECK(remote_cas_upload_object(&large) == 0, "upload large");
+    remote_cas_get_stats(&st);
+    CHECK(st.peak_inflight_bytes == 3 << 20, "large object not sent alone");
+
+    // a sync sends what is left in one batch, then finds nothing to do
+    // with a single request
+    write_text("loose.txt", "only local\n");
+    Digest loose;
+    CHECK(cas_store_blob_from_file("loose.txt", &loose) == 0, "store loose");
+    remote_cas_get_stats(&before);
+    CHECK(remote_cas_sync_to_remote() == 0, "sync_to_remote");
+    remote_cas_get_stats(&after);
+    CHECK(after.objects_uploaded == before.objects_uploaded + 1, "sync uploaded more than the difference");
+    remote_cas_get_stats(&before);
+    CHECK(remote_cas_sync_to_remote() == 0, "second sync_to_remote");
+    remote_cas_get_stats(&after);
+    CHECK(after.requests == before.requests + 1 && after.objects_uploaded == before.objects_uploaded,
+          "in-sync store not settled by one request");
+
+    // task records are stored, fetched and replaced by task hash
+    Digest task;
+    digest_buffer("task", 4, &task);
+    const char *rec1 = "task_hash: first\n", *rec2 = "task_hash: second\n";
+    CHECK(remote_cas_get_action(&task, &data, &len) == 0, "record for an unknown task");
+    CHECK(remote_cas_put_action(&task, (const unsigned char *)rec1, strlen(rec1)) == 0, "put record");
+    CHECK(remote_cas_get_action(&task, &data, &len) == 1 && len == strlen(rec1) && memcmp(data, rec1, len) == 0,
+          "get record");
+    free(data);
+    CHECK(remote_cas_put_action(&task, (const unsigned char *)rec2, strlen(rec2)) == 0, "replace record");
+    CHECK(remote_cas_get_action(&task, &data, &len) == 1 && len == strlen(rec2) && memcmp(data, rec2, len) == 0,
+          "record not replaced");
+    free(data);
+
+    // objects only the remote will have for the clone
+    write_text("through.txt", "read through\n");
+    Digest through;
+    CHECK(cas_store_blob_from_file("through.txt", &through) == 0 && remote_cas_upload_object(&through) == 0,
+          "upload read-through blob");
+    for (int i = 0; i < SHARED; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "shared%d.bin", i);
+        write_random(name, 4096, 100 + i);
+        CHECK(cas_store_blob_from_file(name, &shared[i]) == 0 && remote_cas_upload_object(&shared[i]) == 0,
+              "upload shared blob");
+    }
+
+    // a fresh store fetches the tree and everything below it
+    cas_shutdown();
+    mkdir("clone", 0755);
+    CHECK(cas_init("clone") == 0, "cas_init clone");
+    CHECK(!cas_blob_exists(&root2), "clone not empty");
+    CHECK(remote_cas_download_object(&root2) == 0, "download tree");
+    CHECK(tree_restore(&root2, "clone/out") == 0, "restore downloaded tree");
+    const char *out = "clone/out";
+    Digest got;
+    CHECK(tree_hash_paths(&out, 1, &got) == 0 && digest_eq(&got, &root2), "downloaded tree differs");
+    CHECK(cas_verify_object(&big, NULL) == 0, "downloaded chunked file does not verify");
+    CHECK(remote_cas_download_object(&large) == 0 && cas_verify_object(&large, NULL) == 0,
+          "streamed download does not verify");
+    CHECK(remote_cas_fetch_objects(&large, 1, REMOTE_CAS_BACKGROUND) == 0, "fetch of a present object");
+
+    // a restore that misses locally reads through to the remote
+    CHECK(!cas_blob_exists(&through), "clone has the read-through blob");
+    CHECK(cas_restore_blob_to_file(&through, "clone/through.txt") == 0 && cas_blob_exists(&through),
+          "restore did not read through");
+    // fetches of the same objects at once download each of them once
+    pthread_t fetchers[4];
+    remote_cas_get_stats(&before);
+    for (int i = 0; i < 4; ++i)
+        CHECK(pthread_create(&fetchers[i], NULL, fetch_shared, (void *)(intptr_t)(i % 2)) == 0, "start fetcher");
+    for (int i = 0; i < 4; ++i) {
+        void *r;
+        pthread_join(fetchers[i], &r);
+        CHECK(r == NULL, "concurrent fetch failed");
+    }
+    remote_cas_get_stats(&after);
+    CHECK(after.objects_downloaded - before.objects_downloaded == SHARED, "concurrent fetches downloaded twice");
+
+    // pulling everything fetches only what the clone still lacks
+    CHECK(!cas_blob_exists(&loose), "clone has the loose blob");
+    remote_cas_get_stats(&before);
+    CHECK(remote_cas_sync_from_remote() == 0, "sync_from_remote");
+    remote_cas_get_stats(&after);
+    CHECK(cas_blob_exists(&loose) && cas_blob_exists(&ds[N - 1]) && cas_blob_exists(&root),
+          "sync_from_remote missed objects");
+    // the stored blobs, "hello, remote", the first root and loose.txt
+    // (through.txt and the shared blobs came in above)
+    CHECK(after.objects_downloaded - before.objects_downloaded == (uint64_t)(N / 3 + 3),
+          "sync_from_remote fetched objects already present");
+    remote_cas_get_stats(&before);
+    CHECK(remote_cas_sync_from_remote() == 0, "second sync_from_remote");
+    remote_cas_get_stats(&after);
+    CHECK(after.objects_downloaded == before.objects_downloaded && after.requests == before.requests + 1,
+          "in-sync clone fetched again");
+
+    // content that does not match its name is refused
+    const char *liar = "not what the name says";
+    digest_buffer("the real content", 16, &d);
+    digest_to_hex(&d, hex);
+    CHECK(remote_cas_store(hex, (const unsigned char *)liar, strlen(liar)) == 0, "store mismatched blob");
+    CHECK(remote_cas_download_object(&d) != 0 && !cas_blob_exists(&d), "mismatched blob accepted");
+    CHECK(remote_cas_sync_from_remote() != 0 && !cas_blob_exists(&d), "sync accepted a mismatched blob");
+
+    remote_cas_get_stats(&st);
+    // the engine's connections and the caller's, kept alive throughout
+    CHECK(st.connections <= WORKERS + 1, "connections not reused");
+
+    // a record published in the background goes up after its outputs,
+    // and cleanup waits for it
+    write_text("clone/output.txt", "published output\n");
+    Digest output;
+    CHECK(cas_store_blob_from_file("clone/output.txt", &output) == 0, "store output");
+    digest_buffer("published task", 14, &task);
+    remote_cas_put_action_async(&task, &output, 1, (const unsigned char *)rec1, strlen(rec1));
+    remote_cas_cleanup();
+    snprintf(path, sizeof(path), "%s/cas/%.2s/%s", argv[2], digest_to_hex(&output, hex), hex + 2);
+    CHECK(access(path, F_OK) == 0, "output of a published record not uploaded");
+    snprintf(path, sizeof(path), "%s/ac/%.2s/%s", argv[2], digest_to_hex(&task, hex), hex + 2);
+    CHECK(access(path, F_OK) == 0, "record not published before cleanup returned");
+    cas_shutdown();
+    puts("OK");
+    return 0;
+}
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_remote_cas..."
+gcc -std=c99 -O2 -Wall -Wextra -g remote_cas.c http.c tree.c cas.c util.c sha256.c blake3.c stat_index.c pack.c digest.c chunker.c compression.c hash_pool.c hash_io.c io_batch.c bloom.c durability.c logger.c tests/test_remote_cas.c -o tests/test_remote_cas -lpthread -lm
+gcc -std=c99 -O2 -Wall -Wextra -g reprovm_cas_server.c http.c -o tests/reprovm-cas-server -lpthread
+# run in a scratch directory against a server on a free loopback port
+BIN="$(pwd)/tests/test_remote_cas"
+SERVER="$(pwd)/tests/reprovm-cas-server"
+WORK=$(mktemp -d)
+"$SERVER" --port 0 "$WORK/remote" > "$WORK/server.log" 2>&1 &
+PID=$!
+trap 'kill $PID 2>/dev/null; rm -rf "$WORK"' EXIT
+for _ in $(seq 100); do
+  grep -q "^Serving" "$WORK/server.log" && break
+  sleep 0.05
+done
+URL=$(sed -n 's/^Serving .* on //p' "$WORK/server.log")
+if [ -z "$URL" ]; then
+  echo "FAIL: server did not start"
+  cat "$WORK/server.log"
+  exit 1
+fi
+(cd "$WORK" && "$BIN" "$URL" "$WORK/remote")
+echo "PASS: remote_cas"
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include "../cas.h"
+#include "../gc.h"
+#include "../pack.h"
+#include "../scrub.h"
+#include "helpers.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static void cache_file(const char *name, char *path, size_t sz) {
+    snprintf(path, sz, "%s/%s", cas_get_cache_root(), name);
+}
+
+// Flip one byte of an object where it is stored
+static int damage(const Digest *d) {
+    char path[1200];
+    off_t off = 10;
+    PackRef ref;
+    if (pack_find(d->b, &ref)) {
+        char link[64];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", ref.fd);
+        ssize_t n = readlink(link, path, sizeof(path) - 1);
+        if (n <= 0) return -1;
+        path[n] = '\0';
+        off += (off_t)ref.offset;
+    } else {
+        cas_get_object_path(d, path, sizeof(path));
+    }
+    chmod(path, 0644);
+    int fd = open(path, O_RDWR);
+    unsigned char c;
+    int rc = fd >= 0 && pread(fd, &c, 1, off) == 1 ? 0 : -1;
+    c ^= 0xff;
+    if (rc == 0 && pwrite(fd, &c, 1, off) != 1) rc = -1;
+    if (fd >= 0) close(fd);
+    return rc;
+}
+
+typedef struct {
+    Digest d[4096];
+    size_t n;
+} Listing;
+
+static int list_object(const Digest *d, void *arg) {
+    Listing *l = arg;
+    if (l->n < 4096) l->d[l->n++] = *d;
+    return 0;
+}
+
+// Every object once, in digest order
+static void list_all(Listing *l) {
+    l->n = 0;
+    cas_for_each_object(list_object, l);
+    qsort(l->d, l->n, sizeof(Digest), digest_qsort_cmp);
+    size_t m = 0;
+    for (size_t i = 0; i < l->n; ++i)
+        if (m == 0 || !digest_eq(&l->d[m - 1], &l->d[i])) l->d[m++] = l->d[i];
+    l->n = m;
+}
+
+int main(void) {
+    CHECK(cas_init(".") == 0, "cas_init");
+    cas_set_chunk_threshold(256 * 1024);
+
+    // small objects and the chunks of big end up packed; a stays loose
+    Digest p = store("p", 2000), ok = store("ok", 3000), big = store("big", 1 << 20);
+    CasRepackStats rs;
+    CHECK(cas_repack(&rs) == 0 && rs.objects_packed > 3, "repack");
+    Digest a = store("a", 100 * 1024);
+    Digest *chunks;
+    size_t n_chunks;
+    CHECK(cas_chunk_list(&big, &chunks, &n_chunks) == 1 && n_chunks > 1, "large blob is not chunked");
+    Digest r_a = record("r_a", &a, 1, 0), r_p = record("r_p", &p, 1, 0);
+    Digest r_big = record("r_big", &big, 1, 0), r_ok = record("r_ok", &ok, 1, 0);
+
+    Listing *all = malloc(sizeof(Listing));
+    list_all(all);
+    ScrubOptions opts = { 0, 0, 0 };
+    ScrubStats st;
+    char state[1200];
+    cache_file("scrub.state", state, sizeof(state));
+    CHECK(scrub_run(&opts, &st) == 0, "clean scrub");
+    CHECK(st.complete && !st.resumed && st.corrupt == 0 && st.objects == all->n, "clean scrub counts");
+    CHECK(st.bytes >= (1 << 20) + 100 * 1024, "clean scrub bytes");
+    CHECK(access(state, F_OK) != 0, "checkpoint left after a complete pass");
+    uint64_t pass_bytes = st.bytes;
+
+    // a loose object, a packed one and a chunk of a chunked file go bad
+    CHECK(damage(&a) == 0 && damage(&p) == 0 && damage(&chunks[1]) == 0, "damage objects");
+    CHECK(scrub_run(&opts, &st) == 0, "scrub of damaged store");
+    // the chunk list cannot reassemble either; it goes with its chunk, so
+    // the pass only finds it bad if it gets there first
+    CHECK(st.complete && (st.corrupt == 3 || st.corrupt == 4) && !cas_blob_exists(&big), "corrupt objects not found");
+    CHECK(st.records_invalidated == 3, "records not invalidated");
+    CHECK(!record_exists(&r_a) && !record_exists(&r_p) && !record_exists(&r_big), "record of corrupt object kept");
+    CHECK(record_exists(&r_ok) && restores(&ok), "intact record lost");
+    CHECK(!cas_blob_exists(&a) && !cas_blob_exists(&p) && !cas_blob_exists(&chunks[1]), "corrupt object still stored");
+    char hex[DIGEST_HEX_SIZE], path[1200];
+    snprintf(path, sizeof(path), "%s/%s", cas_get_quarantine_root(), digest_to_hex(&a, hex));
+    CHECK(access(path, F_OK) == 0, "loose object not quarantined");
+    snprintf(path, sizeof(path), "%s/%s", cas_get_quarantine_root(), digest_to_hex(&p, hex));
+    CHECK(access(path, F_OK) == 0, "packed object not quarantined");
+    // storing the content again repairs the store
+    Digest again = store("a", 100 * 1024);
+    CHECK(digest_eq(&a, &again) && restores(&a), "re-store after quarantine");
+    CHECK(scrub_run(&opts, &st) == 0 && st.corrupt == 0, "scrub after repair");
+
+    // resume from a checkpoint in the middle of the store
+    list_all(all);
+    size_t mid = all->n / 2;
+    FILE *f = fopen(state, "w");
+    CHECK(f != NULL, "write checkpoint");
+    fprintf(f, "cursor %s\nobjects %zu\nbytes 0\ncorrupt 0\nstarted 1\n", digest_to_hex(&all->d[mid], hex), mid + 1);
+    fclose(f);
+    CHECK(scrub_run(&opts, &st) == 0, "resumed scrub");
+    CHECK(st.resumed && st.complete && st.objects == all->n - mid - 1, "resume did not start at the cursor");
+    CHECK(st.pass_objects == all->n, "pass total across runs");
+    f = fopen(state, "w");
+    fprintf(f, "cursor %s\n", digest_to_hex(&all->d[mid], hex));
+    fclose(f);
+    opts.restart = 1;
+    CHECK(scrub_run(&opts, &st) == 0 && !st.resumed && st.objects == all->n, "restart ignored checkpoint");
+    opts.restart = 0;
+
+    // a quarantine interrupted before its records went is finished first
+    Digest q = store("q", 5000);
+    Digest r_q = record("r_q", &q, 1, 0);
+    char pending[1200];
+    cache_file("quarantine.pending", pending, sizeof(pending));
+    f = fopen(pending, "w");
+    fprintf(f, "%s\n", digest_to_hex(&q, hex));
+    fclose(f);
+    CHECK(scrub_run(&opts, &st) == 0, "scrub after interrupted quarantine");
+    CHECK(!record_exists(&r_q) && !cas_blob_exists(&q) && access(pending, F_OK) != 0, "pending quarantine");
+
+    // the trees above a bad object go with it, so a rebuild stores it again
+    // instead of reusing them; what else they hold stays
+    Digest t1 = store("t1", 3000), t2 = store("t2", 3000), inner, outer;
+    CasTreeEntry in_e[] = { { CAS_TREE_FILE, t1, "t1" } };
+    CHECK(cas_put_tree(in_e, 1, 1, &inner) == 0, "store inner tree");
+    CasTreeEntry out_e[] = { { CAS_TREE_DIR, inner, "sub" }, { CAS_TREE_FILE, t2, "t2" } };
+    CHECK(cas_put_tree(out_e, 2, 1, &outer) == 0, "store outer tree");
+    Digest r_t = record("r_t", &outer, 1, 0);
+    CHECK(damage(&t1) == 0 && scrub_run(&opts, &st) == 0, "scrub of damaged tree leaf");
+    CHECK(!record_exists(&r_t) && !cas_blob_exists(&t1), "damaged leaf kept");
+    CHECK(!cas_blob_exists(&inner) && !cas_blob_exists(&outer), "tree above a damaged leaf kept");
+    CHECK(restores(&t2), "intact leaf lost");
+
+    // throttled to half a pass per second: at least one refill
+    opts.max_bytes_per_sec = pass_bytes / 2 + 1;
+    time_t t0 = time(NULL);
+    CHECK(scrub_run(&opts, &st) == 0 && st.complete, "throttled scrub");
+    CHECK(time(NULL) - t0 >= 1, "throttle did not slow the scrub");
+    opts.max_bytes_per_sec = 0;
+
+    // one scrub at a time
+    cache_file("scrub.lock", path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    CHECK(fd >= 0 && flock(fd, LOCK_EX) == 0, "lock scrub.lock");
+    CHECK(scrub_run(&opts, &st) == 1, "concurrent scrub not refused");
+    close(fd);
+
+    free(all);
+    free(chunks);
+    cas_shutdown();
+    puts("OK");
+    return 0;
+}
@@ -0,0 +1,12 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_scrub..."
+gcc -std=c99 -O2 -Wall -Wextra -g scrub.c gc.c cas.c util.c sha256.c blake3.c stat_index.c pack.c digest.c chunker.c compression.c hash_pool.c hash_io.c io_batch.c bloom.c durability.c rate_limiter.c metrics.c logger.c tests/test_scrub.c -o tests/test_scrub -lpthread -lm
+# run in a scratch directory so an existing .reprovm cannot affect the result
+BIN="$(pwd)/tests/test_scrub"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+(cd "$WORK" && "$BIN")
+echo "PASS: scrub"
@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_sha256..."
+gcc -std=c99 -O2 -Wall -Wextra -g sha256.c tests/test_sha256.c -o tests/test_sha256 -lpthread
+./tests/test_sha256
+echo "PASS: sha256"
@@ -0,0 +1,75 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../stat_index.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+// Push mtime well into the past so the entry is not racy
+static void age_file(const char *path) {
+    struct timespec times[2];
+    clock_gettime(CLOCK_REALTIME, &times[0]);
+    times[0].tv_sec -= 60;
+    times[1] = times[0];
+    utimensat(AT_FDCWD, path, times, 0);
+}
+
+int main(void) {
+    const char *idx = "tests_stat_index.bin";
+    const char *fn = "tests_stat_index_input.txt";
+    uint8_t digest[32], got[32];
+    struct stat st;
+    memset(digest, 0xab, sizeof(digest));
+    remove(idx);
+
+    // a freshly written file is racy: recorded but not trusted
+    write_file(fn, "hello\n");
+    stat_index_open(idx);
+    stat(fn, &st);
+    stat_index_update(fn, &st, digest, stat_index_now_ns());
+    if (stat_index_lookup(fn, &st, got)) { fprintf(stderr, "racy entry was trusted\n"); return 1; }
+
+    // an old file hits, also after a save/load round trip
+    age_file(fn);
+    stat(fn, &st);
+    stat_index_update(fn, &st, digest, stat_index_now_ns());
+    if (!stat_index_lookup(fn, &st, got) || memcmp(got, digest, 32) != 0) {
+        fprintf(stderr, "expected index hit\n");
+        return 1;
+    }
+    stat_index_close();
+    stat_index_open(idx);
+    if (!stat_index_lookup(fn, &st, got) || memcmp(got, digest, 32) != 0) {
+        fprintf(stderr, "expected index hit after reload\n");
+        return 1;
+    }
+
+    // any change to the fingerprint misses
+    write_file(fn, "hullo\n");
+    age_file(fn);
+    stat(fn, &st);
+    if (stat_index_lookup(fn, &st, got)) { fprintf(stderr, "stale entry was trusted\n"); return 1; }
+    stat_index_close();
+
+    // a damaged index is ignored
+    FILE *f = fopen(idx, "r+b");
+    fseek(f, 20, SEEK_SET);
+    fputc('X', f);
+    fclose(f);
+    stat_index_open(idx);
+    if (stat_index_lookup(fn, &st, got)) { fprintf(stderr, "damaged index was used\n"); return 1; }
+    stat_index_close();
+
+    remove(fn);
+    remove(idx);
+    puts("OK");
+    return 0;
+}
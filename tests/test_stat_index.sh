@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_stat_index..."
+gcc -std=c99 -O2 -Wall -Wextra -g stat_index.c sha256.c tests/test_stat_index.c -o tests/test_stat_index -lpthread
+./tests/test_stat_index 2>/dev/null
+echo "PASS: stat_index"
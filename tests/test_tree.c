@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include "../cas.h"
+#include "../gc.h"
+#include "../tree.h"
+#include "helpers.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Replaces path, which may be a read-only link to an object
+static void write_file(const char *path, const char *text, mode_t mode) {
+    unlink(path);
+    FILE *f = fopen(path, "w");
+    if (!f || fputs(text, f) < 0 || fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+    chmod(path, mode);
+}
+
+// Set every timestamp under path an hour back, out of the racy window
+static void age(const char *path) {
+    struct timespec ts[2];
+    clock_gettime(CLOCK_REALTIME, &ts[0]);
+    ts[0].tv_sec -= 3600;
+    ts[1] = ts[0];
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "find %s -depth -print > tests_tree_paths.txt", path);
+    if (system(cmd) != 0) exit(1);
+    FILE *f = fopen("tests_tree_paths.txt", "r");
+    char line[1024];
+    while (f && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        utimensat(AT_FDCWD, line, ts, AT_SYMLINK_NOFOLLOW);
+    }
+    if (f) fclose(f);
+    remove("tests_tree_paths.txt");
+}
+
+static Digest store_tree(const char *path) {
+    Digest d;
+    if (tree_store_paths(&path, 1, &d) != 0) {
+        fprintf(stderr, "storing %s failed\n", path);
+        exit(1);
+    }
+    return d;
+}
+
+// Whether the directory at path hashes to want
+static int tree_is(const char *path, const Digest *want) {
+    Digest d;
+    return tree_hash_paths(&path, 1, &d) == 0 && digest_eq(&d, want);
+}
+
+static int stores_as(const char *path, const Digest *want) {
+    Digest d = store_tree(path);
+    return digest_eq(&d, want);
+}
+
+int main(void) {
+    CHECK(cas_init(".") == 0, "cas_init");
+    mkdir("src", 0755);
+    mkdir("src/empty", 0755);
+    mkdir("src/sub", 0755);
+    mkdir("src/sub/deep", 0755);
+    write_file("src/a.txt", "alpha\n", 0644);
+    write_file("src/b.sh", "#!/bin/sh\necho beta\n", 0755);
+    write_file("src/sub/c.txt", "gamma\n", 0644);
+    write_file("src/sub/deep/d.txt", "delta\n", 0644);
+    CHECK(symlink("a.txt", "src/link") == 0, "symlink");
+
+    // a directory hashes to a tree, a file beside it to its content
+    const char *paths[] = { "src", "src/a.txt" };
+    Digest hashed[2], stored[2];
+    CHECK(tree_hash_paths(paths, 2, hashed) == 0, "tree_hash_paths");
+    CHECK(!cas_blob_exists(&hashed[0]), "hashing stored the tree");
+    CHECK(tree_store_paths(paths, 2, stored) == 0, "tree_store_paths");
+    CHECK(digest_eq(&hashed[0], &stored[0]) && digest_eq(&hashed[1], &stored[1]), "hash and store disagree");
+    Digest root = stored[0];
+    CHECK(cas_is_tree(&root) == 1 && cas_is_tree(&stored[1]) == 0, "cas_is_tree");
+    CHECK(cas_verify_object(&root, NULL) == 0, "tree does not verify");
+
+    CasTreeEntry *e;
+    size_t n;
+    CHECK(cas_tree_entries(&root, &e, &n) == 1 && n == 5, "tree entries");
+    const char *names[] = { "a.txt", "b.sh", "empty", "link", "sub" };
+    uint32_t modes[] = { CAS_TREE_FILE, CAS_TREE_EXEC, CAS_TREE_DIR, CAS_TREE_SYMLINK, CAS_TREE_DIR };
+    for (size_t i = 0; i < n; ++i)
+        CHECK(strcmp(e[i].name, names[i]) == 0 && e[i].mode == modes[i], "entry names or modes");
+    CHECK(digest_eq(&e[0].d, &stored[1]), "file entry digest");
+    Digest old_sub = e[4].d;
+    cas_free_tree_entries(e, n);
+    CHECK(cas_tree_entries(&stored[1], &e, &n) == 0, "a blob listed as a tree");
+
+    // unchanged subtrees come from the index once out of the racy window
+    age("src");
+    TreeStats before, after;
+    CHECK(stores_as("src", &root), "aging changed the digest");
+    tree_get_stats(&before);
+    CHECK(stores_as("src", &root), "rescan changed the digest");
+    tree_get_stats(&after);
+    CHECK(after.dirs_rebuilt == before.dirs_rebuilt && after.dirs_reused == before.dirs_reused + 4,
+          "unchanged tree was rebuilt");
+    // the stat index alone vouches for them now, but not for a new file
+    Digest looked[2];
+    CHECK(tree_lookup_paths(paths, 2, looked) == 0 && digest_eq(&looked[0], &root) &&
+              digest_eq(&looked[1], &stored[1]),
+          "lookup from the index");
+    write_file("fresh.txt", "fresh\n", 0644);
+    const char *fresh = "fresh.txt";
+    CHECK(tree_lookup_paths(&fresh, 1, looked) != 0 && digest_is_zero(&looked[0]), "unindexed file looked up");
+
+    // an edit deep down rebuilds only its path to the root
+    write_file("src/sub/deep/d.txt", "delta, edited\n", 0644);
+    age("src");
+    tree_get_stats(&before);
+    Digest edited = store_tree("src");
+    tree_get_stats(&after);
+    CHECK(!digest_eq(&edited, &root), "edit did not change the root");
+    CHECK(after.dirs_rebuilt == before.dirs_rebuilt + 3 && after.dirs_reused == before.dirs_reused + 1,
+          "edit rebuilt more than its path");
+    CHECK(cas_tree_entries(&edited, &e, &n) == 1 && n == 5, "edited tree entries");
+    CHECK(digest_eq(&e[0].d, &stored[1]) && !digest_eq(&e[4].d, &old_sub), "edited tree children");
+    cas_free_tree_entries(e, n);
+
+    // restore into nothing reproduces the tree, modes and links included
+    CHECK(tree_restore(&root, "out") == 0, "restore");
+    CHECK(tree_is("out", &root), "restored tree differs");
+    struct stat st;
+    CHECK(stat("out/b.sh", &st) == 0 && (st.st_mode & S_IXUSR), "exec bit lost");
+    CHECK(stat("out/a.txt", &st) == 0 && !(st.st_mode & S_IXUSR), "exec bit added");
+    char target[64];
+    ssize_t len = readlink("out/link", target, sizeof(target));
+    CHECK(len == 5 && memcmp(target, "a.txt", 5) == 0, "symlink target");
+
+    // a second restore writes only what differs and removes what is extra
+    write_file("out/a.txt", "tampered\n", 0644);
+    write_file("out/extra.txt", "extra\n", 0644);
+    mkdir("out/sub/stray", 0755);
+    write_file("out/sub/stray/s.txt", "stray\n", 0644);
+    CHECK(rmdir("out/empty") == 0, "rmdir");
+    tree_get_stats(&before);
+    CHECK(tree_restore(&root, "out") == 0, "repair restore");
+    tree_get_stats(&after);
+    CHECK(tree_is("out", &root), "repaired tree differs");
+    CHECK(after.entries_written == before.entries_written + 1, "unchanged files rewritten");
+    CHECK(after.entries_removed == before.entries_removed + 2, "extra entries not removed");
+    CHECK(after.entries_kept >= before.entries_kept + 4, "unchanged entries not kept");
+
+    tree_get_stats(&before);
+    CHECK(tree_restore(&edited, "out") == 0, "restore of the edit");
+    tree_get_stats(&after);
+    CHECK(tree_is("out", &edited), "edited restore differs");
+    CHECK(after.entries_written == before.entries_written + 1, "edit restore wrote more than the edit");
+
+    // outputs are detached before a task rewrites them
+    CHECK(tree_detach("out") == 0 && access("out/sub/c.txt", W_OK) == 0, "tree_detach");
+    write_file("out/sub/c.txt", "rewritten\n", 0644);
+    CHECK(tree_remove("out") == 0 && access("out", F_OK) != 0, "tree_remove");
+    CHECK(tree_restore(&root, "out") == 0 && tree_is("out", &root), "store changed by a task");
+
+    // a record naming the tree keeps everything in it alive
+    Digest task;
+    digest_buffer("task", 4, &task);
+    char hex[DIGEST_HEX_SIZE], path[1200];
+    snprintf(path, sizeof(path), "%s/%s.meta", cas_get_cache_root(), digest_to_hex(&task, hex));
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL, "write record");
+    fprintf(f, "task_hash: %s\nresult_hash: \ntree out %s\n", hex, digest_to_hex(&root, hex));
+    fclose(f);
+    GcOptions opts = { 0, 0, 0 };
+    GcStats gs;
+    CHECK(gc_run(&opts, &gs) == 0, "gc");
+    CHECK(!cas_blob_exists(&edited), "unreferenced tree kept");
+    CHECK(tree_remove("out") == 0 && tree_restore(&root, "out") == 0 && tree_is("out", &root),
+          "gc dropped part of a live tree");
+
+    cas_shutdown();
+    puts("OK");
+    return 0;
+}
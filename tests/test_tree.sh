@@ -0,0 +1,12 @@
+#!/usr/bin/env bash
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Compiling and running test_tree..."
+gcc -std=c99 -O2 -Wall -Wextra -g tree.c gc.c cas.c util.c sha256.c blake3.c stat_index.c pack.c digest.c chunker.c compression.c hash_pool.c hash_io.c io_batch.c bloom.c durability.c logger.c tests/test_tree.c -o tests/test_tree -lpthread -lm
+# run in a scratch directory so an existing .reprovm cannot affect the result
+BIN="$(pwd)/tests/test_tree"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+(cd "$WORK" && "$BIN")
+echo "PASS: tree"
@@ -1,4 +1,8 @@
+#define _POSIX_C_SOURCE 200809L
 #include "../util.h"
+#include "../hash_io.h"
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -29,6 +33,29 @@ int main(void) {
         return 1;
     }
 
+    // every read strategy hashes the same bytes, around each size threshold
+    static const size_t sizes[] = { 0, 1, HASH_IO_PREAD_MAX, HASH_IO_PREAD_MAX + 1, HASH_IO_PIECE + 7,
+                                    HASH_IO_MMAP_MIN - 1, HASH_IO_MMAP_MIN + 4097 };
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        f = fopen(fn, "wb");
+        if (!f) { perror("fopen"); return 1; }
+        for (size_t j = 0; j < sizes[k]; ++j) fputc((int)((j * 7 + j / 251) & 0xff), f);
+        fclose(f);
+        uint8_t want[32], got[32];
+        for (int s = 0; s < HASH_IO_COUNT; ++s) {
+            int fd = open(fn, O_RDONLY);
+            if (fd < 0 || hash_io_sha256_fd(fd, (HashIoStrategy)s, s ? got : want) != 0) {
+                fprintf(stderr, "hash_io %s failed\n", hash_io_strategy_name((HashIoStrategy)s));
+                return 1;
+            }
+            close(fd);
+            if (s && memcmp(want, got, sizeof(want)) != 0) {
+                fprintf(stderr, "hash_io %s differs at size %zu\n", hash_io_strategy_name((HashIoStrategy)s), sizes[k]);
+                return 1;
+            }
+        }
+    }
+
     remove(fn);
     puts("OK");
     return 0;
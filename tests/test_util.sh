@@ -3,6 +3,6 @@ set -euo pipefail
 cd "$(dirname "$0")/.."
 
 echo "Compiling and running test_util..."
-gcc -std=c99 -O2 -Wall -Wextra -g util.c tests/test_util.c -o tests/test_util
+gcc -std=c99 -O2 -Wall -Wextra -g util.c sha256.c hash_io.c tests/test_util.c -o tests/test_util -lpthread
 ./tests/test_util
 echo "PASS: util"
@@ -0,0 +1,472 @@
+// tree.c
+#define _POSIX_C_SOURCE 200809L
+#include "tree.h"
+#include "cas.h"
+#include "sha256.h"
+#include "stat_index.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LINK_MAX_LEN 4096
+
+static TreeStats tree_stats; // updated with relaxed atomics
+
+static void count(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+void tree_get_stats(TreeStats *out) {
+    out->dirs_reused = __atomic_load_n(&tree_stats.dirs_reused, __ATOMIC_RELAXED);
+    out->dirs_rebuilt = __atomic_load_n(&tree_stats.dirs_rebuilt, __ATOMIC_RELAXED);
+    out->entries_kept = __atomic_load_n(&tree_stats.entries_kept, __ATOMIC_RELAXED);
+    out->entries_written = __atomic_load_n(&tree_stats.entries_written, __ATOMIC_RELAXED);
+    out->entries_removed = __atomic_load_n(&tree_stats.entries_removed, __ATOMIC_RELAXED);
+}
+
+void tree_print_stats(FILE *out) {
+    TreeStats st;
+    tree_get_stats(&st);
+    if (st.dirs_reused + st.dirs_rebuilt > 0)
+        fprintf(out, "Directory trees: %llu unchanged, %llu rebuilt\n", (unsigned long long)st.dirs_reused,
+                (unsigned long long)st.dirs_rebuilt);
+    if (st.entries_kept + st.entries_written + st.entries_removed > 0)
+        fprintf(out, "Tree restores: %llu entries kept, %llu written, %llu removed\n",
+                (unsigned long long)st.entries_kept, (unsigned long long)st.entries_written,
+                (unsigned long long)st.entries_removed);
+}
+
+// One entry of a directory being scanned
+typedef struct {
+    char *name;
+    struct stat st;
+    uint8_t fp[32];  // directories: fingerprint of their subtree
+    int64_t newest;  // directories: newest timestamp in their subtree
+    Digest d;
+} Child;
+
+static char *join(const char *dir, const char *name) {
+    size_t a = strlen(dir), b = strlen(name);
+    char *p = malloc(a + b + 2);
+    if (p) {
+        memcpy(p, dir, a);
+        p[a] = '/';
+        memcpy(p + a + 1, name, b + 1);
+    }
+    return p;
+}
+
+// path without trailing slashes, so "gen/" and "gen" share index entries
+static char *normalize(const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') len--;
+    char *p = malloc(len + 1);
+    if (p) {
+        memcpy(p, path, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+static int64_t ts_ns(struct timespec ts) {
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_child(const void *a, const void *b) {
+    return strcmp(((const Child *)a)->name, ((const Child *)b)->name);
+}
+
+static void free_children(Child *c, size_t n) {
+    for (size_t i = 0; i < n; ++i) free(c[i].name);
+    free(c);
+}
+
+// The regular files, symlinks and subdirectories of path, sorted by name
+static int list_dir(const char *path, Child **out, size_t *n) {
+    *out = NULL;
+    *n = 0;
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    size_t cap = 0;
+    int rc = 0;
+    struct dirent *de;
+    while (rc == 0 && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        struct stat st;
+        char *p = join(path, de->d_name);
+        int ok = p && lstat(p, &st) == 0;
+        free(p);
+        if (!ok) {
+            rc = -1;
+            break;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode)) continue;
+        if (*n == cap) {
+            size_t new_cap = cap ? cap * 2 : 16;
+            Child *grown = realloc(*out, sizeof(Child) * new_cap);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            *out = grown;
+            cap = new_cap;
+        }
+        Child *c = &(*out)[*n];
+        memset(c, 0, sizeof(*c));
+        c->st = st;
+        if ((c->name = malloc(strlen(de->d_name) + 1)) == NULL) {
+            rc = -1;
+            break;
+        }
+        strcpy(c->name, de->d_name);
+        (*n)++;
+    }
+    closedir(d);
+    if (rc != 0) {
+        free_children(*out, *n);
+        *out = NULL;
+        *n = 0;
+        return -1;
+    }
+    qsort(*out, *n, sizeof(Child), cmp_child);
+    return 0;
+}
+
+// A symlink's target, as a blob
+static int hash_link(const char *path, int store, Digest *out) {
+    char target[LINK_MAX_LEN];
+    ssize_t len = readlink(path, target, sizeof(target));
+    if (len < 0 || len == (ssize_t)sizeof(target)) return -1;
+    if (store) return cas_store_blob_from_memory((const unsigned char *)target, (size_t)len, out);
+    digest_buffer(target, (size_t)len, out);
+    return 0;
+}
+
+static uint32_t entry_mode(const struct stat *st) {
+    if (S_ISDIR(st->st_mode)) return CAS_TREE_DIR;
+    if (S_ISLNK(st->st_mode)) return CAS_TREE_SYMLINK;
+    return (st->st_mode & S_IXUSR) ? CAS_TREE_EXEC : CAS_TREE_FILE;
+}
+
+// Digest of the tree at path (dir_st is its stat). Subdirectories are
+// scanned first, since the fingerprint covers their fingerprints; the tree
+// itself is rebuilt only when the index has nothing for that fingerprint,
+// or with indexed_only fails instead.
+static int scan_dir(const char *path, const struct stat *dir_st, int store, int indexed_only, Digest *out,
+                    uint8_t fp[32], int64_t *newest) {
+    int64_t stamp = stat_index_now_ns(); // before any stat below
+    Child *c;
+    size_t n;
+    if (list_dir(path, &c, &n) != 0) return -1;
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    int64_t latest = 0;
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        const struct stat *st = &c[i].st;
+        uint64_t fields[5] = { (uint64_t)st->st_mode, (uint64_t)st->st_ino, (uint64_t)st->st_size,
+                               (uint64_t)ts_ns(st->st_mtim), (uint64_t)ts_ns(st->st_ctim) };
+        if (ts_ns(st->st_mtim) > latest) latest = ts_ns(st->st_mtim);
+        sha256_update(&ctx, (const uint8_t *)c[i].name, strlen(c[i].name) + 1);
+        sha256_update(&ctx, (const uint8_t *)fields, sizeof(fields));
+        if (!S_ISDIR(st->st_mode)) continue;
+        char *sub = join(path, c[i].name);
+        rc = sub ? scan_dir(sub, st, store, indexed_only, &c[i].d, c[i].fp, &c[i].newest) : -1;
+        free(sub);
+        if (c[i].newest > latest) latest = c[i].newest;
+        sha256_update(&ctx, c[i].fp, 32);
+    }
+    sha256_final(&ctx, fp);
+    *newest = latest;
+    if (rc == 0 && stat_index_lookup_tree(path, dir_st, fp, out->b) && (!store || cas_blob_exists(out))) {
+        count(&tree_stats.dirs_reused, 1);
+        free_children(c, n);
+        return 0;
+    }
+    if (indexed_only) {
+        free_children(c, n);
+        return -1;
+    }
+    count(&tree_stats.dirs_rebuilt, 1);
+    // something below changed: the files go through the batch (which still
+    // skips the ones the index vouches for), then the tree is rebuilt
+    char **paths = malloc(sizeof(char *) * (n ? n : 1));
+    size_t *slot = malloc(sizeof(size_t) * (n ? n : 1));
+    Digest *digests = malloc(sizeof(Digest) * (n ? n : 1));
+    CasTreeEntry *entries = malloc(sizeof(CasTreeEntry) * (n ? n : 1));
+    if (!paths || !slot || !digests || !entries) rc = -1;
+    int m = 0;
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        if (S_ISDIR(c[i].st.st_mode)) continue;
+        char *p = join(path, c[i].name);
+        if (!p) {
+            rc = -1;
+        } else if (S_ISLNK(c[i].st.st_mode)) {
+            rc = hash_link(p, store, &c[i].d);
+            free(p);
+        } else {
+            paths[m] = p;
+            slot[m++] = i;
+        }
+    }
+    if (rc == 0 && m > 0) {
+        rc = store ? cas_store_files_batch((const char *const *)paths, m, digests)
+                   : cas_hash_files_batch((const char *const *)paths, m, digests);
+        for (int k = 0; k < m; ++k) c[slot[k]].d = digests[k];
+    }
+    for (int k = 0; k < m; ++k) free(paths[k]);
+    if (rc == 0) {
+        for (size_t i = 0; i < n; ++i) {
+            entries[i].mode = entry_mode(&c[i].st);
+            entries[i].d = c[i].d;
+            entries[i].name = c[i].name;
+        }
+        rc = cas_put_tree(entries, n, store, out);
+    }
+    if (rc == 0) stat_index_update_tree(path, dir_st, fp, latest, out->b, stamp);
+    free(paths);
+    free(slot);
+    free(digests);
+    free(entries);
+    free_children(c, n);
+    return rc;
+}
+
+static int hash_paths(const char *const paths[], int n, Digest out[], int store, int indexed_only) {
+    const char **files = malloc(sizeof(char *) * (n > 0 ? n : 1));
+    int *slot = malloc(sizeof(int) * (n > 0 ? n : 1));
+    Digest *digests = malloc(sizeof(Digest) * (n > 0 ? n : 1));
+    if (!files || !slot || !digests) {
+        free(files);
+        free(slot);
+        free(digests);
+        return -1;
+    }
+    int m = 0, rc = 0;
+    for (int i = 0; i < n; ++i) {
+        struct stat st;
+        memset(&out[i], 0, sizeof(Digest));
+        int found = stat(paths[i], &st) == 0;
+        if (!found || !S_ISDIR(st.st_mode)) {
+            if (!indexed_only) {
+                files[m] = paths[i];
+                slot[m++] = i;
+            } else if (!found || !stat_index_lookup(paths[i], &st, out[i].b)) {
+                memset(&out[i], 0, sizeof(Digest));
+                rc = -1;
+            }
+            continue;
+        }
+        uint8_t fp[32];
+        int64_t newest;
+        char *dir = normalize(paths[i]);
+        if (!dir || scan_dir(dir, &st, store, indexed_only, &out[i], fp, &newest) != 0) {
+            memset(&out[i], 0, sizeof(Digest));
+            rc = -1;
+        }
+        free(dir);
+    }
+    if (m > 0) {
+        if ((store ? cas_store_files_batch(files, m, digests) : cas_hash_files_batch(files, m, digests)) != 0) rc = -1;
+        for (int k = 0; k < m; ++k) out[slot[k]] = digests[k];
+    }
+    free(files);
+    free(slot);
+    free(digests);
+    return rc;
+}
+
+int tree_hash_paths(const char *const paths[], int n, Digest out[]) {
+    return hash_paths(paths, n, out, 0, 0);
+}
+
+int tree_store_paths(const char *const paths[], int n, Digest out[]) {
+    return hash_paths(paths, n, out, 1, 0);
+}
+
+int tree_lookup_paths(const char *const paths[], int n, Digest out[]) {
+    return hash_paths(paths, n, out, 0, 1);
+}
+
+int tree_remove(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return errno == ENOENT ? 0 : -1;
+    if (!S_ISDIR(st.st_mode)) return unlink(path);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    int rc = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        char *p = join(path, de->d_name);
+        if (!p || tree_remove(p) != 0) rc = -1;
+        free(p);
+    }
+    closedir(d);
+    return rmdir(path) == 0 ? rc : -1;
+}
+
+int tree_detach(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return cas_detach_output(path);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    int rc = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        char *p = join(path, de->d_name);
+        if (!p || tree_detach(p) != 0) rc = -1;
+        free(p);
+    }
+    closedir(d);
+    return rc;
+}
+
+static int cmp_entry_name(const void *key, const void *e) {
+    return strcmp(key, ((const CasTreeEntry *)e)->name);
+}
+
+// A symlink pointing at the target stored as d
+static int restore_link(const Digest *d, const char *path, int have, const struct stat *st, int *wrote) {
+    unsigned char *target;
+    size_t len;
+    if (cas_read_blob(d, &target, &len) != 0) return -1;
+    char *want = malloc(len + 1);
+    int rc = want ? 0 : -1;
+    if (want) {
+        memcpy(want, target, len);
+        want[len] = '\0';
+    }
+    char cur[LINK_MAX_LEN];
+    ssize_t got = have && S_ISLNK(st->st_mode) ? readlink(path, cur, sizeof(cur)) : -1;
+    if (rc == 0 && !(got == (ssize_t)len && memcmp(cur, want, len) == 0)) {
+        if (have) tree_remove(path);
+        rc = symlink(want, path);
+        *wrote = 1;
+    }
+    free(want);
+    free(target);
+    return rc;
+}
+
+// Set the exec bit as the tree has it. A file hardlinked to its object is
+// detached first: the object's mode is shared with every other link to it.
+static int fix_mode(const char *path, int exec) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return -1;
+    if (!exec == !(st.st_mode & S_IXUSR)) return 0;
+    if (cas_detach_output(path) != 0) return -1;
+    return chmod(path, exec ? 0755 : (st.st_mode & 07666)) == 0 ? 0 : -1;
+}
+
+static int restore_dir(const Digest *d, const char *dest) {
+    CasTreeEntry *e;
+    size_t n;
+    if (cas_tree_entries(d, &e, &n) != 1) return -1;
+    struct stat st;
+    if (lstat(dest, &st) == 0 && !S_ISDIR(st.st_mode)) unlink(dest);
+    if (mkdir(dest, 0755) != 0 && errno != EEXIST) {
+        cas_free_tree_entries(e, n);
+        return -1;
+    }
+    int rc = 0;
+    // entries the tree does not list
+    DIR *dir = opendir(dest);
+    struct dirent *de;
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+            bsearch(de->d_name, e, n, sizeof(CasTreeEntry), cmp_entry_name))
+            continue;
+        char *p = join(dest, de->d_name);
+        if (!p || tree_remove(p) != 0) rc = -1;
+        free(p);
+        count(&tree_stats.entries_removed, 1);
+    }
+    if (!dir) rc = -1;
+    else closedir(dir);
+    // files whose content is unknown are hashed together, then the ones
+    // that differ are restored together
+    char **paths = calloc(n ? n : 1, sizeof(char *));
+    int *state = calloc(n ? n : 1, sizeof(int)); // 0 same, 1 to hash, 2 to restore
+    const char **hashed = malloc(sizeof(char *) * (n ? n : 1));
+    const char **dests = malloc(sizeof(char *) * (n ? n : 1));
+    Digest *digests = malloc(sizeof(Digest) * (n ? n : 1));
+    if (!paths || !state || !hashed || !dests || !digests) rc = -1;
+    int m = 0;
+    for (size_t i = 0; paths && state && hashed && i < n; ++i) {
+        if ((paths[i] = join(dest, e[i].name)) == NULL) {
+            rc = -1;
+            continue;
+        }
+        int have = lstat(paths[i], &st) == 0;
+        if (e[i].mode == CAS_TREE_DIR) {
+            if (have && !S_ISDIR(st.st_mode)) unlink(paths[i]);
+            if (restore_dir(&e[i].d, paths[i]) != 0) rc = -1;
+            continue;
+        }
+        if (e[i].mode == CAS_TREE_SYMLINK) {
+            int wrote = 0;
+            if (restore_link(&e[i].d, paths[i], have, &st, &wrote) != 0) rc = -1;
+            count(wrote ? &tree_stats.entries_written : &tree_stats.entries_kept, 1);
+            continue;
+        }
+        if (have && !S_ISREG(st.st_mode)) {
+            if (tree_remove(paths[i]) != 0) rc = -1;
+            have = 0;
+        }
+        uint8_t known[32];
+        if (!have) state[i] = 2;
+        else if (!stat_index_lookup(paths[i], &st, known)) state[i] = 1;
+        else state[i] = memcmp(known, e[i].d.b, 32) == 0 ? 0 : 2;
+        if (state[i] == 1) hashed[m++] = paths[i];
+    }
+    if (rc == 0 && m > 0) {
+        cas_hash_files_batch(hashed, m, digests); // unreadable ones stay zero, so differ
+        for (size_t i = 0, k = 0; i < n; ++i) {
+            if (state[i] != 1) continue;
+            state[i] = digest_eq(&digests[k++], &e[i].d) ? 0 : 2;
+        }
+    }
+    int r = 0;
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        if (state[i] != 2) continue;
+        digests[r] = e[i].d;
+        dests[r++] = paths[i];
+    }
+    if (rc == 0 && r > 0 && cas_restore_blobs_batch(digests, dests, r) != 0) rc = -1;
+    if (rc == 0) {
+        count(&tree_stats.entries_written, (uint64_t)r);
+        for (size_t i = 0; i < n; ++i)
+            if ((e[i].mode == CAS_TREE_FILE || e[i].mode == CAS_TREE_EXEC) && state[i] == 0)
+                count(&tree_stats.entries_kept, 1);
+    }
+    for (size_t i = 0; rc == 0 && i < n; ++i) {
+        if (e[i].mode != CAS_TREE_FILE && e[i].mode != CAS_TREE_EXEC) continue;
+        if (fix_mode(paths[i], e[i].mode == CAS_TREE_EXEC) != 0) rc = -1;
+        // the next restore or scan need not read what was just written
+        if (state[i] == 2 && lstat(paths[i], &st) == 0)
+            stat_index_update(paths[i], &st, e[i].d.b, stat_index_now_ns());
+    }
+    for (size_t i = 0; paths && i < n; ++i) free(paths[i]);
+    free(paths);
+    free(state);
+    free(hashed);
+    free(dests);
+    free(digests);
+    cas_free_tree_entries(e, n);
+    return rc;
+}
+
+int tree_restore(const Digest *d, const char *dest) {
+    // a tree missing here is fetched whole, with all it names
+    cas_fetch_missing(d, 1);
+    char *dir = normalize(dest);
+    int rc = dir ? restore_dir(d, dir) : -1;
+    free(dir);
+    return rc;
+}
@@ -0,0 +1,56 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "digest.h"
+
+/*
+ * Directory artifacts. A task input or output that names a directory is
+ * hashed as a Merkle tree (see CasTreeEntry in cas.h): one tree object per
+ * directory, listing each regular file, symlink and subdirectory by name,
+ * mode and digest. Other file types are left out.
+ *
+ * Each directory's digest is kept in the stat index under a fingerprint of
+ * the stat of everything below it, so a subtree in which nothing changed is
+ * only stat'ed: its files are not re-read and its tree is not rebuilt.
+ * Restoring a tree compares the directory on disk with the listing and
+ * writes only the entries that differ.
+ */
+
+// cas_hash_files_batch / cas_store_files_batch over paths that may also be
+// directories, which get the digest of their tree (stored, with every file
+// and subtree in it, by tree_store_paths). out[i] stays all-zero if
+// paths[i] could not be read. Returns 0 if every path was hashed.
+int tree_hash_paths(const char *const paths[], int n, Digest out[]);
+int tree_store_paths(const char *const paths[], int n, Digest out[]);
+
+// tree_hash_paths from the stat index alone: nothing is read but stat
+// results, and a path the index cannot vouch for fails (out[i] all-zero)
+int tree_lookup_paths(const char *const paths[], int n, Digest out[]);
+
+// Make dest match the tree d: missing and changed entries are restored,
+// entries the tree does not list are removed, and unchanged files (by the
+// stat index, or by hashing when it cannot vouch for them) are left alone.
+// Returns 0 on success.
+int tree_restore(const Digest *d, const char *dest);
+
+// cas_detach_output for path and, if it is a directory, every file below it
+int tree_detach(const char *path);
+
+// Remove path and everything below it. A missing path is not an error.
+int tree_remove(const char *path);
+
+// Counters for this process
+typedef struct {
+    uint64_t dirs_reused;     // directories whose digest came from the stat index
+    uint64_t dirs_rebuilt;    // directories whose tree was built again
+    uint64_t entries_kept;    // restore: files and symlinks already right on disk
+    uint64_t entries_written; // restore: files and symlinks written
+    uint64_t entries_removed; // restore: entries the tree does not list
+} TreeStats;
+
+void tree_get_stats(TreeStats *out);
+void tree_print_stats(FILE *out); // nothing when no directory was involved
+
+#endif // TREE_H
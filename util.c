@@ -1,5 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include "util.h"
+#include "sha256.h"
+#include "hash_io.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -7,6 +9,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 char *read_entire_file(const char *path, size_t *out_size) {
     FILE *f = fopen(path, "rb");
@@ -152,18 +155,39 @@ char *join_strings(const char **parts, int n, const char *sep) {
     return res;
 }
 
-char *hex_encode(const unsigned char *data, size_t len) {
+static void hex_into(const unsigned char *data, size_t len, char *out) {
     static const char hex[] = "0123456789abcdef";
-    char *out = malloc(len * 2 + 1);
-    if (!out) return NULL;
     for (size_t i = 0; i < len; ++i) {
         out[2*i]   = hex[(data[i] >> 4) & 0xF];
         out[2*i+1] = hex[data[i] & 0xF];
     }
     out[len*2] = '\0';
+}
+
+char *hex_encode(const unsigned char *data, size_t len) {
+    char *out = malloc(len * 2 + 1);
+    if (!out) return NULL;
+    hex_into(data, len, out);
     return out;
 }
 
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int hex_decode(const char *hex, unsigned char *out, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        int hi = hex_nibble(hex[2*i]);
+        int lo = hi < 0 ? -1 : hex_nibble(hex[2*i+1]);
+        if (lo < 0) return -1;
+        out[i] = (unsigned char)((hi << 4) | lo);
+    }
+    return hex[len*2] == '\0' ? 0 : -1;
+}
+
 void hexdump(const unsigned char *data, size_t len) {
     for (size_t i = 0; i < len; ++i) {
         printf("%02x", data[i]);
@@ -172,3 +196,20 @@ void hexdump(const unsigned char *data, size_t len) {
     }
     if (len%16) printf("\n");
 }
+
+void sha256_string(const unsigned char *data, size_t len, char out_hex[65]) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_digest(data, len, digest);
+    hex_into(digest, sizeof(digest), out_hex);
+}
+
+int sha256_file(const char *path, char out_hex[65]) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int rc = hash_io_sha256_fd(fd, HASH_IO_AUTO, digest);
+    close(fd);
+    if (rc != 0) return -1;
+    hex_into(digest, sizeof(digest), out_hex);
+    return 0;
+}
@@ -14,5 +14,8 @@ int file_exists(const char *path);
 int copy_file(const char *src, const char *dst);
 char *join_strings(const char **parts, int n, const char *sep); // new string
 char *hex_encode(const unsigned char *data, size_t len); // returns malloc'd hex string lowercase
+int hex_decode(const char *hex, unsigned char *out, size_t len); // exactly 2*len hex chars; 0 on success
 void hexdump(const unsigned char *data, size_t len);
+void sha256_string(const unsigned char *data, size_t len, char out_hex[65]); // lowercase hex digest
+int sha256_file(const char *path, char out_hex[65]); // 0 on success
 #endif